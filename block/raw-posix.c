@@ -1298,8 +1298,10 @@ static void raw_aio_plug(BlockDriverState *bs)
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
         laio_io_plug(bs, aio);
+        return;
     }
 #endif
+    thread_pool_plug(aio_get_thread_pool(bdrv_get_aio_context(bs)));
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
@@ -1309,8 +1311,10 @@ static void raw_aio_unplug(BlockDriverState *bs)
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
         laio_io_unplug(bs, aio);
+        return;
     }
 #endif
+    thread_pool_unplug(aio_get_thread_pool(bdrv_get_aio_context(bs)));
 }
 
 static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
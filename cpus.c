@@ -191,6 +191,7 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+    tb_hot_enabled = qemu_opt_get_bool(opts, "tb-hot", false);
 }
 
 int64_t cpu_get_icount_raw(void)
@@ -451,6 +451,163 @@ void tlb_flush_page_all_cpus(CPUState *src, bool wait, target_ulong addr)
     g_assert(!wait);
 }
 
+/* A range flush does not fit in run_on_cpu_data, so each vCPU gets its
+ * own heap allocated copy which is freed by the async work function.
+ */
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+static inline void tlb_flush_entry_range(CPUTLBEntry *tlb_entry,
+                                         target_ulong addr, target_ulong last)
+{
+    /* Entries with TLB_INVALID_MASK set may compare as hits here; clearing
+     * them again is harmless.
+     */
+    target_ulong mask = TARGET_PAGE_MASK | TLB_INVALID_MASK;
+    target_ulong read = tlb_entry->addr_read & mask;
+    target_ulong write = tlb_entry->addr_write & mask;
+    target_ulong code = tlb_entry->addr_code & mask;
+
+    if ((read >= addr && read <= last) ||
+        (write >= addr && write <= last) ||
+        (code >= addr && code <= last)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                              target_ulong len,
+                                              unsigned long mmu_idx_bitmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong last, page;
+    unsigned long nb_pages, n;
+    int mmu_idx;
+    int i;
+
+    assert_cpu_is_self(cpu);
+
+    if (len == 0) {
+        return;
+    }
+
+    last = (addr + len - 1) | ~TARGET_PAGE_MASK;
+    addr &= TARGET_PAGE_MASK;
+    nb_pages = ((last - addr) >> TARGET_PAGE_BITS) + 1;
+
+    tlb_debug("addr:"TARGET_FMT_lx" last:"TARGET_FMT_lx" mmu_idx:0x%lx\n",
+              addr, last, mmu_idx_bitmap);
+
+    /* Once the range covers the whole direct mapped table a flush of the
+     * selected MMU indexes is cheaper than a lookup per page.  Ranges that
+     * touch the large page area must be flushed completely as well, since
+     * large pages are not tracked individually.
+     */
+    if (nb_pages > CPU_TLB_SIZE ||
+        (env->tlb_flush_addr != (target_ulong)-1 &&
+         env->tlb_flush_addr <= last &&
+         addr <= (env->tlb_flush_addr | ~env->tlb_flush_mask))) {
+        tlb_debug("forced full flush ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                  env->tlb_flush_addr, env->tlb_flush_mask);
+
+        tlb_flush_by_mmuidx_async_work(cpu,
+                                       RUN_ON_CPU_HOST_ULONG(mmu_idx_bitmap));
+        return;
+    }
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!test_bit(mmu_idx, &mmu_idx_bitmap)) {
+            continue;
+        }
+
+        for (n = 0, page = addr; n < nb_pages; n++, page += TARGET_PAGE_SIZE) {
+            i = (page >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+            tlb_flush_entry(&env->tlb_table[mmu_idx][i], page);
+        }
+
+        /* the victim TLB is scanned once for the whole range */
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_flush_entry_range(&env->tlb_v_table[mmu_idx][i], addr, last);
+        }
+    }
+
+    for (n = 0, page = addr; n < nb_pages; n++, page += TARGET_PAGE_SIZE) {
+        tb_flush_jmp_cache(cpu, page);
+    }
+}
+
+static void tlb_flush_range_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_nocheck(cpu, d->addr, d->len, d->idxmap);
+    g_free(d);
+}
+
+static run_on_cpu_data tlb_flush_range_data(target_ulong addr,
+                                            target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData *d = g_new(TLBFlushRangeData, 1);
+
+    d->addr = addr;
+    d->len = len;
+    d->idxmap = idxmap;
+    return RUN_ON_CPU_HOST_PTR(d);
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (!qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_range_async_work,
+                         tlb_flush_range_data(addr, len, idxmap));
+    } else {
+        tlb_flush_range_by_mmuidx_nocheck(cpu, addr, len, idxmap);
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+/* Like flush_all_helper, but every vCPU needs its own copy of the range
+ * description.  This function affects all vCPUs and will ensure all work
+ * is complete by the time the loop restarts if wait is set.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, bool wait,
+                                        target_ulong addr, target_ulong len,
+                                        uint16_t idxmap)
+{
+    CPUState *cpu;
+
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            async_run_on_cpu(cpu, tlb_flush_range_async_work,
+                             tlb_flush_range_data(addr, len, idxmap));
+        }
+    }
+
+    if (wait) {
+        async_safe_run_on_cpu(src_cpu, tlb_flush_range_async_work,
+                              tlb_flush_range_data(addr, len, idxmap));
+        cpu_loop_exit(src_cpu);
+    }
+
+    g_assert(qemu_cpu_is_self(src_cpu));
+    tlb_flush_range_by_mmuidx_nocheck(src_cpu, addr, len, idxmap);
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -173,7 +173,10 @@ typedef struct PhysPageMap {
 struct AddressSpaceDispatch {
     struct rcu_head rcu;
 
-    MemoryRegionSection *mru_section;
+    /* Never reused, so that lookups cached for a dispatch tree that has
+     * been freed never match the tree that takes its place.
+     */
+    uint64_t generation;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -385,30 +388,60 @@ bool memory_region_is_unassigned(MemoryRegion *mr)
         && mr != &io_mem_watch;
 }
 
+/* Each thread remembers the last section it looked up, which catches
+ * accesses that stay within one large RAM section, and the sections of
+ * the last few pages it looked at, which catches devices going back and
+ * forth between a few registers or ring pages.  Entries belong to the
+ * dispatch tree whose generation they carry; a topology change brings a
+ * new tree and thus invalidates them all.
+ */
+#define PHYS_CACHE_SIZE 16
+
+typedef struct PhysCacheEntry {
+    uint64_t generation;
+    hwaddr page;
+    MemoryRegionSection *section;
+} PhysCacheEntry;
+
+static __thread PhysCacheEntry phys_cache_mru;
+static __thread PhysCacheEntry phys_cache[PHYS_CACHE_SIZE];
+
+static uint64_t dispatch_generation;
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = atomic_read(&d->mru_section);
+    hwaddr page = addr >> TARGET_PAGE_BITS;
+    PhysCacheEntry *e;
+    MemoryRegionSection *section;
     subpage_t *subpage;
-    bool update;
 
-    if (section && section != &d->map.sections[PHYS_SECTION_UNASSIGNED] &&
+    section = phys_cache_mru.section;
+    if (phys_cache_mru.generation == d->generation &&
+        section != &d->map.sections[PHYS_SECTION_UNASSIGNED] &&
         section_covers_addr(section, addr)) {
-        update = false;
+        goto found;
+    }
+
+    e = &phys_cache[(page ^ d->generation) % PHYS_CACHE_SIZE];
+    if (e->generation == d->generation && e->page == page) {
+        section = e->section;
     } else {
         section = phys_page_find(d->phys_map, addr, d->map.nodes,
                                  d->map.sections);
-        update = true;
+        e->generation = d->generation;
+        e->page = page;
+        e->section = section;
     }
+    phys_cache_mru = *e;
+
+found:
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
         section = &d->map.sections[subpage->sub_section[SUBPAGE_IDX(addr)]];
     }
-    if (update) {
-        atomic_set(&d->mru_section, section);
-    }
     return section;
 }
 
@@ -1168,10 +1201,9 @@ static void register_multipage(AddressSpaceDispatch *d,
     phys_page_set(d, start_addr >> TARGET_PAGE_BITS, num_pages, section_index);
 }
 
-static void mem_add(MemoryListener *listener, MemoryRegionSection *section)
+void address_space_dispatch_add(AddressSpaceDispatch *d,
+                                MemoryRegionSection *section)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *d = as->next_dispatch;
     MemoryRegionSection now = *section, remain = *section;
     Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
 
@@ -2344,9 +2376,8 @@ static void io_mem_init(void)
                           NULL, UINT64_MAX);
 }
 
-static void mem_begin(MemoryListener *listener)
+AddressSpaceDispatch *address_space_dispatch_new(AddressSpace *as)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
@@ -2361,27 +2392,20 @@ static void mem_begin(MemoryListener *listener)
 
     d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
     d->as = as;
-    as->next_dispatch = d;
+    /* Under the BQL, like every topology update */
+    d->generation = ++dispatch_generation;
+    return d;
 }
 
-static void address_space_dispatch_free(AddressSpaceDispatch *d)
+void address_space_dispatch_free(AddressSpaceDispatch *d)
 {
     phys_sections_free(&d->map);
     g_free(d);
 }
 
-static void mem_commit(MemoryListener *listener)
+void address_space_dispatch_compact(AddressSpaceDispatch *d)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *cur = as->dispatch;
-    AddressSpaceDispatch *next = as->next_dispatch;
-
-    phys_page_compact_all(next, next->map.nodes_nb);
-
-    atomic_rcu_set(&as->dispatch, next);
-    if (cur) {
-        call_rcu(cur, address_space_dispatch_free, rcu);
-    }
+    phys_page_compact_all(d, d->map.nodes_nb);
 }
 
 static void tcg_commit(MemoryListener *listener)
@@ -2402,34 +2426,6 @@ static void tcg_commit(MemoryListener *listener)
     tlb_flush(cpuas->cpu, 1);
 }
 
-void address_space_init_dispatch(AddressSpace *as)
-{
-    as->dispatch = NULL;
-    as->dispatch_listener = (MemoryListener) {
-        .begin = mem_begin,
-        .commit = mem_commit,
-        .region_add = mem_add,
-        .region_nop = mem_add,
-        .priority = 0,
-    };
-    memory_listener_register(&as->dispatch_listener, as);
-}
-
-void address_space_unregister(AddressSpace *as)
-{
-    memory_listener_unregister(&as->dispatch_listener);
-}
-
-void address_space_destroy_dispatch(AddressSpace *as)
-{
-    AddressSpaceDispatch *d = as->dispatch;
-
-    atomic_rcu_set(&as->dispatch, NULL);
-    if (d) {
-        call_rcu(d, address_space_dispatch_free, rcu);
-    }
-}
-
 static void memory_map_init(void)
 {
     system_memory = g_malloc(sizeof(*system_memory));
@@ -3064,6 +3060,135 @@ void cpu_physical_memory_unmap(void *buffer, hwaddr len,
     return address_space_unmap(&address_space_memory, buffer, len, is_write, access_len);
 }
 
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write)
+{
+    AddressSpaceDispatch *d;
+    MemoryRegionSection *section;
+    MemoryRegion *mr;
+    hwaddr xlat, l = len;
+
+    *cache = (MemoryRegionCache) {
+        .as = as,
+        .addr = addr,
+        .len = len,
+        .is_write = is_write,
+    };
+    if (!len || xen_enabled()) {
+        return;
+    }
+
+    /* Only RAM that the range fits in can be used directly; the length
+     * is only clamped to the section for RAM.  Anything behind an IOMMU
+     * is left alone too, since its mappings can change without the memory
+     * map changing.
+     */
+    rcu_read_lock();
+    d = atomic_rcu_read(&as->dispatch);
+    section = address_space_translate_internal(d, addr, &xlat, &l, true);
+    mr = section->mr;
+    if (memory_region_is_ram(mr) && l >= len &&
+        memory_access_is_direct(mr, is_write)) {
+        memory_region_ref(mr);
+        cache->mr = mr;
+        cache->xlat = xlat;
+        cache->ptr = qemu_map_ram_ptr(mr->ram_block, xlat);
+    }
+    rcu_read_unlock();
+}
+
+void address_space_cache_destroy(MemoryRegionCache *cache)
+{
+    if (cache->mr) {
+        memory_region_unref(cache->mr);
+    }
+    *cache = MEMORY_REGION_CACHE_INVALID;
+}
+
+static inline void *address_space_cache_ptr(MemoryRegionCache *cache,
+                                            hwaddr addr, hwaddr len)
+{
+    assert(addr < cache->len && len <= cache->len - addr);
+    return cache->ptr ? cache->ptr + addr : NULL;
+}
+
+void address_space_read_cached(MemoryRegionCache *cache, hwaddr addr,
+                               void *buf, hwaddr len)
+{
+    void *ptr = address_space_cache_ptr(cache, addr, len);
+
+    if (likely(ptr)) {
+        memcpy(buf, ptr, len);
+    } else {
+        address_space_read(cache->as, cache->addr + addr,
+                           MEMTXATTRS_UNSPECIFIED, buf, len);
+    }
+}
+
+void address_space_write_cached(MemoryRegionCache *cache, hwaddr addr,
+                                const void *buf, hwaddr len)
+{
+    void *ptr = address_space_cache_ptr(cache, addr, len);
+
+    assert(cache->is_write);
+    if (likely(ptr)) {
+        memcpy(ptr, buf, len);
+        invalidate_and_set_dirty(cache->mr, cache->xlat + addr, len);
+    } else {
+        address_space_write(cache->as, cache->addr + addr,
+                            MEMTXATTRS_UNSPECIFIED, buf, len);
+    }
+}
+
+#define ADDRESS_SPACE_LD_CACHED(name, type, size)                         \
+type address_space_##name##_cached(MemoryRegionCache *cache, hwaddr addr, \
+                                   MemTxAttrs attrs, MemTxResult *result) \
+{                                                                         \
+    void *ptr = address_space_cache_ptr(cache, addr, size);               \
+                                                                          \
+    if (likely(ptr)) {                                                    \
+        if (result) {                                                     \
+            *result = MEMTX_OK;                                           \
+        }                                                                 \
+        return name##_p(ptr);                                             \
+    }                                                                     \
+    return address_space_##name(cache->as, cache->addr + addr,            \
+                                attrs, result);                           \
+}
+
+#define ADDRESS_SPACE_ST_CACHED(name, type, size)                         \
+void address_space_##name##_cached(MemoryRegionCache *cache, hwaddr addr, \
+                                   type val, MemTxAttrs attrs,            \
+                                   MemTxResult *result)                   \
+{                                                                         \
+    void *ptr = address_space_cache_ptr(cache, addr, size);               \
+                                                                          \
+    assert(cache->is_write);                                              \
+    if (likely(ptr)) {                                                    \
+        name##_p(ptr, val);                                               \
+        invalidate_and_set_dirty(cache->mr, cache->xlat + addr, size);    \
+        if (result) {                                                     \
+            *result = MEMTX_OK;                                           \
+        }                                                                 \
+        return;                                                           \
+    }                                                                     \
+    address_space_##name(cache->as, cache->addr + addr, val,              \
+                         attrs, result);                                  \
+}
+
+ADDRESS_SPACE_LD_CACHED(lduw_le, uint32_t, 2)
+ADDRESS_SPACE_LD_CACHED(lduw_be, uint32_t, 2)
+ADDRESS_SPACE_LD_CACHED(ldl_le, uint32_t, 4)
+ADDRESS_SPACE_LD_CACHED(ldl_be, uint32_t, 4)
+ADDRESS_SPACE_LD_CACHED(ldq_le, uint64_t, 8)
+ADDRESS_SPACE_LD_CACHED(ldq_be, uint64_t, 8)
+ADDRESS_SPACE_ST_CACHED(stw_le, uint32_t, 2)
+ADDRESS_SPACE_ST_CACHED(stw_be, uint32_t, 2)
+ADDRESS_SPACE_ST_CACHED(stl_le, uint32_t, 4)
+ADDRESS_SPACE_ST_CACHED(stl_be, uint32_t, 4)
+ADDRESS_SPACE_ST_CACHED(stq_le, uint64_t, 8)
+ADDRESS_SPACE_ST_CACHED(stq_be, uint64_t, 8)
+
 /* warning: addr must be aligned */
 static inline uint32_t address_space_ldl_internal(AddressSpace *as, hwaddr addr,
                                                   MemTxAttrs attrs,
@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <float.h>
+#include <math.h>
 
 #include "fpu/softfloat.h"
 
@@ -2164,7 +2166,7 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add(float32 a, float32 b, float_status *status)
+static float32 soft_float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2187,7 +2189,7 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub(float32 a, float32 b, float_status *status)
+static float32 soft_float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2210,7 +2212,7 @@ float32 float32_sub(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul(float32 a, float32 b, float_status *status)
+static float32 soft_float32_mul(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2275,7 +2277,7 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div(float32 a, float32 b, float_status *status)
+static float32 soft_float32_div(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2452,8 +2454,8 @@ float32 float32_rem(float32 a, float32 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
-                       float_status *status)
+static float32 soft_float32_muladd(float32 a, float32 b, float32 c, int flags,
+                                   float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -2673,7 +2675,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt(float32 a, float_status *status)
+static float32 soft_float32_sqrt(float32 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -3959,7 +3961,7 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add(float64 a, float64 b, float_status *status)
+static float64 soft_float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -3982,7 +3984,7 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub(float64 a, float64 b, float_status *status)
+static float64 soft_float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4005,7 +4007,7 @@ float64 float64_sub(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul(float64 a, float64 b, float_status *status)
+static float64 soft_float64_mul(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4068,7 +4070,7 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div(float64 a, float64 b, float_status *status)
+static float64 soft_float64_div(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4239,8 +4241,8 @@ float64 float64_rem(float64 a, float64 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
-                       float_status *status)
+static float64 soft_float64_muladd(float64 a, float64 b, float64 c, int flags,
+                                   float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -4481,7 +4483,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt(float64 a, float_status *status)
+static float64 soft_float64_sqrt(float64 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -4529,6 +4531,290 @@ float64 float64_sqrt(float64 a, float_status *status)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast paths for the basic arithmetic operations.
+|
+| If the rounding mode is round-to-nearest-even, the inexact flag is already
+| raised and all the operands are zero or normal, the host FPU computes the
+| same result as the soft implementation.  Provided the result is normal (or
+| an exact zero that can be derived from the operands alone), no exception
+| flag other than inexact can be raised either, so the host result can be
+| returned as is.  In every other case we fall back to the soft
+| implementation, which recomputes the result and the flags from scratch.
+|
+| This requires the host to evaluate float and double expressions in their
+| own precision (no x87-style excess precision), and to run with its default
+| round-to-nearest, non-trapping floating-point environment.
+*----------------------------------------------------------------------------*/
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define QEMU_HARDFLOAT 1
+#else
+#define QEMU_HARDFLOAT 0
+#endif
+
+/* Some C libraries do not implement fma() with a single rounding.  */
+#if QEMU_HARDFLOAT && !defined(_WIN32)
+#define QEMU_HARDFLOAT_FMA 1
+#else
+#define QEMU_HARDFLOAT_FMA 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} float32_host;
+
+typedef union {
+    float64 s;
+    double h;
+} float64_host;
+
+static inline bool can_use_hardfloat(const float_status *status)
+{
+    return QEMU_HARDFLOAT &&
+           status->float_rounding_mode == float_round_nearest_even &&
+           (status->float_exception_flags & float_flag_inexact);
+}
+
+static inline bool float32_is_normal(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+
+    return aExp != 0 && aExp != 0xFF;
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    return float32_is_normal(a) || float32_is_zero(a);
+}
+
+/* The magnitude of the result must exceed the smallest normal number, as
+ * anything below may have been tiny before rounding.  */
+static inline bool float32_is_safe_result(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+
+    return aExp > 1 && aExp != 0xFF;
+}
+
+static inline bool float64_is_normal(float64 a)
+{
+    int aExp = extractFloat64Exp(a);
+
+    return aExp != 0 && aExp != 0x7FF;
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    return float64_is_normal(a) || float64_is_zero(a);
+}
+
+/* The magnitude of the result must exceed the smallest normal number, as
+ * anything below may have been tiny before rounding.  */
+static inline bool float64_is_safe_result(float64 a)
+{
+    int aExp = extractFloat64Exp(a);
+
+    return aExp > 1 && aExp != 0x7FF;
+}
+
+float32 float32_add(float32 a, float32 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        float32_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (likely(float32_is_safe_result(ur.s)) ||
+            (float32_is_zero(a) && float32_is_zero(b))) {
+            return ur.s;
+        }
+    }
+    return soft_float32_add(a, b, status);
+}
+
+float32 float32_sub(float32 a, float32 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        float32_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (likely(float32_is_safe_result(ur.s)) ||
+            (float32_is_zero(a) && float32_is_zero(b))) {
+            return ur.s;
+        }
+    }
+    return soft_float32_sub(a, b, status);
+}
+
+float32 float32_mul(float32 a, float32 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        float32_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (likely(float32_is_safe_result(ur.s)) ||
+            float32_is_zero(a) || float32_is_zero(b)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_mul(a, b, status);
+}
+
+float32 float32_div(float32 a, float32 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_normal(b)) {
+        float32_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (likely(float32_is_safe_result(ur.s)) || float32_is_zero(a)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_div(a, b, status);
+}
+
+float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
+                       float_status *status)
+{
+    if (QEMU_HARDFLOAT_FMA && can_use_hardfloat(status) &&
+        !(flags & float_muladd_halve_result) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b) &&
+        float32_is_zero_or_normal(c)) {
+        float32_host ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        if (flags & float_muladd_negate_product) {
+            ua.s = float32_chs(ua.s);
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.s = float32_chs(uc.s);
+        }
+        ur.h = fmaf(ua.h, ub.h, uc.h);
+        if (likely(float32_is_safe_result(ur.s))) {
+            if (flags & float_muladd_negate_result) {
+                ur.s = float32_chs(ur.s);
+            }
+            return ur.s;
+        }
+    }
+    return soft_float32_muladd(a, b, c, flags, status);
+}
+
+float32 float32_sqrt(float32 a, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        (float32_is_zero(a) ||
+         (float32_is_normal(a) && !float32_is_neg(a)))) {
+        float32_host ua = { .s = a }, ur;
+
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+    return soft_float32_sqrt(a, status);
+}
+
+float64 float64_add(float64 a, float64 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        float64_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (likely(float64_is_safe_result(ur.s)) ||
+            (float64_is_zero(a) && float64_is_zero(b))) {
+            return ur.s;
+        }
+    }
+    return soft_float64_add(a, b, status);
+}
+
+float64 float64_sub(float64 a, float64 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        float64_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (likely(float64_is_safe_result(ur.s)) ||
+            (float64_is_zero(a) && float64_is_zero(b))) {
+            return ur.s;
+        }
+    }
+    return soft_float64_sub(a, b, status);
+}
+
+float64 float64_mul(float64 a, float64 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        float64_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (likely(float64_is_safe_result(ur.s)) ||
+            float64_is_zero(a) || float64_is_zero(b)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_mul(a, b, status);
+}
+
+float64 float64_div(float64 a, float64 b, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_normal(b)) {
+        float64_host ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (likely(float64_is_safe_result(ur.s)) || float64_is_zero(a)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_div(a, b, status);
+}
+
+float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
+                       float_status *status)
+{
+    if (QEMU_HARDFLOAT_FMA && can_use_hardfloat(status) &&
+        !(flags & float_muladd_halve_result) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b) &&
+        float64_is_zero_or_normal(c)) {
+        float64_host ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        if (flags & float_muladd_negate_product) {
+            ua.s = float64_chs(ua.s);
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.s = float64_chs(uc.s);
+        }
+        ur.h = fma(ua.h, ub.h, uc.h);
+        if (likely(float64_is_safe_result(ur.s))) {
+            if (flags & float_muladd_negate_result) {
+                ur.s = float64_chs(ur.s);
+            }
+            return ur.s;
+        }
+    }
+    return soft_float64_muladd(a, b, c, flags, status);
+}
+
+float64 float64_sqrt(float64 a, float_status *status)
+{
+    if (can_use_hardfloat(status) &&
+        (float64_is_zero(a) ||
+         (float64_is_normal(a) && !float64_is_neg(a)))) {
+        float64_host ua = { .s = a }, ur;
+
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+    return soft_float64_sqrt(a, status);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the binary log of the double-precision floating-point value `a'.
 | The operation is performed according to the IEC/IEEE Standard for Binary
@@ -273,6 +273,22 @@ STEXI
 @item info jit
 @findex jit
 Show dynamic compiler info.
+ETEXI
+
+    {
+        .name       = "tb-hot",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the most executed translation blocks",
+        .cmd        = hmp_info_tb_hot,
+    },
+
+STEXI
+@item info tb-hot [@var{count}]
+@findex tb-hot
+Show the @var{count} (default 20) most executed translation blocks with
+their guest PC, guest and host code size and execution count.  Requires
+@option{-accel tcg,tb-hot=on}.
 ETEXI
 
     {
@@ -699,6 +715,20 @@ STEXI
 @item info iothreads
 @findex iothreads
 Show iothread's identifiers.
+ETEXI
+
+    {
+        .name       = "coroutine-pool",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show coroutine pool statistics",
+        .cmd        = hmp_info_coroutine_pool,
+    },
+
+STEXI
+@item info coroutine-pool
+@findex coroutine-pool
+Show how often coroutines were taken from the pool or had to be allocated.
 ETEXI
 
     {
@@ -89,6 +89,32 @@ void hmp_info_kvm(Monitor *mon, const QDict *qdict)
     qapi_free_KvmInfo(info);
 }
 
+void hmp_info_tb_hot(Monitor *mon, const QDict *qdict)
+{
+    int64_t count = qdict_get_try_int(qdict, "count", 20);
+    TbHotInfoList *list, *entry;
+    Error *err = NULL;
+
+    list = qmp_x_query_tb_hot(true, count, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %-10s %6s %6s %20s\n",
+                   "pc", "flags", "guest", "host", "count");
+    for (entry = list; entry; entry = entry->next) {
+        TbHotInfo *info = entry->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " 0x%08" PRIx32 " %6" PRId64
+                       " %6" PRId64 " %20" PRIu64 "\n",
+                       info->pc, info->flags, info->guest_size,
+                       info->host_size, info->exec_count);
+    }
+
+    qapi_free_TbHotInfoList(list);
+}
+
 void hmp_info_status(Monitor *mon, const QDict *qdict)
 {
     StatusInfo *info;
@@ -2162,6 +2188,19 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_info_coroutine_pool(Monitor *mon, const QDict *qdict)
+{
+    CoroutinePoolInfo *info = qmp_query_coroutine_pool(NULL);
+
+    monitor_printf(mon, "batch size: %" PRId64 "\n", info->batch_size);
+    monitor_printf(mon, "pool size: %" PRId64 "\n", info->pool_size);
+    monitor_printf(mon, "hits: %" PRId64 "\n", info->hits);
+    monitor_printf(mon, "misses: %" PRId64 "\n", info->misses);
+    monitor_printf(mon, "frees: %" PRId64 "\n", info->frees);
+
+    qapi_free_CoroutinePoolInfo(info);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
@@ -156,6 +156,13 @@ e1000e_intrmgr_on_throttling_timer(void *opaque)
         return;
     }
 
+    /*
+     * Raising the postponed interrupt goes through
+     * e1000e_itr_should_postpone() again, which opens the next
+     * throttling interval.
+     */
+    timer->core->itr_intr_pending = false;
+
     if (msi_enabled(timer->core->owner)) {
         trace_e1000e_irq_msi_notify_postponed();
         e1000e_set_interrupt_cause(timer->core, 0);
@@ -181,7 +188,13 @@ e1000e_intrmgr_on_msix_throttling_timer(void *opaque)
     }
 
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
+    timer->core->eitr_intr_pending[idx] = false;
     msix_notify(timer->core->owner, idx);
+
+    /* The next interrupt on this vector must wait a full interval too */
+    if (timer->core->mac[timer->delay_reg] != 0) {
+        e1000e_intrmgr_rearm_timer(timer);
+    }
 }
 
 static void
@@ -581,7 +594,7 @@ e1000e_rss_calc_hash(E1000ECore *core,
         type = NetPktRssIpV4Tcp;
         break;
     case E1000_MRQ_RSS_TYPE_IPV6TCP:
-        type = NetPktRssIpV6Tcp;
+        type = NetPktRssIpV6TcpEx;
         break;
     case E1000_MRQ_RSS_TYPE_IPV6:
         type = NetPktRssIpV6;
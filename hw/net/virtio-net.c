@@ -16,6 +16,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/gso.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -25,6 +26,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi-event.h"
 #include "hw/virtio/virtio-access.h"
+#include "net_rx_pkt.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -43,18 +45,32 @@
 #define endof(container, field) \
     (offsetof(container, field) + sizeof(((container *)0)->field))
 
+#define VIRTIO_NET_RSS_SUPPORTED_HASHES (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDP_EX)
+
 typedef struct VirtIOFeature {
-    uint32_t flags;
+    uint64_t flags;
     size_t end;
 } VirtIOFeature;
 
 static VirtIOFeature feature_sizes[] = {
-    {.flags = 1 << VIRTIO_NET_F_MAC,
+    {.flags = 1ULL << VIRTIO_NET_F_MAC,
      .end = endof(struct virtio_net_config, mac)},
-    {.flags = 1 << VIRTIO_NET_F_STATUS,
+    {.flags = 1ULL << VIRTIO_NET_F_STATUS,
      .end = endof(struct virtio_net_config, status)},
-    {.flags = 1 << VIRTIO_NET_F_MQ,
+    {.flags = 1ULL << VIRTIO_NET_F_MQ,
      .end = endof(struct virtio_net_config, max_virtqueue_pairs)},
+    {.flags = 1ULL << VIRTIO_NET_F_RSS,
+     .end = endof(struct virtio_net_config, supported_hash_types)},
+    {.flags = 1ULL << VIRTIO_NET_F_HASH_REPORT,
+     .end = endof(struct virtio_net_config, supported_hash_types)},
     {}
 };
 
@@ -82,6 +98,14 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     virtio_stw_p(vdev, &netcfg.status, n->status);
     virtio_stw_p(vdev, &netcfg.max_virtqueue_pairs, n->max_queues);
     memcpy(netcfg.mac, n->mac, ETH_ALEN);
+    /* speed and duplex are unknown */
+    virtio_stl_p(vdev, &netcfg.speed, UINT32_MAX);
+    netcfg.duplex = 0xff;
+    netcfg.rss_max_key_size = VIRTIO_NET_RSS_MAX_KEY_SIZE;
+    virtio_stw_p(vdev, &netcfg.rss_max_indirection_table_length,
+                 VIRTIO_NET_RSS_MAX_TABLE_LEN);
+    virtio_stl_p(vdev, &netcfg.supported_hash_types,
+                 VIRTIO_NET_RSS_SUPPORTED_HASHES);
     memcpy(config, &netcfg, n->config_size);
 }
 
@@ -218,6 +242,17 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Give back receive buffers popped for the peer but never written to */
+static void virtio_net_rx_map_release(VirtIONetQueue *q)
+{
+    while (q->rx_map.num) {
+        VirtQueueElement *elem = q->rx_map.elems[--q->rx_map.num];
+
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+    }
+}
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -243,6 +278,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 
         if (queue_started) {
             qemu_flush_queued_packets(ncs);
+        } else {
+            virtio_net_rx_map_release(q);
         }
 
         if (!q->tx_waiting) {
@@ -388,6 +425,7 @@ static RxFilterInfo *virtio_net_query_rxfilter(NetClientState *nc)
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
+    int i;
 
     /* Reset back to compatibility mode */
     n->promisc = 1;
@@ -401,6 +439,8 @@ static void virtio_net_reset(VirtIODevice *vdev)
     timer_del(n->announce_timer);
     n->announce_counter = 0;
     n->status &= ~VIRTIO_NET_S_ANNOUNCE;
+    n->rss_data.enabled = false;
+    n->rss_data.redirect = false;
 
     /* Flush any MAC and VLAN filter table state */
     n->mac_table.in_use = 0;
@@ -411,6 +451,15 @@ static void virtio_net_reset(VirtIODevice *vdev)
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     memset(n->vlans, 0, MAX_VLAN >> 3);
+
+    /* Drop packets held for coalescing, give back mapped buffers */
+    for (i = 0; i < n->max_queues; i++) {
+        virtio_net_rx_map_release(&n->vqs[i]);
+        if (n->vqs[i].gro) {
+            qemu_bh_cancel(n->vqs[i].gro_bh);
+            net_gro_reset(n->vqs[i].gro);
+        }
+    }
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -428,6 +477,20 @@ static int peer_has_vnet_hdr(VirtIONet *n)
     return n->has_vnet_hdr;
 }
 
+/* Offloads are done by us rather than the peer, see net/gso.c */
+static bool virtio_net_sw_offload(VirtIONet *n)
+{
+    return n->net_conf.sw_offload && !peer_has_vnet_hdr(n);
+}
+
+static bool virtio_net_gro_enabled(VirtIONet *n)
+{
+    return virtio_net_sw_offload(n) &&
+        (n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM)) &&
+        (n->curr_guest_offloads & ((1ULL << VIRTIO_NET_F_GUEST_TSO4) |
+                                   (1ULL << VIRTIO_NET_F_GUEST_TSO6)));
+}
+
 static int peer_has_ufo(VirtIONet *n)
 {
     if (!peer_has_vnet_hdr(n))
@@ -439,28 +502,37 @@ static int peer_has_ufo(VirtIONet *n)
 }
 
 static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
-                                       int version_1)
+                                       int version_1, int hash_report)
 {
     int i;
     NetClientState *nc;
+    size_t host_hdr_len;
 
     n->mergeable_rx_bufs = mergeable_rx_bufs;
 
     if (version_1) {
-        n->guest_hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+        n->guest_hdr_len = hash_report ?
+            sizeof(struct virtio_net_hdr_v1_hash) :
+            sizeof(struct virtio_net_hdr_mrg_rxbuf);
+        n->rss_data.populate_hash = !!hash_report;
     } else {
         n->guest_hdr_len = n->mergeable_rx_bufs ?
             sizeof(struct virtio_net_hdr_mrg_rxbuf) :
             sizeof(struct virtio_net_hdr);
+        n->rss_data.populate_hash = false;
     }
 
+    /* The hash fields are filled in by us, not by the backend */
+    host_hdr_len = MIN(n->guest_hdr_len,
+                       sizeof(struct virtio_net_hdr_mrg_rxbuf));
+
     for (i = 0; i < n->max_queues; i++) {
         nc = qemu_get_subqueue(n->nic, i);
 
         if (peer_has_vnet_hdr(n) &&
-            qemu_has_vnet_hdr_len(nc->peer, n->guest_hdr_len)) {
-            qemu_set_vnet_hdr_len(nc->peer, n->guest_hdr_len);
-            n->host_hdr_len = n->guest_hdr_len;
+            qemu_has_vnet_hdr_len(nc->peer, host_hdr_len)) {
+            qemu_set_vnet_hdr_len(nc->peer, host_hdr_len);
+            n->host_hdr_len = host_hdr_len;
         }
     }
 }
@@ -536,7 +608,7 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
 
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
-    if (!peer_has_vnet_hdr(n)) {
+    if (!peer_has_vnet_hdr(n) && !n->net_conf.sw_offload) {
         virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
@@ -553,9 +625,20 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    /* RSS and hash reports are configured through the control queue */
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
+
+    /* vhost backends receive packets without going through QEMU */
+    virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+    virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+
     return vhost_net_get_features(get_vhost_net(nc->peer), features);
 }
 
@@ -576,6 +659,24 @@ static uint64_t virtio_net_bad_features(VirtIODevice *vdev)
 
 static void virtio_net_apply_guest_offloads(VirtIONet *n)
 {
+    if (virtio_net_sw_offload(n)) {
+        bool csum = n->curr_guest_offloads &
+                    (1ULL << VIRTIO_NET_F_GUEST_CSUM);
+        int i;
+
+        for (i = 0; i < n->max_queues; i++) {
+            if (!n->vqs[i].gro) {
+                continue;
+            }
+            net_gro_set_offloads(n->vqs[i].gro,
+                csum && (n->curr_guest_offloads &
+                         (1ULL << VIRTIO_NET_F_GUEST_TSO4)),
+                csum && (n->curr_guest_offloads &
+                         (1ULL << VIRTIO_NET_F_GUEST_TSO6)));
+        }
+        return;
+    }
+
     qemu_set_offload(qemu_get_queue(n->nic)->peer,
             !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM)),
             !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4)),
@@ -614,9 +715,11 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
                                virtio_has_feature(features,
                                                   VIRTIO_NET_F_MRG_RXBUF),
                                virtio_has_feature(features,
-                                                  VIRTIO_F_VERSION_1));
+                                                  VIRTIO_F_VERSION_1),
+                               virtio_has_feature(features,
+                                                  VIRTIO_NET_F_HASH_REPORT));
 
-    if (n->has_vnet_hdr) {
+    if (n->has_vnet_hdr || virtio_net_sw_offload(n)) {
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
@@ -690,7 +793,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
     if (cmd == VIRTIO_NET_CTRL_GUEST_OFFLOADS_SET) {
         uint64_t supported_offloads;
 
-        if (!n->has_vnet_hdr) {
+        if (!n->has_vnet_hdr && !virtio_net_sw_offload(n)) {
             return VIRTIO_NET_ERR;
         }
 
@@ -850,6 +953,115 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static void virtio_net_disable_rss(VirtIONet *n)
+{
+    n->rss_data.enabled = false;
+    n->rss_data.redirect = false;
+}
+
+/*
+ * Parse a VIRTIO_NET_CTRL_MQ_RSS_CONFIG (do_rss) or
+ * VIRTIO_NET_CTRL_MQ_HASH_CONFIG command.  The two share a layout; for
+ * the latter the indirection table and queue fields are reserved.
+ * Returns the number of queue pairs to use, or 0 on error.
+ */
+static uint16_t virtio_net_handle_rss(VirtIONet *n, struct iovec *iov,
+                                      unsigned int iov_cnt, bool do_rss)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_rss_config cfg;
+    VirtioNetRssData rss = {};
+    size_t s, offset, size_get;
+    uint16_t queues, i;
+    struct {
+        uint16_t max_tx_vq;
+        uint8_t hash_key_length;
+    } QEMU_PACKED temp;
+
+    if (do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_RSS)) {
+        return 0;
+    }
+    if (!do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT)) {
+        return 0;
+    }
+
+    size_get = offsetof(struct virtio_net_rss_config, indirection_table);
+    s = iov_to_buf(iov, iov_cnt, 0, &cfg, size_get);
+    if (s != size_get) {
+        return 0;
+    }
+    offset = size_get;
+
+    rss.hash_types = virtio_ldl_p(vdev, &cfg.hash_types);
+    if (do_rss) {
+        rss.indirections_len =
+            virtio_lduw_p(vdev, &cfg.indirection_table_mask) + 1;
+        rss.default_queue = virtio_lduw_p(vdev, &cfg.unclassified_queue);
+    } else {
+        /* The reserved fields cover a one-entry table */
+        rss.indirections_len = 1;
+        rss.default_queue = 0;
+    }
+    if (!is_power_of_2(rss.indirections_len) ||
+        rss.indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        return 0;
+    }
+
+    size_get = sizeof(uint16_t) * rss.indirections_len;
+    s = iov_to_buf(iov, iov_cnt, offset, rss.indirections_table, size_get);
+    if (s != size_get) {
+        return 0;
+    }
+    offset += size_get;
+
+    s = iov_to_buf(iov, iov_cnt, offset, &temp, sizeof(temp));
+    if (s != sizeof(temp)) {
+        return 0;
+    }
+    offset += sizeof(temp);
+
+    queues = do_rss ? virtio_lduw_p(vdev, &temp.max_tx_vq) : n->curr_queues;
+    if (queues == 0 || queues > (n->multiqueue ? n->max_queues : 1)) {
+        return 0;
+    }
+    if (do_rss) {
+        if (rss.default_queue >= queues) {
+            return 0;
+        }
+        for (i = 0; i < rss.indirections_len; i++) {
+            rss.indirections_table[i] =
+                virtio_lduw_p(vdev, &rss.indirections_table[i]);
+            if (rss.indirections_table[i] >= queues) {
+                return 0;
+            }
+        }
+    }
+
+    if (temp.hash_key_length > VIRTIO_NET_RSS_MAX_KEY_SIZE) {
+        return 0;
+    }
+    if (!temp.hash_key_length) {
+        if (rss.hash_types) {
+            return 0;
+        }
+        /* No hash types and no key: steering/hashing is turned off */
+        virtio_net_disable_rss(n);
+        return queues;
+    }
+
+    s = iov_to_buf(iov, iov_cnt, offset, rss.key, temp.hash_key_length);
+    if (s != temp.hash_key_length) {
+        return 0;
+    }
+
+    rss.enabled = true;
+    rss.redirect = do_rss;
+    rss.populate_hash = n->rss_data.populate_hash;
+    n->rss_data = rss;
+
+    return queues;
+}
+
 static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
                                 struct iovec *iov, unsigned int iov_cnt)
 {
@@ -858,17 +1070,32 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     size_t s;
     uint16_t queues;
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
-    if (s != sizeof(mq)) {
-        return VIRTIO_NET_ERR;
-    }
+    if (cmd == VIRTIO_NET_CTRL_MQ_HASH_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, false);
+        return queues ? VIRTIO_NET_OK : VIRTIO_NET_ERR;
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_RSS_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, true);
+        if (!queues) {
+            return VIRTIO_NET_ERR;
+        }
+        if (!n->multiqueue) {
+            /* Hashing into the only queue pair */
+            return VIRTIO_NET_OK;
+        }
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
+        if (s != sizeof(mq)) {
+            return VIRTIO_NET_ERR;
+        }
+
+        queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
 
-    if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+        /* Plain queue pair selection turns off RSS steering */
+        virtio_net_disable_rss(n);
+    } else {
         return VIRTIO_NET_ERR;
     }
 
-    queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
-
     if (queues < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
         queues > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX ||
         queues > n->max_queues ||
@@ -940,11 +1167,28 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
 /* RX */
 
+static bool virtio_net_gro_flush(VirtIONetQueue *q);
+
 static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    int i;
+
+    if (n->rss_data.redirect) {
+        /*
+         * Packets steered to this queue may have been held back on the
+         * queue they arrived on.
+         */
+        for (i = 0; i < n->curr_queues; i++) {
+            qemu_flush_queued_packets(qemu_get_subqueue(n->nic, i));
+        }
+        return;
+    }
 
+    if (!virtio_net_gro_flush(&n->vqs[queue_index])) {
+        return;
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -1011,9 +1255,9 @@ static void virtio_net_hdr_swap(VirtIODevice *vdev, struct virtio_net_hdr *hdr)
  * checksums.  This is terrible but it's better than hacking the guest
  * kernels.
  *
- * N.B. if we introduce a zero-copy API, this operation is no longer free so
- * we should provide a mechanism to disable it to avoid polluting the host
- * cache.
+ * N.B. with the zero-copy receive path this operation is no longer free:
+ * virtio_net_rx_commit() has to bounce small packets that still need a
+ * checksum out of guest memory to look at them.
  */
 static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
                                         uint8_t *buf, size_t size)
@@ -1029,7 +1273,8 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *sw_hdr)
 {
     if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
@@ -1041,6 +1286,11 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
             virtio_net_hdr_swap(VIRTIO_DEVICE(n), wbuf);
         }
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
+    } else if (sw_hdr) {
+        struct virtio_net_hdr hdr = *sw_hdr;
+
+        virtio_net_hdr_swap(VIRTIO_DEVICE(n), &hdr);
+        iov_from_buf(iov, iov_cnt, 0, &hdr, sizeof hdr);
     } else {
         struct virtio_net_hdr hdr = {
             .flags = 0,
@@ -1101,7 +1351,103 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
-static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+static int virtio_net_get_hash_type(bool isip4, bool isip6,
+                                    bool isudp, bool istcp,
+                                    uint32_t types)
+{
+    uint32_t mask;
+
+    if (isip4) {
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4)) {
+            return NetPktRssIpV4Tcp;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4)) {
+            return NetPktRssIpV4Udp;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv4) {
+            return NetPktRssIpV4;
+        }
+    } else if (isip6) {
+        mask = VIRTIO_NET_RSS_HASH_TYPE_TCP_EX |
+               VIRTIO_NET_RSS_HASH_TYPE_TCPv6;
+        if (istcp && (types & mask)) {
+            return (types & VIRTIO_NET_RSS_HASH_TYPE_TCP_EX) ?
+                NetPktRssIpV6TcpEx : NetPktRssIpV6Tcp;
+        }
+        mask = VIRTIO_NET_RSS_HASH_TYPE_UDP_EX |
+               VIRTIO_NET_RSS_HASH_TYPE_UDPv6;
+        if (isudp && (types & mask)) {
+            return (types & VIRTIO_NET_RSS_HASH_TYPE_UDP_EX) ?
+                NetPktRssIpV6UdpEx : NetPktRssIpV6Udp;
+        }
+        mask = VIRTIO_NET_RSS_HASH_TYPE_IP_EX | VIRTIO_NET_RSS_HASH_TYPE_IPv6;
+        if (types & mask) {
+            return (types & VIRTIO_NET_RSS_HASH_TYPE_IP_EX) ?
+                NetPktRssIpV6Ex : NetPktRssIpV6;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Hash the packet according to the guest's RSS/hash configuration.
+ * Fills in the hash report fields of @hash if the guest asked for them
+ * and returns the queue the packet should be steered to, or -1 to leave
+ * it on the queue it arrived on.
+ */
+static int virtio_net_process_rss(VirtIONet *n, const uint8_t *buf,
+                                  size_t size,
+                                  struct virtio_net_hdr_v1_hash *hash)
+{
+    static const uint16_t reports[] = {
+        [NetPktRssIpV4] = VIRTIO_NET_HASH_REPORT_IPv4,
+        [NetPktRssIpV4Tcp] = VIRTIO_NET_HASH_REPORT_TCPv4,
+        [NetPktRssIpV6Tcp] = VIRTIO_NET_HASH_REPORT_TCPv6,
+        [NetPktRssIpV6] = VIRTIO_NET_HASH_REPORT_IPv6,
+        [NetPktRssIpV6Ex] = VIRTIO_NET_HASH_REPORT_IPv6_EX,
+        [NetPktRssIpV6TcpEx] = VIRTIO_NET_HASH_REPORT_TCPv6_EX,
+        [NetPktRssIpV4Udp] = VIRTIO_NET_HASH_REPORT_UDPv4,
+        [NetPktRssIpV6Udp] = VIRTIO_NET_HASH_REPORT_UDPv6,
+        [NetPktRssIpV6UdpEx] = VIRTIO_NET_HASH_REPORT_UDPv6_EX,
+    };
+    struct NetRxPkt *pkt = n->rx_pkt;
+    bool isip4, isip6, isudp, istcp;
+    int net_hash_type;
+    uint32_t value;
+
+    net_rx_pkt_set_protocols(pkt, buf + n->host_hdr_len,
+                             size - n->host_hdr_len);
+    net_rx_pkt_get_protocols(pkt, &isip4, &isip6, &isudp, &istcp);
+
+    /* Only the first fragment has the ports, so hash fragments by address */
+    if ((isip4 && net_rx_pkt_get_ip4_info(pkt)->fragment) ||
+        (isip6 && net_rx_pkt_get_ip6_info(pkt)->fragment)) {
+        isudp = istcp = false;
+    }
+
+    net_hash_type = virtio_net_get_hash_type(isip4, isip6, isudp, istcp,
+                                             n->rss_data.hash_types);
+    if (net_hash_type < 0) {
+        return n->rss_data.redirect ? n->rss_data.default_queue : -1;
+    }
+
+    value = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
+    if (n->rss_data.populate_hash) {
+        hash->hash_value = cpu_to_le32(value);
+        hash->hash_report = cpu_to_le16(reports[net_hash_type]);
+    }
+
+    if (!n->rss_data.redirect) {
+        return -1;
+    }
+    return n->rss_data.indirections_table[value &
+                                          (n->rss_data.indirections_len - 1)];
+}
+
+static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
+                                     size_t size,
+                                     const struct virtio_net_hdr_v1_hash *hash,
+                                     const struct virtio_net_hdr *sw_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1115,6 +1461,8 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
         return -1;
     }
 
+    virtio_net_rx_map_release(q);
+
     /* hdr_len refers to the header we supply to the guest */
     if (!virtio_net_has_buffers(q, size + n->guest_hdr_len - n->host_hdr_len)) {
         return 0;
@@ -1164,7 +1512,16 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, sw_hdr);
+            if (n->rss_data.populate_hash) {
+                iov_from_buf(sg, elem->in_num,
+                             offsetof(struct virtio_net_hdr_v1_hash,
+                                      hash_value),
+                             &hash->hash_value,
+                             sizeof(*hash) -
+                             offsetof(struct virtio_net_hdr_v1_hash,
+                                      hash_value));
+            }
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1204,13 +1561,272 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
-static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
+/*
+ * Hand the packet built up by net_gro_receive() to the guest.  Returns
+ * false if it has to wait for the guest to post more buffers.
+ */
+static bool virtio_net_gro_flush(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    NetClientState *nc =
+        qemu_get_subqueue(n->nic, vq2q(virtio_get_queue_index(q->rx_vq)));
+    struct virtio_net_hdr_v1_hash hash = {
+        .hash_report = cpu_to_le16(VIRTIO_NET_HASH_REPORT_NONE),
+    };
+    struct virtio_net_hdr hdr;
+    const uint8_t *buf;
+    size_t size;
 
-static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
+    if (!q->gro || !net_gro_pending(q->gro)) {
+        return true;
+    }
+
+    qemu_bh_cancel(q->gro_bh);
+    buf = net_gro_finish(q->gro, &hdr, &size);
+    if (virtio_net_do_receive(nc, buf, size, &hash, &hdr) == 0) {
+        return false;
+    }
+    net_gro_reset(q->gro);
+    return true;
+}
+
+static void virtio_net_gro_bh(void *opaque)
+{
+    virtio_net_gro_flush(opaque);
+}
+
+static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
+                                  size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    struct virtio_net_hdr_v1_hash hash = {
+        .hash_report = cpu_to_le16(VIRTIO_NET_HASH_REPORT_NONE),
+    };
+    int index;
+
+    if (n->rss_data.enabled && size > n->host_hdr_len) {
+        index = virtio_net_process_rss(n, buf, size, &hash);
+        if (index >= 0) {
+            nc = qemu_get_subqueue(n->nic, index);
+        }
+    } else if (virtio_net_gro_enabled(n) && virtio_net_can_receive(nc)) {
+        /* Segments are coalesced until the end of this main loop iteration */
+        if (net_gro_receive(q->gro, buf, size)) {
+            qemu_bh_schedule(q->gro_bh);
+            return size;
+        }
+
+        /* Whatever can't be merged has to go after what is held */
+        if (net_gro_pending(q->gro)) {
+            if (!virtio_net_gro_flush(q)) {
+                return 0;
+            }
+            if (net_gro_receive(q->gro, buf, size)) {
+                qemu_bh_schedule(q->gro_bh);
+                return size;
+            }
+        }
+    }
+
+    return virtio_net_do_receive(nc, buf, size, &hash, NULL);
+}
+
+static size_t virtio_net_rx_map_to_buf(VirtIONetQueue *q, size_t offset,
+                                       void *buf, size_t bytes)
+{
+    size_t done = 0;
+    unsigned int i;
+
+    for (i = 0; i < q->rx_map.num && done < bytes; i++) {
+        VirtQueueElement *elem = q->rx_map.elems[i];
+        size_t len = iov_size(elem->in_sg, elem->in_num);
+
+        if (offset >= len) {
+            offset -= len;
+            continue;
+        }
+        done += iov_to_buf(elem->in_sg, elem->in_num, offset,
+                           buf + done, bytes - done);
+        offset = 0;
+    }
+    return done;
+}
+
+static size_t virtio_net_rx_map_from_buf(VirtIONetQueue *q, size_t offset,
+                                         const void *buf, size_t bytes)
+{
+    size_t done = 0;
+    unsigned int i;
+
+    for (i = 0; i < q->rx_map.num && done < bytes; i++) {
+        VirtQueueElement *elem = q->rx_map.elems[i];
+        size_t len = iov_size(elem->in_sg, elem->in_num);
+
+        if (offset >= len) {
+            offset -= len;
+            continue;
+        }
+        done += iov_from_buf(elem->in_sg, elem->in_num, offset,
+                             buf + done, bytes - done);
+        offset = 0;
+    }
+    return done;
+}
+
+/*
+ * Let the peer read a packet of up to @size bytes straight into guest
+ * receive buffers.  The buffers are popped here and stay with the queue
+ * until virtio_net_rx_commit() hands them to the guest, so a run of small
+ * packets does not pop and unpop a full 64k worth of mergeable buffers
+ * each time.  Any fallback to virtio_net_receive() gives them back first.
+ *
+ * The peer writes what it would otherwise pass to virtio_net_receive(),
+ * so this only works when its header is the one the guest expects (or it
+ * has none and we leave room for ours), and when nothing has to look at
+ * the packet before picking a queue for it.  The peer has to be ready for
+ * a packet of any size, which only mergeable buffers can hold without
+ * posting 64k per descriptor chain, so without them there is no point.
+ */
+static int virtio_net_rx_map(NetClientState *nc, struct iovec *iov,
+                             int iovcnt, size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    size_t skip = n->guest_hdr_len - n->host_hdr_len;
+    size_t avail = 0;
+    unsigned int i;
+    int cnt = 0;
+
+    if (!n->mergeable_rx_bufs || !virtio_net_can_receive(nc)) {
+        return 0;
+    }
+
+    if (n->rss_data.enabled || n->rss_data.populate_hash ||
+        (n->has_vnet_hdr && skip) || virtio_net_gro_enabled(n)) {
+        return 0;
+    }
+
+    for (i = 0; i < q->rx_map.num; i++) {
+        VirtQueueElement *elem = q->rx_map.elems[i];
+
+        avail += iov_size(elem->in_sg, elem->in_num);
+    }
+
+    while (avail < size + skip && q->rx_map.num < VIRTIO_NET_RX_MAP_MAX) {
+        VirtQueueElement *elem;
+
+        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+        if (!elem) {
+            return 0;
+        }
+
+        if (elem->in_num < 1) {
+            virtio_error(vdev,
+                         "virtio-net receive queue contains no in buffers");
+            virtqueue_detach_element(q->rx_vq, elem, 0);
+            g_free(elem);
+            return 0;
+        }
+
+        q->rx_map.elems[q->rx_map.num++] = elem;
+        avail += iov_size(elem->in_sg, elem->in_num);
+    }
+
+    for (i = 0; i < q->rx_map.num && cnt < iovcnt; i++) {
+        VirtQueueElement *elem = q->rx_map.elems[i];
+        size_t offset = i == 0 ? skip : 0;
+
+        cnt += iov_copy(iov + cnt, iovcnt - cnt, elem->in_sg, elem->in_num,
+                        offset, iov_size(elem->in_sg, elem->in_num) - offset);
+    }
+
+    if (iov_size(iov, cnt) < size) {
+        return 0;
+    }
+
+    virtio_queue_set_notification(q->rx_vq, 0);
+    return cnt;
+}
+
+static void virtio_net_rx_commit(NetClientState *nc, size_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_hdr_mrg_rxbuf mhdr = {
+        .hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+    uint8_t head[sizeof(mhdr) + ETH_HLEN + 4] = { 0 };
+    size_t skip = n->guest_hdr_len - n->host_hdr_len;
+    size_t total = len + skip;
+    size_t offset;
+    unsigned int i, num;
+
+    if (!len) {
+        return;
+    }
+
+    virtio_net_rx_map_to_buf(q, skip, head,
+                             MIN(len, n->host_hdr_len + ETH_HLEN + 4));
+    if (!receive_filter(n, head, len)) {
+        /* Nothing was consumed, the buffers stay around for the next one */
+        return;
+    }
+
+    if (n->has_vnet_hdr) {
+        struct virtio_net_hdr *hdr = &mhdr.hdr;
+        size_t size = len - n->host_hdr_len;
+        uint8_t pkt[1500];
+
+        memcpy(hdr, head, sizeof(*hdr));
+        if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && size < sizeof(pkt)) {
+            virtio_net_rx_map_to_buf(q, n->host_hdr_len, pkt, size);
+            work_around_broken_dhclient(hdr, pkt, size);
+            if (!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+                virtio_net_rx_map_from_buf(q, n->host_hdr_len, pkt, size);
+            }
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, hdr);
+        }
+    }
+
+    for (offset = num = 0; offset < total && num < q->rx_map.num; num++) {
+        VirtQueueElement *elem = q->rx_map.elems[num];
+
+        offset += iov_size(elem->in_sg, elem->in_num);
+    }
+
+    /* num_buffers is not written by the peer */
+    virtio_stw_p(vdev, &mhdr.num_buffers, num);
+    virtio_net_rx_map_from_buf(q, 0, &mhdr,
+                               MIN(n->guest_hdr_len, sizeof(mhdr)));
+
+    for (offset = i = 0; i < num; i++) {
+        VirtQueueElement *elem = q->rx_map.elems[i];
+        size_t elen = MIN(iov_size(elem->in_sg, elem->in_num),
+                          total - offset);
+
+        virtqueue_fill(q->rx_vq, elem, elen, i);
+        g_free(elem);
+        offset += elen;
+    }
+
+    q->rx_map.num -= num;
+    memmove(q->rx_map.elems, q->rx_map.elems + num,
+            q->rx_map.num * sizeof(q->rx_map.elems[0]));
+
+    virtqueue_flush(q->rx_vq, num);
+    virtio_notify(vdev, q->rx_vq);
+}
+
+static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
+
+static void virtio_net_tx_complete_queue(VirtIONetQueue *q)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
@@ -1222,6 +1838,70 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtio_net_flush_tx(q);
 }
 
+static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int i;
+
+    if (!n->peer_shared) {
+        virtio_net_tx_complete_queue(virtio_net_get_subqueue(nc));
+        return;
+    }
+
+    /*
+     * All queues send through the first NetClientState, so we cannot
+     * tell whose packet this was.  The net queue holds its own copy of
+     * every packet, so it is safe to resume all of them.
+     */
+    for (i = 0; i < n->max_queues; i++) {
+        if (n->vqs[i].async_tx.elem) {
+            virtio_net_tx_complete_queue(&n->vqs[i]);
+        }
+    }
+}
+
+/* The NetClientState that transmits the packets of @q */
+static NetClientState *virtio_net_tx_queue(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+
+    if (n->peer_shared) {
+        return qemu_get_queue(n->nic);
+    }
+    return qemu_get_subqueue(n->nic, vq2q(virtio_get_queue_index(q->tx_vq)));
+}
+
+static ssize_t virtio_net_gso_send(void *opaque, const struct iovec *iov,
+                                   int iovcnt, bool last)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = virtio_net_tx_queue(q);
+
+    /* Only the last frame completes the guest's request */
+    return qemu_sendv_packet_async(nc, iov, iovcnt,
+                                   last ? virtio_net_tx_complete : NULL);
+}
+
+static ssize_t virtio_net_tx_sw_offload(VirtIONetQueue *q,
+                                        const struct virtio_net_hdr *hdr,
+                                        const struct iovec *sg,
+                                        unsigned int sg_num)
+{
+    VirtIONet *n = q->n;
+    size_t size = iov_size(sg, sg_num) - n->guest_hdr_len;
+
+    if (size > NET_GRO_MAX_SIZE) {
+        return -1;
+    }
+
+    if (!q->tx_gso_buf) {
+        q->tx_gso_buf = g_malloc(NET_GRO_MAX_SIZE);
+    }
+    iov_to_buf(sg, sg_num, n->guest_hdr_len, q->tx_gso_buf, size);
+
+    return net_gso_segment(hdr, q->tx_gso_buf, size, virtio_net_gso_send, q);
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
@@ -1229,7 +1909,6 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -1243,7 +1922,9 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ssize_t ret;
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+        /* Large enough for every header layout the guest can negotiate */
+        struct virtio_net_hdr_v1_hash mhdr;
+        struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)&mhdr;
 
         elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -1259,6 +1940,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             return -EINVAL;
         }
 
+        assert(n->guest_hdr_len <= sizeof(mhdr));
         if (n->has_vnet_hdr) {
             if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
@@ -1268,7 +1950,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
+                virtio_net_hdr_swap(vdev, hdr);
                 sg2[0].iov_base = &mhdr;
                 sg2[0].iov_len = n->guest_hdr_len;
                 out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
@@ -1280,6 +1962,25 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 out_num += 1;
                 out_sg = sg2;
 	    }
+        } else if (virtio_net_sw_offload(n)) {
+            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+                n->guest_hdr_len) {
+                virtio_error(vdev, "virtio-net header incorrect");
+                virtqueue_detach_element(q->tx_vq, elem, 0);
+                g_free(elem);
+                return -EINVAL;
+            }
+            virtio_net_hdr_swap(vdev, hdr);
+            if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) ||
+                hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+                ret = virtio_net_tx_sw_offload(q, hdr, out_sg, out_num);
+                if (ret == 0) {
+                    virtio_queue_set_notification(q->tx_vq, 0);
+                    q->async_tx.elem = elem;
+                    return -EBUSY;
+                }
+                goto drop;
+            }
         }
         /*
          * If host wants to see the guest header as is, we can
@@ -1298,7 +1999,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+        ret = qemu_sendv_packet_async(virtio_net_tx_queue(q),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
@@ -1451,6 +2152,11 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    if (n->net_conf.sw_offload) {
+        n->vqs[index].gro = net_gro_new(false, false);
+        n->vqs[index].gro_bh = qemu_bh_new(virtio_net_gro_bh, &n->vqs[index]);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -1462,6 +2168,7 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     NetClientState *nc = qemu_get_subqueue(n->nic, index);
 
     qemu_purge_queued_packets(nc);
+    virtio_net_rx_map_release(q);
 
     virtio_del_queue(vdev, index * 2);
     if (q->tx_timer) {
@@ -1471,6 +2178,14 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         qemu_bh_delete(q->tx_bh);
     }
     virtio_del_queue(vdev, index * 2 + 1);
+
+    if (q->gro) {
+        qemu_bh_delete(q->gro_bh);
+        net_gro_free(q->gro);
+        q->gro = NULL;
+    }
+    g_free(q->tx_gso_buf);
+    q->tx_gso_buf = NULL;
 }
 
 static void virtio_net_change_num_queues(VirtIONet *n, int new_max_queues)
@@ -1564,7 +2279,9 @@ static int virtio_net_load_device(VirtIODevice *vdev, QEMUFile *f,
 
     virtio_net_set_mrg_rx_bufs(n, qemu_get_be32(f),
                                virtio_vdev_has_feature(vdev,
-                                                       VIRTIO_F_VERSION_1));
+                                                       VIRTIO_F_VERSION_1),
+                               virtio_vdev_has_feature(vdev,
+                                                   VIRTIO_NET_F_HASH_REPORT));
 
     n->status = qemu_get_be16(f);
 
@@ -1634,7 +2351,7 @@ static int virtio_net_load_device(VirtIODevice *vdev, QEMUFile *f,
         n->curr_guest_offloads = virtio_net_supported_guest_offloads(n);
     }
 
-    if (peer_has_vnet_hdr(n)) {
+    if (peer_has_vnet_hdr(n) || virtio_net_sw_offload(n)) {
         virtio_net_apply_guest_offloads(n);
     }
 
@@ -1669,6 +2386,8 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .rx_map = virtio_net_rx_map,
+    .rx_commit = virtio_net_rx_commit,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
@@ -1744,6 +2463,29 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     }
 
     n->max_queues = MAX(n->nic_conf.peers.queues, 1);
+    if (n->net_conf.rss_queues > 1) {
+        NetClientState *peer = n->nic_conf.peers.ncs[0];
+
+        if (!virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) ||
+            n->max_queues > 1 ||
+            (peer && (peer->info->type == NET_CLIENT_DRIVER_TAP ||
+                      peer->info->type == NET_CLIENT_DRIVER_VHOST_USER))) {
+            error_setg(errp, "rss-queues needs rss=on and a single queue "
+                       "netdev other than tap or vhost-user; use the "
+                       "netdev's queues option instead");
+            virtio_cleanup(vdev);
+            return;
+        }
+
+        /*
+         * The extra queue pairs are only reached through RSS steering on
+         * receive; they have no peer of their own and transmit through
+         * the first one.
+         */
+        n->max_queues = n->net_conf.rss_queues;
+        n->nic_conf.peers.queues = n->max_queues;
+        n->peer_shared = true;
+    }
     if (n->max_queues * 2 + 1 > VIRTIO_QUEUE_MAX) {
         error_setg(errp, "Invalid number of queues (= %" PRIu32 "), "
                    "must be a positive integer less than %d.",
@@ -1799,7 +2541,8 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     n->vqs[0].tx_waiting = 0;
     n->tx_burst = n->net_conf.txburst;
-    virtio_net_set_mrg_rx_bufs(n, 0, 0);
+    virtio_net_set_mrg_rx_bufs(n, 0, 0, 0);
+    net_rx_pkt_init(&n->rx_pkt, false);
     n->promisc = 1; /* for compatibility */
 
     n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
@@ -1837,6 +2580,7 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
     timer_del(n->announce_timer);
     timer_free(n->announce_timer);
     g_free(n->vqs);
+    net_rx_pkt_uninit(n->rx_pkt);
     qemu_del_nic(n->nic);
     virtio_cleanup(vdev);
 }
@@ -1864,6 +2608,51 @@ static void virtio_net_pre_save(void *opaque)
     assert(!n->vhost_started);
 }
 
+static bool virtio_net_rss_needed(void *opaque)
+{
+    VirtIONet *n = opaque;
+
+    return n->rss_data.enabled;
+}
+
+static int virtio_net_rss_post_load(void *opaque, int version_id)
+{
+    VirtIONet *n = opaque;
+    int i;
+
+    if (!is_power_of_2(n->rss_data.indirections_len) ||
+        n->rss_data.indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN ||
+        n->rss_data.default_queue >= n->max_queues) {
+        return -EINVAL;
+    }
+    for (i = 0; i < n->rss_data.indirections_len; i++) {
+        if (n->rss_data.indirections_table[i] >= n->max_queues) {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_virtio_net_rss = {
+    .name = "virtio-net/rss",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_rss_needed,
+    .post_load = virtio_net_rss_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_BOOL(rss_data.enabled, VirtIONet),
+        VMSTATE_BOOL(rss_data.redirect, VirtIONet),
+        VMSTATE_UINT32(rss_data.hash_types, VirtIONet),
+        VMSTATE_UINT16(rss_data.indirections_len, VirtIONet),
+        VMSTATE_UINT16(rss_data.default_queue, VirtIONet),
+        VMSTATE_UINT8_ARRAY(rss_data.key, VirtIONet,
+                            VIRTIO_NET_RSS_MAX_KEY_SIZE),
+        VMSTATE_UINT16_ARRAY(rss_data.indirections_table, VirtIONet,
+                             VIRTIO_NET_RSS_MAX_TABLE_LEN),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_virtio_net = {
     .name = "virtio-net",
     .minimum_version_id = VIRTIO_NET_VM_VERSION,
@@ -1873,48 +2662,59 @@ static const VMStateDescription vmstate_virtio_net = {
         VMSTATE_END_OF_LIST()
     },
     .pre_save = virtio_net_pre_save,
+    .subsections = (const VMStateDescription*[]) {
+        &vmstate_virtio_net_rss,
+        NULL
+    }
 };
 
 static Property virtio_net_properties[] = {
-    DEFINE_PROP_BIT("csum", VirtIONet, host_features, VIRTIO_NET_F_CSUM, true),
-    DEFINE_PROP_BIT("guest_csum", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_CSUM, true),
-    DEFINE_PROP_BIT("gso", VirtIONet, host_features, VIRTIO_NET_F_GSO, true),
-    DEFINE_PROP_BIT("guest_tso4", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_TSO4, true),
-    DEFINE_PROP_BIT("guest_tso6", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_TSO6, true),
-    DEFINE_PROP_BIT("guest_ecn", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_ECN, true),
-    DEFINE_PROP_BIT("guest_ufo", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_UFO, true),
-    DEFINE_PROP_BIT("guest_announce", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_ANNOUNCE, true),
-    DEFINE_PROP_BIT("host_tso4", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_TSO4, true),
-    DEFINE_PROP_BIT("host_tso6", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_TSO6, true),
-    DEFINE_PROP_BIT("host_ecn", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_ECN, true),
-    DEFINE_PROP_BIT("host_ufo", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_UFO, true),
-    DEFINE_PROP_BIT("mrg_rxbuf", VirtIONet, host_features,
-                    VIRTIO_NET_F_MRG_RXBUF, true),
-    DEFINE_PROP_BIT("status", VirtIONet, host_features,
-                    VIRTIO_NET_F_STATUS, true),
-    DEFINE_PROP_BIT("ctrl_vq", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_VQ, true),
-    DEFINE_PROP_BIT("ctrl_rx", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_RX, true),
-    DEFINE_PROP_BIT("ctrl_vlan", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_VLAN, true),
-    DEFINE_PROP_BIT("ctrl_rx_extra", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_RX_EXTRA, true),
-    DEFINE_PROP_BIT("ctrl_mac_addr", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_MAC_ADDR, true),
-    DEFINE_PROP_BIT("ctrl_guest_offloads", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, true),
-    DEFINE_PROP_BIT("mq", VirtIONet, host_features, VIRTIO_NET_F_MQ, false),
+    DEFINE_PROP_BIT64("csum", VirtIONet, host_features,
+                      VIRTIO_NET_F_CSUM, true),
+    DEFINE_PROP_BIT64("guest_csum", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_CSUM, true),
+    DEFINE_PROP_BIT64("gso", VirtIONet, host_features,
+                      VIRTIO_NET_F_GSO, true),
+    DEFINE_PROP_BIT64("guest_tso4", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_TSO4, true),
+    DEFINE_PROP_BIT64("guest_tso6", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_TSO6, true),
+    DEFINE_PROP_BIT64("guest_ecn", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_ECN, true),
+    DEFINE_PROP_BIT64("guest_ufo", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_UFO, true),
+    DEFINE_PROP_BIT64("guest_announce", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_ANNOUNCE, true),
+    DEFINE_PROP_BIT64("host_tso4", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_TSO4, true),
+    DEFINE_PROP_BIT64("host_tso6", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_TSO6, true),
+    DEFINE_PROP_BIT64("host_ecn", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_ECN, true),
+    DEFINE_PROP_BIT64("host_ufo", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_UFO, true),
+    DEFINE_PROP_BIT64("mrg_rxbuf", VirtIONet, host_features,
+                      VIRTIO_NET_F_MRG_RXBUF, true),
+    DEFINE_PROP_BIT64("status", VirtIONet, host_features,
+                      VIRTIO_NET_F_STATUS, true),
+    DEFINE_PROP_BIT64("ctrl_vq", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_VQ, true),
+    DEFINE_PROP_BIT64("ctrl_rx", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_RX, true),
+    DEFINE_PROP_BIT64("ctrl_vlan", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_VLAN, true),
+    DEFINE_PROP_BIT64("ctrl_rx_extra", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_RX_EXTRA, true),
+    DEFINE_PROP_BIT64("ctrl_mac_addr", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_MAC_ADDR, true),
+    DEFINE_PROP_BIT64("ctrl_guest_offloads", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, true),
+    DEFINE_PROP_BIT64("mq", VirtIONet, host_features,
+                      VIRTIO_NET_F_MQ, false),
+    DEFINE_PROP_BIT64("rss", VirtIONet, host_features,
+                      VIRTIO_NET_F_RSS, false),
+    DEFINE_PROP_BIT64("hash", VirtIONet, host_features,
+                      VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
     DEFINE_PROP_UINT32("x-txtimer", VirtIONet, net_conf.txtimer,
                        TX_TIMER_INTERVAL),
@@ -1922,6 +2722,8 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
+    DEFINE_PROP_BOOL("sw-offload", VirtIONet, net_conf.sw_offload, false),
+    DEFINE_PROP_UINT16("rss-queues", VirtIONet, net_conf.rss_queues, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
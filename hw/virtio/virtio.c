@@ -59,6 +59,28 @@ typedef struct VRingUsed
     VRingUsedElem ring[0];
 } VRingUsed;
 
+typedef struct VRingPackedDesc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} VRingPackedDesc;
+
+typedef struct VRingPackedDescEvent
+{
+    uint16_t off_wrap;
+    uint16_t flags;
+} VRingPackedDescEvent;
+
+/* The three parts of a ring, translated once per memory map change */
+typedef struct VRingMemoryRegionCaches {
+    struct rcu_head rcu;
+    MemoryRegionCache desc;
+    MemoryRegionCache avail;
+    MemoryRegionCache used;
+} VRingMemoryRegionCaches;
+
 typedef struct VRing
 {
     unsigned int num;
@@ -67,19 +89,30 @@ typedef struct VRing
     hwaddr desc;
     hwaddr avail;
     hwaddr used;
+    VRingMemoryRegionCaches *caches;
 } VRing;
 
+/* An element filled into a packed ring, written out by virtqueue_flush() */
+typedef struct VirtQueueUsedElem
+{
+    unsigned int index;
+    unsigned int len;
+    unsigned int ndescs;
+} VirtQueueUsedElem;
+
 struct VirtQueue
 {
     VRing vring;
 
     /* Next head to pop */
     uint16_t last_avail_idx;
+    bool last_avail_wrap_counter;
 
     /* Last avail_idx read from VQ. */
     uint16_t shadow_avail_idx;
 
     uint16_t used_idx;
+    bool used_wrap_counter;
 
     /* Last used index value we have signalled on */
     uint16_t signalled_used;
@@ -92,7 +125,9 @@ struct VirtQueue
 
     uint16_t queue_index;
 
+    /* Popped elements, or descriptors for a packed ring */
     int inuse;
+    VirtQueueUsedElem *used_elems;
 
     uint16_t vector;
     VirtIOHandleOutput handle_output;
@@ -103,6 +138,106 @@ struct VirtQueue
     QLIST_ENTRY(VirtQueue) node;
 };
 
+static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
+{
+    address_space_cache_destroy(&caches->desc);
+    address_space_cache_destroy(&caches->avail);
+    address_space_cache_destroy(&caches->used);
+    g_free(caches);
+}
+
+/* Readers may still be using the old caches, so they are only freed
+ * after a grace period.
+ */
+static void virtio_set_region_cache(VirtQueue *vq,
+                                    VRingMemoryRegionCaches *new)
+{
+    VRingMemoryRegionCaches *old = vq->vring.caches;
+
+    atomic_rcu_set(&vq->vring.caches, new);
+    if (old) {
+        call_rcu(old, virtio_free_region_cache, rcu);
+    }
+}
+
+static void virtio_reset_region_cache(VirtQueue *vq)
+{
+    virtio_set_region_cache(vq, NULL);
+}
+
+/* Translate the rings of queue @n again, after they moved or the memory
+ * map changed.
+ */
+static void virtio_init_region_cache(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+    VRingMemoryRegionCaches *new = NULL;
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    hwaddr avail_size, used_size;
+
+    if (vq->vring.desc) {
+        if (packed) {
+            avail_size = used_size = sizeof(VRingPackedDescEvent);
+        } else {
+            /* Including used_event and avail_event respectively */
+            avail_size = offsetof(VRingAvail, ring[vq->vring.num + 1]);
+            used_size = offsetof(VRingUsed, ring[vq->vring.num]) +
+                        sizeof(uint16_t);
+        }
+
+        new = g_new0(VRingMemoryRegionCaches, 1);
+        /* A packed ring hands buffers back in the descriptor table */
+        address_space_cache_init(&new->desc, &address_space_memory,
+                                 vq->vring.desc,
+                                 vq->vring.num * (packed ?
+                                                  sizeof(VRingPackedDesc) :
+                                                  sizeof(VRingDesc)),
+                                 packed);
+        address_space_cache_init(&new->avail, &address_space_memory,
+                                 vq->vring.avail, avail_size, false);
+        address_space_cache_init(&new->used, &address_space_memory,
+                                 vq->vring.used, used_size, true);
+    }
+    virtio_set_region_cache(vq, new);
+}
+
+static void virtio_init_region_caches(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        if (vdev->vq[i].vring.desc || vdev->vq[i].vring.caches) {
+            virtio_init_region_cache(vdev, i);
+        }
+    }
+}
+
+static inline VRingMemoryRegionCaches *vring_get_region_caches(VirtQueue *vq)
+{
+    return atomic_rcu_read(&vq->vring.caches);
+}
+
+static void virtio_memory_listener_update(MemoryListener *listener,
+                                          MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    vdev->vring_caches_stale = true;
+}
+
+/* Whatever changed in guest memory, the rings may have been translated
+ * to something that is no longer there.
+ */
+static void virtio_memory_listener_commit(MemoryListener *listener)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    if (vdev->vring_caches_stale) {
+        vdev->vring_caches_stale = false;
+        virtio_init_region_caches(vdev);
+    }
+}
+
 /* virt queue functions */
 void virtio_queue_update_rings(VirtIODevice *vdev, int n)
 {
@@ -116,13 +251,14 @@ void virtio_queue_update_rings(VirtIODevice *vdev, int n)
     vring->used = vring_align(vring->avail +
                               offsetof(VRingAvail, ring[vring->num]),
                               vring->align);
+    virtio_init_region_cache(vdev, n);
 }
 
 static void vring_desc_read(VirtIODevice *vdev, VRingDesc *desc,
-                            hwaddr desc_pa, int i)
+                            MemoryRegionCache *cache, int i)
 {
-    address_space_read(&address_space_memory, desc_pa + i * sizeof(VRingDesc),
-                       MEMTXATTRS_UNSPECIFIED, (void *)desc, sizeof(VRingDesc));
+    address_space_read_cached(cache, i * sizeof(VRingDesc),
+                              desc, sizeof(VRingDesc));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap32s(vdev, &desc->len);
     virtio_tswap16s(vdev, &desc->flags);
@@ -131,24 +267,37 @@ static void vring_desc_read(VirtIODevice *vdev, VRingDesc *desc,
 
 static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, flags);
-    return virtio_lduw_phys(vq->vdev, pa);
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingAvail, flags);
+
+    if (!caches) {
+        return 0;
+    }
+    return virtio_lduw_phys_cached(vq->vdev, &caches->avail, pa);
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, idx);
-    vq->shadow_avail_idx = virtio_lduw_phys(vq->vdev, pa);
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingAvail, idx);
+
+    if (!caches) {
+        return 0;
+    }
+    vq->shadow_avail_idx = virtio_lduw_phys_cached(vq->vdev, &caches->avail,
+                                                   pa);
     return vq->shadow_avail_idx;
 }
 
 static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
-    hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
-    return virtio_lduw_phys(vq->vdev, pa);
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingAvail, ring[i]);
+
+    if (!caches) {
+        return 0;
+    }
+    return virtio_lduw_phys_cached(vq->vdev, &caches->avail, pa);
 }
 
 static inline uint16_t vring_get_used_event(VirtQueue *vq)
@@ -159,59 +308,209 @@ static inline uint16_t vring_get_used_event(VirtQueue *vq)
 static inline void vring_used_write(VirtQueue *vq, VRingUsedElem *uelem,
                                     int i)
 {
-    hwaddr pa;
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingUsed, ring[i]);
+
+    if (!caches) {
+        return;
+    }
     virtio_tswap32s(vq->vdev, &uelem->id);
     virtio_tswap32s(vq->vdev, &uelem->len);
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i]);
-    address_space_write(&address_space_memory, pa, MEMTXATTRS_UNSPECIFIED,
-                       (void *)uelem, sizeof(VRingUsedElem));
+    address_space_write_cached(&caches->used, pa, uelem,
+                               sizeof(VRingUsedElem));
 }
 
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, idx);
-    return virtio_lduw_phys(vq->vdev, pa);
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingUsed, idx);
+
+    if (!caches) {
+        return 0;
+    }
+    return virtio_lduw_phys_cached(vq->vdev, &caches->used, pa);
 }
 
 static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 {
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, idx);
-    virtio_stw_phys(vq->vdev, pa, val);
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa = offsetof(VRingUsed, idx);
+
+    if (caches) {
+        virtio_stw_phys_cached(vq->vdev, &caches->used, pa, val);
+    }
     vq->used_idx = val;
 }
 
 static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
 {
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
     VirtIODevice *vdev = vq->vdev;
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) | mask);
+    hwaddr pa = offsetof(VRingUsed, flags);
+    uint16_t flags;
+
+    if (!caches) {
+        return;
+    }
+    flags = virtio_lduw_phys_cached(vdev, &caches->used, pa);
+    virtio_stw_phys_cached(vdev, &caches->used, pa, flags | mask);
 }
 
 static inline void vring_used_flags_unset_bit(VirtQueue *vq, int mask)
 {
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
     VirtIODevice *vdev = vq->vdev;
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) & ~mask);
+    hwaddr pa = offsetof(VRingUsed, flags);
+    uint16_t flags;
+
+    if (!caches) {
+        return;
+    }
+    flags = virtio_lduw_phys_cached(vdev, &caches->used, pa);
+    virtio_stw_phys_cached(vdev, &caches->used, pa, flags & ~mask);
 }
 
 static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
 {
+    VRingMemoryRegionCaches *caches;
+    hwaddr pa;
+    if (!vq->notification) {
+        return;
+    }
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        return;
+    }
+    pa = offsetof(VRingUsed, ring[vq->vring.num]);
+    virtio_stw_phys_cached(vq->vdev, &caches->used, pa, val);
+}
+
+static inline bool virtio_queue_packed(VirtQueue *vq)
+{
+    return virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+}
+
+static void vring_packed_desc_read(VirtIODevice *vdev, VRingPackedDesc *desc,
+                                   MemoryRegionCache *cache, int i)
+{
+    address_space_read_cached(cache, i * sizeof(VRingPackedDesc),
+                              desc, sizeof(VRingPackedDesc));
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->id);
+    virtio_tswap16s(vdev, &desc->flags);
+}
+
+static inline uint16_t vring_packed_desc_flags(VirtQueue *vq, int i)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    hwaddr pa;
+
+    if (!caches) {
+        return 0;
+    }
+    pa = i * sizeof(VRingPackedDesc) + offsetof(VRingPackedDesc, flags);
+    return virtio_lduw_phys_cached(vq->vdev, &caches->desc, pa);
+}
+
+static inline bool vring_packed_desc_avail(uint16_t flags, bool wrap_counter)
+{
+    bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+    bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+    return avail != used && avail == wrap_counter;
+}
+
+/* Hand a buffer back to the driver.  The flags are written last, and for the
+ * first descriptor of a flush only after everything else in the flush. */
+static void vring_packed_used_write(VirtQueue *vq,
+                                    const VirtQueueUsedElem *uelem,
+                                    unsigned int i, bool wrap_counter,
+                                    bool first)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VirtIODevice *vdev = vq->vdev;
+    hwaddr pa = i * sizeof(VRingPackedDesc);
+    uint16_t flags = 0;
+
+    if (!caches) {
+        return;
+    }
+    if (wrap_counter) {
+        flags |= 1 << VRING_PACKED_DESC_F_AVAIL;
+        flags |= 1 << VRING_PACKED_DESC_F_USED;
+    }
+
+    virtio_stw_phys_cached(vdev, &caches->desc,
+                           pa + offsetof(VRingPackedDesc, id), uelem->index);
+    virtio_stl_phys_cached(vdev, &caches->desc,
+                           pa + offsetof(VRingPackedDesc, len), uelem->len);
+    if (first) {
+        smp_wmb();
+    }
+    virtio_stw_phys_cached(vdev, &caches->desc,
+                           pa + offsetof(VRingPackedDesc, flags), flags);
+}
+
+static void vring_packed_event_read(VirtIODevice *vdev,
+                                    MemoryRegionCache *cache,
+                                    VRingPackedDescEvent *e)
+{
+    e->flags = virtio_lduw_phys_cached(vdev, cache,
+                                       offsetof(VRingPackedDescEvent, flags));
+    /* Make sure flags is seen before off_wrap */
+    smp_rmb();
+    e->off_wrap = virtio_lduw_phys_cached(vdev, cache,
+                                          offsetof(VRingPackedDescEvent,
+                                                   off_wrap));
+}
+
+static void vring_packed_set_avail_event(VirtQueue *vq,
+                                         VRingMemoryRegionCaches *caches)
+{
+    uint16_t off_wrap;
     hwaddr pa;
     if (!vq->notification) {
         return;
     }
-    pa = vq->vring.used + offsetof(VRingUsed, ring[vq->vring.num]);
-    virtio_stw_phys(vq->vdev, pa, val);
+    off_wrap = vq->last_avail_idx |
+               vq->last_avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+    pa = offsetof(VRingPackedDescEvent, off_wrap);
+    virtio_stw_phys_cached(vq->vdev, &caches->used, pa, off_wrap);
+}
+
+static void virtio_queue_packed_set_notification(VirtQueue *vq, int enable)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VirtIODevice *vdev = vq->vdev;
+    hwaddr pa = offsetof(VRingPackedDescEvent, flags);
+
+    if (!caches) {
+        return;
+    }
+    if (!enable) {
+        virtio_stw_phys_cached(vdev, &caches->used, pa,
+                               VRING_PACKED_EVENT_FLAG_DISABLE);
+    } else if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_packed_set_avail_event(vq, caches);
+        /* Expose off_wrap before the flags that make the driver use it. */
+        smp_wmb();
+        virtio_stw_phys_cached(vdev, &caches->used, pa,
+                               VRING_PACKED_EVENT_FLAG_DESC);
+    } else {
+        virtio_stw_phys_cached(vdev, &caches->used, pa,
+                               VRING_PACKED_EVENT_FLAG_ENABLE);
+    }
 }
 
 void virtio_queue_set_notification(VirtQueue *vq, int enable)
 {
     vq->notification = enable;
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+
+    rcu_read_lock();
+    if (virtio_queue_packed(vq)) {
+        virtio_queue_packed_set_notification(vq, enable);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vring_avail_idx(vq));
     } else if (enable) {
         vring_used_flags_unset_bit(vq, VRING_USED_F_NO_NOTIFY);
@@ -222,6 +521,7 @@ void virtio_queue_set_notification(VirtQueue *vq, int enable)
         /* Expose avail event/used flags before caller checks the avail idx. */
         smp_mb();
     }
+    rcu_read_unlock();
 }
 
 int virtio_queue_ready(VirtQueue *vq)
@@ -233,11 +533,28 @@ int virtio_queue_ready(VirtQueue *vq)
  * guest has added some buffers. */
 int virtio_queue_empty(VirtQueue *vq)
 {
+    bool empty;
+
+    if (virtio_queue_packed(vq)) {
+        if (!vq->vring.desc) {
+            return 1;
+        }
+        rcu_read_lock();
+        empty = !vring_packed_desc_avail(vring_packed_desc_flags(vq,
+                                                    vq->last_avail_idx),
+                                         vq->last_avail_wrap_counter);
+        rcu_read_unlock();
+        return empty;
+    }
+
     if (vq->shadow_avail_idx != vq->last_avail_idx) {
         return 0;
     }
 
-    return vring_avail_idx(vq) == vq->last_avail_idx;
+    rcu_read_lock();
+    empty = vring_avail_idx(vq) == vq->last_avail_idx;
+    rcu_read_unlock();
+    return empty;
 }
 
 static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
@@ -275,7 +592,7 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len)
 {
-    vq->inuse--;
+    vq->inuse -= virtio_queue_packed(vq) ? elem->ndescs : 1;
     virtqueue_unmap_sg(vq, elem, len);
 }
 
@@ -290,7 +607,16 @@ void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
                      unsigned int len)
 {
-    vq->last_avail_idx--;
+    if (virtio_queue_packed(vq)) {
+        if (vq->last_avail_idx < elem->ndescs) {
+            vq->last_avail_idx += vq->vring.num;
+            vq->last_avail_wrap_counter ^= 1;
+        }
+        vq->last_avail_idx -= elem->ndescs;
+        vq->shadow_avail_idx = vq->last_avail_idx;
+    } else {
+        vq->last_avail_idx--;
+    }
     virtqueue_detach_element(vq, elem, len);
 }
 
@@ -301,7 +627,8 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
  * Pretend that elements weren't popped from the virtqueue.  The next
  * virtqueue_pop() will refetch the oldest element.
  *
- * Use virtqueue_unpop() instead if you have a VirtQueueElement.
+ * Use virtqueue_unpop() instead if you have a VirtQueueElement.  On a packed
+ * ring each element is taken to be a single descriptor.
  *
  * Returns: true on success, false if @num is greater than the number of in use
  * elements.
@@ -311,6 +638,16 @@ bool virtqueue_rewind(VirtQueue *vq, unsigned int num)
     if (num > vq->inuse) {
         return false;
     }
+    if (virtio_queue_packed(vq)) {
+        if (vq->last_avail_idx < num) {
+            vq->last_avail_idx += vq->vring.num;
+            vq->last_avail_wrap_counter ^= 1;
+        }
+        vq->last_avail_idx -= num;
+        vq->shadow_avail_idx = vq->last_avail_idx;
+        vq->inuse -= num;
+        return true;
+    }
     vq->last_avail_idx -= num;
     vq->inuse -= num;
     return true;
@@ -325,6 +662,15 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
     virtqueue_unmap_sg(vq, elem, len);
 
+    if (virtio_queue_packed(vq)) {
+        /* Written to the ring by virtqueue_flush(), the first one last. */
+        assert(idx < vq->vring.num);
+        vq->used_elems[idx].index = elem->index;
+        vq->used_elems[idx].len = len;
+        vq->used_elems[idx].ndescs = elem->ndescs;
+        return;
+    }
+
     if (unlikely(vq->vdev->broken)) {
         return;
     }
@@ -333,13 +679,67 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
     uelem.id = elem->index;
     uelem.len = len;
+    rcu_read_lock();
     vring_used_write(vq, &uelem, idx);
+    rcu_read_unlock();
+}
+
+static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
+{
+    unsigned int i, head, ndescs;
+    bool wrap_counter;
+
+    if (!count) {
+        return;
+    }
+
+    ndescs = vq->used_elems[0].ndescs;
+    for (i = 1; i < count; i++) {
+        ndescs += vq->used_elems[i].ndescs;
+    }
+    if (unlikely(vq->vdev->broken)) {
+        vq->inuse -= ndescs;
+        return;
+    }
+
+    trace_virtqueue_flush(vq, count);
+
+    /* Each element takes up as many slots as it was popped from, and the
+     * driver may pick up all of them once the first one is marked used. */
+    head = vq->used_idx + vq->used_elems[0].ndescs;
+    wrap_counter = vq->used_wrap_counter;
+    rcu_read_lock();
+    for (i = 1; i < count; i++) {
+        if (head >= vq->vring.num) {
+            head -= vq->vring.num;
+            wrap_counter ^= 1;
+        }
+        vring_packed_used_write(vq, &vq->used_elems[i], head, wrap_counter,
+                                false);
+        head += vq->used_elems[i].ndescs;
+    }
+    vring_packed_used_write(vq, &vq->used_elems[0], vq->used_idx,
+                            vq->used_wrap_counter, true);
+    rcu_read_unlock();
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
 }
 
 void virtqueue_flush(VirtQueue *vq, unsigned int count)
 {
     uint16_t old, new;
 
+    if (virtio_queue_packed(vq)) {
+        virtqueue_packed_flush(vq, count);
+        return;
+    }
+
     if (unlikely(vq->vdev->broken)) {
         vq->inuse -= count;
         return;
@@ -350,7 +750,9 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
     trace_virtqueue_flush(vq, count);
     old = vq->used_idx;
     new = old + count;
+    rcu_read_lock();
     vring_used_idx_set(vq, new);
+    rcu_read_unlock();
     vq->inuse -= count;
     if (unlikely((int16_t)(new - vq->signalled_used) < (uint16_t)(new - old)))
         vq->signalled_used_valid = false;
@@ -405,7 +807,8 @@ enum {
 };
 
 static int virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
-                                    hwaddr desc_pa, unsigned int max,
+                                    MemoryRegionCache *desc_cache,
+                                    unsigned int max,
                                     unsigned int *next)
 {
     /* If this descriptor says it doesn't chain, we're done. */
@@ -423,14 +826,135 @@ static int virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
         return VIRTQUEUE_READ_DESC_ERROR;
     }
 
-    vring_desc_read(vdev, desc, desc_pa, *next);
+    vring_desc_read(vdev, desc, desc_cache, *next);
     return VIRTQUEUE_READ_DESC_MORE;
 }
 
-void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
-                               unsigned int *out_bytes,
-                               unsigned max_in_bytes, unsigned max_out_bytes)
+static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
+                                             VRingMemoryRegionCaches *caches,
+                                             unsigned int *in_bytes,
+                                             unsigned int *out_bytes,
+                                             unsigned max_in_bytes,
+                                             unsigned max_out_bytes)
+{
+    VirtIODevice *vdev = vq->vdev;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
+    unsigned int idx;
+    unsigned int total_bufs, in_total, out_total;
+    bool wrap_counter;
+
+    idx = vq->last_avail_idx;
+    wrap_counter = vq->last_avail_wrap_counter;
+
+    total_bufs = in_total = out_total = 0;
+    while (vring_packed_desc_avail(vring_packed_desc_flags(vq, idx),
+                                   wrap_counter)) {
+        MemoryRegionCache *desc_cache = &caches->desc;
+        unsigned int max, num_bufs;
+        bool indirect = false;
+        VRingPackedDesc desc;
+        unsigned int i;
+
+        /* Read the descriptor only after its flags said it's available. */
+        smp_rmb();
+
+        max = vq->vring.num;
+        num_bufs = total_bufs;
+        i = idx;
+        vring_packed_desc_read(vdev, &desc, desc_cache, i);
+
+        if (desc.flags & VRING_DESC_F_INDIRECT) {
+            if (!desc.len || (desc.len % sizeof(VRingPackedDesc))) {
+                virtio_error(vdev, "Invalid size for indirect buffer table");
+                goto err;
+            }
+
+            /* If we've got too many, that implies a descriptor loop. */
+            if (num_bufs >= max) {
+                virtio_error(vdev, "Looped descriptor");
+                goto err;
+            }
+
+            /* loop over the indirect descriptor table */
+            indirect = true;
+            address_space_cache_init(&indirect_desc_cache,
+                                     &address_space_memory,
+                                     desc.addr, desc.len, false);
+            desc_cache = &indirect_desc_cache;
+            max = desc.len / sizeof(VRingPackedDesc);
+            num_bufs = i = 0;
+            vring_packed_desc_read(vdev, &desc, desc_cache, i);
+        }
+
+        for (;;) {
+            /* If we've got too many, that implies a descriptor loop. */
+            if (++num_bufs > max) {
+                virtio_error(vdev, "Looped descriptor");
+                goto err;
+            }
+
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                in_total += desc.len;
+            } else {
+                out_total += desc.len;
+            }
+            if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
+                goto done;
+            }
+
+            /* Indirect tables are used whole, chains run over adjacent slots */
+            if (indirect) {
+                if (++i == max) {
+                    break;
+                }
+            } else {
+                if (!(desc.flags & VRING_DESC_F_NEXT)) {
+                    break;
+                }
+                if (++i == vq->vring.num) {
+                    i = 0;
+                }
+            }
+            vring_packed_desc_read(vdev, &desc, desc_cache, i);
+        }
+
+        if (indirect) {
+            address_space_cache_destroy(&indirect_desc_cache);
+            idx++;
+            total_bufs++;
+        } else {
+            idx += num_bufs - total_bufs;
+            total_bufs = num_bufs;
+        }
+        if (idx >= vq->vring.num) {
+            idx -= vq->vring.num;
+            wrap_counter ^= 1;
+        }
+    }
+
+done:
+    address_space_cache_destroy(&indirect_desc_cache);
+    if (in_bytes) {
+        *in_bytes = in_total;
+    }
+    if (out_bytes) {
+        *out_bytes = out_total;
+    }
+    return;
+
+err:
+    in_total = out_total = 0;
+    goto done;
+}
+
+static void virtqueue_split_get_avail_bytes(VirtQueue *vq,
+                                            VRingMemoryRegionCaches *caches,
+                                            unsigned int *in_bytes,
+                                            unsigned int *out_bytes,
+                                            unsigned max_in_bytes,
+                                            unsigned max_out_bytes)
 {
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     unsigned int idx;
     unsigned int total_bufs, in_total, out_total;
     int rc;
@@ -439,10 +963,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
     total_bufs = in_total = out_total = 0;
     while ((rc = virtqueue_num_heads(vq, idx)) > 0) {
+        MemoryRegionCache *desc_cache = &caches->desc;
         VirtIODevice *vdev = vq->vdev;
         unsigned int max, num_bufs, indirect = 0;
         VRingDesc desc;
-        hwaddr desc_pa;
         unsigned int i;
 
         max = vq->vring.num;
@@ -452,11 +976,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
             goto err;
         }
 
-        desc_pa = vq->vring.desc;
-        vring_desc_read(vdev, &desc, desc_pa, i);
+        vring_desc_read(vdev, &desc, desc_cache, i);
 
         if (desc.flags & VRING_DESC_F_INDIRECT) {
-            if (desc.len % sizeof(VRingDesc)) {
+            if (!desc.len || (desc.len % sizeof(VRingDesc))) {
                 virtio_error(vdev, "Invalid size for indirect buffer table");
                 goto err;
             }
@@ -469,10 +992,13 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
             /* loop over the indirect descriptor table */
             indirect = 1;
+            address_space_cache_init(&indirect_desc_cache,
+                                     &address_space_memory,
+                                     desc.addr, desc.len, false);
+            desc_cache = &indirect_desc_cache;
             max = desc.len / sizeof(VRingDesc);
-            desc_pa = desc.addr;
             num_bufs = i = 0;
-            vring_desc_read(vdev, &desc, desc_pa, i);
+            vring_desc_read(vdev, &desc, desc_cache, i);
         }
 
         do {
@@ -491,13 +1017,14 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                 goto done;
             }
 
-            rc = virtqueue_read_next_desc(vdev, &desc, desc_pa, max, &i);
+            rc = virtqueue_read_next_desc(vdev, &desc, desc_cache, max, &i);
         } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
         if (rc == VIRTQUEUE_READ_DESC_ERROR) {
             goto err;
         }
 
+        address_space_cache_destroy(&indirect_desc_cache);
         if (!indirect)
             total_bufs = num_bufs;
         else
@@ -509,6 +1036,7 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
     }
 
 done:
+    address_space_cache_destroy(&indirect_desc_cache);
     if (in_bytes) {
         *in_bytes = in_total;
     }
@@ -522,6 +1050,31 @@ err:
     goto done;
 }
 
+void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
+                               unsigned int *out_bytes,
+                               unsigned max_in_bytes, unsigned max_out_bytes)
+{
+    VRingMemoryRegionCaches *caches;
+
+    rcu_read_lock();
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        if (in_bytes) {
+            *in_bytes = 0;
+        }
+        if (out_bytes) {
+            *out_bytes = 0;
+        }
+    } else if (virtio_queue_packed(vq)) {
+        virtqueue_packed_get_avail_bytes(vq, caches, in_bytes, out_bytes,
+                                         max_in_bytes, max_out_bytes);
+    } else {
+        virtqueue_split_get_avail_bytes(vq, caches, in_bytes, out_bytes,
+                                        max_in_bytes, max_out_bytes);
+    }
+    rcu_read_unlock();
+}
+
 int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
                           unsigned int out_bytes)
 {
@@ -650,15 +1203,18 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->ndescs = 0;
     return elem;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq,
+                                 VRingMemoryRegionCaches *caches, size_t sz)
 {
     unsigned int i, head, max;
-    hwaddr desc_pa = vq->vring.desc;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
+    MemoryRegionCache *desc_cache = &caches->desc;
     VirtIODevice *vdev = vq->vdev;
-    VirtQueueElement *elem;
+    VirtQueueElement *elem = NULL;
     unsigned out_num, in_num;
     hwaddr addr[VIRTQUEUE_MAX_SIZE];
     struct iovec iov[VIRTQUEUE_MAX_SIZE];
@@ -694,18 +1250,20 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     i = head;
-    vring_desc_read(vdev, &desc, desc_pa, i);
+    vring_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
-        if (desc.len % sizeof(VRingDesc)) {
+        if (!desc.len || (desc.len % sizeof(VRingDesc))) {
             virtio_error(vdev, "Invalid size for indirect buffer table");
             return NULL;
         }
 
         /* loop over the indirect descriptor table */
+        address_space_cache_init(&indirect_desc_cache, &address_space_memory,
+                                 desc.addr, desc.len, false);
+        desc_cache = &indirect_desc_cache;
         max = desc.len / sizeof(VRingDesc);
-        desc_pa = desc.addr;
         i = 0;
-        vring_desc_read(vdev, &desc, desc_pa, i);
+        vring_desc_read(vdev, &desc, desc_cache, i);
     }
 
     /* Collect all the descriptors */
@@ -736,7 +1294,7 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
             goto err_undo_map;
         }
 
-        rc = virtqueue_read_next_desc(vdev, &desc, desc_pa, max, &i);
+        rc = virtqueue_read_next_desc(vdev, &desc, desc_cache, max, &i);
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     if (rc == VIRTQUEUE_READ_DESC_ERROR) {
@@ -758,11 +1316,170 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     vq->inuse++;
 
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+done:
+    address_space_cache_destroy(&indirect_desc_cache);
+    return elem;
+
+err_undo_map:
+    virtqueue_undo_map_desc(out_num, in_num, iov);
+    goto done;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq,
+                                  VRingMemoryRegionCaches *caches, size_t sz)
+{
+    unsigned int i, max, ndescs, num_bufs;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
+    MemoryRegionCache *desc_cache = &caches->desc;
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueElement *elem = NULL;
+    unsigned out_num, in_num;
+    hwaddr addr[VIRTQUEUE_MAX_SIZE];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+    VRingPackedDesc desc;
+    bool indirect = false;
+    uint16_t id;
+
+    if (unlikely(vdev->broken)) {
+        return NULL;
+    }
+    if (virtio_queue_empty(vq)) {
+        return NULL;
+    }
+    /* Read the descriptor only after its flags said it's available. */
+    smp_rmb();
+
+    /* When we start there are none of either input nor output. */
+    out_num = in_num = 0;
+
+    max = vq->vring.num;
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    i = vq->last_avail_idx;
+    vring_packed_desc_read(vdev, &desc, desc_cache, i);
+    id = desc.id;
+    if (desc.flags & VRING_DESC_F_INDIRECT) {
+        if (!desc.len || (desc.len % sizeof(VRingPackedDesc))) {
+            virtio_error(vdev, "Invalid size for indirect buffer table");
+            return NULL;
+        }
+
+        /* loop over the indirect descriptor table */
+        indirect = true;
+        address_space_cache_init(&indirect_desc_cache, &address_space_memory,
+                                 desc.addr, desc.len, false);
+        desc_cache = &indirect_desc_cache;
+        max = desc.len / sizeof(VRingPackedDesc);
+        i = 0;
+        vring_packed_desc_read(vdev, &desc, desc_cache, i);
+    }
+
+    /* Collect all the descriptors */
+    ndescs = 1;
+    num_bufs = 0;
+    for (;;) {
+        bool map_ok;
+
+        if (desc.flags & VRING_DESC_F_WRITE) {
+            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+                                        iov + out_num,
+                                        VIRTQUEUE_MAX_SIZE - out_num, true,
+                                        desc.addr, desc.len);
+        } else {
+            if (in_num) {
+                virtio_error(vdev, "Incorrect order for descriptors");
+                goto err_undo_map;
+            }
+            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+                                        VIRTQUEUE_MAX_SIZE, false,
+                                        desc.addr, desc.len);
+        }
+        if (!map_ok) {
+            goto err_undo_map;
+        }
+
+        /* If we've got too many, that implies a descriptor loop. */
+        if (++num_bufs > max) {
+            virtio_error(vdev, "Looped descriptor");
+            goto err_undo_map;
+        }
+
+        /* Indirect tables are used whole, chains run over adjacent slots */
+        if (indirect) {
+            if (++i == max) {
+                break;
+            }
+        } else {
+            if (!(desc.flags & VRING_DESC_F_NEXT)) {
+                break;
+            }
+            if (++i == vq->vring.num) {
+                i = 0;
+            }
+            ndescs++;
+        }
+        vring_packed_desc_read(vdev, &desc, desc_cache, i);
+        if (!indirect) {
+            /* The buffer id is the one in the last descriptor */
+            id = desc.id;
+        }
+    }
+
+    /* Now copy what we have collected and mapped */
+    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem->index = id;
+    elem->ndescs = ndescs;
+    for (i = 0; i < out_num; i++) {
+        elem->out_addr[i] = addr[i];
+        elem->out_sg[i] = iov[i];
+    }
+    for (i = 0; i < in_num; i++) {
+        elem->in_addr[i] = addr[out_num + i];
+        elem->in_sg[i] = iov[out_num + i];
+    }
+
+    vq->inuse += ndescs;
+    vq->last_avail_idx += ndescs;
+    if (vq->last_avail_idx >= vq->vring.num) {
+        vq->last_avail_idx -= vq->vring.num;
+        vq->last_avail_wrap_counter ^= 1;
+    }
+    vq->shadow_avail_idx = vq->last_avail_idx;
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_packed_set_avail_event(vq, caches);
+    }
+
+    trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+done:
+    address_space_cache_destroy(&indirect_desc_cache);
     return elem;
 
 err_undo_map:
     virtqueue_undo_map_desc(out_num, in_num, iov);
-    return NULL;
+    goto done;
+}
+
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    void *elem = NULL;
+
+    rcu_read_lock();
+    caches = vring_get_region_caches(vq);
+    if (caches) {
+        if (virtio_queue_packed(vq)) {
+            elem = virtqueue_packed_pop(vq, caches, sz);
+        } else {
+            elem = virtqueue_split_pop(vq, caches, sz);
+        }
+    }
+    rcu_read_unlock();
+    return elem;
 }
 
 /* Reading and writing a structure directly to QEMUFile is *awful*, but
@@ -782,7 +1499,7 @@ typedef struct VirtQueueElementOld {
     struct iovec out_sg[VIRTQUEUE_MAX_SIZE];
 } VirtQueueElementOld;
 
-void *qemu_get_virtqueue_element(QEMUFile *f, size_t sz)
+void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
 {
     VirtQueueElement *elem;
     VirtQueueElementOld data;
@@ -813,11 +1530,17 @@ void *qemu_get_virtqueue_element(QEMUFile *f, size_t sz)
         elem->out_sg[i].iov_len = data.out_sg[i].iov_len;
     }
 
+    /* Guest features aren't loaded yet, but host features match. */
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        elem->ndescs = qemu_get_be32(f);
+    }
+
     virtqueue_map(elem);
     return elem;
 }
 
-void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
+void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
+                                VirtQueueElement *elem)
 {
     VirtQueueElementOld data;
     int i;
@@ -846,6 +1569,10 @@ void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
         data.out_sg[i].iov_len = elem->out_sg[i].iov_len;
     }
     qemu_put_buffer(f, (uint8_t *)&data, sizeof(VirtQueueElementOld));
+
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        qemu_put_be32(f, elem->ndescs);
+    }
 }
 
 /* virtio device */
@@ -954,14 +1681,17 @@ void virtio_reset(void *opaque)
         vdev->vq[i].vring.avail = 0;
         vdev->vq[i].vring.used = 0;
         vdev->vq[i].last_avail_idx = 0;
+        vdev->vq[i].last_avail_wrap_counter = true;
         vdev->vq[i].shadow_avail_idx = 0;
         vdev->vq[i].used_idx = 0;
+        vdev->vq[i].used_wrap_counter = true;
         virtio_queue_set_vector(vdev, i, VIRTIO_NO_VECTOR);
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        virtio_init_region_cache(vdev, i);
     }
 }
 
@@ -1171,6 +1901,7 @@ void virtio_queue_set_rings(VirtIODevice *vdev, int n, hwaddr desc,
     vdev->vq[n].vring.desc = desc;
     vdev->vq[n].vring.avail = avail;
     vdev->vq[n].vring.used = used;
+    virtio_init_region_cache(vdev, n);
 }
 
 void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
@@ -1184,6 +1915,9 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
         return;
     }
     vdev->vq[n].vring.num = num;
+    if (vdev->vq[n].vring.desc) {
+        virtio_init_region_cache(vdev, n);
+    }
 }
 
 VirtQueue *virtio_vector_first_queue(VirtIODevice *vdev, uint16_t vector)
@@ -1304,6 +2038,7 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
     vdev->vq[i].handle_aio_output = NULL;
+    vdev->vq[i].used_elems = g_new(VirtQueueUsedElem, VIRTQUEUE_MAX_SIZE);
 
     return &vdev->vq[i];
 }
@@ -1316,6 +2051,9 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
 
     vdev->vq[n].vring.num = 0;
     vdev->vq[n].vring.num_default = 0;
+    virtio_reset_region_cache(&vdev->vq[n]);
+    g_free(vdev->vq[n].used_elems);
+    vdev->vq[n].used_elems = NULL;
 }
 
 static void virtio_set_isr(VirtIODevice *vdev, int value)
@@ -1330,18 +2068,52 @@ static void virtio_set_isr(VirtIODevice *vdev, int value)
     }
 }
 
-bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+static bool vring_packed_need_event(VirtQueue *vq, bool wrap,
+                                    uint16_t off_wrap, uint16_t new,
+                                    uint16_t old)
+{
+    int off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+    /* An event offset from the previous lap is behind everything we used */
+    if (wrap != off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) {
+        off -= vq->vring.num;
+    }
+
+    return vring_need_event(off, new, old);
+}
+
+static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VRingPackedDescEvent e = { 0 };
     uint16_t old, new;
     bool v;
-    /* We need to expose used array entries before checking used event. */
-    smp_mb();
-    /* Always notify when queue is empty (when feature acknowledge) */
-    if (virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
-        !vq->inuse && virtio_queue_empty(vq)) {
+
+    if (caches) {
+        vring_packed_event_read(vdev, &caches->avail, &e);
+    }
+
+    v = vq->signalled_used_valid;
+    vq->signalled_used_valid = true;
+    old = vq->signalled_used;
+    new = vq->signalled_used = vq->used_idx;
+
+    if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        return false;
+    } else if (e.flags == VRING_PACKED_EVENT_FLAG_ENABLE ||
+               !virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         return true;
     }
 
+    return !v || vring_packed_need_event(vq, vq->used_wrap_counter,
+                                         e.off_wrap, new, old);
+}
+
+static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    uint16_t old, new;
+    bool v;
+
     if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         return !(vring_avail_flags(vq) & VRING_AVAIL_F_NO_INTERRUPT);
     }
@@ -1353,6 +2125,28 @@ bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     return !v || vring_need_event(vring_get_used_event(vq), new, old);
 }
 
+bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    bool notify;
+
+    /* We need to expose used array entries before checking used event. */
+    smp_mb();
+    /* Always notify when queue is empty (when feature acknowledge) */
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
+        !vq->inuse && virtio_queue_empty(vq)) {
+        return true;
+    }
+
+    rcu_read_lock();
+    if (virtio_queue_packed(vq)) {
+        notify = virtio_packed_should_notify(vdev, vq);
+    } else {
+        notify = virtio_split_should_notify(vdev, vq);
+    }
+    rcu_read_unlock();
+    return notify;
+}
+
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
     if (!virtio_should_notify(vdev, vq)) {
@@ -1427,6 +2221,13 @@ static bool virtio_virtqueue_needed(void *opaque)
     return virtio_host_has_feature(vdev, VIRTIO_F_VERSION_1);
 }
 
+static bool virtio_packed_virtqueue_needed(void *opaque)
+{
+    VirtIODevice *vdev = opaque;
+
+    return virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED);
+}
+
 static bool virtio_ringsize_needed(void *opaque)
 {
     VirtIODevice *vdev = opaque;
@@ -1480,6 +2281,31 @@ static const VMStateDescription vmstate_virtio_virtqueues = {
     }
 };
 
+static const VMStateDescription vmstate_packed_virtqueue = {
+    .name = "packed_virtqueue_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_BOOL(last_avail_wrap_counter, struct VirtQueue),
+        VMSTATE_UINT16(used_idx, struct VirtQueue),
+        VMSTATE_BOOL(used_wrap_counter, struct VirtQueue),
+        VMSTATE_INT32(inuse, struct VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_virtio_packed_virtqueues = {
+    .name = "virtio/packed_virtqueues",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = &virtio_packed_virtqueue_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_VARRAY_POINTER_KNOWN(vq, struct VirtIODevice,
+                      VIRTIO_QUEUE_MAX, 0, vmstate_packed_virtqueue, VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_ringsize = {
     .name = "ringsize_state",
     .version_id = 1,
@@ -1597,6 +2423,7 @@ static const VMStateDescription vmstate_virtio = {
         &vmstate_virtio_ringsize,
         &vmstate_virtio_broken,
         &vmstate_virtio_extra_state,
+        &vmstate_virtio_packed_virtqueues,
         NULL
     }
 };
@@ -1686,6 +2513,8 @@ static int virtio_set_features_nocheck(VirtIODevice *vdev, uint64_t val)
         k->set_features(vdev, val);
     }
     vdev->guest_features = val;
+    /* The layout of the rings depends on VIRTIO_F_RING_PACKED */
+    virtio_init_region_caches(vdev);
     return bad ? -1 : 0;
 }
 
@@ -1836,8 +2665,23 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
         }
     }
 
+    rcu_read_lock();
     for (i = 0; i < num; i++) {
-        if (vdev->vq[i].vring.desc) {
+        if (vdev->vq[i].vring.desc && virtio_queue_packed(&vdev->vq[i])) {
+            /* The ring has no indexes, the subsection carried our own. */
+            vdev->vq[i].shadow_avail_idx = vdev->vq[i].last_avail_idx;
+            if (vdev->vq[i].last_avail_idx >= vdev->vq[i].vring.num ||
+                vdev->vq[i].used_idx >= vdev->vq[i].vring.num ||
+                vdev->vq[i].inuse > vdev->vq[i].vring.num) {
+                error_report("VQ %d size 0x%x inconsistent with "
+                             "last_avail_idx 0x%x used_idx 0x%x inuse %d",
+                             i, vdev->vq[i].vring.num,
+                             vdev->vq[i].last_avail_idx,
+                             vdev->vq[i].used_idx, vdev->vq[i].inuse);
+                rcu_read_unlock();
+                return -1;
+            }
+        } else if (vdev->vq[i].vring.desc) {
             uint16_t nheads;
             nheads = vring_avail_idx(&vdev->vq[i]) - vdev->vq[i].last_avail_idx;
             /* Check it isn't doing strange things with descriptor numbers. */
@@ -1847,6 +2691,7 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                              i, vdev->vq[i].vring.num,
                              vring_avail_idx(&vdev->vq[i]),
                              vdev->vq[i].last_avail_idx, nheads);
+                rcu_read_unlock();
                 return -1;
             }
             vdev->vq[i].used_idx = vring_used_idx(&vdev->vq[i]);
@@ -1864,18 +2709,26 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                              i, vdev->vq[i].vring.num,
                              vdev->vq[i].last_avail_idx,
                              vdev->vq[i].used_idx);
+                rcu_read_unlock();
                 return -1;
             }
         }
     }
+    rcu_read_unlock();
 
     return 0;
 }
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtio_reset_region_cache(&vdev->vq[i]);
+        g_free(vdev->vq[i].used_elems);
+    }
     g_free(vdev->vq);
     g_free(vdev->vector_queues);
 }
@@ -1937,6 +2790,8 @@ void virtio_init(VirtIODevice *vdev, const char *name,
         vdev->vq[i].vector = VIRTIO_NO_VECTOR;
         vdev->vq[i].vdev = vdev;
         vdev->vq[i].queue_index = i;
+        vdev->vq[i].last_avail_wrap_counter = true;
+        vdev->vq[i].used_wrap_counter = true;
     }
 
     vdev->name = name;
@@ -1974,23 +2829,41 @@ hwaddr virtio_queue_get_desc_size(VirtIODevice *vdev, int n)
 
 hwaddr virtio_queue_get_avail_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
     return offsetof(VRingAvail, ring) +
         sizeof(uint16_t) * vdev->vq[n].vring.num;
 }
 
 hwaddr virtio_queue_get_used_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
     return offsetof(VRingUsed, ring) +
         sizeof(VRingUsedElem) * vdev->vq[n].vring.num;
 }
 
+/* For a packed ring the wrap counter is kept in bit 15, as vhost expects */
 uint16_t virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return vdev->vq[n].last_avail_idx |
+               vdev->vq[n].last_avail_wrap_counter << 15;
+    }
     return vdev->vq[n].last_avail_idx;
 }
 
 void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        /* The backend has stopped with everything it popped used */
+        vdev->vq[n].last_avail_wrap_counter = idx >> 15;
+        idx &= 0x7fff;
+        vdev->vq[n].used_idx = idx;
+        vdev->vq[n].used_wrap_counter = vdev->vq[n].last_avail_wrap_counter;
+    }
     vdev->vq[n].last_avail_idx = idx;
     vdev->vq[n].shadow_avail_idx = idx;
 }
@@ -2120,6 +2993,11 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         error_propagate(errp, err);
         return;
     }
+
+    vdev->listener.region_add = virtio_memory_listener_update;
+    vdev->listener.region_del = virtio_memory_listener_update;
+    vdev->listener.commit = virtio_memory_listener_commit;
+    memory_listener_register(&vdev->listener, &address_space_memory);
 }
 
 static void virtio_device_unrealize(DeviceState *dev, Error **errp)
@@ -2128,6 +3006,7 @@ static void virtio_device_unrealize(DeviceState *dev, Error **errp)
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
     Error *err = NULL;
 
+    memory_listener_unregister(&vdev->listener);
     virtio_bus_device_unplugged(vdev);
 
     if (vdc->unrealize != NULL) {
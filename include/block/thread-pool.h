@@ -24,9 +24,40 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+#define THREAD_POOL_DEFAULT_MAX_THREADS 64
+
+/* Upper bound for the max_threads argument of thread_pool_set_size().  */
+#define THREAD_POOL_MAX_THREADS 256
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/**
+ * thread_pool_set_size:
+ * @pool: the thread pool
+ * @min_threads: number of workers that are kept even when idle
+ * @max_threads: number of workers the pool may grow to
+ *
+ * Resize @pool.  Workers up to @min_threads are started right away;
+ * workers beyond it are started when requests find all others busy, and
+ * exit after they have been idle for a while.  The default is 0 and
+ * %THREAD_POOL_DEFAULT_MAX_THREADS.
+ */
+void thread_pool_set_size(ThreadPool *pool, int min_threads, int max_threads);
+
+/**
+ * thread_pool_set_affinity:
+ * @pool: the thread pool
+ * @host_cpus: bitmap of host CPUs the workers may run on, or %NULL
+ * @nbits: size of @host_cpus
+ *
+ * Bind the workers of @pool to @host_cpus.  With %NULL, the workers that
+ * are started from now on inherit the affinity of the thread that runs
+ * the AioContext of @pool.
+ */
+void thread_pool_set_affinity(ThreadPool *pool, const unsigned long *host_cpus,
+                              long nbits);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
@@ -34,4 +65,15 @@ int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
 
+/**
+ * thread_pool_plug:
+ * @pool: the thread pool
+ *
+ * Hold back requests submitted to @pool until the matching
+ * thread_pool_unplug(), then hand them to the workers in one go, spread
+ * over as many workers as the pool may have.  Calls can be nested.
+ */
+void thread_pool_plug(ThreadPool *pool);
+void thread_pool_unplug(ThreadPool *pool);
+
 #endif
@@ -170,6 +170,45 @@ void tlb_flush_by_mmuidx(CPUState *cpu, ...);
  * cpu_loop.
  */
 void tlb_flush_by_mmuidx_all_cpus(CPUState *cpu, bool wait, ...);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ *
+ * Flush all pages overlapping [@addr, @addr + @len) from the TLB of the
+ * specified CPU, for all MMU indexes.  The flush is queued as a single
+ * work item; large ranges degrade to a full flush.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush all pages overlapping [@addr, @addr + @len) from the TLB of the
+ * specified CPU, for the MMU indexes in @idxmap.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @cpu: Originating CPU of the flush
+ * @wait: If true ensure synchronisation by exiting the cpu_loop
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the MMU indexes
+ * in @idxmap.  Each CPU receives one work item for the whole range.
+ * If the caller forces synchronisation they need to ensure all register
+ * state is synchronised as we will exit the cpu_loop.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu, bool wait,
+                                        target_ulong addr, target_ulong len,
+                                        uint16_t idxmap);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -235,6 +274,21 @@ static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 static inline void tlb_flush_by_mmuidx_all_cpus(CPUState *cpu, bool wait, ...)
 {
 }
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu,
+                                                      bool wait,
+                                                      target_ulong addr,
+                                                      target_ulong len,
+                                                      uint16_t idxmap)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
@@ -271,11 +325,17 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_COUNT_EXEC  0x80000 /* Count executions in exec_count */
 
     uint16_t invalid;
 
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
+    uint32_t tc_size;    /* size of the translated code */
+    /* number of executions, only updated if cflags has CF_COUNT_EXEC.
+     * Not atomic, so concurrent vCPUs may lose increments.
+     */
+    uint64_t exec_count;
     /* original tb when cflags has CF_NOCACHE */
     struct TranslationBlock *orig_tb;
     /* first and second physical page containing code. The lower bit
@@ -313,6 +373,9 @@ struct TranslationBlock {
     uintptr_t jmp_list_first;
 };
 
+/* Generate execution counters in new TBs (-accel tcg,tb-hot=on) */
+extern bool tb_hot_enabled;
+
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
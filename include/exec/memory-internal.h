@@ -22,9 +22,15 @@
 #ifndef CONFIG_USER_ONLY
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
 
-void address_space_init_dispatch(AddressSpace *as);
-void address_space_unregister(AddressSpace *as);
-void address_space_destroy_dispatch(AddressSpace *as);
+/* Dispatch trees are built by memory.c for each FlatView, and shared by
+ * all the AddressSpaces that use it.  @as is the one subpages and the
+ * sections of the tree refer to; it must be one of those AddressSpaces.
+ */
+AddressSpaceDispatch *address_space_dispatch_new(AddressSpace *as);
+void address_space_dispatch_add(AddressSpaceDispatch *d,
+                                MemoryRegionSection *section);
+void address_space_dispatch_compact(AddressSpaceDispatch *d);
+void address_space_dispatch_free(AddressSpaceDispatch *d);
 
 extern const MemoryRegionOps unassigned_mem_ops;
 
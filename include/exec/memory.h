@@ -218,6 +218,8 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(subregions, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    QTAILQ_HEAD(aliases, MemoryRegion) aliases; /* Aliases of this region */
+    QTAILQ_ENTRY(MemoryRegion) aliases_link;
     QTAILQ_HEAD(coalesced_ranges, CoalescedMemoryRange) coalesced;
     const char *name;
     unsigned ioeventfd_nb;
@@ -276,9 +278,8 @@ struct AddressSpace {
 
     int ioeventfd_nb;
     struct MemoryRegionIoeventfd *ioeventfds;
+    /* Accessed via RCU, owned by current_map.  */
     struct AddressSpaceDispatch *dispatch;
-    struct AddressSpaceDispatch *next_dispatch;
-    MemoryListener dispatch_listener;
     QTAILQ_HEAD(memory_listeners_as, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
 };
@@ -1467,6 +1468,92 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/* MemoryRegionCache: a range of an address space, translated once.
+ *
+ * Devices that keep going back to the same guest structure, such as
+ * virtio rings, can translate it once and then access it without walking
+ * the dispatch tree every time.  If the whole range is RAM, accesses go
+ * straight to host memory and the RAM is kept alive until the cache is
+ * destroyed; otherwise they fall back to the address space accessors.
+ *
+ * A cache does not follow changes to the memory map.  Users must set up
+ * their caches again from a #MemoryListener commit callback, and should
+ * free them with call_rcu() if other threads may access them.
+ */
+typedef struct MemoryRegionCache {
+    void *ptr;
+    hwaddr xlat;
+    hwaddr len;
+    hwaddr addr;
+    AddressSpace *as;
+    MemoryRegion *mr;
+    bool is_write;
+} MemoryRegionCache;
+
+#define MEMORY_REGION_CACHE_INVALID ((MemoryRegionCache) { .mr = NULL })
+
+/* address_space_cache_init: prepare for repeated access to a range
+ *
+ * @cache: #MemoryRegionCache to be filled
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: length of the range; accesses through @cache must stay within it
+ * @is_write: whether the range will be written to
+ */
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write);
+
+/* address_space_cache_destroy: release what address_space_cache_init()
+ * took hold of.
+ *
+ * @cache: the #MemoryRegionCache
+ */
+void address_space_cache_destroy(MemoryRegionCache *cache);
+
+/* address_space_read_cached, address_space_write_cached: like
+ * address_space_read() and address_space_write(), with @addr relative to
+ * the start of @cache.
+ */
+void address_space_read_cached(MemoryRegionCache *cache, hwaddr addr,
+                               void *buf, hwaddr len);
+void address_space_write_cached(MemoryRegionCache *cache, hwaddr addr,
+                                const void *buf, hwaddr len);
+
+/* address_space_ld*_cached, address_space_st*_cached: like the
+ * address_space_ld* and address_space_st* functions, with @addr relative
+ * to the start of @cache.
+ */
+uint32_t address_space_lduw_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+uint32_t address_space_lduw_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+uint32_t address_space_ldl_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+uint32_t address_space_ldl_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+uint64_t address_space_ldq_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+uint64_t address_space_ldq_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            MemTxAttrs attrs, MemTxResult *result);
+void address_space_stw_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint32_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+void address_space_stw_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint32_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+void address_space_stl_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint32_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+void address_space_stl_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint32_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+void address_space_stq_le_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint64_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+void address_space_stq_be_cached(MemoryRegionCache *cache, hwaddr addr,
+                            uint64_t val, MemTxAttrs attrs,
+                            MemTxResult *result);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_continue(AddressSpace *as, hwaddr addr,
@@ -82,6 +82,44 @@ static inline void virtio_stl_phys(VirtIODevice *vdev, hwaddr pa,
     }
 }
 
+static inline uint16_t virtio_lduw_phys_cached(VirtIODevice *vdev,
+                                               MemoryRegionCache *cache,
+                                               hwaddr pa)
+{
+    if (virtio_access_is_big_endian(vdev)) {
+        return address_space_lduw_be_cached(cache, pa,
+                                            MEMTXATTRS_UNSPECIFIED, NULL);
+    }
+    return address_space_lduw_le_cached(cache, pa,
+                                        MEMTXATTRS_UNSPECIFIED, NULL);
+}
+
+static inline void virtio_stw_phys_cached(VirtIODevice *vdev,
+                                          MemoryRegionCache *cache,
+                                          hwaddr pa, uint16_t value)
+{
+    if (virtio_access_is_big_endian(vdev)) {
+        address_space_stw_be_cached(cache, pa, value,
+                                    MEMTXATTRS_UNSPECIFIED, NULL);
+    } else {
+        address_space_stw_le_cached(cache, pa, value,
+                                    MEMTXATTRS_UNSPECIFIED, NULL);
+    }
+}
+
+static inline void virtio_stl_phys_cached(VirtIODevice *vdev,
+                                          MemoryRegionCache *cache,
+                                          hwaddr pa, uint32_t value)
+{
+    if (virtio_access_is_big_endian(vdev)) {
+        address_space_stl_be_cached(cache, pa, value,
+                                    MEMTXATTRS_UNSPECIFIED, NULL);
+    } else {
+        address_space_stl_le_cached(cache, pa, value,
+                                    MEMTXATTRS_UNSPECIFIED, NULL);
+    }
+}
+
 static inline void virtio_stw_p(VirtIODevice *vdev, void *ptr, uint16_t v)
 {
     if (virtio_access_is_big_endian(vdev)) {
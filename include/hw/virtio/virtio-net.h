@@ -36,11 +36,31 @@ typedef struct virtio_net_conf
     int32_t txburst;
     char *tx;
     uint16_t rx_queue_size;
+    bool sw_offload;
+    uint16_t rss_queues;
 } virtio_net_conf;
 
+/* Limits advertised to the guest for receive-side scaling */
+#define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
+#define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
+
+typedef struct VirtioNetRssData {
+    bool enabled;
+    bool redirect;
+    bool populate_hash;
+    uint32_t hash_types;
+    uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    uint16_t indirections_table[VIRTIO_NET_RSS_MAX_TABLE_LEN];
+    uint16_t indirections_len;
+    uint16_t default_queue;
+} VirtioNetRssData;
+
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 << 10))
 
+/* Receive buffers a queue may keep popped for a backend reading into them */
+#define VIRTIO_NET_RX_MAP_MAX 64
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -50,6 +70,15 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* rx buffers handed to the peer by virtio_net_rx_map() */
+    struct {
+        VirtQueueElement *elems[VIRTIO_NET_RX_MAP_MAX];
+        unsigned int num;
+    } rx_map;
+    /* offloads done in software for peers without a vnet header */
+    struct NetGro *gro;
+    QEMUBH *gro_bh;
+    uint8_t *tx_gso_buf;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -65,7 +94,7 @@ typedef struct VirtIONet {
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
-    uint32_t host_features;
+    uint64_t host_features;
     uint8_t has_ufo;
     int mergeable_rx_bufs;
     uint8_t promisc;
@@ -89,6 +118,7 @@ typedef struct VirtIONet {
     int multiqueue;
     uint16_t max_queues;
     uint16_t curr_queues;
+    bool peer_shared;
     size_t config_size;
     char *netclient_name;
     char *netclient_type;
@@ -96,6 +126,8 @@ typedef struct VirtIONet {
     QEMUTimer *announce_timer;
     int announce_counter;
     bool needs_vnet_hdr_swap;
+    VirtioNetRssData rss_data;
+    struct NetRxPkt *rx_pkt;
 } VirtIONet;
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
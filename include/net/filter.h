@@ -12,6 +12,7 @@
 #include "qom/object.h"
 #include "qemu-common.h"
 #include "net/queue.h"
+#include "net/net.h"
 
 #define TYPE_NETFILTER "netfilter"
 #define NETFILTER(obj) \
@@ -35,6 +36,17 @@ typedef ssize_t (FilterReceiveIOV)(NetFilterState *nc,
                                    int iovcnt,
                                    NetPacketSent *sent_cb);
 
+/*
+ * Handle every packet of @batch that has not been stolen yet, and set
+ * @batch->stolen for those the filter takes.  Filters that don't provide
+ * this see the packets one by one through receive_iov.
+ */
+typedef void (FilterReceiveBatch)(NetFilterState *nf,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  NetPacketBatch *batch,
+                                  NetPacketSent *sent_cb);
+
 typedef void (FilterStatusChanged) (NetFilterState *nf, Error **errp);
 
 typedef struct NetFilterClass {
@@ -44,6 +56,7 @@ typedef struct NetFilterClass {
     FilterSetup *setup;
     FilterCleanup *cleanup;
     FilterStatusChanged *status_changed;
+    FilterReceiveBatch *receive_batch;
     /* mandatory */
     FilterReceiveIOV *receive_iov;
 } NetFilterClass;
@@ -69,6 +82,20 @@ ssize_t qemu_netfilter_receive(NetFilterState *nf,
                                int iovcnt,
                                NetPacketSent *sent_cb);
 
+void qemu_netfilter_receive_batch(NetFilterState *nf,
+                                  NetFilterDirection direction,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  NetPacketBatch *batch,
+                                  NetPacketSent *sent_cb);
+
+/* Was the packet sent by (one of the queues of) the filtered netdev? */
+static inline bool qemu_netfilter_from_netdev(NetFilterState *nf,
+                                              NetClientState *sender)
+{
+    return sender->filter_owner == nf->netdev;
+}
+
 /* pass the packet to the next filter */
 ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     unsigned flags,
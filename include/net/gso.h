@@ -0,0 +1,106 @@
+/*
+ * Software segmentation and receive coalescing
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+#include "standard-headers/linux/virtio_net.h"
+
+/* Largest L2 + L3 + L4 header a super-packet may carry */
+#define NET_GSO_MAX_HDR 256
+
+/* An IP datagram of up to 64k plus Ethernet and two VLAN tags */
+#define NET_GRO_MAX_SIZE (65535 + 22)
+
+/*
+ * Called for each frame produced by net_gso_segment().  @last is true
+ * for the final frame of the packet.
+ */
+typedef ssize_t (NetGsoSend)(void *opaque, const struct iovec *iov,
+                             int iovcnt, bool last);
+
+/**
+ * net_gso_segment:
+ * @hdr: offload request for the packet, in host byte order
+ * @buf: the packet, starting at the Ethernet header
+ * @size: size of @buf
+ * @send: called for each frame that goes on the wire
+ * @opaque: passed to @send
+ *
+ * Carry out the checksum and TCP segmentation offloads that @hdr asks for,
+ * for a peer that can't.  The checksum of a packet that only needs one is
+ * filled in within @buf.  A TSO packet is cut into @hdr->gso_size chunks
+ * that are passed to @send as a rebuilt header plus a slice of @buf.
+ *
+ * Returns: what the last call to @send returned, or -1 if @hdr describes
+ * something that can't be done in software and the packet must be dropped.
+ */
+ssize_t net_gso_segment(const struct virtio_net_hdr *hdr,
+                        uint8_t *buf, size_t size,
+                        NetGsoSend *send, void *opaque);
+
+typedef struct NetGro NetGro;
+
+/**
+ * net_gro_new:
+ * @tso4: TCP over IPv4 segments may be coalesced
+ * @tso6: TCP over IPv6 segments may be coalesced
+ *
+ * Create a receive coalescing context.  It holds at most one super-packet
+ * at a time, built from consecutive in-order segments of one TCP flow.
+ */
+NetGro *net_gro_new(bool tso4, bool tso6);
+void net_gro_free(NetGro *gro);
+void net_gro_set_offloads(NetGro *gro, bool tso4, bool tso6);
+
+/**
+ * net_gro_receive:
+ * @gro: the coalescing context
+ * @buf: a frame, starting at the Ethernet header
+ * @size: size of @buf
+ *
+ * Offer a received frame for coalescing.  The frame is appended to the
+ * packet being built if it continues the same flow, or starts a new one
+ * if nothing is held.
+ *
+ * Returns: true if @gro took the frame, false if the caller must deliver
+ * it itself.  When false is returned and net_gro_pending() is true, the
+ * held packet must be delivered first and the frame offered again.
+ */
+bool net_gro_receive(NetGro *gro, const uint8_t *buf, size_t size);
+
+/**
+ * net_gro_pending:
+ * @gro: the coalescing context
+ *
+ * Returns: true if a packet is being held.
+ */
+bool net_gro_pending(NetGro *gro);
+
+/**
+ * net_gro_finish:
+ * @gro: the coalescing context
+ * @hdr: filled in with the offload information for the held packet
+ *
+ * Fix up the headers of the held packet so that it can be delivered along
+ * with @hdr.  The packet stays held until net_gro_reset() is called, so a
+ * delivery that has to be retried can call this again.
+ *
+ * Returns: the held packet, with its size stored in @size.
+ */
+const uint8_t *net_gro_finish(NetGro *gro, struct virtio_net_hdr *hdr,
+                              size_t *size);
+
+/**
+ * net_gro_reset:
+ * @gro: the coalescing context
+ *
+ * Drop the held packet, if any.
+ */
+void net_gro_reset(NetGro *gro);
+
+#endif
@@ -21,6 +21,9 @@
  */
 #define NET_BUFSIZE (4096 + 65536)
 
+/* Most packets handed to qemu_send_packet_batch() at once */
+#define NET_BATCH_MAX 16
+
 struct MACAddr {
     uint8_t a[6];
 };
@@ -62,6 +65,8 @@ typedef void (SetOffload)(NetClientState *, int, int, int, int, int);
 typedef void (SetVnetHdrLen)(NetClientState *, int);
 typedef int (SetVnetLE)(NetClientState *, bool);
 typedef int (SetVnetBE)(NetClientState *, bool);
+typedef int (NetRxMap)(NetClientState *, struct iovec *, int, size_t);
+typedef void (NetRxCommit)(NetClientState *, size_t);
 typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 
@@ -84,6 +89,8 @@ typedef struct NetClientInfo {
     SetVnetHdrLen *set_vnet_hdr_len;
     SetVnetLE *set_vnet_le;
     SetVnetBE *set_vnet_be;
+    NetRxMap *rx_map;
+    NetRxCommit *rx_commit;
 } NetClientInfo;
 
 struct NetClientState {
@@ -101,8 +108,17 @@ struct NetClientState {
     unsigned rxfilter_notify_enabled:1;
     int vring_enable;
     QTAILQ_HEAD(NetFilterHead, NetFilterState) filters;
+    /* The queues of a multiqueue backend share the filters of the first */
+    NetClientState *filter_owner;
 };
 
+typedef struct NetPacketBatch {
+    int count;
+    struct iovec iov[NET_BATCH_MAX];
+    /* Set by a filter that takes the packet off the normal path */
+    bool stolen[NET_BATCH_MAX];
+} NetPacketBatch;
+
 typedef struct NICState {
     NetClientState *ncs;
     NICConf *conf;
@@ -149,6 +165,12 @@ void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
+int qemu_send_packet_batch(NetClientState *nc, NetPacketBatch *batch,
+                           NetPacketSent *sent_cb);
+bool qemu_net_filtered(NetClientState *nc);
+int qemu_peer_rx_map(NetClientState *nc, struct iovec *iov, int iovcnt,
+                     size_t size);
+void qemu_peer_rx_commit(NetClientState *nc, size_t len);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_format_nic_info_str(NetClientState *nc, uint8_t macaddr[6]);
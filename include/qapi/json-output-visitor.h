@@ -0,0 +1,31 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+#include "qapi/qmp/qstring.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/*
+ * Create a new JSON output visitor.
+ *
+ * The visit appends compact JSON text to @str as it goes, without
+ * building a QObject first; the text is what qobject_to_json() would
+ * produce for the QObject output visitor's result, up to the order of
+ * object members.  If the visit fails, @str is left with partial
+ * output.
+ *
+ * If everything else succeeds, pass @str to visit_complete() to finish
+ * the visit.
+ */
+Visitor *json_output_visitor_new(QString *str);
+
+#endif
@@ -23,5 +23,7 @@ QObject *qobject_from_jsonv(const char *string, va_list *ap) GCC_FMT_ATTR(1, 0);
 
 QString *qobject_to_json(const QObject *obj);
 QString *qobject_to_json_pretty(const QObject *obj);
+void qstring_append_json(QString *str, const QObject *obj);
+void qstring_append_json_string(QString *str, const char *s);
 
 #endif /* QJSON_H */
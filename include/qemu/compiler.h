@@ -42,6 +42,12 @@
 #define QEMU_ARTIFICIAL
 #endif
 
+#if QEMU_GNUC_PREREQ(4, 3)
+#define QEMU_COLD __attribute__((cold))
+#else
+#define QEMU_COLD
+#endif
+
 #if defined(_WIN32)
 # define QEMU_PACKED __attribute__((gcc_struct, packed))
 #else
@@ -106,6 +106,37 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Grow the coroutine pool
+ *
+ * Terminated coroutines are kept for reuse, so that creating a coroutine
+ * does not have to allocate a stack.  Devices that may have many requests
+ * in flight should grow the pool by their queue depth, so that such a
+ * workload does not keep allocating and freeing stacks.
+ */
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size);
+
+/**
+ * Undo qemu_coroutine_increase_pool_batch_size()
+ */
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size);
+
+typedef struct CoroutinePoolStats {
+    unsigned int batch_size;
+    unsigned int release_pool_size;
+    uint64_t hits;          /* coroutines that were taken from a pool */
+    uint64_t misses;        /* coroutines that had to be allocated */
+    uint64_t frees;         /* coroutines freed because the pool was full */
+} CoroutinePoolStats;
+
+/**
+ * Get statistics about the coroutine pool
+ *
+ * Hits are accounted lazily by each thread, so a thread may have up to
+ * one batch of them that is not included yet.
+ */
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats);
+
 
 /**
  * CoQueues are a mechanism to queue coroutines in order to continue executing
@@ -67,7 +67,10 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    QEMUTimer *next;            /* next sibling in the timer heap */
+    QEMUTimer *prev;            /* parent or previous sibling */
+    QEMUTimer *child;           /* first child */
+    uint64_t seq;               /* keeps equal deadlines in FIFO order */
     int scale;
 };
 
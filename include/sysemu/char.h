@@ -69,6 +69,10 @@ typedef enum {
     /* Whether it is possible to send/recv file descriptors
      * over the data channel */
     QEMU_CHAR_FEATURE_FD_PASS,
+    /* Whether the chardev honours the GMainContext given to
+     * qemu_chr_fe_set_handlers() for its read and event callbacks,
+     * so that the frontend may run in a thread of its own */
+    QEMU_CHAR_FEATURE_GCONTEXT,
 
     QEMU_CHAR_FEATURE_LAST,
 } CharDriverFeature;
@@ -110,7 +114,8 @@ struct CharDriverState {
     int logfd;
     int be_open;
     int is_mux;
-    guint fd_in_tag;
+    GSource *fd_in_src;
+    GMainContext *gcontext;     /* where the frontend handlers run */
     bool replay;
     DECLARE_BITMAP(features, QEMU_CHAR_FEATURE_LAST);
     QTAILQ_ENTRY(CharDriverState) next;
@@ -253,7 +258,9 @@ void qemu_chr_fe_printf(CharBackend *be, const char *fmt, ...)
  * If the backend is connected, create and add a #GSource that fires
  * when the given condition (typically G_IO_OUT|G_IO_HUP or G_IO_HUP)
  * is active; return the #GSource's tag.  If it is disconnected,
- * or without associated CharDriver, return 0.
+ * or without associated CharDriver, return 0.  The #GSource is attached
+ * to the default main context, even if the frontend handlers run in
+ * another one, so that the tag can be passed to g_source_remove().
  *
  * @cond the condition to poll for
  * @func the function to call when the condition happens
@@ -28,6 +28,11 @@ typedef struct {
     QemuCond init_done_cond;    /* is thread initialization done? */
     bool stopping;
     int thread_id;
+
+    /* Settings for the thread pool of ctx */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+    char *thread_pool_affinity;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -17,11 +17,16 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/cutils.h"
+#include "qemu/bitmap.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -30,6 +35,9 @@ typedef ObjectClass IOThreadClass;
 #define IOTHREAD_CLASS(klass) \
    OBJECT_CLASS_CHECK(IOThreadClass, klass, TYPE_IOTHREAD)
 
+/* Bound for the CPU numbers in thread-pool-affinity */
+#define IOTHREAD_MAX_HOST_CPUS 65536
+
 static __thread IOThread *my_iothread;
 
 AioContext *qemu_get_current_aio_context(void)
@@ -78,12 +86,180 @@ static void iothread_instance_finalize(Object *obj)
     iothread_stop(obj, NULL);
     qemu_cond_destroy(&iothread->init_done_cond);
     qemu_mutex_destroy(&iothread->init_done_lock);
+    g_free(iothread->thread_pool_affinity);
     if (!iothread->ctx) {
         return;
     }
     aio_context_unref(iothread->ctx);
 }
 
+/* Parse a list of host CPUs such as "0-3,8" into a bitmap.  */
+static unsigned long *iothread_parse_cpus(const char *str, long *nbits,
+                                          Error **errp)
+{
+    unsigned long *cpus = NULL;
+    const char *p = str;
+    unsigned long first, last;
+
+    *nbits = 0;
+    for (;;) {
+        if (!qemu_isdigit(*p) || qemu_strtoul(p, &p, 10, &first) < 0) {
+            goto fail;
+        }
+        last = first;
+        if (*p == '-' &&
+            (!qemu_isdigit(p[1]) || qemu_strtoul(p + 1, &p, 10, &last) < 0)) {
+            goto fail;
+        }
+        if (last < first || last >= IOTHREAD_MAX_HOST_CPUS) {
+            goto fail;
+        }
+        if (last >= *nbits) {
+            cpus = bitmap_zero_extend(cpus, *nbits, last + 1);
+            *nbits = last + 1;
+        }
+        bitmap_set(cpus, first, last - first + 1);
+
+        if (*p == '\0') {
+            return cpus;
+        }
+        if (*p++ != ',') {
+            goto fail;
+        }
+    }
+
+fail:
+    error_setg(errp, "Invalid host CPU list '%s'", str);
+    g_free(cpus);
+    return NULL;
+}
+
+/* Apply the thread pool settings to a running IOThread.  */
+static void iothread_set_thread_pool(IOThread *iothread, Error **errp)
+{
+    ThreadPool *pool;
+    unsigned long *cpus = NULL;
+    long nbits = 0;
+
+    if (iothread->thread_pool_min > iothread->thread_pool_max) {
+        error_setg(errp, "thread-pool-min (%" PRId64 ") must not be larger "
+                   "than thread-pool-max (%" PRId64 ")",
+                   iothread->thread_pool_min, iothread->thread_pool_max);
+        return;
+    }
+    if (iothread->thread_pool_affinity && *iothread->thread_pool_affinity) {
+        cpus = iothread_parse_cpus(iothread->thread_pool_affinity, &nbits,
+                                   errp);
+        if (!cpus) {
+            return;
+        }
+    }
+
+    /* Leave the pool to be created on first use if nothing was set.  */
+    if (!iothread->ctx->thread_pool && !iothread->thread_pool_min &&
+        iothread->thread_pool_max == THREAD_POOL_DEFAULT_MAX_THREADS &&
+        !cpus) {
+        return;
+    }
+
+    aio_context_acquire(iothread->ctx);
+    pool = aio_get_thread_pool(iothread->ctx);
+    thread_pool_set_size(pool, iothread->thread_pool_min,
+                         iothread->thread_pool_max);
+    thread_pool_set_affinity(pool, cpus, nbits);
+    aio_context_release(iothread->ctx);
+    g_free(cpus);
+}
+
+static void iothread_get_thread_pool_size(Object *obj, Visitor *v,
+                                          const char *name, void *opaque,
+                                          Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t *field = (void *)iothread + (uintptr_t)opaque;
+
+    visit_type_int64(v, name, field, errp);
+}
+
+static void iothread_set_thread_pool_size(Object *obj, Visitor *v,
+                                          const char *name, void *opaque,
+                                          Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t *field = (void *)iothread + (uintptr_t)opaque;
+    Error *local_err = NULL;
+    int64_t value, old;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (value < 0 || value > THREAD_POOL_MAX_THREADS ||
+        (field == &iothread->thread_pool_max && value == 0)) {
+        error_setg(&local_err, "%s value must be in range [%d, %d]", name,
+                   field == &iothread->thread_pool_max, THREAD_POOL_MAX_THREADS);
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+    if (iothread->ctx) {
+        iothread_set_thread_pool(iothread, &local_err);
+        if (local_err) {
+            *field = old;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static char *iothread_get_thread_pool_affinity(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return g_strdup(iothread->thread_pool_affinity ?: "");
+}
+
+static void iothread_set_thread_pool_affinity(Object *obj, const char *value,
+                                              Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    char *old = iothread->thread_pool_affinity;
+
+    iothread->thread_pool_affinity = g_strdup(value);
+    if (iothread->ctx) {
+        iothread_set_thread_pool(iothread, &local_err);
+    }
+    if (local_err) {
+        g_free(iothread->thread_pool_affinity);
+        iothread->thread_pool_affinity = old;
+        error_propagate(errp, local_err);
+        return;
+    }
+    g_free(old);
+}
+
+static void iothread_instance_init(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->thread_pool_max = THREAD_POOL_DEFAULT_MAX_THREADS;
+
+    object_property_add(obj, "thread-pool-min", "int",
+                        iothread_get_thread_pool_size,
+                        iothread_set_thread_pool_size, NULL,
+                        (void *)offsetof(IOThread, thread_pool_min), NULL);
+    object_property_add(obj, "thread-pool-max", "int",
+                        iothread_get_thread_pool_size,
+                        iothread_set_thread_pool_size, NULL,
+                        (void *)offsetof(IOThread, thread_pool_max), NULL);
+    object_property_add_str(obj, "thread-pool-affinity",
+                            iothread_get_thread_pool_affinity,
+                            iothread_set_thread_pool_affinity, NULL);
+}
+
 static void iothread_complete(UserCreatable *obj, Error **errp)
 {
     Error *local_error = NULL;
@@ -98,6 +274,14 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    iothread_set_thread_pool(iothread, &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
 
@@ -131,6 +315,7 @@ static const TypeInfo iothread_info = {
     .parent = TYPE_OBJECT,
     .class_init = iothread_class_init,
     .instance_size = sizeof(IOThread),
+    .instance_init = iothread_instance_init,
     .instance_finalize = iothread_instance_finalize,
     .interfaces = (InterfaceInfo[]) {
         {TYPE_USER_CREATABLE},
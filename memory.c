@@ -30,6 +30,7 @@
 #include "exec/ram_addr.h"
 #include "sysemu/kvm.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/qtest.h"
 
 //#define DEBUG_UNASSIGNED
 
@@ -95,6 +96,92 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+/* Windows of the memory hierarchy that changed since the last topology
+ * update, so that views can be patched instead of rendered from scratch.
+ * A change is followed from the changed region up through containers and
+ * enabled aliases, and recorded by the regions on the way that are the
+ * root of a current view, in the coordinates of that region.  When too
+ * much changed to keep track, everything is rendered again.
+ */
+typedef struct DirtyWindow {
+    MemoryRegion *mr;
+    AddrRange range;
+} DirtyWindow;
+
+#define DIRTY_WINDOWS_MAX       256
+#define DIRTY_WINDOWS_MAX_DEPTH 32
+
+static DirtyWindow dirty_windows[DIRTY_WINDOWS_MAX];
+static unsigned dirty_windows_nb;
+static bool memory_region_update_full;
+
+/* The roots of the views in use, the only ones that can be patched */
+static GHashTable *flatview_roots;
+
+static void memory_region_mark_dirty(MemoryRegion *mr, AddrRange range,
+                                     unsigned depth)
+{
+    AddrRange extent = addrrange_make(int128_zero(), mr->size);
+    MemoryRegion *alias;
+    unsigned i;
+
+    if (memory_region_update_full || !int128_nz(range.size) ||
+        !addrrange_intersects(range, extent)) {
+        return;
+    }
+    range = addrrange_intersection(range, extent);
+    if (depth == DIRTY_WINDOWS_MAX_DEPTH) {
+        memory_region_update_full = true;
+        return;
+    }
+
+    if (flatview_roots && g_hash_table_lookup(flatview_roots, mr)) {
+        for (i = 0; i < dirty_windows_nb; i++) {
+            if (dirty_windows[i].mr == mr &&
+                addrrange_equal(dirty_windows[i].range, range)) {
+                break;
+            }
+        }
+        if (i == dirty_windows_nb) {
+            if (dirty_windows_nb == DIRTY_WINDOWS_MAX) {
+                memory_region_update_full = true;
+                return;
+            }
+            dirty_windows[dirty_windows_nb].mr = mr;
+            dirty_windows[dirty_windows_nb].range = range;
+            dirty_windows_nb++;
+        }
+    }
+
+    /* Keep going even if the window was already there: the way up may
+     * have changed since it was recorded.  Nothing shows through a
+     * disabled alias; enabling it marks all of it.
+     */
+    QTAILQ_FOREACH(alias, &mr->aliases, aliases_link) {
+        Int128 offset = int128_make64(alias->alias_offset);
+
+        if (!alias->enabled) {
+            continue;
+        }
+
+        memory_region_mark_dirty(alias,
+                                 addrrange_shift(range, int128_neg(offset)),
+                                 depth + 1);
+    }
+    if (mr->container) {
+        memory_region_mark_dirty(mr->container,
+                                 addrrange_shift(range,
+                                                 int128_make64(mr->addr)),
+                                 depth + 1);
+    }
+}
+
+/* Note that all of @mr may look different at the next topology update */
+static void memory_region_mark_dirty_all(MemoryRegion *mr)
+{
+    memory_region_mark_dirty(mr, addrrange_make(int128_zero(), mr->size), 0);
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -218,7 +305,8 @@ struct FlatRange {
 };
 
 /* Flattened global view of current active memory hierarchy.  Kept in sorted
- * order.
+ * order.  AddressSpaces whose roots resolve to the same region share one
+ * FlatView, along with the dispatch tree built from it.
  */
 struct FlatView {
     struct rcu_head rcu;
@@ -226,6 +314,10 @@ struct FlatView {
     FlatRange *ranges;
     unsigned nr;
     unsigned nr_allocated;
+    MemoryRegion *root;
+    AddressSpaceDispatch *dispatch;
+    /* The AddressSpace the dispatch tree was built for */
+    AddressSpace *owner;
 };
 
 typedef struct AddressSpaceOps AddressSpaceOps;
@@ -261,6 +353,9 @@ static void flatview_init(FlatView *view)
     view->ranges = NULL;
     view->nr = 0;
     view->nr_allocated = 0;
+    view->root = NULL;
+    view->dispatch = NULL;
+    view->owner = NULL;
 }
 
 /* Insert a range into a given position.  Caller is responsible for maintaining
@@ -284,6 +379,9 @@ static void flatview_destroy(FlatView *view)
 {
     int i;
 
+    if (view->dispatch) {
+        address_space_dispatch_free(view->dispatch);
+    }
     for (i = 0; i < view->nr; i++) {
         memory_region_unref(view->ranges[i].mr);
     }
@@ -698,6 +796,48 @@ static void render_memory_region(FlatView *view,
     }
 }
 
+/* Look through the aliases and single-child containers at the top of an
+ * AddressSpace, such as the bus master region of a PCI device, for the
+ * region that really determines its view.  Every step must render exactly
+ * like its target would as a root: at offset zero, writable, and covering
+ * the whole target.  Returns NULL if nothing is visible.
+ */
+static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
+{
+    while (mr && mr->enabled) {
+        if (mr->addr || mr->readonly) {
+            return mr;
+        }
+        if (mr->alias) {
+            if (!mr->alias_offset && !mr->alias->addr &&
+                int128_ge(mr->size, mr->alias->size)) {
+                mr = mr->alias;
+                continue;
+            }
+        } else if (!mr->terminates) {
+            MemoryRegion *child, *next = NULL;
+            unsigned found = 0;
+
+            QTAILQ_FOREACH(child, &mr->subregions, subregions_link) {
+                if (child->enabled) {
+                    found++;
+                    next = child;
+                }
+            }
+            if (!found) {
+                return NULL;
+            }
+            if (found == 1 && !next->addr &&
+                int128_ge(mr->size, next->size)) {
+                mr = next;
+                continue;
+            }
+        }
+        return mr;
+    }
+    return NULL;
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
@@ -705,6 +845,7 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
 
     view = g_new(FlatView, 1);
     flatview_init(view);
+    view->root = mr;
 
     if (mr) {
         render_memory_region(view, mr, int128_zero(),
@@ -715,6 +856,231 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     return view;
 }
 
+static int addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_lt(r2->start, r1->start);
+}
+
+/* The absolute windows of the view of @root that changed since the last
+ * update, sorted and merged.
+ */
+static GArray *memory_region_dirty_windows(MemoryRegion *root)
+{
+    GArray *windows = g_array_new(false, false, sizeof(AddrRange));
+    AddrRange all = addrrange_make(int128_zero(), int128_2_64());
+    AddrRange *w, *last;
+    unsigned i, n;
+
+    for (i = 0; i < dirty_windows_nb; i++) {
+        AddrRange range;
+
+        if (dirty_windows[i].mr != root) {
+            continue;
+        }
+        range = addrrange_shift(dirty_windows[i].range,
+                                int128_make64(root->addr));
+        if (addrrange_intersects(range, all)) {
+            range = addrrange_intersection(range, all);
+            g_array_append_val(windows, range);
+        }
+    }
+    if (windows->len < 2) {
+        return windows;
+    }
+
+    g_array_sort(windows, addrrange_compare);
+    n = 1;
+    for (i = 1; i < windows->len; i++) {
+        w = &g_array_index(windows, AddrRange, i);
+        last = &g_array_index(windows, AddrRange, n - 1);
+        if (int128_le(w->start, addrrange_end(*last))) {
+            last->size = int128_sub(int128_max(addrrange_end(*last),
+                                               addrrange_end(*w)),
+                                    last->start);
+        } else {
+            g_array_index(windows, AddrRange, n++) = *w;
+        }
+    }
+    g_array_set_size(windows, n);
+    return windows;
+}
+
+/* Append the part of @fr that lies within @clip to the end of @view */
+static void flatview_append_clipped(FlatView *view, FlatRange *fr,
+                                    AddrRange clip)
+{
+    FlatRange piece = *fr;
+
+    if (!addrrange_intersects(fr->addr, clip)) {
+        return;
+    }
+    piece.addr = addrrange_intersection(fr->addr, clip);
+    piece.offset_in_region += int128_get64(int128_sub(piece.addr.start,
+                                                      fr->addr.start));
+    flatview_insert(view, view->nr, &piece);
+}
+
+/* Render @root again, starting from @old_view, which was rendered from the
+ * same root at the last update.  Only the sorted, disjoint @windows are
+ * rendered; everything outside them is copied from @old_view.
+ */
+static FlatView *flatview_patch(FlatView *old_view, MemoryRegion *root,
+                                GArray *windows)
+{
+    FlatView *view;
+    Int128 start = int128_zero();
+    unsigned i = 0, w;
+
+    view = g_new(FlatView, 1);
+    flatview_init(view);
+    view->root = root;
+
+    for (w = 0; w <= windows->len; w++) {
+        Int128 end = w < windows->len ?
+                     g_array_index(windows, AddrRange, w).start :
+                     int128_2_64();
+        AddrRange gap = addrrange_make(start, int128_sub(end, start));
+
+        /* Copy the unchanged part before this window.  A range that goes
+         * on past the window is looked at again for the next gap.
+         */
+        while (i < old_view->nr &&
+               int128_lt(old_view->ranges[i].addr.start, end)) {
+            flatview_append_clipped(view, &old_view->ranges[i], gap);
+            if (int128_gt(addrrange_end(old_view->ranges[i].addr), end)) {
+                break;
+            }
+            i++;
+        }
+        if (w == windows->len) {
+            break;
+        }
+
+        /* Everything in @view so far lies before the window, so the
+         * window is rendered as if into an empty view.
+         */
+        render_memory_region(view, root, int128_zero(),
+                             g_array_index(windows, AddrRange, w), false);
+        start = addrrange_end(g_array_index(windows, AddrRange, w));
+    }
+    flatview_simplify(view);
+
+    return view;
+}
+
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Under qtest, compare a view rendered from the dirty windows with a full
+ * render of the same root, so that the device tests catch a change that
+ * did not mark its windows.
+ */
+static void flatview_check_patch(FlatView *view, MemoryRegion *root)
+{
+    FlatView *full;
+
+    if (!qtest_enabled()) {
+        return;
+    }
+    full = generate_memory_topology(root);
+    if (!flatview_equal(view, full)) {
+        error_report("memory: patched view of '%s' differs from a full render",
+                     memory_region_name(root));
+        abort();
+    }
+    flatview_unref(full);
+}
+
+static void flatview_build_dispatch(FlatView *view, AddressSpace *as)
+{
+    FlatRange *fr;
+
+    view->dispatch = address_space_dispatch_new(as);
+    view->owner = as;
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        MemoryRegionSection section = section_from_flat_range(fr, as);
+
+        address_space_dispatch_add(view->dispatch, &section);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
+/* Pick the FlatView @as uses from now on.  @views maps the roots already
+ * rendered in this transaction to their FlatView, so that each distinct
+ * root is rendered once however many AddressSpaces look at it.  If the
+ * root is the same as before, only the windows that changed below it are
+ * rendered again.  A view that came out the same as before is kept along
+ * with its dispatch tree.
+ */
+static FlatView *address_space_next_flatview(AddressSpace *as,
+                                             GHashTable *views)
+{
+    MemoryRegion *root = memory_region_get_flatview_root(as->root);
+    FlatView *old_view = as->current_map;
+    FlatView *view = NULL;
+
+    /* Empty views are cheap, and they are not shared so that an
+     * AddressSpace being destroyed never owns a view somebody else uses.
+     */
+    if (root) {
+        view = g_hash_table_lookup(views, root);
+    }
+    if (view) {
+        flatview_ref(view);
+        return view;
+    }
+
+    if (root && old_view->root == root && !memory_region_update_full) {
+        GArray *windows = memory_region_dirty_windows(root);
+
+        if (!windows->len && old_view->owner == as) {
+            /* Nothing below @root changed */
+            g_array_free(windows, true);
+            flatview_check_patch(old_view, root);
+            g_hash_table_insert(views, root, old_view);
+            flatview_ref(old_view);
+            return old_view;
+        }
+        view = flatview_patch(old_view, root, windows);
+        g_array_free(windows, true);
+        flatview_check_patch(view, root);
+    } else {
+        view = generate_memory_topology(root);
+    }
+
+    if (old_view->root == root && old_view->owner == as &&
+        flatview_equal(old_view, view)) {
+        flatview_unref(view);
+        view = old_view;
+        flatview_ref(view);
+    } else {
+        flatview_build_dispatch(view, as);
+    }
+
+    if (root) {
+        g_hash_table_insert(views, root, view);
+    }
+    return view;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -877,16 +1243,27 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
-static void address_space_update_topology(AddressSpace *as)
+static void address_space_update_topology(AddressSpace *as,
+                                          GHashTable *views)
 {
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *new_view = address_space_next_flatview(as, views);
+
+    if (new_view == old_view) {
+        flatview_unref(new_view);
+        flatview_unref(old_view);
+        if (ioeventfd_update_pending) {
+            address_space_update_ioeventfds(as);
+        }
+        return;
+    }
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
 
     /* Writes are protected by the BQL.  */
     atomic_rcu_set(&as->current_map, new_view);
+    atomic_rcu_set(&as->dispatch, new_view->dispatch);
     call_rcu(old_view, flatview_unref, rcu);
 
     /* Note that all the old MemoryRegions are still alive up to this
@@ -912,6 +1289,23 @@ static void memory_region_clear_pending(void)
     ioeventfd_update_pending = false;
 }
 
+static void memory_region_update_flatview_roots(void)
+{
+    AddressSpace *as;
+
+    if (!flatview_roots) {
+        flatview_roots = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    g_hash_table_remove_all(flatview_roots);
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *root = as->current_map->root;
+
+        if (root) {
+            g_hash_table_insert(flatview_roots, root, root);
+        }
+    }
+}
+
 void memory_region_transaction_commit(void)
 {
     AddressSpace *as;
@@ -922,11 +1316,18 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            GHashTable *views = g_hash_table_new(g_direct_hash,
+                                                 g_direct_equal);
+
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_update_topology(as);
+                address_space_update_topology(as, views);
             }
+            g_hash_table_destroy(views);
+            memory_region_update_flatview_roots();
+            dirty_windows_nb = 0;
+            memory_region_update_full = false;
 
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
         } else if (ioeventfd_update_pending) {
@@ -1073,6 +1474,7 @@ static void memory_region_initfn(Object *obj)
     mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
+    QTAILQ_INIT(&mr->aliases);
     QTAILQ_INIT(&mr->coalesced);
 
     op = object_property_add(OBJECT(mr), "container",
@@ -1444,6 +1846,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliases, mr, aliases_link);
 }
 
 void memory_region_init_rom(MemoryRegion *mr,
@@ -1512,6 +1915,15 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias) {
+        QTAILQ_REMOVE(&mr->alias->aliases, mr, aliases_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->aliases)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->aliases);
+        QTAILQ_REMOVE(&mr->aliases, alias, aliases_link);
+        alias->alias = NULL;
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1684,6 +2096,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_mark_dirty_all(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -1747,6 +2160,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_mark_dirty_all(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -1757,6 +2171,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
+        memory_region_mark_dirty_all(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2037,6 +2452,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_mark_dirty_all(subregion);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2073,6 +2489,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
 {
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    memory_region_mark_dirty_all(subregion);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
@@ -2087,6 +2504,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_mark_dirty_all(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2102,7 +2520,9 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_mark_dirty_all(mr);
     mr->size = s;
+    memory_region_mark_dirty_all(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2125,6 +2545,10 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        /* memory_region_del_subregion() only gets to see the new
+         * address, so note the old place now.
+         */
+        memory_region_mark_dirty_all(mr);
         mr->addr = addr;
         memory_region_readd_subregion(mr);
     }
@@ -2140,6 +2564,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_mark_dirty_all(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2274,6 +2699,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
+    memory_region_update_full = true;
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2284,6 +2710,7 @@ void memory_global_dirty_log_stop(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
+    memory_region_update_full = true;
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 
@@ -2377,12 +2804,13 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->malloced = false;
     as->current_map = g_new(FlatView, 1);
     flatview_init(as->current_map);
+    flatview_build_dispatch(as->current_map, as);
+    as->dispatch = as->current_map->dispatch;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
-    address_space_init_dispatch(as);
     memory_region_update_pending |= root->enabled;
     memory_region_transaction_commit();
 }
@@ -2391,7 +2819,6 @@ static void do_address_space_destroy(AddressSpace *as)
 {
     bool do_free = as->malloced;
 
-    address_space_destroy_dispatch(as);
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -2423,17 +2850,34 @@ AddressSpace *address_space_init_shareable(MemoryRegion *root, const char *name)
 void address_space_destroy(AddressSpace *as)
 {
     MemoryRegion *root = as->root;
+    FlatView *view = as->current_map;
+    AddressSpace *other;
 
     as->ref_count--;
     if (as->ref_count) {
         return;
     }
     /* Flush out anything from MemoryListeners listening in on this */
+    flatview_ref(view);
     memory_region_transaction_begin();
     as->root = NULL;
     memory_region_transaction_commit();
     QTAILQ_REMOVE(&address_spaces, as, address_spaces_link);
-    address_space_unregister(as);
+
+    /* The dispatch tree of a view we shared refers to us; if the view
+     * is still in use, have it built again for one of its other users.
+     */
+    if (view->owner == as) {
+        QTAILQ_FOREACH(other, &address_spaces, address_spaces_link) {
+            if (other->current_map == view) {
+                memory_region_transaction_begin();
+                memory_region_update_pending = true;
+                memory_region_transaction_commit();
+                break;
+            }
+        }
+    }
+    flatview_unref(view);
 
     /* At this point, as->dispatch and as->current_map are dummy
      * entries that the guest should never use.  Wait for the old
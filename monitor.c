@@ -165,6 +165,13 @@ typedef struct {
      * mode.
      */
     bool in_command_mode;       /* are we in command mode? */
+    /*
+     * Set by qmp_capabilities when the client asked for the 'oob'
+     * capability; read from the monitor I/O thread.
+     */
+    bool oob_enabled;
+    /* In-band requests parsed but not dispatched yet */
+    int reqs_pending;
 } MonitorQMP;
 
 /*
@@ -192,6 +199,7 @@ struct Monitor {
 
     QemuMutex out_lock;
     QString *outbuf;
+    size_t out_pos;     /* bytes of outbuf already written */
     guint out_watch;
 
     /* Read under either BQL or out_lock, written with BQL+out_lock.  */
@@ -199,6 +207,8 @@ struct Monitor {
 
     ReadLineState *rs;
     MonitorQMP qmp;
+    /* QMP input is read and parsed by the monitor I/O thread */
+    bool use_io_thread;
     CPUState *mon_cpu;
     BlockCompletionFunc *password_completion_cb;
     void *password_opaque;
@@ -210,6 +220,39 @@ struct Monitor {
 /* QMP checker flags */
 #define QMP_ACCEPT_UNKNOWNS 1
 
+/*
+ * Number of in-band requests a QMP monitor may have queued for the main
+ * loop before the I/O thread stops reading from it.
+ */
+#define QMP_REQ_QUEUE_LEN_MAX 8
+
+/*
+ * The monitor I/O thread reads and parses the input of QMP monitors whose
+ * chardev can be driven from a context other than the main loop.
+ * Out-of-band commands run there on the spot, without the BQL; everything
+ * else is queued for the main loop.
+ */
+static struct {
+    QemuThread thread;
+    GMainContext *ctx;
+    bool stopping;
+} mon_io_thread;
+
+typedef struct QMPRequest {
+    Monitor *mon;
+    QObject *req;       /* NULL if @err is set or for an event */
+    QObject *id;
+    Error *err;
+    int event;          /* CHR_EVENT_*, or -1 for a request */
+    QSIMPLEQ_ENTRY(QMPRequest) entry;
+} QMPRequest;
+
+/* Protects qmp_requests.  */
+static QemuMutex qmp_queue_lock;
+static QSIMPLEQ_HEAD(, QMPRequest) qmp_requests =
+    QSIMPLEQ_HEAD_INITIALIZER(qmp_requests);
+static QEMUBH *qmp_dispatcher_bh;
+
 /* Protects mon_list, monitor_event_state.  */
 static QemuMutex monitor_lock;
 
@@ -291,8 +334,8 @@ static void monitor_flush_locked(Monitor *mon)
         return;
     }
 
-    buf = qstring_get_str(mon->outbuf);
-    len = qstring_get_length(mon->outbuf);
+    buf = qstring_get_str(mon->outbuf) + mon->out_pos;
+    len = qstring_get_length(mon->outbuf) - mon->out_pos;
 
     if (len && !mon->mux_out) {
         rc = qemu_chr_fe_write(&mon->chr, (const uint8_t *) buf, len);
@@ -300,13 +343,20 @@ static void monitor_flush_locked(Monitor *mon)
             /* all flushed or error */
             QDECREF(mon->outbuf);
             mon->outbuf = qstring_new();
+            mon->out_pos = 0;
             return;
         }
         if (rc > 0) {
-            /* partial write */
-            QString *tmp = qstring_from_str(buf + rc);
-            QDECREF(mon->outbuf);
-            mon->outbuf = tmp;
+            /* partial write; only copy the rest down once it is the
+             * smaller part, so that big replies aren't copied over and
+             * over while they trickle out */
+            mon->out_pos += rc;
+            if (mon->out_pos > qstring_get_length(mon->outbuf) / 2) {
+                QString *tmp = qstring_from_str(buf + rc);
+                QDECREF(mon->outbuf);
+                mon->outbuf = tmp;
+                mon->out_pos = 0;
+            }
         }
         if (mon->out_watch == 0) {
             mon->out_watch =
@@ -381,8 +431,18 @@ static void monitor_json_emitter(Monitor *mon, const QObject *data)
 {
     QString *json;
 
-    json = mon->flags & MONITOR_USE_PRETTY ? qobject_to_json_pretty(data) :
-                                             qobject_to_json(data);
+    if (!(mon->flags & MONITOR_USE_PRETTY)) {
+        /* There are no newlines to translate in compact JSON, so it can
+         * be formatted straight into the output buffer */
+        qemu_mutex_lock(&mon->out_lock);
+        qstring_append_json(mon->outbuf, data);
+        qstring_append(mon->outbuf, "\r\n");
+        monitor_flush_locked(mon);
+        qemu_mutex_unlock(&mon->out_lock);
+        return;
+    }
+
+    json = qobject_to_json_pretty(data);
     assert(json != NULL);
 
     qstring_append_chr(json, '\n');
@@ -562,9 +622,29 @@ static void monitor_qapi_event_init(void)
     qmp_event_set_func_emit(monitor_qapi_event_queue);
 }
 
-void qmp_qmp_capabilities(Error **errp)
+void qmp_qmp_capabilities(bool has_enable, QMPCapabilityList *enable,
+                          Error **errp)
 {
+    QMPCapabilityList *cap;
+    bool oob = false;
+
+    for (cap = enable; cap; cap = cap->next) {
+        switch (cap->value) {
+        case QMP_CAPABILITY_OOB:
+            if (!cur_mon->use_io_thread) {
+                error_setg(errp, "Capability '%s' is not available on this "
+                           "monitor", QMPCapability_lookup[cap->value]);
+                return;
+            }
+            oob = true;
+            break;
+        default:
+            abort();
+        }
+    }
+
     cur_mon->qmp.in_command_mode = true;
+    atomic_set(&cur_mon->qmp.oob_enabled, oob);
 }
 
 static void handle_hmp_command(Monitor *mon, const char *cmdline);
@@ -954,7 +1034,14 @@ EventInfoList *qmp_query_events(Error **errp)
 static void qmp_query_qmp_schema(QDict *qdict, QObject **ret_data,
                                  Error **errp)
 {
-    *ret_data = qobject_from_json(qmp_schema_json);
+    static QObject *schema;
+
+    /* It never changes, so parse it only once */
+    if (!schema) {
+        schema = qobject_from_json(qmp_schema_json);
+    }
+    qobject_incref(schema);
+    *ret_data = schema;
 }
 
 /*
@@ -3644,6 +3731,10 @@ static int monitor_can_read(void *opaque)
 {
     Monitor *mon = opaque;
 
+    if (mon->use_io_thread) {
+        /* Stop reading while the main loop is behind on this monitor */
+        return atomic_read(&mon->qmp.reqs_pending) < QMP_REQ_QUEUE_LEN_MAX;
+    }
     return (mon->suspend_cnt == 0) ? 1 : 0;
 }
 
@@ -3671,8 +3762,8 @@ static bool invalid_qmp_mode(const Monitor *mon, const char *cmd,
  * Input object checking rules
  *
  * 1. Input object must be a dict
- * 2. The "execute" key must exist
- * 3. The "execute" key must be a string
+ * 2. Exactly one of the "execute" and "exec-oob" keys must exist
+ * 3. The "execute" or "exec-oob" key must be a string
  * 4. If the "arguments" key exists, it must be a dict
  * 5. If the "id" key exists, it can be anything (ie. json-value)
  * 6. Any argument not listed above is considered invalid
@@ -3694,10 +3785,15 @@ static QDict *qmp_check_input_obj(QObject *input_obj, Error **errp)
         const char *arg_name = qdict_entry_key(ent);
         const QObject *arg_obj = qdict_entry_value(ent);
 
-        if (!strcmp(arg_name, "execute")) {
+        if (!strcmp(arg_name, "execute") || !strcmp(arg_name, "exec-oob")) {
             if (qobject_type(arg_obj) != QTYPE_QSTRING) {
                 error_setg(errp, QERR_QMP_BAD_INPUT_OBJECT_MEMBER,
-                           "execute", "string");
+                           arg_name, "string");
+                return NULL;
+            }
+            if (has_exec_key) {
+                error_setg(errp, "QMP input object member '%s' conflicts "
+                           "with 'execute'", arg_name);
                 return NULL;
             }
             has_exec_key = 1;
@@ -3723,41 +3819,83 @@ static QDict *qmp_check_input_obj(QObject *input_obj, Error **errp)
     return input_dict;
 }
 
-static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
+/*
+ * Run @req and send its reply if the command's marshaller can format
+ * the return value as JSON text itself.  Replies can get big (think of
+ * query-block or query-cpus on a large guest), and this way no QObject
+ * tree is built and converted to text for them.  Returns false if the
+ * request is left to qmp_dispatch().
+ */
+static bool monitor_qmp_dispatch_text(Monitor *mon, QObject *req,
+                                      QObject *id, Error **errp)
 {
-    QObject *req, *rsp = NULL, *id = NULL;
-    QDict *qdict = NULL;
-    const char *cmd_name;
-    Monitor *mon = cur_mon;
-    Error *err = NULL;
+    Error *local_err = NULL;
+    QString *rsp;
 
-    req = json_parser_parse_err(tokens, NULL, &err);
-    if (err || !req || qobject_type(req) != QTYPE_QDICT) {
-        if (!err) {
-            error_setg(&err, QERR_JSON_PARSING);
-        }
-        goto err_out;
+    /* Pretty printing is done on the QObject */
+    if (mon->flags & MONITOR_USE_PRETTY) {
+        return false;
     }
 
-    qdict = qmp_check_input_obj(req, &err);
-    if (!qdict) {
-        goto err_out;
+    rsp = qstring_from_str("{\"return\": ");
+    if (!qmp_dispatch_text(req, rsp, &local_err)) {
+        QDECREF(rsp);
+        return false;
     }
+    if (local_err) {
+        error_propagate(errp, local_err);
+        QDECREF(rsp);
+        return true;
+    }
+    if (id) {
+        qstring_append(rsp, ", \"id\": ");
+        qstring_append_json(rsp, id);
+    }
+    qstring_append(rsp, "}\r\n");
 
-    id = qdict_get(qdict, "id");
-    qobject_incref(id);
-    qdict_del(qdict, "id");
+    qemu_mutex_lock(&mon->out_lock);
+    if (!qstring_get_length(mon->outbuf)) {
+        /* Nothing else is waiting to go out, so send the reply as is */
+        QDECREF(mon->outbuf);
+        mon->outbuf = rsp;
+        mon->out_pos = 0;
+    } else {
+        qstring_append(mon->outbuf, qstring_get_str(rsp));
+        QDECREF(rsp);
+    }
+    monitor_flush_locked(mon);
+    qemu_mutex_unlock(&mon->out_lock);
+    return true;
+}
 
-    cmd_name = qdict_get_str(qdict, "execute");
-    trace_handle_qmp_command(mon, cmd_name);
+/*
+ * Run a parsed request and send the response.  In-band requests run in
+ * the main loop; out-of-band ones in the monitor I/O thread, where
+ * cur_mon must not be touched.
+ */
+static void monitor_qmp_dispatch(Monitor *mon, QObject *req, QObject *id,
+                                 Error *err, bool oob)
+{
+    Monitor *old_mon = cur_mon;
+    QObject *rsp = NULL;
+    QDict *qdict;
+    const char *cmd_name;
 
-    if (invalid_qmp_mode(mon, cmd_name, &err)) {
-        goto err_out;
+    if (!oob) {
+        cur_mon = mon;
     }
 
-    rsp = qmp_dispatch(req);
+    if (!err) {
+        cmd_name = qdict_get_str(qobject_to_qdict(req), "execute");
+        trace_handle_qmp_command(mon, cmd_name);
+        if (oob) {
+            rsp = qmp_dispatch(req);
+        } else if (!invalid_qmp_mode(mon, cmd_name, &err) &&
+                   !monitor_qmp_dispatch_text(mon, req, id, &err)) {
+            rsp = qmp_dispatch(req);
+        }
+    }
 
-err_out:
     if (err) {
         qdict = qdict_new();
         qdict_put_obj(qdict, "error", qmp_build_error_object(err));
@@ -3777,17 +3915,163 @@ err_out:
     qobject_decref(id);
     qobject_decref(rsp);
     qobject_decref(req);
+
+    if (!oob) {
+        cur_mon = old_mon;
+    }
 }
 
-static void monitor_qmp_read(void *opaque, const uint8_t *buf, int size)
+static void monitor_qmp_handle_event(Monitor *mon, int event);
+
+static void monitor_qmp_bh_dispatcher(void *opaque)
 {
-    Monitor *old_mon = cur_mon;
+    QMPRequest *r;
+    bool more;
 
-    cur_mon = opaque;
+    qemu_mutex_lock(&qmp_queue_lock);
+    r = QSIMPLEQ_FIRST(&qmp_requests);
+    if (r) {
+        QSIMPLEQ_REMOVE_HEAD(&qmp_requests, entry);
+    }
+    more = !QSIMPLEQ_EMPTY(&qmp_requests);
+    qemu_mutex_unlock(&qmp_queue_lock);
+
+    /* One request per run, so that a busy client can't starve the rest */
+    if (more) {
+        qemu_bh_schedule(qmp_dispatcher_bh);
+    }
+    if (!r) {
+        return;
+    }
 
-    json_message_parser_feed(&cur_mon->qmp.parser, (const char *) buf, size);
+    if (r->event >= 0) {
+        monitor_qmp_handle_event(r->mon, r->event);
+    } else {
+        monitor_qmp_dispatch(r->mon, r->req, r->id, r->err, false);
+        if (atomic_fetch_dec(&r->mon->qmp.reqs_pending) ==
+            QMP_REQ_QUEUE_LEN_MAX) {
+            /* Let the I/O thread poll the chardev again */
+            g_main_context_wakeup(mon_io_thread.ctx);
+        }
+    }
+    g_free(r);
+}
 
-    cur_mon = old_mon;
+/* Hand a request or chardev event over to the main loop, in order */
+static void monitor_qmp_queue(Monitor *mon, QObject *req, QObject *id,
+                              Error *err, int event)
+{
+    QMPRequest *r = g_new0(QMPRequest, 1);
+
+    r->mon = mon;
+    r->req = req;
+    r->id = id;
+    r->err = err;
+    r->event = event;
+    if (event < 0) {
+        atomic_inc(&mon->qmp.reqs_pending);
+    }
+
+    qemu_mutex_lock(&qmp_queue_lock);
+    QSIMPLEQ_INSERT_TAIL(&qmp_requests, r, entry);
+    qemu_mutex_unlock(&qmp_queue_lock);
+    qemu_bh_schedule(qmp_dispatcher_bh);
+}
+
+/* Drop the requests a monitor has queued, e.g. because its client left */
+static void monitor_qmp_drop_requests(Monitor *mon)
+{
+    QMPRequest *r, *next;
+
+    qemu_mutex_lock(&qmp_queue_lock);
+    QSIMPLEQ_FOREACH_SAFE(r, &qmp_requests, entry, next) {
+        if (r->mon != mon || r->event >= 0) {
+            continue;
+        }
+        QSIMPLEQ_REMOVE(&qmp_requests, r, QMPRequest, entry);
+        atomic_dec(&mon->qmp.reqs_pending);
+        qobject_decref(r->req);
+        qobject_decref(r->id);
+        error_free(r->err);
+        g_free(r);
+    }
+    qemu_mutex_unlock(&qmp_queue_lock);
+}
+
+static bool monitor_qmp_check_oob(Monitor *mon, QDict *qdict, Error **errp)
+{
+    const char *cmd_name = qdict_get_str(qdict, "exec-oob");
+    QmpCommand *cmd;
+
+    if (!atomic_read(&mon->qmp.oob_enabled)) {
+        error_setg(errp, "Out-of-band execution of '%s' requires QMP "
+                   "capability 'oob'", cmd_name);
+        return false;
+    }
+
+    /* An unknown command is reported by qmp_dispatch() */
+    cmd = qmp_find_command(cmd_name);
+    if (cmd && !(cmd->options & QCO_ALLOW_OOB)) {
+        error_setg(errp, "Command '%s' can't be executed out-of-band",
+                   cmd_name);
+        return false;
+    }
+    return true;
+}
+
+static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
+{
+    Monitor *mon = container_of(parser, Monitor, qmp.parser);
+    QObject *req, *id = NULL;
+    QDict *qdict = NULL;
+    Error *err = NULL;
+    bool oob = false;
+
+    req = json_parser_parse_err(tokens, NULL, &err);
+    if (err || !req || qobject_type(req) != QTYPE_QDICT) {
+        if (!err) {
+            error_setg(&err, QERR_JSON_PARSING);
+        }
+        goto out;
+    }
+
+    qdict = qmp_check_input_obj(req, &err);
+    if (!qdict) {
+        goto out;
+    }
+
+    id = qdict_get(qdict, "id");
+    qobject_incref(id);
+    qdict_del(qdict, "id");
+
+    if (qdict_haskey(qdict, "exec-oob")) {
+        oob = true;
+        if (!monitor_qmp_check_oob(mon, qdict, &err)) {
+            goto out;
+        }
+        /* qmp_dispatch() only knows about "execute" */
+        qdict_put(qdict, "execute",
+                  qstring_from_str(qdict_get_str(qdict, "exec-oob")));
+        qdict_del(qdict, "exec-oob");
+    }
+
+out:
+    if (err) {
+        qobject_decref(req);
+        req = NULL;
+    }
+    if (oob || !mon->use_io_thread) {
+        monitor_qmp_dispatch(mon, req, id, err, oob);
+    } else {
+        monitor_qmp_queue(mon, req, id, err, -1);
+    }
+}
+
+static void monitor_qmp_read(void *opaque, const uint8_t *buf, int size)
+{
+    Monitor *mon = opaque;
+
+    json_message_parser_feed(&mon->qmp.parser, (const char *) buf, size);
 }
 
 static void monitor_read(void *opaque, const uint8_t *buf, int size)
@@ -3836,38 +4120,70 @@ void monitor_resume(Monitor *mon)
         readline_show_prompt(mon->rs);
 }
 
-static QObject *get_qmp_greeting(void)
+static QObject *get_qmp_greeting(Monitor *mon)
 {
+    QList *cap_list = qlist_new();
     QObject *ver = NULL;
 
     qmp_marshal_query_version(NULL, &ver, NULL);
 
-    return qobject_from_jsonf("{'QMP': {'version': %p, 'capabilities': []}}",
-                              ver);
+    if (mon->use_io_thread) {
+        qlist_append(cap_list,
+                     qstring_from_str(QMPCapability_lookup[QMP_CAPABILITY_OOB]));
+    }
+
+    return qobject_from_jsonf("{'QMP': {'version': %p, 'capabilities': %p}}",
+                              ver, cap_list);
 }
 
-static void monitor_qmp_event(void *opaque, int event)
+/* The main loop side of a chardev event, run with the BQL held */
+static void monitor_qmp_handle_event(Monitor *mon, int event)
 {
     QObject *data;
-    Monitor *mon = opaque;
 
     switch (event) {
     case CHR_EVENT_OPENED:
         mon->qmp.in_command_mode = false;
-        data = get_qmp_greeting();
+        atomic_set(&mon->qmp.oob_enabled, false);
+        data = get_qmp_greeting(mon);
         monitor_json_emitter(mon, data);
         qobject_decref(data);
         mon_refcount++;
         break;
     case CHR_EVENT_CLOSED:
-        json_message_parser_destroy(&mon->qmp.parser);
-        json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
         mon_refcount--;
         monitor_fdsets_cleanup();
         break;
     }
 }
 
+static void monitor_qmp_event(void *opaque, int event)
+{
+    Monitor *mon = opaque;
+
+    switch (event) {
+    case CHR_EVENT_OPENED:
+        break;
+    case CHR_EVENT_CLOSED:
+        json_message_parser_destroy(&mon->qmp.parser);
+        json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
+        if (mon->use_io_thread) {
+            /* Nobody is left to read the answers */
+            atomic_set(&mon->qmp.oob_enabled, false);
+            monitor_qmp_drop_requests(mon);
+        }
+        break;
+    default:
+        return;
+    }
+
+    if (mon->use_io_thread) {
+        monitor_qmp_queue(mon, NULL, NULL, NULL, event);
+    } else {
+        monitor_qmp_handle_event(mon, event);
+    }
+}
+
 static void monitor_event(void *opaque, int event)
 {
     Monitor *mon = opaque;
@@ -3979,6 +4295,35 @@ void error_vprintf_unless_qmp(const char *fmt, va_list ap)
 static void __attribute__((constructor)) monitor_lock_init(void)
 {
     qemu_mutex_init(&monitor_lock);
+    qemu_mutex_init(&qmp_queue_lock);
+}
+
+static void *monitor_io_thread_run(void *opaque)
+{
+    while (!atomic_read(&mon_io_thread.stopping)) {
+        g_main_context_iteration(mon_io_thread.ctx, TRUE);
+    }
+    return NULL;
+}
+
+static void monitor_io_thread_init(void)
+{
+    if (mon_io_thread.ctx) {
+        return;
+    }
+    mon_io_thread.ctx = g_main_context_new();
+    qemu_thread_create(&mon_io_thread.thread, "mon_iothread",
+                       monitor_io_thread_run, NULL, QEMU_THREAD_JOINABLE);
+}
+
+static void monitor_io_thread_stop(void)
+{
+    if (!mon_io_thread.ctx) {
+        return;
+    }
+    atomic_set(&mon_io_thread.stopping, true);
+    g_main_context_wakeup(mon_io_thread.ctx);
+    qemu_thread_join(&mon_io_thread.thread);
 }
 
 void monitor_init(CharDriverState *chr, int flags)
@@ -3989,6 +4334,8 @@ void monitor_init(CharDriverState *chr, int flags)
     if (is_first_init) {
         monitor_qapi_event_init();
         sortcmdlist();
+        qmp_dispatcher_bh = aio_bh_new(iohandler_get_aio_context(),
+                                       monitor_qmp_bh_dispatcher, NULL);
         is_first_init = 0;
     }
 
@@ -4006,10 +4353,23 @@ void monitor_init(CharDriverState *chr, int flags)
     }
 
     if (monitor_is_qmp(mon)) {
+        /*
+         * A mux chardev is shared with frontends that run in the main
+         * loop, so only a chardev of its own can move to the I/O thread.
+         */
+        mon->use_io_thread = flags & MONITOR_USE_IO_THREAD;
+        assert(!mon->use_io_thread || (!chr->is_mux &&
+               qemu_chr_has_feature(chr, QEMU_CHAR_FEATURE_GCONTEXT)));
+        if (mon->use_io_thread) {
+            monitor_io_thread_init();
+        }
+        /* Input may arrive as soon as the handlers are in place */
+        json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
         qemu_chr_fe_set_handlers(&mon->chr, monitor_can_read, monitor_qmp_read,
-                                 monitor_qmp_event, mon, NULL, true);
+                                 monitor_qmp_event, mon,
+                                 mon->use_io_thread ? mon_io_thread.ctx : NULL,
+                                 true);
         qemu_chr_fe_set_echo(&mon->chr, true);
-        json_message_parser_init(&mon->qmp.parser, handle_qmp_command);
     } else {
         qemu_chr_fe_set_handlers(&mon->chr, monitor_can_read, monitor_read,
                                  monitor_event, mon, NULL, true);
@@ -4023,6 +4383,21 @@ void monitor_init(CharDriverState *chr, int flags)
 void monitor_cleanup(void)
 {
     Monitor *mon, *next;
+    QMPRequest *r;
+
+    /* No more input once the I/O thread is gone; drop what is queued */
+    monitor_io_thread_stop();
+    while ((r = QSIMPLEQ_FIRST(&qmp_requests))) {
+        QSIMPLEQ_REMOVE_HEAD(&qmp_requests, entry);
+        qobject_decref(r->req);
+        qobject_decref(r->id);
+        error_free(r->err);
+        g_free(r);
+    }
+    if (qmp_dispatcher_bh) {
+        qemu_bh_delete(qmp_dispatcher_bh);
+        qmp_dispatcher_bh = NULL;
+    }
 
     qemu_mutex_lock(&monitor_lock);
     QLIST_FOREACH_SAFE(mon, &mon_list, entry, next) {
@@ -4118,6 +4493,9 @@ QemuOptsList qemu_mon_opts = {
         },{
             .name = "pretty",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "io-thread",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -36,12 +36,19 @@
 
 #define COMPARE_READ_LEN_MAX NET_BUFSIZE
 #define MAX_QUEUE_SIZE 1024
+#define COMPARE_MAX_THREADS 64
+/* Maximum number of segments coalesced by colo_compare_tcp_payload() */
+#define COMPARE_TCP_MAX_SEGMENTS 64
 
 /* TODO: Should be configurable */
 #define REGULAR_PACKET_CHECK_MS 3000
 
 /*
-  + CompareState ++
+ * Connections are spread over compare_threads shards by the hash of
+ * their ConnectionKey.  Each shard owns its connection table and list
+ * and, with more than one compare thread, a thread of its own.
+ *
+  + CompareShard ++
   |               |
   +---------------+   +---------------+         +---------------+
   |conn list      +--->conn           +--------->conn           |
@@ -62,7 +69,45 @@
                     |packet  |  |packet  +    |packet  | |packet  +
                     +--------+  +--------+    +--------+ +--------+
 */
-typedef struct CompareState {
+typedef struct CompareState CompareState;
+
+typedef struct CompareStats {
+    uint64_t primary_packets;
+    uint64_t secondary_packets;
+    uint64_t matched;
+    uint64_t miscompared;
+    /* time between the arrival of a primary packet and its release */
+    uint64_t latency_total_us;
+    int64_t latency_min_us;
+    int64_t latency_max_us;
+} CompareStats;
+
+typedef struct CompareShard {
+    CompareState *s;
+    QemuThread thread;
+
+    /*
+     * Packets handed over by the receive thread when there is more
+     * than one compare thread, protected by in_lock.
+     */
+    QemuMutex in_lock;
+    QemuCond in_cond;
+    GQueue in_queue[2];
+    bool stopping;
+
+    /* Everything below is protected by lock */
+    QemuMutex lock;
+    /* connection list: the connections belonged to this shard could be
+     * found in this list.
+     * element type: Connection
+     */
+    GQueue conn_list;
+    /* hashtable to save connection */
+    GHashTable *connection_track_table;
+    CompareStats stats;
+} CompareShard;
+
+struct CompareState {
     Object parent;
 
     char *pri_indev;
@@ -74,19 +119,17 @@ typedef struct CompareState {
     SocketReadState pri_rs;
     SocketReadState sec_rs;
 
-    /* connection list: the connections belonged to this NIC could be found
-     * in this list.
-     * element type: Connection
-     */
-    GQueue conn_list;
-    /* hashtable to save connection */
-    GHashTable *connection_track_table;
-    /* compare thread, a thread for each NIC */
+    uint32_t compare_threads;
+    CompareShard *shards;
+    /* receive thread, a thread for each NIC */
     QemuThread thread;
+    /* Serializes the compare threads' writes to chr_out */
+    QemuMutex out_lock;
+    /* Primary packets forwarded without comparison, protected by out_lock */
+    uint64_t unsupported_packets;
     /* Timer used on the primary to find packets that are never matched */
     QEMUTimer *timer;
-    QemuMutex timer_check_lock;
-} CompareState;
+};
 
 typedef struct CompareClass {
     ObjectClass parent_class;
@@ -101,57 +144,141 @@ static int compare_chr_send(CharBackend *out,
                             const uint8_t *buf,
                             uint32_t size);
 
+enum {
+    COMPARE_MATCH = 0,
+    /* The primary segments match the start of the last secondary one */
+    COMPARE_PARTIAL,
+    COMPARE_MISMATCH,
+    COMPARE_WAIT,
+};
+
 /*
- * Return 0 on success, if return -1 means the pkt
- * is unsupported(arp and ipv6) and will be sent later
+ * Locate the payload of an unfragmented TCP segment, so that streams
+ * can be compared even if the primary and the secondary segmented them
+ * differently.  Other packets are left with payload_size == 0 and are
+ * compared as a whole.
  */
-static int packet_enqueue(CompareState *s, int mode)
+static void colo_packet_parse_tcp(Packet *pkt)
 {
-    ConnectionKey key;
-    Packet *pkt = NULL;
-    Connection *conn;
+    struct tcphdr *tcp = (struct tcphdr *)pkt->transport_header;
+    uint8_t *end = pkt->network_header + ntohs(pkt->ip->ip_len);
+    uint8_t *payload;
 
-    if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf, s->pri_rs.packet_len);
+    if (pkt->ip->ip_p != IPPROTO_TCP ||
+        ntohs(pkt->ip->ip_off) & (IP_MF | IP_OFFMASK)) {
+        return;
+    }
+
+    if (end > (uint8_t *)pkt->data + pkt->size) {
+        end = (uint8_t *)pkt->data + pkt->size;
+    }
+    if (pkt->transport_header + sizeof(*tcp) > end) {
+        return;
+    }
+
+    payload = pkt->transport_header + tcp->th_off * 4;
+    if (payload >= end) {
+        return;
+    }
+
+    pkt->tcp_seq = ntohl(tcp->th_seq);
+    pkt->payload = payload;
+    pkt->payload_size = end - payload;
+}
+
+/*
+ * Index a secondary segment that carries payload by its sequence
+ * number.  A retransmission is indexed once the segment ahead of it
+ * with the same seq has been released.
+ */
+static void colo_index_secondary(Connection *conn, Packet *pkt)
+{
+    gpointer seq = GUINT_TO_POINTER(pkt->tcp_seq);
+
+    if (!g_hash_table_lookup(conn->secondary_seq_map, seq)) {
+        g_hash_table_insert(conn->secondary_seq_map, seq, pkt);
     } else {
-        pkt = packet_new(s->sec_rs.buf, s->sec_rs.packet_len);
+        conn->secondary_seq_dups++;
     }
+}
 
-    if (parse_packet_early(pkt)) {
-        packet_destroy(pkt, NULL);
-        pkt = NULL;
-        return -1;
+static int colo_packet_same_seq(Packet *pkt, Packet *released)
+{
+    return !(pkt != released && pkt->payload_size &&
+             pkt->tcp_seq == released->tcp_seq);
+}
+
+/* Remove @pkt from the index, it is released or about to be trimmed */
+static void colo_unindex_secondary(Connection *conn, Packet *pkt)
+{
+    gpointer seq = GUINT_TO_POINTER(pkt->tcp_seq);
+    GList *dup = NULL;
+
+    if (g_hash_table_lookup(conn->secondary_seq_map, seq) != pkt) {
+        conn->secondary_seq_dups--;
+        return;
     }
-    fill_connection_key(pkt, &key);
 
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+    g_hash_table_remove(conn->secondary_seq_map, seq);
+    /* Index the next queued segment with the same seq, if any */
+    if (conn->secondary_seq_dups) {
+        dup = g_queue_find_custom(&conn->secondary_list, pkt,
+                                  (GCompareFunc)colo_packet_same_seq);
+    }
+    if (dup) {
+        g_hash_table_insert(conn->secondary_seq_map, seq, dup->data);
+        conn->secondary_seq_dups--;
+    }
+}
+
+/*
+ * Queue @pkt on its connection.  Return the connection, or NULL
+ * if the packet had to be dropped.
+ */
+static Connection *packet_enqueue(CompareShard *shard, Packet *pkt,
+                                  ConnectionKey *key, int mode)
+{
+    Connection *conn;
+
+    conn = connection_get(shard->connection_track_table,
+                          key,
+                          &shard->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&shard->conn_list, conn);
         conn->processing = true;
     }
 
     if (mode == PRIMARY_IN) {
-        if (g_queue_get_length(&conn->primary_list) <=
+        if (g_queue_get_length(&conn->primary_list) >
                                MAX_QUEUE_SIZE) {
-            g_queue_push_tail(&conn->primary_list, pkt);
-        } else {
             error_report("colo compare primary queue size too big,"
                          "drop packet");
+            packet_destroy(pkt, NULL);
+            return NULL;
         }
+        g_queue_push_tail(&conn->primary_list, pkt);
+        shard->stats.primary_packets++;
     } else {
-        if (g_queue_get_length(&conn->secondary_list) <=
+        if (g_queue_get_length(&conn->secondary_list) >
                                MAX_QUEUE_SIZE) {
-            g_queue_push_tail(&conn->secondary_list, pkt);
-        } else {
             error_report("colo compare secondary queue size too big,"
                          "drop packet");
+            packet_destroy(pkt, NULL);
+            return NULL;
+        }
+        g_queue_push_tail(&conn->secondary_list, pkt);
+        shard->stats.secondary_packets++;
+
+        if (pkt->payload_size) {
+            if (!conn->secondary_seq_map) {
+                conn->secondary_seq_map = g_hash_table_new(NULL, NULL);
+            }
+            colo_index_secondary(conn, pkt);
         }
     }
 
-    return 0;
+    return conn;
 }
 
 /*
@@ -337,8 +464,191 @@ static void colo_old_packet_check_one_conn(void *opaque,
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    int i;
 
-    g_queue_foreach(&s->conn_list, colo_old_packet_check_one_conn, NULL);
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        g_queue_foreach(&shard->conn_list, colo_old_packet_check_one_conn,
+                        NULL);
+        qemu_mutex_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Compare the TCP payload starting at the primary packet in @plink
+ * with the secondary segment that has the same sequence number.  When
+ * the two sides segmented the stream differently, follow consecutive
+ * segments on both sides until the segment boundaries line up again.
+ * The segments that were compared are returned in @pri and @sec.
+ *
+ * Coalescing stops at the first primary packet without payload, so
+ * that primary packets are still released in arrival order.  If the
+ * primary segments collected so far end inside a secondary segment,
+ * COMPARE_PARTIAL is returned and @sec_off is the number of bytes of
+ * the last secondary segment that were matched.
+ */
+static int colo_compare_tcp_payload(Connection *conn, GList *plink,
+                                    GList **pri, int *n_pri,
+                                    Packet **sec, int *n_sec, int *sec_off)
+{
+    Packet *ppkt = plink->data;
+    Packet *spkt;
+    int poff = 0, soff = 0;
+
+    *n_pri = *n_sec = 0;
+
+    spkt = g_hash_table_lookup(conn->secondary_seq_map,
+                               GUINT_TO_POINTER(ppkt->tcp_seq));
+    if (!spkt) {
+        return COMPARE_WAIT;
+    }
+    pri[(*n_pri)++] = plink;
+    sec[(*n_sec)++] = spkt;
+
+    for (;;) {
+        int len = MIN(ppkt->payload_size - poff, spkt->payload_size - soff);
+
+        if (memcmp(ppkt->payload + poff, spkt->payload + soff, len)) {
+            return COMPARE_MISMATCH;
+        }
+        poff += len;
+        soff += len;
+
+        if (poff == ppkt->payload_size && soff == spkt->payload_size) {
+            return COMPARE_MATCH;
+        }
+
+        if (poff == ppkt->payload_size) {
+            uint32_t next = ppkt->tcp_seq + ppkt->payload_size;
+
+            /* The secondary segment continues past this one */
+            plink = plink->next;
+            if (!plink || *n_pri == COMPARE_TCP_MAX_SEGMENTS ||
+                !((Packet *)plink->data)->payload_size ||
+                ((Packet *)plink->data)->tcp_seq != next) {
+                *sec_off = soff;
+                return COMPARE_PARTIAL;
+            }
+            ppkt = plink->data;
+            pri[(*n_pri)++] = plink;
+            poff = 0;
+        }
+
+        if (soff == spkt->payload_size) {
+            uint32_t next = spkt->tcp_seq + spkt->payload_size;
+
+            if (*n_sec == COMPARE_TCP_MAX_SEGMENTS) {
+                return COMPARE_WAIT;
+            }
+            spkt = g_hash_table_lookup(conn->secondary_seq_map,
+                                       GUINT_TO_POINTER(next));
+            if (!spkt) {
+                return COMPARE_WAIT;
+            }
+            sec[(*n_sec)++] = spkt;
+            soff = 0;
+        }
+    }
+}
+
+static void colo_release_primary(CompareShard *shard, Packet *pkt)
+{
+    CompareState *s = shard->s;
+    CompareStats *stats = &shard->stats;
+    int64_t latency;
+    int ret;
+
+    qemu_mutex_lock(&s->out_lock);
+    ret = compare_chr_send(&s->chr_out, pkt->data, pkt->size);
+    qemu_mutex_unlock(&s->out_lock);
+    if (ret < 0) {
+        error_report("colo_send_primary_packet failed");
+    }
+
+    latency = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - pkt->creation_ns) /
+              SCALE_US;
+    if (!stats->matched || latency < stats->latency_min_us) {
+        stats->latency_min_us = latency;
+    }
+    if (latency > stats->latency_max_us) {
+        stats->latency_max_us = latency;
+    }
+    stats->latency_total_us += latency;
+    stats->matched++;
+
+    trace_colo_compare_release(pkt->size, latency);
+    packet_destroy(pkt, NULL);
+}
+
+static void colo_release_secondary(Connection *conn, Packet *pkt)
+{
+    g_queue_remove(&conn->secondary_list, pkt);
+    if (pkt->payload_size) {
+        colo_unindex_secondary(conn, pkt);
+    }
+    packet_destroy(pkt, NULL);
+}
+
+/*
+ * Drop the first @len bytes of payload of a secondary segment, they
+ * were matched by primary segments that have been released.
+ */
+static void colo_trim_secondary(Connection *conn, Packet *pkt, int len)
+{
+    colo_unindex_secondary(conn, pkt);
+    pkt->tcp_seq += len;
+    pkt->payload += len;
+    pkt->payload_size -= len;
+    colo_index_secondary(conn, pkt);
+}
+
+/*
+ * Called from the compare thread on the primary, with the shard
+ * lock held, to compare TCP segments that carry payload.
+ * Return true if the head of the primary list was released.
+ */
+static bool colo_compare_tcp_segments(CompareShard *shard, Connection *conn)
+{
+    GList *head = g_queue_peek_head_link(&conn->primary_list);
+    GList *pri[COMPARE_TCP_MAX_SEGMENTS];
+    Packet *sec[COMPARE_TCP_MAX_SEGMENTS];
+    Packet *pkt;
+    int n_pri, n_sec, sec_off = 0, i;
+    int ret;
+
+    ret = colo_compare_tcp_payload(conn, head, pri, &n_pri, sec, &n_sec,
+                                   &sec_off);
+    switch (ret) {
+    case COMPARE_MATCH:
+    case COMPARE_PARTIAL:
+        trace_colo_compare_main("tcp payload same and release packet");
+        for (i = 0; i < n_pri; i++) {
+            pkt = pri[i]->data;
+            g_queue_delete_link(&conn->primary_list, pri[i]);
+            colo_release_primary(shard, pkt);
+        }
+        if (ret == COMPARE_PARTIAL) {
+            colo_trim_secondary(conn, sec[--n_sec], sec_off);
+        }
+        for (i = 0; i < n_sec; i++) {
+            colo_release_secondary(conn, sec[i]);
+        }
+        return true;
+    case COMPARE_MISMATCH:
+        /* The head is compared again on every retry, count it once */
+        pkt = pri[n_pri - 1]->data;
+        if (!pkt->miscompared) {
+            pkt->miscompared = true;
+            shard->stats.miscompared++;
+            trace_colo_compare_tcp_miscompare(pkt->tcp_seq, n_pri, n_sec);
+        }
+        /* TODO: colo_notify_checkpoint();*/
+        return false;
+    default:
+        return false;
+    }
 }
 
 /*
@@ -347,17 +657,21 @@ static void colo_old_packet_check(void *opaque)
  */
 static void colo_compare_connection(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareShard *shard = user_data;
     Connection *conn = opaque;
     Packet *pkt = NULL;
     GList *result = NULL;
-    int ret;
 
     while (!g_queue_is_empty(&conn->primary_list) &&
            !g_queue_is_empty(&conn->secondary_list)) {
-        qemu_mutex_lock(&s->timer_check_lock);
-        pkt = g_queue_pop_tail(&conn->primary_list);
-        qemu_mutex_unlock(&s->timer_check_lock);
+        pkt = g_queue_peek_head(&conn->primary_list);
+        if (pkt->payload_size) {
+            if (colo_compare_tcp_segments(shard, conn)) {
+                continue;
+            }
+            break;
+        }
+
         switch (conn->ip_proto) {
         case IPPROTO_TCP:
             result = g_queue_find_custom(&conn->secondary_list,
@@ -378,13 +692,10 @@ static void colo_compare_connection(void *opaque, void *user_data)
         }
 
         if (result) {
-            ret = compare_chr_send(&s->chr_out, pkt->data, pkt->size);
-            if (ret < 0) {
-                error_report("colo_send_primary_packet failed");
-            }
             trace_colo_compare_main("packet same and release packet");
-            g_queue_remove(&conn->secondary_list, result->data);
-            packet_destroy(pkt, NULL);
+            g_queue_pop_head(&conn->primary_list);
+            colo_release_primary(shard, pkt);
+            colo_release_secondary(conn, result->data);
         } else {
             /*
              * If one packet arrive late, the secondary_list or
@@ -392,9 +703,6 @@ static void colo_compare_connection(void *opaque, void *user_data)
              * until next comparison.
              */
             trace_colo_compare_main("packet different");
-            qemu_mutex_lock(&s->timer_check_lock);
-            g_queue_push_tail(&conn->primary_list, pkt);
-            qemu_mutex_unlock(&s->timer_check_lock);
             /* TODO: colo_notify_checkpoint();*/
             break;
         }
@@ -534,31 +842,191 @@ static void compare_set_outdev(Object *obj, const char *value, Error **errp)
     s->outdev = g_strdup(value);
 }
 
-static void compare_pri_rs_finalize(SocketReadState *pri_rs)
+static void compare_get_threads(Object *obj, Visitor *v, const char *name,
+                                void *opaque, Error **errp)
 {
-    CompareState *s = container_of(pri_rs, CompareState, pri_rs);
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->compare_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_threads(Object *obj, Visitor *v, const char *name,
+                                void *opaque, Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    if (s->shards) {
+        error_setg(&local_err, "Property '%s.%s' can't be changed after "
+                   "the object is created", object_get_typename(obj), name);
+        goto out;
+    }
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (!value || value > COMPARE_MAX_THREADS) {
+        error_setg(&local_err, "Property '%s.%s' requires a value "
+                   "between 1 and %d", object_get_typename(obj), name,
+                   COMPARE_MAX_THREADS);
+        goto out;
+    }
+    s->compare_threads = value;
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void compare_get_stats(Object *obj, Visitor *v, const char *name,
+                              void *opaque, Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    ColoCompareStats stats = { 0 };
+    ColoCompareStats *p = &stats;
+    uint64_t latency_total = 0;
+    int i;
+
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        stats.primary_packets += shard->stats.primary_packets;
+        stats.secondary_packets += shard->stats.secondary_packets;
+        stats.miscompared += shard->stats.miscompared;
+        if (shard->stats.matched) {
+            if (!stats.matched ||
+                shard->stats.latency_min_us < stats.latency_min) {
+                stats.latency_min = shard->stats.latency_min_us;
+            }
+            stats.latency_max = MAX(stats.latency_max,
+                                    shard->stats.latency_max_us);
+            stats.matched += shard->stats.matched;
+            latency_total += shard->stats.latency_total_us;
+        }
+        qemu_mutex_unlock(&shard->lock);
+    }
+    if (stats.matched) {
+        stats.latency_avg = latency_total / stats.matched;
+    }
+    if (s->shards) {
+        qemu_mutex_lock(&s->out_lock);
+        stats.unsupported_packets = s->unsupported_packets;
+        qemu_mutex_unlock(&s->out_lock);
+    }
+
+    visit_type_ColoCompareStats(v, name, &p, errp);
+}
+
+/*
+ * Called from the receive thread on the primary.  Hand the packet over
+ * to the shard that owns its connection, or compare it right away if
+ * there is a single compare thread.
+ */
+static void colo_compare_packet(CompareState *s, SocketReadState *rs,
+                                int mode)
+{
+    ConnectionKey key;
+    CompareShard *shard;
+    Connection *conn;
+    Packet *pkt;
 
-    if (packet_enqueue(s, PRIMARY_IN)) {
-        trace_colo_compare_main("primary: unsupported packet in");
-        compare_chr_send(&s->chr_out, pri_rs->buf, pri_rs->packet_len);
+    pkt = packet_new(rs->buf, rs->packet_len);
+    if (parse_packet_early(pkt)) {
+        packet_destroy(pkt, NULL);
+        if (mode == PRIMARY_IN) {
+            trace_colo_compare_main("primary: unsupported packet in");
+            qemu_mutex_lock(&s->out_lock);
+            s->unsupported_packets++;
+            compare_chr_send(&s->chr_out, rs->buf, rs->packet_len);
+            qemu_mutex_unlock(&s->out_lock);
+        } else {
+            trace_colo_compare_main("secondary: unsupported packet in");
+        }
+        return;
+    }
+    colo_packet_parse_tcp(pkt);
+    fill_connection_key(pkt, &key);
+    shard = &s->shards[connection_key_hash(&key) % s->compare_threads];
+
+    if (s->compare_threads == 1) {
+        qemu_mutex_lock(&shard->lock);
+        conn = packet_enqueue(shard, pkt, &key, mode);
+        if (conn) {
+            /* compare connection */
+            colo_compare_connection(conn, shard);
+        }
+        qemu_mutex_unlock(&shard->lock);
     } else {
-        /* compare connection */
-        g_queue_foreach(&s->conn_list, colo_compare_connection, s);
+        qemu_mutex_lock(&shard->in_lock);
+        g_queue_push_tail(&shard->in_queue[mode], pkt);
+        qemu_cond_signal(&shard->in_cond);
+        qemu_mutex_unlock(&shard->in_lock);
     }
 }
 
+static void compare_pri_rs_finalize(SocketReadState *pri_rs)
+{
+    CompareState *s = container_of(pri_rs, CompareState, pri_rs);
+
+    colo_compare_packet(s, pri_rs, PRIMARY_IN);
+}
+
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
 
-    if (packet_enqueue(s, SECONDARY_IN)) {
-        trace_colo_compare_main("secondary: unsupported packet in");
-    } else {
-        /* compare connection */
-        g_queue_foreach(&s->conn_list, colo_compare_connection, s);
-    }
+    colo_compare_packet(s, sec_rs, SECONDARY_IN);
 }
 
+/*
+ * Body of the compare threads, only used with more than one
+ * compare thread.
+ */
+static void *colo_compare_shard_thread(void *opaque)
+{
+    CompareShard *shard = opaque;
+    GQueue in_queue[2];
+    ConnectionKey key;
+    Connection *conn;
+    Packet *pkt;
+    int mode;
+
+    for (;;) {
+        qemu_mutex_lock(&shard->in_lock);
+        while (!shard->stopping &&
+               g_queue_is_empty(&shard->in_queue[PRIMARY_IN]) &&
+               g_queue_is_empty(&shard->in_queue[SECONDARY_IN])) {
+            qemu_cond_wait(&shard->in_cond, &shard->in_lock);
+        }
+        if (shard->stopping) {
+            qemu_mutex_unlock(&shard->in_lock);
+            break;
+        }
+        for (mode = PRIMARY_IN; mode <= SECONDARY_IN; mode++) {
+            in_queue[mode] = shard->in_queue[mode];
+            g_queue_init(&shard->in_queue[mode]);
+        }
+        qemu_mutex_unlock(&shard->in_lock);
+
+        qemu_mutex_lock(&shard->lock);
+        /* Queue secondary packets first, the primaries are waiting */
+        for (mode = SECONDARY_IN; mode >= PRIMARY_IN; mode--) {
+            while ((pkt = g_queue_pop_head(&in_queue[mode]))) {
+                fill_connection_key(pkt, &key);
+                conn = packet_enqueue(shard, pkt, &key, mode);
+                if (conn) {
+                    colo_compare_connection(conn, shard);
+                }
+            }
+        }
+        qemu_mutex_unlock(&shard->lock);
+    }
+
+    return NULL;
+}
 
 /*
  * Return 0 is success.
@@ -599,9 +1067,7 @@ static void check_old_packet_regular(void *opaque)
      * TODO: Make timer handler run in compare thread
      * like qemu_chr_add_handlers_full.
      */
-    qemu_mutex_lock(&s->timer_check_lock);
     colo_old_packet_check(s);
-    qemu_mutex_unlock(&s->timer_check_lock);
 }
 
 /*
@@ -614,6 +1080,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     CharDriverState *chr;
     char thread_name[64];
     static int compare_id;
+    int i;
 
     if (!s->pri_indev || !s->sec_indev || !s->outdev) {
         error_setg(errp, "colo compare needs 'primary_in' ,"
@@ -645,15 +1112,37 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     net_socket_rs_init(&s->pri_rs, compare_pri_rs_finalize);
     net_socket_rs_init(&s->sec_rs, compare_sec_rs_finalize);
 
-    g_queue_init(&s->conn_list);
-    qemu_mutex_init(&s->timer_check_lock);
-
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      connection_destroy);
+    qemu_mutex_init(&s->out_lock);
+
+    s->shards = g_new0(CompareShard, s->compare_threads);
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        shard->s = s;
+        qemu_mutex_init(&shard->lock);
+        g_queue_init(&shard->conn_list);
+        shard->connection_track_table =
+            g_hash_table_new_full(connection_key_hash,
+                                  connection_key_equal,
+                                  g_free,
+                                  connection_destroy);
+
+        if (s->compare_threads > 1) {
+            qemu_mutex_init(&shard->in_lock);
+            qemu_cond_init(&shard->in_cond);
+            g_queue_init(&shard->in_queue[PRIMARY_IN]);
+            g_queue_init(&shard->in_queue[SECONDARY_IN]);
+
+            snprintf(thread_name, sizeof(thread_name), "colo-compare %d/%d",
+                     compare_id, i);
+            qemu_thread_create(&shard->thread, thread_name,
+                               colo_compare_shard_thread, shard,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
 
-    sprintf(thread_name, "colo-compare %d", compare_id);
+    snprintf(thread_name, sizeof(thread_name), "colo-compare %d",
+             compare_id);
     qemu_thread_create(&s->thread, thread_name,
                        colo_compare_thread, s,
                        QEMU_THREAD_JOINABLE);
@@ -677,6 +1166,10 @@ static void colo_compare_class_init(ObjectClass *oc, void *data)
 
 static void colo_compare_init(Object *obj)
 {
+    CompareState *s = COLO_COMPARE(obj);
+
+    s->compare_threads = 1;
+
     object_property_add_str(obj, "primary_in",
                             compare_get_pri_indev, compare_set_pri_indev,
                             NULL);
@@ -686,21 +1179,23 @@ static void colo_compare_init(Object *obj)
     object_property_add_str(obj, "outdev",
                             compare_get_outdev, compare_set_outdev,
                             NULL);
+    object_property_add(obj, "compare_threads", "uint32",
+                        compare_get_threads, compare_set_threads,
+                        NULL, NULL, NULL);
+    object_property_add(obj, "stats", "ColoCompareStats",
+                        compare_get_stats, NULL, NULL, NULL, NULL);
 }
 
 static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
+    int i;
 
     qemu_chr_fe_deinit(&s->chr_pri_in);
     qemu_chr_fe_deinit(&s->chr_sec_in);
     qemu_chr_fe_deinit(&s->chr_out);
 
-    g_queue_free(&s->conn_list);
-
     if (qemu_thread_is_self(&s->thread)) {
-        /* compare connection */
-        g_queue_foreach(&s->conn_list, colo_compare_connection, s);
         qemu_thread_join(&s->thread);
     }
 
@@ -708,7 +1203,33 @@ static void colo_compare_finalize(Object *obj)
         timer_del(s->timer);
     }
 
-    qemu_mutex_destroy(&s->timer_check_lock);
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+        int mode;
+
+        if (s->compare_threads > 1) {
+            qemu_mutex_lock(&shard->in_lock);
+            shard->stopping = true;
+            qemu_cond_signal(&shard->in_cond);
+            qemu_mutex_unlock(&shard->in_lock);
+            qemu_thread_join(&shard->thread);
+
+            for (mode = PRIMARY_IN; mode <= SECONDARY_IN; mode++) {
+                g_queue_foreach(&shard->in_queue[mode], packet_destroy, NULL);
+                g_queue_clear(&shard->in_queue[mode]);
+            }
+            qemu_cond_destroy(&shard->in_cond);
+            qemu_mutex_destroy(&shard->in_lock);
+        }
+
+        g_queue_clear(&shard->conn_list);
+        g_hash_table_destroy(shard->connection_track_table);
+        qemu_mutex_destroy(&shard->lock);
+    }
+    if (s->shards) {
+        qemu_mutex_destroy(&s->out_lock);
+        g_free(s->shards);
+    }
 
     g_free(s->pri_indev);
     g_free(s->sec_indev);
@@ -138,6 +138,8 @@ Connection *connection_new(ConnectionKey *key)
     conn->syn_flag = 0;
     g_queue_init(&conn->primary_list);
     g_queue_init(&conn->secondary_list);
+    conn->secondary_seq_map = NULL;
+    conn->secondary_seq_dups = 0;
 
     return conn;
 }
@@ -150,6 +152,9 @@ void connection_destroy(void *opaque)
     g_queue_free(&conn->primary_list);
     g_queue_foreach(&conn->secondary_list, packet_destroy, NULL);
     g_queue_free(&conn->secondary_list);
+    if (conn->secondary_seq_map) {
+        g_hash_table_destroy(conn->secondary_seq_map);
+    }
     g_slice_free(Connection, conn);
 }
 
@@ -160,6 +165,10 @@ Packet *packet_new(const void *data, int size)
     pkt->data = g_memdup(data, size);
     pkt->size = size;
     pkt->creation_ms = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    pkt->creation_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    pkt->payload = NULL;
+    pkt->payload_size = 0;
+    pkt->miscompared = false;
 
     return pkt;
 }
@@ -197,10 +206,11 @@ Connection *connection_get(GHashTable *connection_track_table,
                                   " clear it");
             connection_hashtable_reset(connection_track_table);
             /*
-             * clear the conn_list
+             * The connections were freed by the hashtable reset,
+             * just forget about them.
              */
-            while (!g_queue_is_empty(conn_list)) {
-                connection_destroy(g_queue_pop_head(conn_list));
+            if (conn_list) {
+                g_queue_clear(conn_list);
             }
         }
 
@@ -43,6 +43,14 @@ typedef struct Packet {
     int size;
     /* Time of packet creation, in wall clock ms */
     int64_t creation_ms;
+    /* Time of packet creation, in realtime clock ns */
+    int64_t creation_ns;
+    /* TCP sequence number and payload, filled in by colo-compare */
+    uint32_t tcp_seq;
+    uint8_t *payload;
+    int payload_size;
+    /* colo-compare only: already counted as miscompared */
+    bool miscompared;
 } Packet;
 
 typedef struct ConnectionKey {
@@ -59,6 +67,13 @@ typedef struct Connection {
     GQueue primary_list;
     /* connection secondary send queue: element type: Packet */
     GQueue secondary_list;
+    /*
+     * colo-compare only: secondary TCP segments carrying payload,
+     * indexed by sequence number.  key: tcp_seq, value: Packet
+     */
+    GHashTable *secondary_seq_map;
+    /* secondary segments not in the map because their seq already is */
+    unsigned int secondary_seq_dups;
     /* flag to enqueue unprocessed_connections */
     bool processing;
     uint8_t ip_proto;
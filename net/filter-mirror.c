@@ -77,6 +77,47 @@ err:
     return ret < 0 ? ret : -EIO;
 }
 
+/*
+ * Send the packets of @batch that are still on their way in a single
+ * write, framed the same way as filter_mirror_send() frames them.
+ */
+static int filter_mirror_send_batch(CharBackend *chr_out,
+                                    NetPacketBatch *batch)
+{
+    size_t total = 0, offset = 0;
+    uint32_t len;
+    uint8_t *buf;
+    int i, ret;
+
+    for (i = 0; i < batch->count; i++) {
+        if (!batch->stolen[i] && batch->iov[i].iov_len) {
+            total += sizeof(len) + batch->iov[i].iov_len;
+        }
+    }
+    if (!total) {
+        return 0;
+    }
+
+    buf = g_malloc(total);
+    for (i = 0; i < batch->count; i++) {
+        if (batch->stolen[i] || !batch->iov[i].iov_len) {
+            continue;
+        }
+        len = htonl(batch->iov[i].iov_len);
+        memcpy(buf + offset, &len, sizeof(len));
+        offset += sizeof(len);
+        memcpy(buf + offset, batch->iov[i].iov_base, batch->iov[i].iov_len);
+        offset += batch->iov[i].iov_len;
+    }
+
+    ret = qemu_chr_fe_write_all(chr_out, buf, total);
+    g_free(buf);
+    if (ret != total) {
+        return ret < 0 ? ret : -EIO;
+    }
+    return 0;
+}
+
 static void
 redirector_to_filter(NetFilterState *nf, const uint8_t *buf, int len)
 {
@@ -152,6 +193,21 @@ static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
     return 0;
 }
 
+static void filter_mirror_receive_batch(NetFilterState *nf,
+                                        NetClientState *sender,
+                                        unsigned flags,
+                                        NetPacketBatch *batch,
+                                        NetPacketSent *sent_cb)
+{
+    MirrorState *s = FILTER_MIRROR(nf);
+    int ret;
+
+    ret = filter_mirror_send_batch(&s->chr_out, batch);
+    if (ret) {
+        error_report("filter_mirror_send failed(%s)", strerror(-ret));
+    }
+}
+
 static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
                                              NetClientState *sender,
                                              unsigned flags,
@@ -173,6 +229,28 @@ static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
     }
 }
 
+static void filter_redirector_receive_batch(NetFilterState *nf,
+                                            NetClientState *sender,
+                                            unsigned flags,
+                                            NetPacketBatch *batch,
+                                            NetPacketSent *sent_cb)
+{
+    MirrorState *s = FILTER_REDIRECTOR(nf);
+    int i, ret;
+
+    if (!qemu_chr_fe_get_driver(&s->chr_out)) {
+        return;
+    }
+
+    ret = filter_mirror_send_batch(&s->chr_out, batch);
+    if (ret) {
+        error_report("filter_mirror_send failed(%s)", strerror(-ret));
+    }
+    for (i = 0; i < batch->count; i++) {
+        batch->stolen[i] = true;
+    }
+}
+
 static void filter_mirror_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_MIRROR(nf);
@@ -273,6 +351,7 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
     nfc->setup = filter_mirror_setup;
     nfc->cleanup = filter_mirror_cleanup;
     nfc->receive_iov = filter_mirror_receive_iov;
+    nfc->receive_batch = filter_mirror_receive_batch;
 }
 
 static void filter_redirector_class_init(ObjectClass *oc, void *data)
@@ -282,6 +361,7 @@ static void filter_redirector_class_init(ObjectClass *oc, void *data)
     nfc->setup = filter_redirector_setup;
     nfc->cleanup = filter_redirector_cleanup;
     nfc->receive_iov = filter_redirector_receive_iov;
+    nfc->receive_batch = filter_redirector_receive_batch;
 }
 
 static char *filter_redirector_get_indev(Object *obj, Error **errp)
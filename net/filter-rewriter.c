@@ -165,7 +165,7 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
 
         fill_connection_key(pkt, &key);
 
-        if (sender == nf->netdev) {
+        if (qemu_netfilter_from_netdev(nf, sender)) {
             /*
              * We need make tcp TX and RX packet
              * into one connection.
@@ -176,7 +176,7 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
                               &key,
                               NULL);
 
-        if (sender == nf->netdev) {
+        if (qemu_netfilter_from_netdev(nf, sender)) {
             /* NET_FILTER_DIRECTION_TX */
             if (!handle_primary_tcp_pkt(nf, conn, pkt)) {
                 qemu_net_queue_send(s->incoming_queue, sender, 0,
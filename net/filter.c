@@ -43,6 +43,38 @@ ssize_t qemu_netfilter_receive(NetFilterState *nf,
     return 0;
 }
 
+void qemu_netfilter_receive_batch(NetFilterState *nf,
+                                  NetFilterDirection direction,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  NetPacketBatch *batch,
+                                  NetPacketSent *sent_cb)
+{
+    NetFilterClass *nfc;
+    int i;
+
+    if (qemu_can_skip_netfilter(nf)) {
+        return;
+    }
+    if (nf->direction != direction &&
+        nf->direction != NET_FILTER_DIRECTION_ALL) {
+        return;
+    }
+
+    nfc = NETFILTER_GET_CLASS(OBJECT(nf));
+    if (nfc->receive_batch) {
+        nfc->receive_batch(nf, sender, flags, batch, sent_cb);
+        return;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        if (!batch->stolen[i] &&
+            nfc->receive_iov(nf, sender, flags, &batch->iov[i], 1, sent_cb)) {
+            batch->stolen[i] = true;
+        }
+    }
+}
+
 static NetFilterState *netfilter_next(NetFilterState *nf,
                                       NetFilterDirection dir)
 {
@@ -76,7 +108,7 @@ ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
     }
 
     if (nf->direction == NET_FILTER_DIRECTION_ALL) {
-        if (sender == nf->netdev) {
+        if (qemu_netfilter_from_netdev(nf, sender)) {
             /* This packet is sent by netdev itself */
             direction = NET_FILTER_DIRECTION_TX;
         } else {
@@ -192,7 +224,7 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
     NetFilterState *nf = NETFILTER(uc);
     NetClientState *ncs[MAX_QUEUE_NUM];
     NetFilterClass *nfc = NETFILTER_GET_CLASS(uc);
-    int queues;
+    int queues, i;
     Error *local_err = NULL;
 
     if (!nf->netdev_id) {
@@ -207,9 +239,6 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "netdev",
                    "a network backend id");
         return;
-    } else if (queues > 1) {
-        error_setg(errp, "multiqueue is not supported");
-        return;
     }
 
     if (get_vhost_net(ncs[0])) {
@@ -227,6 +256,15 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         }
     }
     QTAILQ_INSERT_TAIL(&nf->netdev->filters, nf, next);
+
+    /*
+     * All queues of a multiqueue backend go through the filters of the
+     * first one.  Packets keep their own sender, so whatever a filter
+     * holds back is released to the right queue.
+     */
+    for (i = 1; i < queues; i++) {
+        ncs[i]->filter_owner = nf->netdev;
+    }
 }
 
 static void netfilter_finalize(Object *obj)
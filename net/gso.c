@@ -0,0 +1,428 @@
+/*
+ * Software segmentation and receive coalescing
+ *
+ * Backends such as socket, l2tpv3 or slirp take plain Ethernet frames, so
+ * a NIC in front of them would otherwise have to hide its checksum and
+ * segmentation offloads from the guest.  The helpers here let it keep
+ * them: super-packets from the guest are cut into MTU-sized frames on the
+ * way out, and in-order TCP segments coming in are glued back together.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gso.h"
+
+#define TCP_SEQ_OFFSET      4
+#define TCP_ACK_OFFSET      8
+#define TCP_FLAGS_OFFSET    13
+#define TCP_WIN_OFFSET      14
+#define TCP_CSUM_OFFSET     16
+#define TCP_FLAG_CWR        0x80
+
+struct NetGro {
+    bool tso4;
+    bool tso6;
+    uint8_t *buf;
+
+    /* The packet being built, valid if size is non-zero */
+    size_t size;
+    size_t l3hdr_off;
+    size_t l4hdr_off;
+    size_t hdr_len;
+    bool ipv6;
+    uint16_t mss;
+    uint32_t next_seq;
+    unsigned int segs;
+    bool closed;
+};
+
+static ssize_t net_gso_tcp(const struct virtio_net_hdr *hdr,
+                           uint8_t *buf, size_t size,
+                           NetGsoSend *send, void *opaque)
+{
+    bool ipv6 = (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) ==
+                VIRTIO_NET_HDR_GSO_TCPV6;
+    size_t l3hdr_off;
+    size_t l4hdr_off = hdr->csum_start;
+    size_t l3hdr_len = ipv6 ? sizeof(struct ip6_header) :
+                              sizeof(struct ip_header);
+    uint8_t seg[NET_GSO_MAX_HDR];
+    struct iovec iov[2];
+    size_t thlen, hlen, payload, off, len;
+    uint32_t seq, csum, cso;
+    uint16_t id;
+    unsigned int n;
+    ssize_t ret;
+
+    if (size < sizeof(struct eth_header) + sizeof(struct vlan_header)) {
+        return -1;
+    }
+    l3hdr_off = eth_get_l2_hdr_length(buf);
+
+    if (!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) || !hdr->gso_size ||
+        l4hdr_off < l3hdr_off + l3hdr_len ||
+        l4hdr_off + sizeof(struct tcp_header) > size) {
+        return -1;
+    }
+
+    if (IP_HEADER_VERSION((struct ip_header *)(buf + l3hdr_off)) !=
+        (ipv6 ? IP_HEADER_VERSION_6 : IP_HEADER_VERSION_4)) {
+        return -1;
+    }
+
+    /* The IPv4 header, options included, must end where TCP starts */
+    if (!ipv6 && l3hdr_off + IP_HDR_GET_LEN(buf + l3hdr_off) != l4hdr_off) {
+        return -1;
+    }
+
+    thlen = TCP_HEADER_DATA_OFFSET((struct tcp_header *)(buf + l4hdr_off));
+    hlen = l4hdr_off + thlen;
+    if (thlen < sizeof(struct tcp_header) || hlen > size ||
+        hlen > sizeof(seg)) {
+        return -1;
+    }
+
+    seq = ldl_be_p(buf + l4hdr_off + TCP_SEQ_OFFSET);
+    id = ipv6 ? 0 : be16_to_cpu(((struct ip_header *)(buf + l3hdr_off))->ip_id);
+    payload = size - hlen;
+
+    off = n = 0;
+    do {
+        len = MIN(hdr->gso_size, payload - off);
+
+        memcpy(seg, buf, hlen);
+        stl_be_p(seg + l4hdr_off + TCP_SEQ_OFFSET, seq + off);
+        /* FIN and PSH belong on the last segment, CWR on the first only */
+        if (off + len < payload) {
+            seg[l4hdr_off + TCP_FLAGS_OFFSET] &= ~(TH_FIN | TH_PUSH);
+        }
+        if (off) {
+            seg[l4hdr_off + TCP_FLAGS_OFFSET] &= ~TCP_FLAG_CWR;
+        }
+
+        if (ipv6) {
+            struct ip6_header *ip6 = (struct ip6_header *)(seg + l3hdr_off);
+
+            ip6->ip6_ctlun.ip6_un1.ip6_un1_plen =
+                cpu_to_be16(hlen - l3hdr_off - sizeof(*ip6) + len);
+            csum = eth_calc_ip6_pseudo_hdr_csum(ip6, thlen + len,
+                                                IP_PROTO_TCP, &cso);
+        } else {
+            struct ip_header *ip = (struct ip_header *)(seg + l3hdr_off);
+
+            ip->ip_len = cpu_to_be16(hlen - l3hdr_off + len);
+            ip->ip_id = cpu_to_be16(id + n);
+            eth_fix_ip4_checksum(ip, IP_HDR_GET_LEN(ip));
+            csum = eth_calc_ip4_pseudo_hdr_csum(ip, thlen + len, &cso);
+        }
+
+        stw_be_p(seg + l4hdr_off + TCP_CSUM_OFFSET, 0);
+        csum += net_checksum_add(thlen, seg + l4hdr_off);
+        csum += net_checksum_add(len, buf + hlen + off);
+        stw_be_p(seg + l4hdr_off + TCP_CSUM_OFFSET, net_checksum_finish(csum));
+
+        iov[0].iov_base = seg;
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = buf + hlen + off;
+        iov[1].iov_len = len;
+        ret = send(opaque, iov, 2, off + len >= payload);
+
+        off += len;
+        n++;
+    } while (off < payload);
+
+    return ret;
+}
+
+ssize_t net_gso_segment(const struct virtio_net_hdr *hdr,
+                        uint8_t *buf, size_t size,
+                        NetGsoSend *send, void *opaque)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = size,
+    };
+
+    if (size < sizeof(struct eth_header)) {
+        return -1;
+    }
+
+    switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        return net_gso_tcp(hdr, buf, size, send, opaque);
+    case VIRTIO_NET_HDR_GSO_NONE:
+        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+            size_t start = hdr->csum_start;
+
+            if (start + hdr->csum_offset + 2 > size) {
+                return -1;
+            }
+            /* The field already holds the pseudo header sum */
+            stw_be_p(buf + start + hdr->csum_offset,
+                     net_raw_checksum(buf + start, size - start));
+        }
+        return send(opaque, &iov, 1, true);
+    default:
+        return -1;
+    }
+}
+
+NetGro *net_gro_new(bool tso4, bool tso6)
+{
+    NetGro *gro = g_new0(NetGro, 1);
+
+    net_gro_set_offloads(gro, tso4, tso6);
+    return gro;
+}
+
+void net_gro_free(NetGro *gro)
+{
+    if (gro) {
+        g_free(gro->buf);
+        g_free(gro);
+    }
+}
+
+void net_gro_set_offloads(NetGro *gro, bool tso4, bool tso6)
+{
+    gro->tso4 = tso4;
+    gro->tso6 = tso6;
+    if ((tso4 || tso6) && !gro->buf) {
+        gro->buf = g_malloc(NET_GRO_MAX_SIZE);
+    }
+    net_gro_reset(gro);
+}
+
+bool net_gro_pending(NetGro *gro)
+{
+    return gro->size != 0;
+}
+
+void net_gro_reset(NetGro *gro)
+{
+    gro->size = 0;
+}
+
+/*
+ * Locate the headers of a TCP segment that may be coalesced: plain ACK
+ * (and possibly PSH) carrying data, no IPv4 options or IPv6 extension
+ * headers, and valid checksums since the result is handed on with
+ * the checksum marked as already verified.
+ */
+static bool net_gro_parse(NetGro *gro, const uint8_t *buf, size_t size,
+                          NetGro *seg)
+{
+    size_t l3hdr_off, l4hdr_off, end, thlen;
+    uint32_t csum, cso;
+    uint8_t flags;
+
+    if (size < sizeof(struct eth_header) + sizeof(struct vlan_header)) {
+        return false;
+    }
+    l3hdr_off = eth_get_l2_hdr_length(buf);
+
+    switch (lduw_be_p(buf + l3hdr_off - 2)) {
+    case ETH_P_IP: {
+        struct ip_header *ip = (struct ip_header *)(buf + l3hdr_off);
+
+        if (!gro->tso4 || size < l3hdr_off + sizeof(*ip) ||
+            ip->ip_ver_len != 0x45 || ip->ip_p != IP_PROTO_TCP ||
+            IP4_IS_FRAGMENT(ip) ||
+            net_raw_checksum((uint8_t *)ip, sizeof(*ip))) {
+            return false;
+        }
+        l4hdr_off = l3hdr_off + sizeof(*ip);
+        end = l3hdr_off + be16_to_cpu(ip->ip_len);
+        if (end > size || end < l4hdr_off + sizeof(struct tcp_header)) {
+            return false;
+        }
+        csum = eth_calc_ip4_pseudo_hdr_csum(ip, end - l4hdr_off, &cso);
+        seg->ipv6 = false;
+        break;
+    }
+    case ETH_P_IPV6: {
+        struct ip6_header *ip6 = (struct ip6_header *)(buf + l3hdr_off);
+
+        if (!gro->tso6 || size < l3hdr_off + sizeof(*ip6) ||
+            IP_HEADER_VERSION((struct ip_header *)ip6) != IP_HEADER_VERSION_6 ||
+            ip6->ip6_nxt != IP_PROTO_TCP) {
+            return false;
+        }
+        l4hdr_off = l3hdr_off + sizeof(*ip6);
+        end = l4hdr_off + be16_to_cpu(ip6->ip6_ctlun.ip6_un1.ip6_un1_plen);
+        if (end > size || end < l4hdr_off + sizeof(struct tcp_header)) {
+            return false;
+        }
+        csum = eth_calc_ip6_pseudo_hdr_csum(ip6, end - l4hdr_off,
+                                            IP_PROTO_TCP, &cso);
+        seg->ipv6 = true;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    thlen = TCP_HEADER_DATA_OFFSET((struct tcp_header *)(buf + l4hdr_off));
+    flags = buf[l4hdr_off + TCP_FLAGS_OFFSET];
+    if (thlen < sizeof(struct tcp_header) || l4hdr_off + thlen >= end ||
+        (flags & ~TH_PUSH) != TH_ACK) {
+        return false;
+    }
+
+    csum += net_checksum_add(end - l4hdr_off, (uint8_t *)buf + l4hdr_off);
+    if (net_checksum_finish(csum)) {
+        return false;
+    }
+
+    seg->l3hdr_off = l3hdr_off;
+    seg->l4hdr_off = l4hdr_off;
+    seg->hdr_len = l4hdr_off + thlen;
+    seg->size = end;
+    seg->next_seq = ldl_be_p(buf + l4hdr_off + TCP_SEQ_OFFSET);
+    seg->closed = flags & TH_PUSH;
+    return true;
+}
+
+/* Everything but lengths, IDs, checksums, sequence and window must match */
+static bool net_gro_same_flow(NetGro *gro, const uint8_t *buf, NetGro *seg)
+{
+    const uint8_t *held = gro->buf;
+    size_t l3 = seg->l3hdr_off, l4 = seg->l4hdr_off;
+
+    if (seg->ipv6 != gro->ipv6 || l3 != gro->l3hdr_off ||
+        l4 != gro->l4hdr_off || seg->hdr_len != gro->hdr_len) {
+        return false;
+    }
+
+    if (memcmp(buf, held, l3)) {
+        return false;
+    }
+
+    if (seg->ipv6) {
+        /* version, class, flow label; next header, hop limit, addresses */
+        if (memcmp(buf + l3, held + l3, 4) ||
+            memcmp(buf + l3 + 6, held + l3 + 6, l4 - l3 - 6)) {
+            return false;
+        }
+    } else {
+        /* version, tos; flags, ttl, protocol; addresses */
+        if (memcmp(buf + l3, held + l3, 2) ||
+            memcmp(buf + l3 + 6, held + l3 + 6, 4) ||
+            memcmp(buf + l3 + 12, held + l3 + 12, 8)) {
+            return false;
+        }
+    }
+
+    /* ports; ack; data offset; options */
+    return !memcmp(buf + l4, held + l4, 4) &&
+           !memcmp(buf + l4 + TCP_ACK_OFFSET, held + l4 + TCP_ACK_OFFSET, 5) &&
+           !memcmp(buf + l4 + sizeof(struct tcp_header),
+                   held + l4 + sizeof(struct tcp_header),
+                   seg->hdr_len - l4 - sizeof(struct tcp_header));
+}
+
+bool net_gro_receive(NetGro *gro, const uint8_t *buf, size_t size)
+{
+    NetGro seg;
+    size_t len;
+
+    if (!gro->tso4 && !gro->tso6) {
+        return false;
+    }
+
+    if (!net_gro_parse(gro, buf, size, &seg)) {
+        return false;
+    }
+    len = seg.size - seg.hdr_len;
+
+    if (!gro->size) {
+        /* Holding on to a segment that ends a burst only adds latency */
+        if (seg.closed) {
+            return false;
+        }
+        memcpy(gro->buf, buf, seg.size);
+        gro->size = seg.size;
+        gro->l3hdr_off = seg.l3hdr_off;
+        gro->l4hdr_off = seg.l4hdr_off;
+        gro->hdr_len = seg.hdr_len;
+        gro->ipv6 = seg.ipv6;
+        gro->mss = len;
+        gro->next_seq = seg.next_seq + len;
+        gro->segs = 1;
+        gro->closed = false;
+        return true;
+    }
+
+    if (gro->closed || seg.next_seq != gro->next_seq || len > gro->mss ||
+        gro->size + len > NET_GRO_MAX_SIZE ||
+        gro->size + len - gro->l3hdr_off > 65535 ||
+        !net_gro_same_flow(gro, buf, &seg)) {
+        return false;
+    }
+
+    memcpy(gro->buf + gro->size, buf + seg.hdr_len, len);
+    gro->size += len;
+    gro->next_seq += len;
+    gro->segs++;
+
+    /* The window and PSH of the latest segment are the ones that count */
+    memcpy(gro->buf + gro->l4hdr_off + TCP_WIN_OFFSET,
+           buf + seg.l4hdr_off + TCP_WIN_OFFSET, 2);
+    if (seg.closed) {
+        gro->buf[gro->l4hdr_off + TCP_FLAGS_OFFSET] |= TH_PUSH;
+    }
+    gro->closed = seg.closed || len < gro->mss;
+    return true;
+}
+
+const uint8_t *net_gro_finish(NetGro *gro, struct virtio_net_hdr *hdr,
+                              size_t *size)
+{
+    uint8_t *l3hdr = gro->buf + gro->l3hdr_off;
+    uint32_t csum, cso;
+
+    assert(gro->size);
+    memset(hdr, 0, sizeof(*hdr));
+    *size = gro->size;
+
+    if (gro->segs == 1) {
+        hdr->flags = VIRTIO_NET_HDR_F_DATA_VALID;
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        return gro->buf;
+    }
+
+    if (gro->ipv6) {
+        struct ip6_header *ip6 = (struct ip6_header *)l3hdr;
+
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_plen =
+            cpu_to_be16(gro->size - gro->l4hdr_off);
+        csum = eth_calc_ip6_pseudo_hdr_csum(ip6, gro->size - gro->l4hdr_off,
+                                            IP_PROTO_TCP, &cso);
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    } else {
+        struct ip_header *ip = (struct ip_header *)l3hdr;
+
+        ip->ip_len = cpu_to_be16(gro->size - gro->l3hdr_off);
+        eth_fix_ip4_checksum(ip, sizeof(*ip));
+        csum = eth_calc_ip4_pseudo_hdr_csum(ip, gro->size - gro->l4hdr_off,
+                                            &cso);
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    }
+
+    /* Leave the TCP checksum partial, as a GSO packet from tap would be */
+    stw_be_p(gro->buf + gro->l4hdr_off + TCP_CSUM_OFFSET,
+             (uint16_t)~net_checksum_finish(csum));
+
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->hdr_len = gro->hdr_len;
+    hdr->gso_size = gro->mss;
+    hdr->csum_start = gro->l4hdr_off;
+    hdr->csum_offset = TCP_CSUM_OFFSET;
+    return gro->buf;
+}
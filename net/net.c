@@ -261,6 +261,7 @@ static void qemu_net_client_setup(NetClientState *nc,
     nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
     nc->destructor = destructor;
     QTAILQ_INIT(&nc->filters);
+    nc->filter_owner = nc;
 }
 
 NetClientState *qemu_new_net_client(NetClientInfo *info,
@@ -370,7 +371,7 @@ void qemu_del_net_client(NetClientState *nc)
                                           MAX_QUEUE_NUM);
     assert(queues != 0);
 
-    QTAILQ_FOREACH_SAFE(nf, &nc->filters, next, next) {
+    QTAILQ_FOREACH_SAFE(nf, &nc->filter_owner->filters, next, next) {
         object_unparent(OBJECT(nf));
     }
 
@@ -412,7 +413,12 @@ void qemu_del_nic(NICState *nic)
     /* If this is a peer NIC and peer has already been deleted, free it now. */
     if (nic->peer_deleted) {
         for (i = 0; i < queues; i++) {
-            qemu_free_net_client(qemu_get_subqueue(nic, i)->peer);
+            NetClientState *peer = qemu_get_subqueue(nic, i)->peer;
+
+            /* Queues added by the NIC itself have no peer */
+            if (peer) {
+                qemu_free_net_client(peer);
+            }
         }
     }
 
@@ -551,9 +557,10 @@ static ssize_t filter_receive_iov(NetClientState *nc,
 {
     ssize_t ret = 0;
     NetFilterState *nf = NULL;
+    struct NetFilterHead *filters = &nc->filter_owner->filters;
 
     if (direction == NET_FILTER_DIRECTION_TX) {
-        QTAILQ_FOREACH(nf, &nc->filters, next) {
+        QTAILQ_FOREACH(nf, filters, next) {
             ret = qemu_netfilter_receive(nf, direction, sender, flags, iov,
                                          iovcnt, sent_cb);
             if (ret) {
@@ -561,7 +568,7 @@ static ssize_t filter_receive_iov(NetClientState *nc,
             }
         }
     } else {
-        QTAILQ_FOREACH_REVERSE(nf, &nc->filters, NetFilterHead, next) {
+        QTAILQ_FOREACH_REVERSE(nf, filters, NetFilterHead, next) {
             ret = qemu_netfilter_receive(nf, direction, sender, flags, iov,
                                          iovcnt, sent_cb);
             if (ret) {
@@ -589,6 +596,42 @@ static ssize_t filter_receive(NetClientState *nc,
     return filter_receive_iov(nc, direction, sender, flags, &iov, 1, sent_cb);
 }
 
+static void filter_receive_batch(NetClientState *nc,
+                                 NetFilterDirection direction,
+                                 NetClientState *sender,
+                                 unsigned flags,
+                                 NetPacketBatch *batch,
+                                 NetPacketSent *sent_cb)
+{
+    NetFilterState *nf = NULL;
+    struct NetFilterHead *filters = &nc->filter_owner->filters;
+
+    if (direction == NET_FILTER_DIRECTION_TX) {
+        QTAILQ_FOREACH(nf, filters, next) {
+            qemu_netfilter_receive_batch(nf, direction, sender, flags,
+                                         batch, sent_cb);
+        }
+    } else {
+        QTAILQ_FOREACH_REVERSE(nf, filters, NetFilterHead, next) {
+            qemu_netfilter_receive_batch(nf, direction, sender, flags,
+                                         batch, sent_cb);
+        }
+    }
+}
+
+/*
+ * Does a packet sent by @nc have to go through any filters?  Backends
+ * use this to decide whether gathering packets for
+ * qemu_send_packet_batch() is worth it.
+ */
+bool qemu_net_filtered(NetClientState *nc)
+{
+    if (!QTAILQ_EMPTY(&nc->filter_owner->filters)) {
+        return true;
+    }
+    return nc->peer && !QTAILQ_EMPTY(&nc->peer->filter_owner->filters);
+}
+
 void qemu_purge_queued_packets(NetClientState *nc)
 {
     if (!nc->peer) {
@@ -659,6 +702,52 @@ static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
     return qemu_net_queue_send(queue, sender, flags, buf, size, sent_cb);
 }
 
+/*
+ * Send the packets in @batch, in order.  Each filter on the way sees the
+ * whole batch in one go, which lets it amortize its per-packet costs; the
+ * packets no filter took are then delivered to the peer, which has its
+ * queue flushed once for the whole batch.
+ *
+ * Returns the number of packets the peer could not take right away.  They
+ * are held in its queue and @sent_cb is called for each once delivered,
+ * so the caller should stop sending until then.  The buffers in @batch may
+ * be reused as soon as this returns.
+ */
+int qemu_send_packet_batch(NetClientState *sender, NetPacketBatch *batch,
+                           NetPacketSent *sent_cb)
+{
+    struct iovec iov[NET_BATCH_MAX];
+    int i, count = 0;
+
+    if (sender->link_down || !sender->peer) {
+        return 0;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        batch->stolen[i] = false;
+    }
+
+    /* Let filters handle the packets first */
+    filter_receive_batch(sender, NET_FILTER_DIRECTION_TX, sender,
+                         QEMU_NET_PACKET_FLAG_NONE, batch, sent_cb);
+    filter_receive_batch(sender->peer, NET_FILTER_DIRECTION_RX, sender,
+                         QEMU_NET_PACKET_FLAG_NONE, batch, sent_cb);
+
+    if (!sender->peer) {
+        return 0;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        if (!batch->stolen[i]) {
+            iov[count++] = batch->iov[i];
+        }
+    }
+
+    return qemu_net_queue_send_batch(sender->peer->incoming_queue, sender,
+                                     QEMU_NET_PACKET_FLAG_NONE, iov, count,
+                                     sent_cb);
+}
+
 ssize_t qemu_send_packet_async(NetClientState *sender,
                                const uint8_t *buf, int size,
                                NetPacketSent *sent_cb)
@@ -678,6 +767,43 @@ ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size)
                                              buf, size, NULL);
 }
 
+/*
+ * Ask the peer of @nc for buffers that a packet of up to @size bytes can be
+ * read into directly, bypassing the net queue.  Returns the number of iovec
+ * entries filled in, or 0 if the packet must go through
+ * qemu_send_packet_async() instead.  A successful map must be followed by
+ * qemu_peer_rx_commit() with the number of bytes actually written.
+ *
+ * This is only possible when nothing has to look at or hold on to the
+ * packet on its way: no filters on either side, and nothing already
+ * queued for the peer that the packet would overtake.
+ */
+int qemu_peer_rx_map(NetClientState *nc, struct iovec *iov, int iovcnt,
+                     size_t size)
+{
+    NetClientState *peer = nc->peer;
+
+    if (nc->link_down || !peer || peer->link_down || !peer->info->rx_map) {
+        return 0;
+    }
+
+    if (qemu_net_filtered(nc)) {
+        return 0;
+    }
+
+    if (!qemu_can_send_packet(nc) ||
+        !qemu_net_queue_empty(peer->incoming_queue)) {
+        return 0;
+    }
+
+    return peer->info->rx_map(peer, iov, iovcnt, size);
+}
+
+void qemu_peer_rx_commit(NetClientState *nc, size_t len)
+{
+    nc->peer->info->rx_commit(nc->peer, len);
+}
+
 static ssize_t nc_sendv_compat(NetClientState *nc, const struct iovec *iov,
                                int iovcnt, unsigned flags)
 {
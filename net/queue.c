@@ -232,6 +232,41 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/* Send @count packets, each described by a single iovec.  Once a packet
+ * has to wait, the ones after it are queued behind it so that they stay
+ * in order.  The queue is flushed once for the whole batch.  Returns the
+ * number of packets that were queued.
+ */
+int qemu_net_queue_send_batch(NetQueue *queue,
+                              NetClientState *sender,
+                              unsigned flags,
+                              const struct iovec *iov,
+                              int count,
+                              NetPacketSent *sent_cb)
+{
+    int i = 0, j;
+
+    if (!queue->delivering) {
+        while (i < count && qemu_can_send_packet(sender)) {
+            if (qemu_net_queue_deliver_iov(queue, sender, flags,
+                                           &iov[i], 1) == 0) {
+                break;
+            }
+            i++;
+        }
+    }
+
+    for (j = i; j < count; j++) {
+        qemu_net_queue_append_iov(queue, sender, flags, &iov[j], 1, sent_cb);
+    }
+
+    if (i == count) {
+        qemu_net_queue_flush(queue);
+    }
+
+    return count - i;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -248,6 +283,11 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
     }
 }
 
+bool qemu_net_queue_empty(NetQueue *queue)
+{
+    return QTAILQ_EMPTY(&queue->packets) && !queue->delivering;
+}
+
 bool qemu_net_queue_flush(NetQueue *queue)
 {
     while (!QTAILQ_EMPTY(&queue->packets)) {
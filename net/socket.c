@@ -44,6 +44,9 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+    /* Packets gathered for qemu_send_packet_batch(), allocated on first use */
+    NetPacketBatch *batch;
+    uint8_t *batch_buf;
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
@@ -140,10 +143,42 @@ static void net_socket_send_completed(NetClientState *nc, ssize_t len)
     }
 }
 
+static void net_socket_send_batch(NetSocketState *s)
+{
+    if (!s->batch || !s->batch->count) {
+        return;
+    }
+    if (qemu_send_packet_batch(&s->nc, s->batch, net_socket_send_completed)) {
+        net_socket_read_poll(s, false);
+    }
+    s->batch->count = 0;
+}
+
 static void net_socket_rs_finalize(SocketReadState *rs)
 {
     NetSocketState *s = container_of(rs, NetSocketState, rs);
 
+    /*
+     * With filters attached, hand the packets of one read to them together;
+     * net_socket_send() flushes what is left once the read is parsed.
+     */
+    if (qemu_net_filtered(&s->nc)) {
+        uint8_t *buf;
+
+        if (!s->batch) {
+            s->batch = g_new0(NetPacketBatch, 1);
+            s->batch_buf = g_malloc(NET_BATCH_MAX * NET_BUFSIZE);
+        }
+        buf = s->batch_buf + s->batch->count * NET_BUFSIZE;
+        memcpy(buf, rs->buf, rs->packet_len);
+        s->batch->iov[s->batch->count].iov_base = buf;
+        s->batch->iov[s->batch->count].iov_len = rs->packet_len;
+        if (++s->batch->count == NET_BATCH_MAX) {
+            net_socket_send_batch(s);
+        }
+        return;
+    }
+
     if (qemu_send_packet_async(&s->nc, rs->buf,
                                rs->packet_len,
                                net_socket_send_completed) == 0) {
@@ -183,6 +218,7 @@ static void net_socket_send(void *opaque)
     buf = buf1;
 
     ret = net_fill_rstate(&s->rs, buf, size);
+    net_socket_send_batch(s);
 
     if (ret == -1) {
         goto eoc;
@@ -308,6 +344,8 @@ static void net_socket_cleanup(NetClientState *nc)
         closesocket(s->listen_fd);
         s->listen_fd = -1;
     }
+    g_free(s->batch);
+    g_free(s->batch_buf);
 }
 
 static NetClientInfo net_dgram_socket_info = {
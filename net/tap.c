@@ -45,12 +45,17 @@
 
 #include "net/vhost_net.h"
 
+/* Default number of packets read per tap_send() invocation */
+#define TAP_RX_BATCH_DEFAULT 50
+
+/* Enough for a 64k packet spread over MTU-sized mergeable buffers */
+#define TAP_RX_MAP_IOV 64
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -58,6 +63,10 @@ typedef struct TAPState {
     bool enabled;
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
+    unsigned rx_batch;
+    /* Packets gathered for qemu_send_packet_batch(), allocated on first use */
+    NetPacketBatch *batch;
+    uint8_t *batch_buf;
     Notifier exit;
 } TAPState;
 
@@ -171,6 +180,40 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 {
     return read(tapfd, buf, maxlen);
 }
+
+/*
+ * Read the next packet straight into the peer's receive buffers, saving
+ * a copy.  Returns the packet size, 0 if there was nothing to read, or -1
+ * if the peer can't take the packet this way and it has to be copied.
+ */
+static ssize_t tap_read_zerocopy(TAPState *s)
+{
+    struct iovec iov[TAP_RX_MAP_IOV];
+    ssize_t len;
+    int iovcnt;
+
+    /* The peer must see exactly what the kernel hands us */
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        return -1;
+    }
+
+    iovcnt = qemu_peer_rx_map(&s->nc, iov, ARRAY_SIZE(iov), NET_BUFSIZE);
+    if (iovcnt <= 0) {
+        return -1;
+    }
+
+    do {
+        len = readv(s->fd, iov, iovcnt);
+    } while (len == -1 && errno == EINTR);
+
+    qemu_peer_rx_commit(&s->nc, len > 0 ? len : 0);
+    return len > 0 ? len : 0;
+}
+#else
+static ssize_t tap_read_zerocopy(TAPState *s)
+{
+    return -1;
+}
 #endif
 
 static void tap_send_completed(NetClientState *nc, ssize_t len)
@@ -179,43 +222,86 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
-static void tap_send(void *opaque)
+/*
+ * Read up to @budget packets, handing them over NET_BATCH_MAX at a time,
+ * so that the net layer checks the peer, runs each filter and flushes
+ * the peer's queue once per batch rather than once per packet.
+ */
+static void tap_send_batch(TAPState *s, unsigned budget)
 {
-    TAPState *s = opaque;
+    NetPacketBatch *batch;
+    unsigned packets = 0;
     int size;
-    int packets = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
+    if (!s->batch) {
+        s->batch = g_new0(NetPacketBatch, 1);
+        s->batch_buf = g_malloc(NET_BATCH_MAX * NET_BUFSIZE);
+    }
+    batch = s->batch;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
-        }
+    while (packets < budget) {
+        batch->count = 0;
+        while (batch->count < NET_BATCH_MAX && packets < budget) {
+            uint8_t *buf = s->batch_buf + batch->count * NET_BUFSIZE;
+
+            size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
+            if (size <= 0) {
+                break;
+            }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+            if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+                buf  += s->host_vnet_hdr_len;
+                size -= s->host_vnet_hdr_len;
+            }
+
+            batch->iov[batch->count].iov_base = buf;
+            batch->iov[batch->count].iov_len = size;
+            batch->count++;
+            packets++;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
+        if (!batch->count) {
+            break;
+        }
+        if (qemu_send_packet_batch(&s->nc, batch, tap_send_completed)) {
             tap_read_poll(s, false);
             break;
-        } else if (size < 0) {
+        }
+        if (batch->count < NET_BATCH_MAX) {
+            /* Nothing left to read */
             break;
         }
+    }
+}
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
+/*
+ * When the host keeps receiving more packets while tap_send() is running
+ * we can hog the QEMU global mutex.  Limit the number of packets that are
+ * processed per tap_send() callback to prevent stalling the guest.  The
+ * limit can be raised with rx-batch= on hosts that trade latency for
+ * throughput.
+ */
+static void tap_send(void *opaque)
+{
+    TAPState *s = opaque;
+    unsigned packets = 0;
+    ssize_t size;
+
+    if (qemu_net_filtered(&s->nc)) {
+        tap_send_batch(s, s->rx_batch);
+        return;
+    }
+
+    while (packets < s->rx_batch) {
+        size = tap_read_zerocopy(s);
+        if (size == 0) {
+            break;
+        } else if (size < 0) {
+            /* The peer can't be written to directly, copy the rest */
+            tap_send_batch(s, s->rx_batch - packets);
             break;
         }
+        packets++;
     }
 }
 
@@ -325,6 +411,11 @@ static void tap_cleanup(NetClientState *nc)
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+
+    g_free(s->batch);
+    s->batch = NULL;
+    g_free(s->batch_buf);
+    s->batch_buf = NULL;
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
@@ -379,6 +470,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s->using_vnet_hdr = false;
     s->has_ufo = tap_probe_has_ufo(s->fd);
     s->enabled = true;
+    s->rx_batch = TAP_RX_BATCH_DEFAULT;
     tap_set_offload(&s->nc, 0, 0, 0, 0, 0);
     /*
      * Make sure host header length is set correctly in tap:
@@ -654,6 +746,10 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         return;
     }
 
+    if (tap->has_rx_batch) {
+        s->rx_batch = tap->rx_batch;
+    }
+
     if (tap->has_fd || tap->has_fds) {
         snprintf(s->nc.info_str, sizeof(s->nc.info_str), "fd=%d", fd);
     } else if (tap->has_helper) {
@@ -760,6 +856,11 @@ int net_init_tap(const Netdev *netdev, const char *name,
         return -1;
     }
 
+    if (tap->has_rx_batch && tap->rx_batch == 0) {
+        error_setg(errp, "rx-batch must be at least 1");
+        return -1;
+    }
+
     if (tap->has_fd) {
         if (tap->has_ifname || tap->has_script || tap->has_downscript ||
             tap->has_vnet_hdr || tap->has_helper || tap->has_queues ||
@@ -0,0 +1,197 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/visitor-impl.h"
+#include "qemu-common.h"
+#include "qapi/qmp/types.h"
+#include "qapi/qmp/qjson.h"
+
+struct JSONOutputVisitor {
+    Visitor visitor;
+    QString *str;       /* Where the text goes */
+    int depth;          /* Number of unfinished objects and arrays */
+    bool comma;         /* The next value isn't the first in its container */
+};
+
+static JSONOutputVisitor *to_jov(Visitor *v)
+{
+    return container_of(v, JSONOutputVisitor, visitor);
+}
+
+/* Start a value: separate it from the previous one and emit its name */
+static void json_output_name(JSONOutputVisitor *jov, const char *name)
+{
+    if (!jov->depth) {
+        /* The root value; its name, if any, means nothing */
+        return;
+    }
+    if (jov->comma) {
+        qstring_append(jov->str, ", ");
+    }
+    jov->comma = true;
+    if (name) {
+        qstring_append_json_string(jov->str, name);
+        qstring_append(jov->str, ": ");
+    }
+}
+
+static void json_output_start(JSONOutputVisitor *jov, const char *name,
+                              char c)
+{
+    json_output_name(jov, name);
+    qstring_append_chr(jov->str, c);
+    jov->depth++;
+    jov->comma = false;
+}
+
+static void json_output_end(JSONOutputVisitor *jov, char c)
+{
+    assert(jov->depth);
+    qstring_append_chr(jov->str, c);
+    jov->depth--;
+    jov->comma = true;
+}
+
+static void json_output_start_struct(Visitor *v, const char *name, void **obj,
+                                     size_t unused, Error **errp)
+{
+    json_output_start(to_jov(v), name, '{');
+}
+
+static void json_output_end_struct(Visitor *v, void **obj)
+{
+    json_output_end(to_jov(v), '}');
+}
+
+static void json_output_start_list(Visitor *v, const char *name,
+                                   GenericList **listp, size_t size,
+                                   Error **errp)
+{
+    json_output_start(to_jov(v), name, '[');
+}
+
+static GenericList *json_output_next_list(Visitor *v, GenericList *tail,
+                                          size_t size)
+{
+    return tail->next;
+}
+
+static void json_output_end_list(Visitor *v, void **obj)
+{
+    json_output_end(to_jov(v), ']');
+}
+
+static void json_output_type_int64(Visitor *v, const char *name, int64_t *obj,
+                                   Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append_int(jov->str, *obj);
+}
+
+static void json_output_type_uint64(Visitor *v, const char *name,
+                                    uint64_t *obj, Error **errp)
+{
+    /* FIXME values larger than INT64_MAX become negative, as in
+     * the QObject output visitor */
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append_int(jov->str, *obj);
+}
+
+static void json_output_type_bool(Visitor *v, const char *name, bool *obj,
+                                  Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append(jov->str, *obj ? "true" : "false");
+}
+
+static void json_output_type_str(Visitor *v, const char *name, char **obj,
+                                 Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append_json_string(jov->str, *obj ? *obj : "");
+}
+
+static void json_output_type_number(Visitor *v, const char *name, double *obj,
+                                    Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    QFloat *val = qfloat_from_double(*obj);
+
+    /* Format it exactly like qobject_to_json() does */
+    json_output_name(jov, name);
+    qstring_append_json(jov->str, QOBJECT(val));
+    QDECREF(val);
+}
+
+static void json_output_type_any(Visitor *v, const char *name, QObject **obj,
+                                 Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append_json(jov->str, *obj);
+}
+
+static void json_output_type_null(Visitor *v, const char *name, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_name(jov, name);
+    qstring_append(jov->str, "null");
+}
+
+static void json_output_complete(Visitor *v, void *opaque)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    /* Each start must have been paired with an end */
+    assert(!jov->depth);
+    assert(opaque == jov->str);
+}
+
+static void json_output_free(Visitor *v)
+{
+    g_free(to_jov(v));
+}
+
+Visitor *json_output_visitor_new(QString *str)
+{
+    JSONOutputVisitor *v;
+
+    v = g_malloc0(sizeof(*v));
+
+    v->visitor.type = VISITOR_OUTPUT;
+    v->visitor.start_struct = json_output_start_struct;
+    v->visitor.end_struct = json_output_end_struct;
+    v->visitor.start_list = json_output_start_list;
+    v->visitor.next_list = json_output_next_list;
+    v->visitor.end_list = json_output_end_list;
+    v->visitor.type_int64 = json_output_type_int64;
+    v->visitor.type_uint64 = json_output_type_uint64;
+    v->visitor.type_bool = json_output_type_bool;
+    v->visitor.type_str = json_output_type_str;
+    v->visitor.type_number = json_output_type_number;
+    v->visitor.type_any = json_output_type_any;
+    v->visitor.type_null = json_output_type_null;
+    v->visitor.complete = json_output_complete;
+    v->visitor.free = json_output_free;
+
+    v->str = str;
+
+    return &v->visitor;
+}
@@ -109,6 +109,41 @@ static QObject *do_qmp_dispatch(QObject *request, Error **errp)
     return ret;
 }
 
+/*
+ * Run @request like qmp_dispatch() if its command can format its return
+ * value itself, and append that value to @ret as JSON text.  Returns
+ * false, without running anything, if the request must go through
+ * qmp_dispatch() instead; this includes all malformed requests, so that
+ * they are reported the same way.
+ */
+bool qmp_dispatch_text(QObject *request, QString *ret, Error **errp)
+{
+    QDict *args, *dict;
+    QmpCommand *cmd;
+
+    dict = qmp_dispatch_check_obj(request, NULL);
+    if (!dict) {
+        return false;
+    }
+
+    cmd = qmp_find_command(qdict_get_str(dict, "execute"));
+    if (!cmd || !cmd->enabled || !cmd->fn_text) {
+        return false;
+    }
+
+    if (!qdict_haskey(dict, "arguments")) {
+        args = qdict_new();
+    } else {
+        args = qdict_get_qdict(dict, "arguments");
+        QINCREF(args);
+    }
+
+    cmd->fn_text(args, ret, errp);
+
+    QDECREF(args);
+    return true;
+}
+
 QObject *qmp_build_error_object(Error *err)
 {
     return qobject_from_jsonf("{ 'class': %s, 'desc': %s }",
@@ -30,6 +30,15 @@ void qmp_register_command(const char *name, QmpCommandFunc *fn,
     QTAILQ_INSERT_TAIL(&qmp_commands, cmd, node);
 }
 
+/* Let the command @name, registered already, format its own return value */
+void qmp_register_command_text(const char *name, QmpCommandTextFunc *fn)
+{
+    QmpCommand *cmd = qmp_find_command(name);
+
+    assert(cmd);
+    cmd->fn_text = fn;
+}
+
 void qmp_unregister_command(const char *name)
 {
     QmpCommand *cmd = qmp_find_command(name);
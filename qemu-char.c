@@ -970,6 +970,7 @@ void qemu_chr_fe_set_handlers(CharBackend *b,
     b->chr_read = fd_read;
     b->chr_event = fd_event;
     b->opaque = opaque;
+    s->gcontext = context;
     if (s->chr_update_read_handler) {
         s->chr_update_read_handler(s, context);
     }
@@ -1079,15 +1080,14 @@ static GSourceFuncs io_watch_poll_funcs = {
 };
 
 /* Can only be used for read */
-static guint io_add_watch_poll(CharDriverState *chr,
-                               QIOChannel *ioc,
-                               IOCanReadHandler *fd_can_read,
-                               QIOChannelFunc fd_read,
-                               gpointer user_data,
-                               GMainContext *context)
+static GSource *io_add_watch_poll(CharDriverState *chr,
+                                  QIOChannel *ioc,
+                                  IOCanReadHandler *fd_can_read,
+                                  QIOChannelFunc fd_read,
+                                  gpointer user_data,
+                                  GMainContext *context)
 {
     IOWatchPoll *iwp;
-    int tag;
     char *name;
 
     iwp = (IOWatchPoll *) g_source_new(&io_watch_poll_funcs,
@@ -1103,21 +1103,17 @@ static guint io_add_watch_poll(CharDriverState *chr,
     g_source_set_name((GSource *)iwp, name);
     g_free(name);
 
-    tag = g_source_attach(&iwp->parent, context);
+    g_source_attach(&iwp->parent, context);
     g_source_unref(&iwp->parent);
-    return tag;
+    return &iwp->parent;
 }
 
-static void io_remove_watch_poll(guint tag)
+/* The source is looked up by pointer rather than by tag, because it need
+ * not be attached to the default context.  */
+static void io_remove_watch_poll(GSource *source)
 {
-    GSource *source;
     IOWatchPoll *iwp;
 
-    g_return_if_fail (tag > 0);
-
-    source = g_main_context_find_source_by_id(NULL, tag);
-    g_return_if_fail (source != NULL);
-
     iwp = io_watch_poll_from_source(source);
     if (iwp->src) {
         g_source_destroy(iwp->src);
@@ -1129,9 +1125,9 @@ static void io_remove_watch_poll(guint tag)
 
 static void remove_fd_in_watch(CharDriverState *chr)
 {
-    if (chr->fd_in_tag) {
-        io_remove_watch_poll(chr->fd_in_tag);
-        chr->fd_in_tag = 0;
+    if (chr->fd_in_src) {
+        io_remove_watch_poll(chr->fd_in_src);
+        chr->fd_in_src = NULL;
     }
 }
 
@@ -1242,7 +1238,7 @@ static void fd_chr_update_read_handler(CharDriverState *chr,
 
     remove_fd_in_watch(chr);
     if (s->ioc_in) {
-        chr->fd_in_tag = io_add_watch_poll(chr, s->ioc_in,
+        chr->fd_in_src = io_add_watch_poll(chr, s->ioc_in,
                                            fd_chr_read_poll,
                                            fd_chr_read, chr,
                                            context);
@@ -1608,8 +1604,8 @@ static void pty_chr_state(CharDriverState *chr, int connected)
             s->connected = 1;
             s->open_tag = g_idle_add(qemu_chr_be_generic_open_func, chr);
         }
-        if (!chr->fd_in_tag) {
-            chr->fd_in_tag = io_add_watch_poll(chr, s->ioc,
+        if (!chr->fd_in_src) {
+            chr->fd_in_src = io_add_watch_poll(chr, s->ioc,
                                                pty_chr_read_poll,
                                                pty_chr_read,
                                                chr, NULL);
@@ -2770,7 +2766,7 @@ static void udp_chr_update_read_handler(CharDriverState *chr,
 
     remove_fd_in_watch(chr);
     if (s->ioc) {
-        chr->fd_in_tag = io_add_watch_poll(chr, s->ioc,
+        chr->fd_in_src = io_add_watch_poll(chr, s->ioc,
                                            udp_chr_read_poll,
                                            udp_chr_read, chr,
                                            context);
@@ -2822,7 +2818,7 @@ typedef struct {
     QIOChannel *ioc; /* Client I/O channel */
     QIOChannelSocket *sioc; /* Client master channel */
     QIOChannelSocket *listen_ioc;
-    guint listen_tag;
+    GSource *listen_src;
     QCryptoTLSCreds *tls_creds;
     int connected;
     int max_size;
@@ -2838,7 +2834,7 @@ typedef struct {
     bool is_listen;
     bool is_telnet;
 
-    guint reconnect_timer;
+    GSource *reconnect_src;
     int64_t reconnect_time;
     bool connect_err_reported;
 } TCPCharDriver;
@@ -2850,11 +2846,24 @@ static void qemu_chr_socket_restart_timer(CharDriverState *chr)
     TCPCharDriver *s = chr->opaque;
     char *name;
     assert(s->connected == 0);
-    s->reconnect_timer = g_timeout_add_seconds(s->reconnect_time,
-                                               socket_reconnect_timeout, chr);
+    s->reconnect_src = g_timeout_source_new_seconds(s->reconnect_time);
+    g_source_set_callback(s->reconnect_src, socket_reconnect_timeout,
+                          chr, NULL);
     name = g_strdup_printf("chardev-socket-reconnect-%s", chr->label);
-    g_source_set_name_by_id(s->reconnect_timer, name);
+    g_source_set_name(s->reconnect_src, name);
     g_free(name);
+    g_source_attach(s->reconnect_src, chr->gcontext);
+}
+
+static void qemu_chr_socket_cancel_timer(CharDriverState *chr)
+{
+    TCPCharDriver *s = chr->opaque;
+
+    if (s->reconnect_src) {
+        g_source_destroy(s->reconnect_src);
+        g_source_unref(s->reconnect_src);
+        s->reconnect_src = NULL;
+    }
 }
 
 static void check_report_connect_error(CharDriverState *chr,
@@ -2874,6 +2883,30 @@ static gboolean tcp_chr_accept(QIOChannel *chan,
                                GIOCondition cond,
                                void *opaque);
 
+/* The listener is polled in the same context as the frontend handlers, so
+ * that a new client is set up by the thread that will serve it.  */
+static void tcp_chr_listen_watch_add(CharDriverState *chr)
+{
+    TCPCharDriver *s = chr->opaque;
+
+    s->listen_src = qio_channel_create_watch(QIO_CHANNEL(s->listen_ioc),
+                                             G_IO_IN);
+    g_source_set_callback(s->listen_src, (GSourceFunc)tcp_chr_accept,
+                          chr, NULL);
+    g_source_attach(s->listen_src, chr->gcontext);
+}
+
+static void tcp_chr_listen_watch_remove(CharDriverState *chr)
+{
+    TCPCharDriver *s = chr->opaque;
+
+    if (s->listen_src) {
+        g_source_destroy(s->listen_src);
+        g_source_unref(s->listen_src);
+        s->listen_src = NULL;
+    }
+}
+
 /* Called with chr_write_lock held.  */
 static int tcp_chr_write(CharDriverState *chr, const uint8_t *buf, int len)
 {
@@ -3067,9 +3100,18 @@ static ssize_t tcp_chr_recv(CharDriverState *chr, char *buf, size_t len)
 static GSource *tcp_chr_add_watch(CharDriverState *chr, GIOCondition cond)
 {
     TCPCharDriver *s = chr->opaque;
-    return qio_channel_create_watch(s->ioc, cond);
+    GSource *src = NULL;
+
+    /* The connection may go away under our feet in the reader's thread */
+    qemu_mutex_lock(&chr->chr_write_lock);
+    if (s->ioc) {
+        src = qio_channel_create_watch(s->ioc, cond);
+    }
+    qemu_mutex_unlock(&chr->chr_write_lock);
+    return src;
 }
 
+/* Called with chr_write_lock held.  */
 static void tcp_chr_free_connection(CharDriverState *chr)
 {
     TCPCharDriver *s = chr->opaque;
@@ -3103,15 +3145,18 @@ static void tcp_chr_disconnect(CharDriverState *chr)
 {
     TCPCharDriver *s = chr->opaque;
 
+    /* The reader may be running in another thread than the writers, take
+     * the connection away from them before freeing it.  */
+    qemu_mutex_lock(&chr->chr_write_lock);
     if (!s->connected) {
+        qemu_mutex_unlock(&chr->chr_write_lock);
         return;
     }
-
     tcp_chr_free_connection(chr);
+    qemu_mutex_unlock(&chr->chr_write_lock);
 
     if (s->listen_ioc) {
-        s->listen_tag = qio_channel_add_watch(
-            QIO_CHANNEL(s->listen_ioc), G_IO_IN, tcp_chr_accept, chr, NULL);
+        tcp_chr_listen_watch_add(chr);
     }
     chr->filename = SocketAddress_to_str("disconnected:", s->addr,
                                          s->is_listen, s->is_telnet);
@@ -3177,12 +3222,14 @@ static void tcp_chr_connect(void *opaque)
         &s->sioc->remoteAddr, s->sioc->remoteAddrLen,
         s->is_listen, s->is_telnet);
 
+    qemu_mutex_lock(&chr->chr_write_lock);
     s->connected = 1;
+    qemu_mutex_unlock(&chr->chr_write_lock);
     if (s->ioc) {
-        chr->fd_in_tag = io_add_watch_poll(chr, s->ioc,
+        chr->fd_in_src = io_add_watch_poll(chr, s->ioc,
                                            tcp_chr_read_poll,
                                            tcp_chr_read,
-                                           chr, NULL);
+                                           chr, chr->gcontext);
     }
     qemu_chr_be_generic_open(chr);
 }
@@ -3192,13 +3239,24 @@ static void tcp_chr_update_read_handler(CharDriverState *chr,
 {
     TCPCharDriver *s = chr->opaque;
 
+    /* Move the sources that may set up a new connection along with the
+     * handlers.  */
+    if (s->listen_src) {
+        tcp_chr_listen_watch_remove(chr);
+        tcp_chr_listen_watch_add(chr);
+    }
+    if (s->reconnect_src) {
+        qemu_chr_socket_cancel_timer(chr);
+        qemu_chr_socket_restart_timer(chr);
+    }
+
     if (!s->connected) {
         return;
     }
 
     remove_fd_in_watch(chr);
     if (s->ioc) {
-        chr->fd_in_tag = io_add_watch_poll(chr, s->ioc,
+        chr->fd_in_src = io_add_watch_poll(chr, s->ioc,
                                            tcp_chr_read_poll,
                                            tcp_chr_read, chr,
                                            context);
@@ -3349,20 +3407,19 @@ static int tcp_chr_new_client(CharDriverState *chr, QIOChannelSocket *sioc)
 	return -1;
     }
 
+    qemu_mutex_lock(&chr->chr_write_lock);
     s->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(sioc));
     s->sioc = sioc;
     object_ref(OBJECT(sioc));
+    qemu_mutex_unlock(&chr->chr_write_lock);
 
     qio_channel_set_blocking(s->ioc, false, NULL);
 
     if (s->do_nodelay) {
         qio_channel_set_delay(s->ioc, false);
     }
-    if (s->listen_tag) {
-        g_source_remove(s->listen_tag);
-        s->listen_tag = 0;
-    }
+    tcp_chr_listen_watch_remove(chr);
 
     if (s->tls_creds) {
         tcp_chr_tls_init(chr);
@@ -3465,17 +3522,13 @@ static void tcp_chr_free(CharDriverState *chr)
 {
     TCPCharDriver *s = chr->opaque;
 
+    qemu_mutex_lock(&chr->chr_write_lock);
     tcp_chr_free_connection(chr);
+    qemu_mutex_unlock(&chr->chr_write_lock);
 
-    if (s->reconnect_timer) {
-        g_source_remove(s->reconnect_timer);
-        s->reconnect_timer = 0;
-    }
+    qemu_chr_socket_cancel_timer(chr);
     qapi_free_SocketAddress(s->addr);
-    if (s->listen_tag) {
-        g_source_remove(s->listen_tag);
-        s->listen_tag = 0;
-    }
+    tcp_chr_listen_watch_remove(chr);
     if (s->listen_ioc) {
         object_unref(OBJECT(s->listen_ioc));
     }
@@ -4298,6 +4351,8 @@ guint qemu_chr_fe_add_watch(CharBackend *be, GIOCondition cond,
         return 0;
     }
 
+    /* Always the default context, so that the tag can be given to
+     * g_source_remove() */
     g_source_set_callback(src, (GSourceFunc)func, user_data, NULL);
     tag = g_source_attach(src, NULL);
     g_source_unref(src);
@@ -4630,7 +4685,8 @@ static gboolean socket_reconnect_timeout(gpointer opaque)
     TCPCharDriver *s = chr->opaque;
     QIOChannelSocket *sioc;
 
-    s->reconnect_timer = 0;
+    g_source_unref(s->reconnect_src);
+    s->reconnect_src = NULL;
 
     if (chr->be_open) {
         return false;
@@ -4712,6 +4768,7 @@ static CharDriverState *qmp_chardev_open_socket(const char *id,
     if (s->is_unix) {
         qemu_chr_set_feature(chr, QEMU_CHAR_FEATURE_FD_PASS);
     }
+    qemu_chr_set_feature(chr, QEMU_CHAR_FEATURE_GCONTEXT);
 
     chr->opaque = s;
     chr->chr_wait_connected = tcp_chr_wait_connected;
@@ -4762,9 +4819,7 @@ static CharDriverState *qmp_chardev_open_socket(const char *id,
                 goto error;
             }
             if (!s->ioc) {
-                s->listen_tag = qio_channel_add_watch(
-                    QIO_CHANNEL(s->listen_ioc), G_IO_IN,
-                    tcp_chr_accept, chr, NULL);
+                tcp_chr_listen_watch_add(chr);
             }
         } else if (qemu_chr_wait_connected(chr, errp) < 0) {
             goto error;
@@ -62,12 +62,19 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers are kept in a pairing heap whose root is the
+ * timer that expires first, so that the deadline can be read in
+ * constant time while arming and deleting a timer stay cheap even
+ * with many thousands of timers.  Timers with the same expiry time
+ * run in the order they were armed.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
     QEMUTimer *active_timers;
+    uint64_t timer_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -352,43 +359,103 @@ void timer_free(QEMUTimer *ts)
     g_free(ts);
 }
 
+static inline bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+/* Link two heaps by making the later root the first child of the
+ * earlier one.  Returns the root of the result.
+ */
+static QEMUTimer *timer_heap_meld(QEMUTimer *a, QEMUTimer *b)
+{
+    QEMUTimer *t;
+
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (timer_before(b, a)) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    b->prev = a;
+    b->next = a->child;
+    if (a->child) {
+        a->child->prev = b;
+    }
+    a->child = b;
+    a->prev = a->next = NULL;
+    return a;
+}
+
+/* Build a single heap out of a list of siblings: meld them in pairs
+ * from left to right, then meld the pairs from right to left.
+ */
+static QEMUTimer *timer_heap_merge_pairs(QEMUTimer *first)
+{
+    QEMUTimer *a, *b, *pairs = NULL, *root = NULL;
+
+    while (first) {
+        a = first;
+        b = a->next;
+        first = b ? b->next : NULL;
+        a = timer_heap_meld(a, b);
+        a->next = pairs;
+        pairs = a;
+    }
+    while (pairs) {
+        a = pairs;
+        pairs = a->next;
+        root = timer_heap_meld(root, a);
+    }
+    if (root) {
+        root->prev = root->next = NULL;
+    }
+    return root;
+}
+
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *children;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
 
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            *pt = t->next;
-            break;
+    children = timer_heap_merge_pairs(ts->child);
+    if (ts == timer_list->active_timers) {
+        timer_list->active_timers = children;
+    } else {
+        if (ts->prev->child == ts) {
+            ts->prev->child = ts->next;
+        } else {
+            ts->prev->next = ts->next;
         }
-        pt = &t->next;
+        if (ts->next) {
+            ts->next->prev = ts->prev;
+        }
+        timer_list->active_timers =
+            timer_heap_meld(timer_list->active_timers, children);
     }
+    ts->next = ts->prev = ts->child = NULL;
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
-
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
-    }
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    *pt = ts;
+    ts->seq = timer_list->timer_seq++;
+    ts->next = ts->prev = ts->child = NULL;
+    timer_list->active_timers =
+        timer_heap_meld(timer_list->active_timers, ts);
 
-    return pt == &timer_list->active_timers;
+    return timer_list->active_timers == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -517,9 +584,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
         qemu_mutex_unlock(&timer_list->active_timers_lock);
@@ -36,6 +36,7 @@
 #include "qom/object_interfaces.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/acpi/acpi_dev_interface.h"
+#include "qemu/coroutine.h"
 
 NameInfo *qmp_query_name(Error **errp)
 {
@@ -72,6 +73,21 @@ KvmInfo *qmp_query_kvm(Error **errp)
     return info;
 }
 
+CoroutinePoolInfo *qmp_query_coroutine_pool(Error **errp)
+{
+    CoroutinePoolInfo *info = g_new0(CoroutinePoolInfo, 1);
+    CoroutinePoolStats stats;
+
+    qemu_coroutine_get_pool_stats(&stats);
+    info->batch_size = stats.batch_size;
+    info->pool_size = stats.release_pool_size;
+    info->hits = stats.hits;
+    info->misses = stats.misses;
+    info->frees = stats.frees;
+
+    return info;
+}
+
 UuidInfo *qmp_query_uuid(Error **errp)
 {
     UuidInfo *info = g_malloc0(sizeof(*info));
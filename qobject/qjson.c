@@ -78,10 +78,75 @@ typedef struct ToJsonIterState
 
 static void to_json(const QObject *obj, QString *str, int pretty, int indent);
 
+static void to_json_str(const char *ptr, QString *str)
+{
+    const char *run;
+    int cp;
+    char buf[16];
+    char *end;
+
+    qstring_append_chr(str, '"');
+
+    while (*ptr) {
+        /* Copy characters that need no escaping in one go */
+        for (run = ptr; *ptr >= 0x20 && *ptr < 0x7F &&
+                 *ptr != '\"' && *ptr != '\\'; ptr++) {
+            /* nothing */
+        }
+        qstring_append_len(str, run, ptr - run);
+        if (!*ptr) {
+            break;
+        }
+
+        cp = mod_utf8_codepoint(ptr, 6, &end);
+        switch (cp) {
+        case '\"':
+            qstring_append(str, "\\\"");
+            break;
+        case '\\':
+            qstring_append(str, "\\\\");
+            break;
+        case '\b':
+            qstring_append(str, "\\b");
+            break;
+        case '\f':
+            qstring_append(str, "\\f");
+            break;
+        case '\n':
+            qstring_append(str, "\\n");
+            break;
+        case '\r':
+            qstring_append(str, "\\r");
+            break;
+        case '\t':
+            qstring_append(str, "\\t");
+            break;
+        default:
+            if (cp < 0) {
+                cp = 0xFFFD; /* replacement character */
+            }
+            if (cp > 0xFFFF) {
+                /* beyond BMP; need a surrogate pair */
+                snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
+                         0xD800 + ((cp - 0x10000) >> 10),
+                         0xDC00 + ((cp - 0x10000) & 0x3FF));
+            } else if (cp < 0x20 || cp >= 0x7F) {
+                snprintf(buf, sizeof(buf), "\\u%04X", cp);
+            } else {
+                buf[0] = cp;
+                buf[1] = 0;
+            }
+            qstring_append(str, buf);
+        }
+        ptr = end;
+    }
+
+    qstring_append_chr(str, '"');
+}
+
 static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
 {
     ToJsonIterState *s = opaque;
-    QString *qkey;
     int j;
 
     if (s->count) {
@@ -94,9 +159,7 @@ static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
             qstring_append(s->str, "    ");
     }
 
-    qkey = qstring_from_str(key);
-    to_json(QOBJECT(qkey), s->str, s->pretty, s->indent);
-    QDECREF(qkey);
+    to_json_str(key, s->str);
 
     qstring_append(s->str, ": ");
     to_json(obj, s->str, s->pretty, s->indent);
@@ -136,62 +199,9 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         qstring_append(str, buffer);
         break;
     }
-    case QTYPE_QSTRING: {
-        QString *val = qobject_to_qstring(obj);
-        const char *ptr;
-        int cp;
-        char buf[16];
-        char *end;
-
-        ptr = qstring_get_str(val);
-        qstring_append(str, "\"");
-
-        for (; *ptr; ptr = end) {
-            cp = mod_utf8_codepoint(ptr, 6, &end);
-            switch (cp) {
-            case '\"':
-                qstring_append(str, "\\\"");
-                break;
-            case '\\':
-                qstring_append(str, "\\\\");
-                break;
-            case '\b':
-                qstring_append(str, "\\b");
-                break;
-            case '\f':
-                qstring_append(str, "\\f");
-                break;
-            case '\n':
-                qstring_append(str, "\\n");
-                break;
-            case '\r':
-                qstring_append(str, "\\r");
-                break;
-            case '\t':
-                qstring_append(str, "\\t");
-                break;
-            default:
-                if (cp < 0) {
-                    cp = 0xFFFD; /* replacement character */
-                }
-                if (cp > 0xFFFF) {
-                    /* beyond BMP; need a surrogate pair */
-                    snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
-                             0xD800 + ((cp - 0x10000) >> 10),
-                             0xDC00 + ((cp - 0x10000) & 0x3FF));
-                } else if (cp < 0x20 || cp >= 0x7F) {
-                    snprintf(buf, sizeof(buf), "\\u%04X", cp);
-                } else {
-                    buf[0] = cp;
-                    buf[1] = 0;
-                }
-                qstring_append(str, buf);
-            }
-        };
-
-        qstring_append(str, "\"");
+    case QTYPE_QSTRING:
+        to_json_str(qstring_get_str(qobject_to_qstring(obj)), str);
         break;
-    }
     case QTYPE_QDICT: {
         ToJsonIterState s;
         QDict *val = qobject_to_qdict(obj);
@@ -282,6 +292,25 @@ QString *qobject_to_json(const QObject *obj)
     return str;
 }
 
+/**
+ * qstring_append_json(): Append the compact JSON text for @obj to @str
+ *
+ * This is qobject_to_json() without the temporary QString, for callers
+ * that collect output in a buffer of their own.
+ */
+void qstring_append_json(QString *str, const QObject *obj)
+{
+    to_json(obj, str, 0, 0);
+}
+
+/**
+ * qstring_append_json_string(): Append @s to @str as a JSON string
+ */
+void qstring_append_json_string(QString *str, const char *s)
+{
+    to_json_str(s, str);
+}
+
 QString *qobject_to_json_pretty(const QObject *obj)
 {
     QString *str = qstring_new();
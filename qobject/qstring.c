@@ -88,6 +88,17 @@ void qstring_append(QString *qstring, const char *str)
     qstring->string[qstring->length] = 0;
 }
 
+/**
+ * qstring_append_len(): Append @len bytes of @str to a QString
+ */
+void qstring_append_len(QString *qstring, const char *str, size_t len)
+{
+    capacity_increase(qstring, len);
+    memcpy(qstring->string + qstring->length, str, len);
+    qstring->length += len;
+    qstring->string[qstring->length] = 0;
+}
+
 void qstring_append_int(QString *qstring, int64_t value)
 {
     char num[32];
@@ -63,18 +63,11 @@ def gen_call(name, arg_type, boxed, ret_type):
 def gen_marshal_output(ret_type):
     return mcgen('''
 
-static void qmp_marshal_output_%(c_name)s(%(c_type)s ret_in, QObject **ret_out, Error **errp)
+static void qmp_marshal_output_%(c_name)s(%(c_type)s ret_in, Visitor *out, Error **errp)
 {
-    Error *err = NULL;
     Visitor *v;
 
-    v = qobject_output_visitor_new(ret_out);
-    visit_type_%(c_name)s(v, "unused", &ret_in, &err);
-    if (!err) {
-        visit_complete(v, ret_out);
-    }
-    error_propagate(errp, err);
-    visit_free(v);
+    visit_type_%(c_name)s(out, "unused", &ret_in, errp);
     v = qapi_dealloc_visitor_new();
     visit_type_%(c_name)s(v, "unused", &ret_in, NULL);
     visit_free(v);
@@ -87,23 +80,59 @@ def gen_marshal_proto(name):
     return 'void qmp_marshal_%s(QDict *args, QObject **ret, Error **errp)' % c_name(name)
 
 
-def gen_marshal_decl(name):
-    return mcgen('''
+def gen_marshal_text_proto(name):
+    return 'void qmp_marshal_text_%s(QDict *args, QString *ret, Error **errp)' % c_name(name)
+
+
+def gen_marshal_decl(name, ret_type):
+    ret = mcgen('''
 %(proto)s;
 ''',
-                 proto=gen_marshal_proto(name))
+                proto=gen_marshal_proto(name))
+    if ret_type:
+        ret += mcgen('''
+%(proto)s;
+''',
+                     proto=gen_marshal_text_proto(name))
+    return ret
+
+
+def gen_marshal_visit(name, visitor_new):
+    return mcgen('''
+{
+    Error *err = NULL;
+    Visitor *v = %(visitor_new)s(ret);
+
+    qmp_marshal_visit_%(c_name)s(args, v, &err);
+    if (!err) {
+        visit_complete(v, ret);
+    }
+    error_propagate(errp, err);
+    visit_free(v);
+}
+''',
+                 visitor_new=visitor_new, c_name=c_name(name))
 
 
 def gen_marshal(name, arg_type, boxed, ret_type):
     have_args = arg_type and not arg_type.is_empty()
 
+    if ret_type:
+        # The return value is visited into an output visitor supplied by
+        # the caller: a QObject one for qmp_dispatch(), or one that
+        # writes JSON text for callers that send the reply as it is.
+        proto = ('static void qmp_marshal_visit_%s(QDict *args, Visitor *ret, Error **errp)'
+                 % c_name(name))
+    else:
+        proto = gen_marshal_proto(name)
+
     ret = mcgen('''
 
 %(proto)s
 {
     Error *err = NULL;
 ''',
-                proto=gen_marshal_proto(name))
+                proto=proto)
 
     if ret_type:
         ret += mcgen('''
@@ -189,19 +218,44 @@ out:
     ret += mcgen('''
 }
 ''')
+
+    if ret_type:
+        ret += mcgen('''
+
+%(proto)s
+''',
+                     proto=gen_marshal_proto(name))
+        ret += gen_marshal_visit(name, 'qobject_output_visitor_new')
+        ret += mcgen('''
+
+%(proto)s
+''',
+                     proto=gen_marshal_text_proto(name))
+        ret += gen_marshal_visit(name, 'json_output_visitor_new')
     return ret
 
 
-def gen_register_command(name, success_response):
-    options = 'QCO_NO_OPTIONS'
+def gen_register_command(name, success_response, allow_oob, ret_type):
+    options = []
     if not success_response:
-        options = 'QCO_NO_SUCCESS_RESP'
+        options += ['QCO_NO_SUCCESS_RESP']
+    if allow_oob:
+        options += ['QCO_ALLOW_OOB']
+    if options:
+        options = ' | '.join(options)
+    else:
+        options = 'QCO_NO_OPTIONS'
 
     ret = mcgen('''
     qmp_register_command("%(name)s", qmp_marshal_%(c_name)s, %(opts)s);
 ''',
                 name=name, c_name=c_name(name),
                 opts=options)
+    if ret_type:
+        ret += mcgen('''
+    qmp_register_command_text("%(name)s", qmp_marshal_text_%(c_name)s);
+''',
+                     name=name, c_name=c_name(name))
     return ret
 
 
@@ -239,16 +293,17 @@ class QAPISchemaGenCommandVisitor(QAPISchemaVisitor):
         self._visited_ret_types = None
 
     def visit_command(self, name, info, arg_type, ret_type,
-                      gen, success_response, boxed):
+                      gen, success_response, boxed, allow_oob):
         if not gen:
             return
         self.decl += gen_command_decl(name, arg_type, boxed, ret_type)
         if ret_type and ret_type not in self._visited_ret_types:
             self._visited_ret_types.add(ret_type)
             self.defn += gen_marshal_output(ret_type)
-        self.decl += gen_marshal_decl(name)
+        self.decl += gen_marshal_decl(name, ret_type)
         self.defn += gen_marshal(name, arg_type, boxed, ret_type)
-        self._regy += gen_register_command(name, success_response)
+        self._regy += gen_register_command(name, success_response, allow_oob,
+                                           ret_type)
 
 
 (input_file, output_dir, do_c, do_h, prefix, opts) = parse_command_line()
@@ -295,6 +350,7 @@ fdef.write(mcgen('''
 #include "qapi/visitor.h"
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qobject-input-visitor.h"
+#include "qapi/json-output-visitor.h"
 #include "qapi/dealloc-visitor.h"
 #include "%(prefix)sqapi-types.h"
 #include "%(prefix)sqapi-visit.h"
@@ -306,6 +362,7 @@ fdef.write(mcgen('''
 fdecl.write(mcgen('''
 #include "%(prefix)sqapi-types.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qstring.h"
 #include "qapi/error.h"
 
 ''',
@@ -17,6 +17,8 @@ from qapi import *
 def to_json(obj, level=0):
     if obj is None:
         ret = 'null'
+    elif isinstance(obj, bool):
+        ret = obj and 'true' or 'false'
     elif isinstance(obj, str):
         ret = '"' + obj.replace('"', r'\"') + '"'
     elif isinstance(obj, list):
@@ -154,12 +156,14 @@ const char %(c_name)s[] = %(c_string)s;
                                     for m in variants.variants]})
 
     def visit_command(self, name, info, arg_type, ret_type,
-                      gen, success_response, boxed):
+                      gen, success_response, boxed, allow_oob):
         arg_type = arg_type or self._schema.the_empty_object_type
         ret_type = ret_type or self._schema.the_empty_object_type
-        self._gen_json(name, 'command',
-                       {'arg-type': self._use_type(arg_type),
-                        'ret-type': self._use_type(ret_type)})
+        obj = {'arg-type': self._use_type(arg_type),
+               'ret-type': self._use_type(ret_type)}
+        if allow_oob:
+            obj['allow-oob'] = allow_oob
+        self._gen_json(name, 'command', obj)
 
     def visit_event(self, name, info, arg_type, boxed):
         arg_type = arg_type or self._schema.the_empty_object_type
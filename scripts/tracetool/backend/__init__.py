@@ -24,6 +24,12 @@ Backend attributes
 Attribute Description
 ========= ====================================================================
 PUBLIC    If exists and is set to 'True', the backend is considered "public".
+CHECK_TRACE_EVENT_GET_STATE
+          If exists and is set to 'True', the backend only records events
+          for which trace_event_get_state() is true.  When every backend
+          in use has it, the state is checked once by the format, and the
+          backend's 'generate_h' and 'generate_c' functions are passed
+          'check_state=False' to leave their own check out.
 ========= ====================================================================
 
 
@@ -105,6 +111,11 @@ class Wrapper:
         for backend in self._backends:
             assert exists(backend)
         assert tracetool.format.exists(self._format)
+        self.check_trace_event_get_state = len(self._backends) > 0
+        for backend in self._backends:
+            module = tracetool.try_import("tracetool.backend." + backend)[1]
+            if not getattr(module, "CHECK_TRACE_EVENT_GET_STATE", False):
+                self.check_trace_event_get_state = False
 
     def _run_function(self, name, *args, **kwargs):
         for backend in self._backends:
@@ -116,8 +127,8 @@ class Wrapper:
     def generate_begin(self, events, group):
         self._run_function("generate_%s_begin", events, group)
 
-    def generate(self, event, group):
-        self._run_function("generate_%s", event, group)
+    def generate(self, event, group, **kwargs):
+        self._run_function("generate_%s", event, group, **kwargs)
 
     def generate_end(self, events, group):
         self._run_function("generate_%s_end", events, group)
@@ -17,6 +17,7 @@ from tracetool import out
 
 
 PUBLIC = True
+CHECK_TRACE_EVENT_GET_STATE = True
 
 
 def generate_h_begin(events, group):
@@ -24,11 +25,28 @@ def generate_h_begin(events, group):
         '')
 
 
-def generate_h(event, group):
+def generate_h(event, group, check_state=True):
     argnames = ", ".join(event.args.names())
     if len(event.args) > 0:
         argnames = ", " + argnames
 
+    if not check_state:
+        # already checked on the generic format code, which puts us in a
+        # function of our own
+        out('    {',
+            '        char ftrace_buf[MAX_TRACE_STRLEN];',
+            '        int unused __attribute__ ((unused));',
+            '        int trlen;',
+            '        trlen = snprintf(ftrace_buf, MAX_TRACE_STRLEN,',
+            '                         "%(name)s " %(fmt)s "\\n" %(argnames)s);',
+            '        trlen = MIN(trlen, MAX_TRACE_STRLEN - 1);',
+            '        unused = write(trace_marker_fd, ftrace_buf, trlen);',
+            '    }',
+            name=event.name,
+            fmt=event.fmt.rstrip("\n"),
+            argnames=argnames)
+        return
+
     out('        {',
         '            char ftrace_buf[MAX_TRACE_STRLEN];',
         '            int unused __attribute__ ((unused));',
@@ -17,6 +17,7 @@ from tracetool import out
 
 
 PUBLIC = True
+CHECK_TRACE_EVENT_GET_STATE = True
 
 
 def generate_h_begin(events, group):
@@ -24,11 +25,27 @@ def generate_h_begin(events, group):
         '')
 
 
-def generate_h(event, group):
+def generate_h(event, group, check_state=True):
     argnames = ", ".join(event.args.names())
     if len(event.args) > 0:
         argnames = ", " + argnames
 
+    if not check_state:
+        # already checked on the generic format code, which puts us in a
+        # function of our own
+        out('    {',
+            '        struct timeval _now;',
+            '        gettimeofday(&_now, NULL);',
+            '        qemu_log_mask(LOG_TRACE, "%%d@%%zd.%%06zd:%(name)s " %(fmt)s "\\n",',
+            '                      getpid(),',
+            '                      (size_t)_now.tv_sec, (size_t)_now.tv_usec',
+            '                      %(argnames)s);',
+            '    }',
+            name=event.name,
+            fmt=event.fmt.rstrip("\n"),
+            argnames=argnames)
+        return
+
     if "vcpu" in event.properties:
         # already checked on the generic format code
         cond = "true"
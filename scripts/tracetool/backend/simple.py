@@ -17,6 +17,7 @@ from tracetool import out
 
 
 PUBLIC = True
+CHECK_TRACE_EVENT_GET_STATE = True
 
 
 def is_string(arg):
@@ -36,8 +37,15 @@ def generate_h_begin(events, group):
     out('')
 
 
-def generate_h(event, group):
-    out('        _simple_%(api)s(%(args)s);',
+def generate_h(event, group, check_state=True):
+    if not check_state:
+        # already checked on the generic format code, which puts us in a
+        # function of our own
+        indent = "    "
+    else:
+        indent = "        "
+    out('%(indent)s_simple_%(api)s(%(args)s);',
+        indent=indent,
         api=event.api(),
         args=", ".join(event.args.names()))
 
@@ -50,7 +58,7 @@ def generate_c_begin(events, group):
         '')
 
 
-def generate_c(event, group):
+def generate_c(event, group, check_state=True):
     out('void _simple_%(api)s(%(args)s)',
         '{',
         '    TraceBufferRecord rec;',
@@ -70,7 +78,7 @@ def generate_c(event, group):
         sizestr = '0'
 
     event_id = 'TRACE_' + event.name.upper()
-    if "vcpu" in event.properties:
+    if "vcpu" in event.properties or not check_state:
         # already checked on the generic format code
         cond = "true"
     else:
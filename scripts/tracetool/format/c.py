@@ -66,5 +66,9 @@ def generate(events, backend, group):
 
     backend.generate_begin(active_events, group)
     for event in active_events:
-        backend.generate(event, group)
+        if backend.check_trace_event_get_state:
+            # checked by the header before calling into the backends
+            backend.generate(event, group, check_state=False)
+        else:
+            backend.generate(event, group)
     backend.generate_end(active_events, group)
@@ -56,9 +56,37 @@ def generate(events, backend, group):
                    % dict(
                        cpu=trace_cpu,
                        id=e.name.upper())
+        elif backend.check_trace_event_get_state:
+            cond = "trace_event_get_state(TRACE_%s)" % e.name.upper()
         else:
             cond = "true"
 
+        if backend.check_trace_event_get_state and \
+           "disable" not in e.properties:
+            # No backend records the event unless it is enabled, so check
+            # that once and keep the recording code out of line: a call
+            # site for a disabled event is then a load and a branch.
+            out('',
+                'static inline QEMU_COLD void %(api)s(%(args)s)',
+                '{',
+                api=e.api(e.QEMU_TRACE_NOCHECK),
+                args=e.args)
+            backend.generate(e, group, check_state=False)
+            out('}',
+                '',
+                'static inline void %(api)s(%(args)s)',
+                '{',
+                '    if (%(cond)s) {',
+                '        %(api_nocheck)s(%(names)s);',
+                '    }',
+                '}',
+                api=e.api(),
+                api_nocheck=e.api(e.QEMU_TRACE_NOCHECK),
+                args=e.args,
+                names=", ".join(e.args.names()),
+                cond=cond)
+            continue
+
         out('',
             'static inline void %(api)s(%(args)s)',
             '{',
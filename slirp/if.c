@@ -116,6 +116,7 @@ diddit:
 		/* Update *_queued */
 		so->so_queued++;
 		so->so_nqueued++;
+		sowatch(so);
 		/*
 		 * Check if the interactive session should be downgraded to
 		 * the batchq.  A session is downgraded if it has queued 6
@@ -227,9 +228,12 @@ void if_start(Slirp *slirp)
         }
 
         /* Update so_queued */
-        if (ifm->ifq_so && --ifm->ifq_so->so_queued == 0) {
-            /* If there's no more queued, reset nqueued */
-            ifm->ifq_so->so_nqueued = 0;
+        if (ifm->ifq_so) {
+            if (--ifm->ifq_so->so_queued == 0) {
+                /* If there's no more queued, reset nqueued */
+                ifm->ifq_so->so_nqueued = 0;
+            }
+            sowatch(ifm->ifq_so);
         }
 
         m_free(ifm);
@@ -96,6 +96,7 @@ static int icmp_send(struct socket *so, struct mbuf *m, int hlen)
     addr.sin_addr = so->so_faddr;
 
     insque(so, &so->slirp->icmp);
+    sowatch(so);
 
     if (sendto(so->s, m->m_data + hlen, m->m_len - hlen, 0,
                (struct sockaddr *)&addr, sizeof(addr)) == -1) {
@@ -110,6 +111,7 @@ static int icmp_send(struct socket *so, struct mbuf *m, int hlen)
 
 void icmp_detach(struct socket *so)
 {
+    sounwatch(so);
     closesocket(so->s);
     sofree(so);
 }
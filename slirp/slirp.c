@@ -33,6 +33,9 @@
 #ifndef _WIN32
 #include <net/if.h>
 #endif
+#ifdef CONFIG_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
 
 /* host loopback address */
 struct in_addr loopback_addr;
@@ -321,6 +324,15 @@ Slirp *slirp_init(int restricted, bool in_enabled, struct in_addr vnetwork,
 
     slirp->opaque = opaque;
 
+#ifdef CONFIG_EPOLL_CREATE1
+    slirp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    slirp->epoll_fd = -1;
+#endif
+    slirp->epoll_pollfds_idx = -1;
+    QTAILQ_INIT(&slirp->watch_changed);
+    QTAILQ_INIT(&slirp->watch_ready);
+
     register_savevm(NULL, "slirp", 0, 4,
                     slirp_state_save, slirp_state_load, slirp);
 
@@ -341,6 +353,10 @@ void slirp_cleanup(Slirp *slirp)
 
     g_rand_free(slirp->grand);
 
+    if (slirp->epoll_fd >= 0) {
+        close(slirp->epoll_fd);
+    }
+
     g_free(slirp->vdnssearch);
     g_free(slirp->tftp_prefix);
     g_free(slirp->bootp_filename);
@@ -376,94 +392,227 @@ static void slirp_update_timeout(uint32_t *timeout)
     *timeout = t;
 }
 
-void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
+#ifdef CONFIG_EPOLL_CREATE1
+/*
+ * With many connections, passing every socket to the main loop's poll()
+ * on each iteration gets expensive.  Sockets are kept in an epoll set
+ * instead.  Whatever can change the events a socket waits for puts it on
+ * the watch_changed list with sowatch(), and only those sockets have
+ * their registration updated before the next poll.  The sockets that
+ * epoll reports ready go on the watch_ready list and are the only ones
+ * dispatched afterwards.
+ */
+#define SLIRP_EPOLL_MAX_EVENTS 256
+
+static inline int epoll_events_from_pfd(int pfd_events)
 {
-    Slirp *slirp;
-    struct socket *so, *so_next;
+    return (pfd_events & G_IO_IN ? EPOLLIN : 0) |
+           (pfd_events & G_IO_PRI ? EPOLLPRI : 0) |
+           (pfd_events & G_IO_OUT ? EPOLLOUT : 0) |
+           (pfd_events & G_IO_HUP ? EPOLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? EPOLLERR : 0);
+}
 
-    if (QTAILQ_EMPTY(&slirp_instances)) {
-        return;
+static inline int pfd_events_from_epoll(int epoll_events)
+{
+    return (epoll_events & EPOLLIN ? G_IO_IN : 0) |
+           (epoll_events & EPOLLPRI ? G_IO_PRI : 0) |
+           (epoll_events & EPOLLOUT ? G_IO_OUT : 0) |
+           (epoll_events & EPOLLHUP ? G_IO_HUP : 0) |
+           (epoll_events & EPOLLERR ? G_IO_ERR : 0);
+}
+
+/* Fall back to poll() for good if the epoll set can't be kept up to date */
+static void slirp_epoll_disable(Slirp *slirp)
+{
+    struct socket *heads[] = { &slirp->tcb, &slirp->udb, &slirp->icmp };
+    struct socket *so;
+    int i;
+
+    close(slirp->epoll_fd);
+    slirp->epoll_fd = -1;
+
+    for (i = 0; i < ARRAY_SIZE(heads); i++) {
+        for (so = heads[i]->so_next; so != heads[i]; so = so->so_next) {
+            so->poll_events = 0;
+            so->revents = 0;
+            so->watch_changed = false;
+            so->watch_ready = false;
+        }
     }
+    QTAILQ_INIT(&slirp->watch_changed);
+    QTAILQ_INIT(&slirp->watch_ready);
+}
 
-    /*
-     * First, TCP sockets
-     */
+static bool slirp_epoll_update(Slirp *slirp, struct socket *so, int events)
+{
+    struct epoll_event event = {
+        .events = epoll_events_from_pfd(events),
+        .data.ptr = so,
+    };
+    int op;
+
+    if (events == so->poll_events) {
+        return true;
+    }
+    if (!events && so->s == -1) {
+        /* The fd is gone already, and with it the registration */
+        so->poll_events = 0;
+        return true;
+    }
 
-    QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
+    if (!events) {
+        op = EPOLL_CTL_DEL;
+    } else if (!so->poll_events) {
+        op = EPOLL_CTL_ADD;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
+    if (epoll_ctl(slirp->epoll_fd, op, so->s, &event) < 0) {
+        return false;
+    }
+    so->poll_events = events;
+    return true;
+}
+#endif
+
+/* Recompute the events @so waits for before the next poll */
+void sowatch(struct socket *so)
+{
+#ifdef CONFIG_EPOLL_CREATE1
+    Slirp *slirp = so->slirp;
+
+    if (slirp->epoll_fd >= 0 && !so->watch_changed) {
+        so->watch_changed = true;
+        QTAILQ_INSERT_TAIL(&slirp->watch_changed, so, watch_entry);
+    }
+#endif
+}
+
+/*
+ * Stop watching the fd of @so.  This must be called before the fd is
+ * closed, or the epoll set could keep reporting a socket that was freed.
+ */
+void sounwatch(struct socket *so)
+{
+#ifdef CONFIG_EPOLL_CREATE1
+    Slirp *slirp = so->slirp;
+
+    if (so->poll_events && slirp->epoll_fd >= 0 && so->s != -1) {
+        epoll_ctl(slirp->epoll_fd, EPOLL_CTL_DEL, so->s, NULL);
+    }
+    if (so->watch_ready) {
+        QTAILQ_REMOVE(&slirp->watch_ready, so, ready_entry);
+        so->watch_ready = false;
+    }
+#endif
+    so->poll_events = 0;
+    so->revents = 0;
+
+    /* The socket may be given a new fd */
+    sowatch(so);
+}
+
+/* Forget about @so before it is freed */
+void sowatch_release(struct socket *so)
+{
+    sounwatch(so);
+    if (so->watch_changed) {
+        QTAILQ_REMOVE(&so->slirp->watch_changed, so, watch_entry);
+        so->watch_changed = false;
+    }
+}
+
+/* The events @so must be polled for, or 0 if it is not polled at all */
+static int slirp_socket_events(Slirp *slirp, struct socket *so)
+{
+    int events = 0;
+
+    if (so->so_tcpcb) {
         /*
-         * *_slowtimo needs calling if there are IP fragments
-         * in the fragment queue, or there are TCP connections active
+         * See if we need a tcp_fasttimo
          */
-        slirp->do_slowtimo = ((slirp->tcb.so_next != &slirp->tcb) ||
-                (&slirp->ipq.ip_link != slirp->ipq.ip_link.next));
+        if (slirp->time_fasttimo == 0 &&
+            so->so_tcpcb->t_flags & TF_DELACK) {
+            slirp->time_fasttimo = curtime; /* Flag when want a fasttimo */
+        }
 
-        for (so = slirp->tcb.so_next; so != &slirp->tcb;
-                so = so_next) {
-            int events = 0;
+        /*
+         * NOFDREF can include still connecting to local-host,
+         * newly socreated() sockets etc. Don't want to select these.
+         */
+        if (so->so_state & SS_NOFDREF || so->s == -1) {
+            return 0;
+        }
 
-            so_next = so->so_next;
+        /*
+         * Set for reading sockets which are accepting
+         */
+        if (so->so_state & SS_FACCEPTCONN) {
+            return G_IO_IN | G_IO_HUP | G_IO_ERR;
+        }
 
-            so->pollfds_idx = -1;
+        /*
+         * Set for writing sockets which are connecting
+         */
+        if (so->so_state & SS_ISFCONNECTING) {
+            return G_IO_OUT | G_IO_ERR;
+        }
 
-            /*
-             * See if we need a tcp_fasttimo
-             */
-            if (slirp->time_fasttimo == 0 &&
-                so->so_tcpcb->t_flags & TF_DELACK) {
-                slirp->time_fasttimo = curtime; /* Flag when want a fasttimo */
-            }
+        /*
+         * Set for writing if we are connected, can send more, and
+         * we have something to send
+         */
+        if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
+            events |= G_IO_OUT | G_IO_ERR;
+        }
 
-            /*
-             * NOFDREF can include still connecting to local-host,
-             * newly socreated() sockets etc. Don't want to select these.
-             */
-            if (so->so_state & SS_NOFDREF || so->s == -1) {
-                continue;
-            }
+        /*
+         * Set for reading (and urgent data) if we are connected, can
+         * receive more, and we have room for it XXX /2 ?
+         */
+        if (CONN_CANFRCV(so) &&
+            (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
+            events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
+        }
+        return events;
+    }
 
-            /*
-             * Set for reading sockets which are accepting
-             */
-            if (so->so_state & SS_FACCEPTCONN) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-                continue;
-            }
+    if (so->so_type == IPPROTO_ICMP) {
+        if (so->so_state & SS_ISFCONNECTED) {
+            return G_IO_IN | G_IO_HUP | G_IO_ERR;
+        }
+        return 0;
+    }
 
-            /*
-             * Set for writing sockets which are connecting
-             */
-            if (so->so_state & SS_ISFCONNECTING) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_OUT | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-                continue;
-            }
+    /*
+     * When UDP packets are received from over the
+     * link, they're sendto()'d straight away, so
+     * no need for setting for writing
+     * Limit the number of packets queued by this session
+     * to 4.  Note that even though we try and limit this
+     * to 4 packets, the session could have more queued
+     * if the packets needed to be fragmented
+     * (XXX <= 4 ?)
+     */
+    if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
+        return G_IO_IN | G_IO_HUP | G_IO_ERR;
+    }
+    return 0;
+}
 
-            /*
-             * Set for writing if we are connected, can send more, and
-             * we have something to send
-             */
-            if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-                events |= G_IO_OUT | G_IO_ERR;
-            }
+/* Without epoll, every socket goes to the main loop's poll() */
+static void slirp_poll_fill(Slirp *slirp, GArray *pollfds)
+{
+    struct socket *heads[] = { &slirp->tcb, &slirp->udb, &slirp->icmp };
+    struct socket *so;
+    int i, events;
 
-            /*
-             * Set for reading (and urgent data) if we are connected, can
-             * receive more, and we have room for it XXX /2 ?
-             */
-            if (CONN_CANFRCV(so) &&
-                (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-                events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
-            }
+    for (i = 0; i < ARRAY_SIZE(heads); i++) {
+        for (so = heads[i]->so_next; so != heads[i]; so = so->so_next) {
+            so->pollfds_idx = -1;
 
+            events = slirp_socket_events(slirp, so);
             if (events) {
                 GPollFD pfd = {
                     .fd = so->s,
@@ -473,87 +622,306 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
                 g_array_append_val(pollfds, pfd);
             }
         }
+    }
+}
+
+#ifdef CONFIG_EPOLL_CREATE1
+/* Bring the epoll set up to date with the sockets that changed */
+static bool slirp_epoll_fill(Slirp *slirp)
+{
+    struct socket *so;
+
+    while ((so = QTAILQ_FIRST(&slirp->watch_changed))) {
+        QTAILQ_REMOVE(&slirp->watch_changed, so, watch_entry);
+        so->watch_changed = false;
+
+        if (!slirp_epoll_update(slirp, so, slirp_socket_events(slirp, so))) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
+{
+    Slirp *slirp;
 
+    if (QTAILQ_EMPTY(&slirp_instances)) {
+        return;
+    }
+
+    QTAILQ_FOREACH(slirp, &slirp_instances, entry) {
         /*
-         * UDP sockets
+         * *_slowtimo needs calling if there are IP fragments
+         * in the fragment queue, or there are TCP connections active.
+         * UDP and ICMP sockets are expired from there too.
          */
-        for (so = slirp->udb.so_next; so != &slirp->udb;
-                so = so_next) {
-            so_next = so->so_next;
+        slirp->do_slowtimo = ((slirp->tcb.so_next != &slirp->tcb) ||
+                (slirp->udb.so_next != &slirp->udb) ||
+                (slirp->icmp.so_next != &slirp->icmp) ||
+                (&slirp->ipq.ip_link != slirp->ipq.ip_link.next));
 
-            so->pollfds_idx = -1;
+#ifdef CONFIG_EPOLL_CREATE1
+        if (slirp->epoll_fd >= 0 && !slirp_epoll_fill(slirp)) {
+            slirp_epoll_disable(slirp);
+        }
+#endif
 
-            /*
-             * See if it's timed out
-             */
-            if (so->so_expire) {
-                if (so->so_expire <= curtime) {
-                    udp_detach(so);
-                    continue;
-                } else {
-                    slirp->do_slowtimo = true; /* Let socket expire */
+        slirp->epoll_pollfds_idx = -1;
+        if (slirp->epoll_fd >= 0) {
+            GPollFD pfd = {
+                .fd = slirp->epoll_fd,
+                .events = G_IO_IN,
+            };
+            slirp->epoll_pollfds_idx = pollfds->len;
+            g_array_append_val(pollfds, pfd);
+        } else {
+            slirp_poll_fill(slirp, pollfds);
+        }
+    }
+    slirp_update_timeout(timeout);
+}
+
+/* Drop the UDP and ICMP sockets that have been idle for too long */
+static void slirp_expire_sockets(Slirp *slirp)
+{
+    struct socket *so, *so_next;
+
+    for (so = slirp->udb.so_next; so != &slirp->udb; so = so_next) {
+        so_next = so->so_next;
+        if (so->so_expire && so->so_expire <= curtime) {
+            udp_detach(so);
+        }
+    }
+
+    for (so = slirp->icmp.so_next; so != &slirp->icmp; so = so_next) {
+        so_next = so->so_next;
+        if (so->so_expire && so->so_expire <= curtime) {
+            icmp_detach(so);
+        }
+    }
+}
+
+static void slirp_tcp_dispatch(struct socket *so, int revents)
+{
+    int ret;
+
+    if (so->so_state & SS_NOFDREF || so->s == -1) {
+        return;
+    }
+
+    /*
+     * Check for URG data
+     * This will soread as well, so no need to
+     * test for G_IO_IN below if this succeeds
+     */
+    if (revents & G_IO_PRI) {
+        ret = sorecvoob(so);
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
+    /*
+     * Check sockets for reading
+     */
+    else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
+        /*
+         * Check for incoming connections
+         */
+        if (so->so_state & SS_FACCEPTCONN) {
+            tcp_connect(so);
+            return;
+        } /* else */
+        ret = soread(so);
+
+        /* Output it if we read something */
+        if (ret > 0) {
+            tcp_output(sototcpcb(so));
+        }
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
+
+    /*
+     * Check sockets for writing
+     */
+    if (!(so->so_state & SS_NOFDREF) &&
+            (revents & (G_IO_OUT | G_IO_ERR))) {
+        /*
+         * Check for non-blocking, still-connecting sockets
+         */
+        if (so->so_state & SS_ISFCONNECTING) {
+            /* Connected */
+            so->so_state &= ~SS_ISFCONNECTING;
+
+            ret = send(so->s, (const void *) &ret, 0, 0);
+            if (ret < 0) {
+                /* XXXXX Must fix, zero bytes is a NOP */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
                 }
+
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
             }
+            /* else so->so_state &= ~SS_ISFCONNECTING; */
 
             /*
-             * When UDP packets are received from over the
-             * link, they're sendto()'d straight away, so
-             * no need for setting for writing
-             * Limit the number of packets queued by this session
-             * to 4.  Note that even though we try and limit this
-             * to 4 packets, the session could have more queued
-             * if the packets needed to be fragmented
-             * (XXX <= 4 ?)
+             * Continue tcp_input
              */
-            if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-            }
+            tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                      so->so_ffamily);
+            /* continue; */
+        } else {
+            ret = sowrite(so);
         }
-
         /*
-         * ICMP sockets
+         * XXXXX If we wrote something (a lot), there
+         * could be a need for a window update.
+         * In the worst case, the remote will send
+         * a window probe to get things going again
          */
-        for (so = slirp->icmp.so_next; so != &slirp->icmp;
-                so = so_next) {
-            so_next = so->so_next;
+    }
 
-            so->pollfds_idx = -1;
+    /*
+     * Probe a still-connecting, non-blocking socket
+     * to check if it's still alive
+     */
+#ifdef PROBE_CONN
+    if (so->so_state & SS_ISFCONNECTING) {
+        ret = qemu_recv(so->s, &ret, 0, 0);
+
+        if (ret < 0) {
+            /* XXX */
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == EINPROGRESS || errno == ENOTCONN) {
+                return; /* Still connecting, continue */
+            }
 
-            /*
-             * See if it's timed out
-             */
-            if (so->so_expire) {
-                if (so->so_expire <= curtime) {
-                    icmp_detach(so);
-                    continue;
-                } else {
-                    slirp->do_slowtimo = true; /* Let socket expire */
+            /* else failed */
+            so->so_state &= SS_PERSISTENT_MASK;
+            so->so_state |= SS_NOFDREF;
+
+            /* tcp_input will take care of it */
+        } else {
+            ret = send(so->s, &ret, 0, 0);
+            if (ret < 0) {
+                /* XXX */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
                 }
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
+            } else {
+                so->so_state &= ~SS_ISFCONNECTING;
             }
 
-            if (so->so_state & SS_ISFCONNECTED) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
+        }
+        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                  so->so_ffamily);
+    } /* SS_ISFCONNECTING */
+#endif
+}
+
+static void slirp_socket_dispatch(struct socket *so, int revents)
+{
+    if (so->so_tcpcb) {
+        slirp_tcp_dispatch(so, revents);
+        return;
+    }
+
+    /*
+     * Incoming UDP packets are sent straight away, they're not buffered.
+     * Incoming UDP data isn't buffered either.
+     */
+    if (so->s == -1 || !(revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+        return;
+    }
+    if (so->so_type == IPPROTO_ICMP) {
+        icmp_receive(so);
+    } else {
+        sorecvfrom(so);
+    }
+}
+
+static void slirp_poll_dispatch(Slirp *slirp, GArray *pollfds)
+{
+    struct socket *heads[] = { &slirp->tcb, &slirp->udb, &slirp->icmp };
+    struct socket *so, *so_next;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(heads); i++) {
+        for (so = heads[i]->so_next; so != heads[i]; so = so_next) {
+            so_next = so->so_next;
+
+            if (so->pollfds_idx != -1) {
+                GPollFD *pfd = &g_array_index(pollfds, GPollFD,
+                                              so->pollfds_idx);
+
+                so->pollfds_idx = -1;
+                slirp_socket_dispatch(so, pfd->revents);
             }
         }
     }
-    slirp_update_timeout(timeout);
 }
 
+#ifdef CONFIG_EPOLL_CREATE1
+static void slirp_epoll_dispatch(Slirp *slirp, GArray *pollfds)
+{
+    struct epoll_event events[SLIRP_EPOLL_MAX_EVENTS];
+    struct socket *so;
+    int i, ret;
+
+    if (slirp->epoll_pollfds_idx == -1 ||
+        !(g_array_index(pollfds, GPollFD, slirp->epoll_pollfds_idx).revents &
+          G_IO_IN)) {
+        return;
+    }
+
+    /*
+     * The set is level triggered, so whatever doesn't fit here is picked
+     * up on the next iteration of the main loop.
+     */
+    ret = epoll_wait(slirp->epoll_fd, events, ARRAY_SIZE(events), 0);
+    for (i = 0; i < ret; i++) {
+        so = events[i].data.ptr;
+        so->revents = pfd_events_from_epoll(events[i].events);
+        if (!so->watch_ready) {
+            so->watch_ready = true;
+            QTAILQ_INSERT_TAIL(&slirp->watch_ready, so, ready_entry);
+        }
+    }
+
+    /*
+     * Servicing a socket can free others, which takes them off the list,
+     * so the list is consumed from the head rather than iterated.
+     */
+    while ((so = QTAILQ_FIRST(&slirp->watch_ready))) {
+        int revents = so->revents;
+
+        QTAILQ_REMOVE(&slirp->watch_ready, so, ready_entry);
+        so->watch_ready = false;
+        so->revents = 0;
+
+        sowatch(so);
+        slirp_socket_dispatch(so, revents);
+    }
+}
+#endif
+
 void slirp_pollfds_poll(GArray *pollfds, int select_error)
 {
     Slirp *slirp;
-    struct socket *so, *so_next;
-    int ret;
 
     if (QTAILQ_EMPTY(&slirp_instances)) {
         return;
@@ -574,6 +942,7 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
             ((curtime - slirp->last_slowtimo) >= TIMEOUT_SLOW)) {
             ip_slowtimo(slirp);
             tcp_slowtimo(slirp);
+            slirp_expire_sockets(slirp);
             slirp->last_slowtimo = curtime;
         }
 
@@ -582,189 +951,20 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
          */
         if (!select_error) {
             /*
-             * Check TCP sockets
+             * Queue what the ready sockets produce and send it in one
+             * pass below, so that if_start() interleaves the sessions
+             * instead of running once per packet.
              */
-            for (so = slirp->tcb.so_next; so != &slirp->tcb;
-                    so = so_next) {
-                int revents;
-
-                so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                                            so->pollfds_idx).revents;
-                }
-
-                if (so->so_state & SS_NOFDREF || so->s == -1) {
-                    continue;
-                }
-
-                /*
-                 * Check for URG data
-                 * This will soread as well, so no need to
-                 * test for G_IO_IN below if this succeeds
-                 */
-                if (revents & G_IO_PRI) {
-                    ret = sorecvoob(so);
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-                /*
-                 * Check sockets for reading
-                 */
-                else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
-                    /*
-                     * Check for incoming connections
-                     */
-                    if (so->so_state & SS_FACCEPTCONN) {
-                        tcp_connect(so);
-                        continue;
-                    } /* else */
-                    ret = soread(so);
-
-                    /* Output it if we read something */
-                    if (ret > 0) {
-                        tcp_output(sototcpcb(so));
-                    }
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-
-                /*
-                 * Check sockets for writing
-                 */
-                if (!(so->so_state & SS_NOFDREF) &&
-                        (revents & (G_IO_OUT | G_IO_ERR))) {
-                    /*
-                     * Check for non-blocking, still-connecting sockets
-                     */
-                    if (so->so_state & SS_ISFCONNECTING) {
-                        /* Connected */
-                        so->so_state &= ~SS_ISFCONNECTING;
-
-                        ret = send(so->s, (const void *) &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXXXX Must fix, zero bytes is a NOP */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        }
-                        /* else so->so_state &= ~SS_ISFCONNECTING; */
-
-                        /*
-                         * Continue tcp_input
-                         */
-                        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                                  so->so_ffamily);
-                        /* continue; */
-                    } else {
-                        ret = sowrite(so);
-                    }
-                    /*
-                     * XXXXX If we wrote something (a lot), there
-                     * could be a need for a window update.
-                     * In the worst case, the remote will send
-                     * a window probe to get things going again
-                     */
-                }
-
-                /*
-                 * Probe a still-connecting, non-blocking socket
-                 * to check if it's still alive
-                 */
-#ifdef PROBE_CONN
-                if (so->so_state & SS_ISFCONNECTING) {
-                    ret = qemu_recv(so->s, &ret, 0, 0);
-
-                    if (ret < 0) {
-                        /* XXX */
-                        if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                            errno == EINPROGRESS || errno == ENOTCONN) {
-                            continue; /* Still connecting, continue */
-                        }
-
-                        /* else failed */
-                        so->so_state &= SS_PERSISTENT_MASK;
-                        so->so_state |= SS_NOFDREF;
-
-                        /* tcp_input will take care of it */
-                    } else {
-                        ret = send(so->s, &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXX */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        } else {
-                            so->so_state &= ~SS_ISFCONNECTING;
-                        }
-
-                    }
-                    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                              so->so_ffamily);
-                } /* SS_ISFCONNECTING */
+            slirp->if_start_busy = true;
+#ifdef CONFIG_EPOLL_CREATE1
+            if (slirp->epoll_fd >= 0) {
+                slirp_epoll_dispatch(slirp, pollfds);
+            } else
 #endif
+            {
+                slirp_poll_dispatch(slirp, pollfds);
             }
-
-            /*
-             * Now UDP sockets.
-             * Incoming packets are sent straight away, they're not buffered.
-             * Incoming UDP data isn't buffered either.
-             */
-            for (so = slirp->udb.so_next; so != &slirp->udb;
-                    so = so_next) {
-                int revents;
-
-                so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                            so->pollfds_idx).revents;
-                }
-
-                if (so->s != -1 &&
-                    (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    sorecvfrom(so);
-                }
-            }
-
-            /*
-             * Check incoming ICMP relies.
-             */
-            for (so = slirp->icmp.so_next; so != &slirp->icmp;
-                    so = so_next) {
-                    int revents;
-
-                    so_next = so->so_next;
-
-                    revents = 0;
-                    if (so->pollfds_idx != -1) {
-                        revents = g_array_index(pollfds, GPollFD,
-                                                so->pollfds_idx).revents;
-                    }
-
-                    if (so->s != -1 &&
-                        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    icmp_receive(so);
-                }
-            }
+            slirp->if_start_busy = false;
         }
 
         if_start(slirp);
@@ -1025,6 +1225,7 @@ int slirp_remove_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
             getsockname(so->s, (struct sockaddr *)&addr, &addr_len) == 0 &&
             addr.sin_addr.s_addr == host_addr.s_addr &&
             addr.sin_port == port) {
+            sounwatch(so);
             close(so->s);
             sofree(so);
             return 0;
@@ -1124,6 +1325,7 @@ void slirp_socket_recv(Slirp *slirp, struct in_addr guest_addr, int guest_port,
         return;
 
     ret = soreadbuf(so, (const char *)buf, size);
+    sowatch(so);
 
     if (ret > 0)
         tcp_output(sototcpcb(so));
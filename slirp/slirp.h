@@ -220,6 +220,13 @@ struct Slirp {
     GRand *grand;
     QEMUTimer *ra_timer;
 
+    /* sockets are watched through this epoll set when available */
+    int epoll_fd;
+    int epoll_pollfds_idx;
+    /* sockets whose poll events must be recomputed, and ready sockets */
+    QTAILQ_HEAD(, socket) watch_changed;
+    QTAILQ_HEAD(, socket) watch_ready;
+
     void *opaque;
 };
 
@@ -68,6 +68,8 @@ sofree(struct socket *so)
   Slirp *slirp = so->slirp;
   struct mbuf *ifm;
 
+  sowatch_release(so);
+
   for (ifm = (struct mbuf *) slirp->if_fastq.qh_link;
        (struct quehead *) ifm != &slirp->if_fastq;
        ifm = ifm->ifq_next) {
@@ -690,6 +692,7 @@ tcp_listen(Slirp *slirp, uint32_t haddr, u_int hport, uint32_t laddr,
 		return NULL;
 	}
 	insque(so, &slirp->tcb);
+	sowatch(so);
 
 	/*
 	 * SS_FACCEPTONCE sockets must time out.
@@ -21,6 +21,12 @@ struct socket {
   int s;                           /* The actual socket */
 
   int pollfds_idx;                 /* GPollFD GArray index */
+  int poll_events;                 /* G_IO_* events registered with epoll */
+  int revents;                     /* G_IO_* events reported by epoll */
+  bool watch_changed;              /* on slirp->watch_changed */
+  bool watch_ready;                /* on slirp->watch_ready */
+  QTAILQ_ENTRY(socket) watch_entry;
+  QTAILQ_ENTRY(socket) ready_entry;
 
   Slirp *slirp;			   /* managing slirp instance */
 
@@ -138,6 +144,9 @@ struct socket *solookup(struct socket **, struct socket *,
         struct sockaddr_storage *, struct sockaddr_storage *);
 struct socket *socreate(Slirp *);
 void sofree(struct socket *);
+void sowatch(struct socket *);
+void sounwatch(struct socket *);
+void sowatch_release(struct socket *);
 int soread(struct socket *);
 int sorecvoob(struct socket *);
 int sosendoob(struct socket *);
@@ -395,6 +395,10 @@ findso:
 	}
 
 	so = solookup(&slirp->tcp_last_so, &slirp->tcb, &lhost, &fhost);
+	if (so) {
+		/* The segment can change the events the socket waits for */
+		sowatch(so);
+	}
 
 	/*
 	 * If the state is CLOSED (i.e., TCB does not exist) then
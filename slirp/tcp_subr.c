@@ -328,6 +328,7 @@ tcp_close(struct tcpcb *tp)
 	/* clobber input socket cache if we're closing the cached connection */
 	if (so == slirp->tcp_last_so)
 		slirp->tcp_last_so = &slirp->tcb;
+	sounwatch(so);
 	closesocket(so->s);
 	sbfree(&so->so_rcv);
 	sbfree(&so->so_snd);
@@ -490,6 +491,7 @@ void tcp_connect(struct socket *inso)
     /* Close the accept() socket, set right state */
     if (inso->so_state & SS_FACCEPTONCE) {
         /* If we only accept once, close the accept() socket */
+        sounwatch(so);
         closesocket(so->s);
 
         /* Don't select it yet, even though we have an FD */
@@ -522,6 +524,7 @@ tcp_attach(struct socket *so)
 	   return -1;
 
 	insque(so, &so->slirp->tcb);
+	sowatch(so);
 
 	return 0;
 }
@@ -289,6 +289,7 @@ udp_attach(struct socket *so, unsigned short af)
   if (so->s != -1) {
     so->so_expire = curtime + SO_EXPIRE;
     insque(so, &so->slirp->udb);
+    sowatch(so);
   }
   return(so->s);
 }
@@ -296,6 +297,7 @@ udp_attach(struct socket *so, unsigned short af)
 void
 udp_detach(struct socket *so)
 {
+	sounwatch(so);
 	closesocket(so->s);
 	sofree(so);
 }
@@ -337,6 +339,7 @@ udp_listen(Slirp *slirp, uint32_t haddr, u_int hport, uint32_t laddr,
 	so->s = qemu_socket(AF_INET,SOCK_DGRAM,0);
 	so->so_expire = curtime + SO_EXPIRE;
 	insque(so, &slirp->udb);
+	sowatch(so);
 
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = haddr;
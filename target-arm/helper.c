@@ -517,10 +517,18 @@ static void tlbimva_write(CPUARMState *env, const ARMCPRegInfo *ri,
 static void tlbiasid_write(CPUARMState *env, const ARMCPRegInfo *ri,
                            uint64_t value)
 {
-    /* Invalidate by ASID (TLBIASID) */
-    ARMCPU *cpu = arm_env_get_cpu(env);
+    /* Invalidate by ASID (TLBIASID). We don't tag TLB entries with the
+     * ASID, but only the EL1&0 regime of the current security state
+     * needs to be flushed. Secure PL1 may be using the EL3 index when
+     * EL3 is AArch32, so fall back to a full flush for secure state.
+     */
+    CPUState *cs = ENV_GET_CPU(env);
 
-    tlb_flush(CPU(cpu), value == 0);
+    if (arm_is_secure_below_el3(env)) {
+        tlb_flush(cs, value == 0);
+    } else {
+        tlb_flush_by_mmuidx(cs, ARMMMUIdx_S12NSE1, ARMMMUIdx_S12NSE0, -1);
+    }
 }
 
 static void tlbimvaa_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -546,23 +554,42 @@ static void tlbiasid_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     CPUState *cs = ENV_GET_CPU(env);
 
-    tlb_flush_all_cpus(cs, true);
+    /* See tlbiasid_write */
+    if (arm_is_secure_below_el3(env)) {
+        tlb_flush_all_cpus(cs, true);
+    } else {
+        tlb_flush_by_mmuidx_all_cpus(cs, true, ARMMMUIdx_S12NSE1,
+                                     ARMMMUIdx_S12NSE0, -1);
+    }
 }
 
-static void tlbimva_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
-                             uint64_t value)
+/* Like TLBIASIDIS, the by-MVA IS operations only need to reach the
+ * non-secure EL1&0 indexes of the other cores when issued from
+ * non-secure state.
+ */
+static void tlbimva_is_flush(CPUARMState *env, uint64_t value)
 {
     CPUState *cs = ENV_GET_CPU(env);
+    target_ulong page = value & TARGET_PAGE_MASK;
 
-    tlb_flush_page_all_cpus(cs, true, value & TARGET_PAGE_MASK);
+    if (arm_is_secure_below_el3(env)) {
+        tlb_flush_page_all_cpus(cs, true, page);
+    } else {
+        tlb_flush_page_by_mmuidx_all_cpus(cs, true, page, ARMMMUIdx_S12NSE1,
+                                          ARMMMUIdx_S12NSE0, -1);
+    }
 }
 
-static void tlbimvaa_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
+static void tlbimva_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
-    CPUState *cs = ENV_GET_CPU(env);
+    tlbimva_is_flush(env, value);
+}
 
-    tlb_flush_page_all_cpus(cs, true, value & TARGET_PAGE_MASK);
+static void tlbimvaa_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                             uint64_t value)
+{
+    tlbimva_is_flush(env, value);
 }
 
 static void tlbiall_nsnh_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -2285,19 +2312,40 @@ static uint64_t pmsav7_read(CPUARMState *env, const ARMCPRegInfo *ri)
     return *u32p;
 }
 
+/* Flush the pages covered by MPU region @n, if it is enabled */
+static void pmsav7_flush_region(CPUARMState *env, uint32_t n)
+{
+    CPUState *cs = ENV_GET_CPU(env);
+    uint32_t rsize = extract32(env->pmsav7.drsr[n], 1, 5);
+    uint64_t len;
+
+    if (!(env->pmsav7.drsr[n] & 0x1) || !rsize) {
+        return;
+    }
+    len = 1ull << (rsize + 1);
+    if (len > UINT32_MAX) {
+        tlb_flush(cs, 1);
+    } else {
+        tlb_flush_range(cs, env->pmsav7.drbar[n] & ~(len - 1), len);
+    }
+}
+
 static void pmsav7_write(CPUARMState *env, const ARMCPRegInfo *ri,
                          uint64_t value)
 {
-    ARMCPU *cpu = arm_env_get_cpu(env);
     uint32_t *u32p = *(uint32_t **)raw_ptr(env, ri);
+    uint32_t n = env->cp15.c6_rgnr;
 
     if (!u32p) {
         return;
     }
 
-    u32p += env->cp15.c6_rgnr;
-    tlb_flush(CPU(cpu), 1); /* Mappings may have changed - purge! */
-    *u32p = value;
+    /* A region only decides the mappings of the addresses it covers, so
+     * only its old and new ranges need to be purged.
+     */
+    pmsav7_flush_region(env, n);
+    u32p[n] = value;
+    pmsav7_flush_region(env, n);
 }
 
 static void pmsav7_reset(CPUARMState *env, const ARMCPRegInfo *ri)
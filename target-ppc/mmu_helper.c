@@ -1725,15 +1725,13 @@ static inline void do_invalidate_BAT(CPUPPCState *env, target_ulong BATu,
                                      target_ulong mask)
 {
     CPUState *cs = CPU(ppc_env_get_cpu(env));
-    target_ulong base, end, page;
+    target_ulong base, end;
 
     base = BATu & ~0x0001FFFF;
     end = base + mask + 0x00020000;
     LOG_BATS("Flush BAT from " TARGET_FMT_lx " to " TARGET_FMT_lx " ("
              TARGET_FMT_lx ")\n", base, end, mask);
-    for (page = base; page != end; page += TARGET_PAGE_SIZE) {
-        tlb_flush_page(cs, page);
-    }
+    tlb_flush_range(cs, base, end - base);
     LOG_BATS("Flush done\n");
 }
 #endif
@@ -2305,7 +2303,6 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
     PowerPCCPU *cpu = ppc_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
     ppcemb_tlb_t *tlb;
-    target_ulong page, end;
 
     LOG_SWTLB("%s entry %d val " TARGET_FMT_lx "\n", __func__, (int)entry,
               val);
@@ -2313,12 +2310,10 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
     tlb = &env->tlb.tlbe[entry];
     /* Invalidate previous TLB (if it's valid) */
     if (tlb->prot & PAGE_VALID) {
-        end = tlb->EPN + tlb->size;
         LOG_SWTLB("%s: invalidate old TLB %d start " TARGET_FMT_lx " end "
-                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN, end);
-        for (page = tlb->EPN; page < end; page += TARGET_PAGE_SIZE) {
-            tlb_flush_page(cs, page);
-        }
+                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN,
+                  tlb->EPN + tlb->size);
+        tlb_flush_range(cs, tlb->EPN, tlb->size);
     }
     tlb->size = booke_tlb_to_page_size((val >> PPC4XX_TLBHI_SIZE_SHIFT)
                                        & PPC4XX_TLBHI_SIZE_MASK);
@@ -2352,12 +2347,10 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
               tlb->prot & PAGE_VALID ? 'v' : '-', (int)tlb->PID);
     /* Invalidate new TLB (if valid) */
     if (tlb->prot & PAGE_VALID) {
-        end = tlb->EPN + tlb->size;
         LOG_SWTLB("%s: invalidate TLB %d start " TARGET_FMT_lx " end "
-                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN, end);
-        for (page = tlb->EPN; page < end; page += TARGET_PAGE_SIZE) {
-            tlb_flush_page(cs, page);
-        }
+                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN,
+                  tlb->EPN + tlb->size);
+        tlb_flush_range(cs, tlb->EPN, tlb->size);
     }
 }
 
@@ -2558,13 +2551,25 @@ void helper_booke_setpid(CPUPPCState *env, uint32_t pidn, target_ulong pid)
     tlb_flush(CPU(cpu), 1);
 }
 
+static void booke206_flush_tlb_range(CPUState *cs, target_ulong epn,
+                                     hwaddr size)
+{
+    if (size == (target_ulong)size) {
+        tlb_flush_range(cs, epn, size);
+    } else {
+        tlb_flush(cs, 1);
+    }
+}
+
 void helper_booke206_tlbwe(CPUPPCState *env)
 {
     PowerPCCPU *cpu = ppc_env_get_cpu(env);
     uint32_t tlbncfg, tlbn;
     ppcmas_tlb_t *tlb;
     uint32_t size_tlb, size_ps;
-    target_ulong mask;
+    target_ulong mask, old_epn;
+    hwaddr old_size;
+    bool old_valid;
 
 
     switch (env->spr[SPR_BOOKE_MAS0] & MAS0_WQ_MASK) {
@@ -2616,6 +2621,12 @@ void helper_booke206_tlbwe(CPUPPCState *env)
     if (msr_gs) {
         cpu_abort(CPU(cpu), "missing HV implementation\n");
     }
+
+    /* The old translation has to go too if the entry moves or shrinks */
+    old_valid = tlb->mas1 & MAS1_VALID;
+    old_epn = tlb->mas2 & MAS2_EPN_MASK;
+    old_size = booke206_tlb_to_page_size(env, tlb);
+
     tlb->mas7_3 = ((uint64_t)env->spr[SPR_BOOKE_MAS7] << 32) |
         env->spr[SPR_BOOKE_MAS3];
     tlb->mas1 = env->spr[SPR_BOOKE_MAS1];
@@ -2647,11 +2658,11 @@ void helper_booke206_tlbwe(CPUPPCState *env)
         tlb->mas1 &= ~MAS1_IPROT;
     }
 
-    if (booke206_tlb_to_page_size(env, tlb) == TARGET_PAGE_SIZE) {
-        tlb_flush_page(CPU(cpu), tlb->mas2 & MAS2_EPN_MASK);
-    } else {
-        tlb_flush(CPU(cpu), 1);
+    if (old_valid) {
+        booke206_flush_tlb_range(CPU(cpu), old_epn, old_size);
     }
+    booke206_flush_tlb_range(CPU(cpu), tlb->mas2 & MAS2_EPN_MASK,
+                             booke206_tlb_to_page_size(env, tlb));
 }
 
 static inline void booke206_tlb_to_mas(CPUPPCState *env, ppcmas_tlb_t *tlb)
@@ -2735,29 +2746,33 @@ void helper_booke206_tlbsx(CPUPPCState *env, target_ulong address)
     env->spr[SPR_BOOKE_MAS0] |= env->last_way << MAS0_NV_SHIFT;
 }
 
-static inline void booke206_invalidate_ea_tlb(CPUPPCState *env, int tlbn,
-                                              uint32_t ea)
+/* Returns the size of the largest entry invalidated, 0 if none was */
+static inline target_ulong booke206_invalidate_ea_tlb(CPUPPCState *env,
+                                                      int tlbn, uint32_t ea)
 {
     int i;
     int ways = booke206_tlb_ways(env, tlbn);
-    target_ulong mask;
+    target_ulong size, max_size = 0;
 
     for (i = 0; i < ways; i++) {
         ppcmas_tlb_t *tlb = booke206_get_tlbm(env, tlbn, ea, i);
         if (!tlb) {
             continue;
         }
-        mask = ~(booke206_tlb_to_page_size(env, tlb) - 1);
-        if (((tlb->mas2 & MAS2_EPN_MASK) == (ea & mask)) &&
+        size = booke206_tlb_to_page_size(env, tlb);
+        if (((tlb->mas2 & MAS2_EPN_MASK) == (ea & ~(size - 1))) &&
             !(tlb->mas1 & MAS1_IPROT)) {
             tlb->mas1 &= ~MAS1_VALID;
+            max_size = MAX(max_size, size);
         }
     }
+    return max_size;
 }
 
 void helper_booke206_tlbivax(CPUPPCState *env, target_ulong address)
 {
-    CPUState *cs;
+    CPUState *cs = CPU(ppc_env_get_cpu(env));
+    target_ulong size;
 
     if (address & 0x4) {
         /* flush all entries */
@@ -2773,17 +2788,21 @@ void helper_booke206_tlbivax(CPUPPCState *env, target_ulong address)
 
     if (address & 0x8) {
         /* flush TLB1 entries */
-        booke206_invalidate_ea_tlb(env, 1, address);
-        CPU_FOREACH(cs) {
-            tlb_flush(cs, 1);
+        size = booke206_invalidate_ea_tlb(env, 1, address);
+        if (!size) {
+            tlb_flush_all_cpus(cs, false);
+            return;
         }
     } else {
         /* flush TLB0 entries */
-        booke206_invalidate_ea_tlb(env, 0, address);
-        CPU_FOREACH(cs) {
-            tlb_flush_page(cs, address & MAS2_EPN_MASK);
-        }
+        size = booke206_invalidate_ea_tlb(env, 0, address);
     }
+
+    /* One work item per vCPU for all of the pages the entries mapped */
+    size = MAX(size, TARGET_PAGE_SIZE);
+    tlb_flush_range_by_mmuidx_all_cpus(cs, false,
+                                       address & MAS2_EPN_MASK & ~(size - 1),
+                                       size, (1 << NB_MMU_MODES) - 1);
 }
 
 void helper_booke206_tlbilx0(CPUPPCState *env, target_ulong address)
@@ -34,6 +34,7 @@
 
 struct tcg_temp_info {
     bool is_const;
+    bool is_mem_copy;
     uint16_t prev_copy;
     uint16_t next_copy;
     tcg_target_ulong val;
@@ -43,6 +44,20 @@ struct tcg_temp_info {
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
 static TCGTempSet temps_used;
 
+/* Known contents of the CPU state: each entry records that the SIZE bytes
+   at env + OFS hold the value of TEMP.  Loads from such a location can be
+   replaced by a copy of TEMP, and stores of an equal value dropped.  */
+struct tcg_mem_copy {
+    intptr_t ofs;
+    int size;
+    TCGArg temp;
+};
+
+#define MAX_MEM_COPIES 32
+
+static struct tcg_mem_copy mem_copies[MAX_MEM_COPIES];
+static int nb_mem_copies;
+
 static inline bool temp_is_const(TCGArg arg)
 {
     return temps[arg].is_const;
@@ -53,9 +68,26 @@ static inline bool temp_is_copy(TCGArg arg)
     return temps[arg].next_copy != arg;
 }
 
+/* Forget the memory locations known to hold the value of TEMP.  */
+static void remove_mem_copies_of(TCGArg temp)
+{
+    int i, j;
+
+    for (i = j = 0; i < nb_mem_copies; i++) {
+        if (mem_copies[i].temp != temp) {
+            mem_copies[j++] = mem_copies[i];
+        }
+    }
+    nb_mem_copies = j;
+    temps[temp].is_mem_copy = false;
+}
+
 /* Reset TEMP's state, possibly removing the temp for the list of copies.  */
 static void reset_temp(TCGArg temp)
 {
+    if (temps[temp].is_mem_copy) {
+        remove_mem_copies_of(temp);
+    }
     temps[temps[temp].next_copy].prev_copy = temps[temp].prev_copy;
     temps[temps[temp].prev_copy].next_copy = temps[temp].next_copy;
     temps[temp].next_copy = temp;
@@ -64,10 +96,80 @@ static void reset_temp(TCGArg temp)
     temps[temp].mask = -1;
 }
 
+/* Forget everything we know about the contents of the CPU state.  */
+static void reset_all_mem_copies(void)
+{
+    int i;
+
+    for (i = 0; i < nb_mem_copies; i++) {
+        temps[mem_copies[i].temp].is_mem_copy = false;
+    }
+    nb_mem_copies = 0;
+}
+
 /* Reset all temporaries, given that there are NB_TEMPS of them.  */
 static void reset_all_temps(int nb_temps)
 {
     bitmap_zero(temps_used.l, nb_temps);
+    nb_mem_copies = 0;
+}
+
+/* Reset the temporaries that do not survive the end of a basic block.
+   Globals and local temps keep their value on the fall-through path of
+   a conditional branch, so what we know about them remains valid until
+   the next label.  */
+static void reset_bb_temps(TCGContext *s, int nb_temps)
+{
+    int i;
+
+    for (i = s->nb_globals; i < nb_temps; i++) {
+        if (test_bit(i, temps_used.l) && !s->temps[i].temp_local) {
+            reset_temp(i);
+        }
+    }
+}
+
+/* Look for a temp holding the SIZE bytes at env + OFS.  */
+static bool find_mem_copy(intptr_t ofs, int size, TCGArg *temp)
+{
+    int i;
+
+    for (i = 0; i < nb_mem_copies; i++) {
+        if (mem_copies[i].ofs == ofs && mem_copies[i].size == size) {
+            *temp = mem_copies[i].temp;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Forget the contents of the SIZE bytes at env + OFS.  The is_mem_copy
+   flag of the temps involved is left set; it only costs a useless scan
+   when they are reset.  */
+static void remove_mem_copies_in(intptr_t ofs, int size)
+{
+    int i, j;
+
+    for (i = j = 0; i < nb_mem_copies; i++) {
+        struct tcg_mem_copy *mc = &mem_copies[i];
+
+        if (mc->ofs >= ofs + size || ofs >= mc->ofs + mc->size) {
+            mem_copies[j++] = *mc;
+        }
+    }
+    nb_mem_copies = j;
+}
+
+/* Record that the SIZE bytes at env + OFS hold the value of TEMP.  */
+static void record_mem_copy(intptr_t ofs, int size, TCGArg temp)
+{
+    if (nb_mem_copies < MAX_MEM_COPIES) {
+        mem_copies[nb_mem_copies].ofs = ofs;
+        mem_copies[nb_mem_copies].size = size;
+        mem_copies[nb_mem_copies].temp = temp;
+        nb_mem_copies++;
+        temps[temp].is_mem_copy = true;
+    }
 }
 
 /* Initialize and activate a temporary.  */
@@ -77,6 +179,7 @@ static void init_temp_info(TCGArg temp)
         temps[temp].next_copy = temp;
         temps[temp].prev_copy = temp;
         temps[temp].is_const = false;
+        temps[temp].is_mem_copy = false;
         temps[temp].mask = -1;
         set_bit(temp, temps_used.l);
     }
@@ -555,11 +658,15 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
-/* Propagate constants and copies, fold constant expressions. */
+/* Propagate constants and copies, fold constant expressions, and forward
+   values stored to the CPU state to later loads.  Information about
+   globals and local temps is kept across the fall-through edge of
+   conditional branches.  */
 void tcg_optimize(TCGContext *s)
 {
     int oi, oi_next, nb_temps, nb_globals;
     TCGArg *prev_mb_args = NULL;
+    TCGArg env_arg = -1;
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -570,6 +677,13 @@ void tcg_optimize(TCGContext *s)
     nb_globals = s->nb_globals;
     reset_all_temps(nb_temps);
 
+    for (oi = 0; oi < nb_globals; oi++) {
+        if (s->temps[oi].fixed_reg && s->temps[oi].reg == TCG_AREG0) {
+            env_arg = oi;
+            break;
+        }
+    }
+
     for (oi = s->gen_op_buf[0].next; oi != 0; oi = oi_next) {
         tcg_target_ulong mask, partmask, affected;
         int nb_oargs, nb_iargs, i;
@@ -1241,7 +1355,7 @@ void tcg_optimize(TCGContext *s)
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                reset_all_temps(nb_temps);
+                reset_bb_temps(s, nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 args[0] = args[1];
                 args[1] = args[3];
@@ -1265,7 +1379,7 @@ void tcg_optimize(TCGContext *s)
                     goto do_default;
                 }
             do_brcond_low:
-                reset_all_temps(nb_temps);
+                reset_bb_temps(s, nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 args[1] = args[2];
                 args[2] = args[4];
@@ -1356,8 +1470,56 @@ void tcg_optimize(TCGContext *s)
             }
             break;
 
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld_i64:
+            if (args[1] != env_arg) {
+                goto do_default;
+            }
+            i = opc == INDEX_op_ld_i32 ? 4 : 8;
+            if (find_mem_copy(args[2], i, &tmp)) {
+                tcg_opt_gen_mov(s, op, args, args[0], tmp);
+                break;
+            }
+            reset_temp(args[0]);
+            record_mem_copy(args[2], i, args[0]);
+            break;
+
+        case INDEX_op_st_i32:
+        case INDEX_op_st_i64:
+            if (args[1] != env_arg) {
+                reset_all_mem_copies();
+                break;
+            }
+            i = opc == INDEX_op_st_i32 ? 4 : 8;
+            if (find_mem_copy(args[2], i, &tmp)
+                && temps_are_copies(tmp, args[0])) {
+                /* The location already holds this value.  */
+                tcg_op_remove(s, op);
+                break;
+            }
+            remove_mem_copies_in(args[2], i);
+            record_mem_copy(args[2], i, args[0]);
+            break;
+
+        CASE_OP_32_64(st8):
+            i = 1;
+            goto do_st_partial;
+        CASE_OP_32_64(st16):
+            i = 2;
+            goto do_st_partial;
+        case INDEX_op_st32_i64:
+            i = 4;
+        do_st_partial:
+            if (args[1] != env_arg) {
+                reset_all_mem_copies();
+            } else {
+                remove_mem_copies_in(args[2], i);
+            }
+            break;
+
         case INDEX_op_call:
-            if (!(args[nb_oargs + nb_iargs + 1]
+            tmp = args[nb_oargs + nb_iargs + 1];
+            if (!(tmp
                   & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
                 for (i = 0; i < nb_globals; i++) {
                     if (test_bit(i, temps_used.l)) {
@@ -1365,6 +1527,10 @@ void tcg_optimize(TCGContext *s)
                     }
                 }
             }
+            if (!(tmp & TCG_CALL_NO_SIDE_EFFECTS)) {
+                /* The helper may modify the CPU state.  */
+                reset_all_mem_copies();
+            }
             goto do_reset_output;
 
         default:
@@ -1375,7 +1541,15 @@ void tcg_optimize(TCGContext *s)
                block, otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
             if (def->flags & TCG_OPF_BB_END) {
-                reset_all_temps(nb_temps);
+                switch (opc) {
+                CASE_OP_32_64(brcond):
+                case INDEX_op_brcond2_i32:
+                    reset_bb_temps(s, nb_temps);
+                    break;
+                default:
+                    reset_all_temps(nb_temps);
+                    break;
+                }
             } else {
         do_reset_output:
                 for (i = 0; i < nb_oargs; i++) {
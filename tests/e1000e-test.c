@@ -35,7 +35,9 @@
 #include "libqos/malloc-pc.h"
 #include "libqos/malloc-generic.h"
 
+#define E1000E_ICR      (0x00c0)
 #define E1000E_IMS      (0x00d0)
+#define E1000E_IMS_TXQ0 BIT(22)
 
 #define E1000E_STATUS   (0x0008)
 #define E1000E_STATUS_LU BIT(1)
@@ -58,6 +60,7 @@
 #define E1000E_CTRL_EXT             (0x0018)
 #define E1000E_CTRL_EXT_DRV_LOAD    BIT(28)
 #define E1000E_CTRL_EXT_TXLSFLOW    BIT(22)
+#define E1000E_CTRL_EXT_PBA_CLR     BIT(31)
 
 #define E1000E_RX0_MSG_ID           (0)
 #define E1000E_TX0_MSG_ID           (1)
@@ -69,6 +72,10 @@
                                      (E1000E_OTHER_MSG_ID << 16) | BIT(19) | \
                                      BIT(31))
 
+#define E1000E_EITR(n)              (0x00E8 + (n) * 4)
+#define E1000E_EITR_TEST_VAL        (4000)
+#define E1000E_EITR_TEST_NS         (E1000E_EITR_TEST_VAL * 256)
+
 #define E1000E_RING_LEN             (0x1000)
 #define E1000E_TXD_LEN              (16)
 #define E1000E_RXD_LEN              (16)
@@ -296,6 +303,43 @@ static void e1000e_send_verify(e1000e_device *d)
     guest_free(test_alloc, data);
 }
 
+/* Transmit a packet without waiting for its interrupt */
+static void e1000e_send_nowait(e1000e_device *d, uint64_t data)
+{
+    static const uint64_t dtyp_data = BIT(20);
+    static const uint64_t dtyp_ext  = BIT(29);
+    static const uint64_t dcmd_rs   = BIT(27);
+    static const uint64_t dcmd_eop  = BIT(24);
+    static const uint64_t dsta_dd   = BIT(32);
+    char buffer[64];
+    uint64_t descr[2];
+    uint32_t recv_len;
+    int ret;
+
+    descr[0] = cpu_to_le64(data);
+    descr[1] = cpu_to_le64(dcmd_rs | dcmd_eop | dtyp_ext | dtyp_data |
+                           sizeof(buffer));
+    e1000e_tx_ring_push(d, descr);
+    g_assert_cmphex(le64_to_cpu(descr[1]) & dsta_dd, ==, dsta_dd);
+
+    ret = qemu_recv(test_sockets[0], &recv_len, sizeof(recv_len), 0);
+    g_assert_cmpint(ret, == , sizeof(recv_len));
+    g_assert_cmpint(ntohl(recv_len), == , sizeof(buffer));
+    ret = qemu_recv(test_sockets[0], buffer, sizeof(buffer), 0);
+    g_assert_cmpint(ret, == , sizeof(buffer));
+}
+
+/* Test and clear the pending bit of the TX vector */
+static bool e1000e_tx_isr_pending(e1000e_device *d)
+{
+    bool pending = qpci_msix_pending(d->pci_dev, E1000E_TX0_MSG_ID);
+
+    /* The PBA itself is read-only, CTRL_EXT.PBA_CLR makes IMS clear it */
+    e1000e_macreg_write(d, E1000E_ICR, 0xFFFFFFFF);
+    e1000e_macreg_write(d, E1000E_IMS, E1000E_IMS_TXQ0);
+    return pending;
+}
+
 static void e1000e_receive_verify(e1000e_device *d)
 {
     union {
@@ -450,6 +494,46 @@ static void test_e1000e_multiple_transfers(gconstpointer data)
     data_test_clear(&d);
 }
 
+static void test_e1000e_eitr(gconstpointer data)
+{
+    e1000e_device d;
+    uint64_t buf;
+    uint32_t val;
+
+    data_test_init(&d);
+    buf = guest_alloc(test_alloc, 64);
+
+    val = e1000e_macreg_read(&d, E1000E_CTRL_EXT);
+    e1000e_macreg_write(&d, E1000E_CTRL_EXT, val | E1000E_CTRL_EXT_PBA_CLR);
+    e1000e_macreg_write(&d, E1000E_EITR(E1000E_TX0_MSG_ID),
+                        E1000E_EITR_TEST_VAL);
+    clock_step(E1000E_EITR_TEST_NS * 2);
+    e1000e_tx_isr_pending(&d);
+
+    /* The first interrupt goes out at once and opens an interval */
+    e1000e_send_nowait(&d, buf);
+    g_assert(e1000e_tx_isr_pending(&d));
+
+    /* The next one is held until the interval ends */
+    e1000e_send_nowait(&d, buf);
+    g_assert(!e1000e_tx_isr_pending(&d));
+    clock_step(E1000E_EITR_TEST_NS);
+    g_assert(e1000e_tx_isr_pending(&d));
+
+    /* Delivering it opens a new interval for the one after */
+    e1000e_send_nowait(&d, buf);
+    g_assert(!e1000e_tx_isr_pending(&d));
+    clock_step(E1000E_EITR_TEST_NS);
+    g_assert(e1000e_tx_isr_pending(&d));
+
+    /* With nothing new pending, the next expiry raises nothing */
+    clock_step(E1000E_EITR_TEST_NS);
+    g_assert(!e1000e_tx_isr_pending(&d));
+
+    guest_free(test_alloc, buf);
+    data_test_clear(&d);
+}
+
 static void test_e1000e_hotplug(gconstpointer data)
 {
     static const uint8_t slot = 0x06;
@@ -471,6 +555,7 @@ int main(int argc, char **argv)
     qtest_add_data_func("e1000e/rx", NULL, test_e1000e_rx);
     qtest_add_data_func("e1000e/multiple_transfers", NULL,
         test_e1000e_multiple_transfers);
+    qtest_add_data_func("e1000e/eitr", NULL, test_e1000e_eitr);
     qtest_add_data_func("e1000e/hotplug", NULL, test_e1000e_hotplug);
 
     return g_test_run();
@@ -371,6 +371,88 @@ static void test_i440fx_firmware(FirmwareTestFixture *fixture,
     qtest_end();
 }
 
+#define E1000_SLOT      4
+#define E1000_BAR0_A    0xe0000000
+#define E1000_BAR0_B    0xe0010000
+
+/* Every memory transaction commit under qtest checks the FlatViews it
+ * patched from the changed windows against a full render, and aborts if
+ * they differ.  Change the topology in all the ways the memory API
+ * offers: subregions that come and go and move, aliases that are
+ * enabled and disabled, read-only aliases, and a ROM device that leaves
+ * and enters ROMD mode.
+ */
+static void test_i440fx_flatview(void)
+{
+    char *fw_pathname, *cmdline;
+    uint64_t flash = 0x100000000ULL - BLOB_SIZE;
+    QPCIBus *bus;
+    QPCIDevice *host, *dev;
+    uint16_t cmd;
+    int i;
+
+    fw_pathname = create_blob_file();
+    g_assert(fw_pathname != NULL);
+    cmdline = g_strdup_printf("-S -drive if=pflash,format=raw,file=%s "
+                              "-device e1000,addr=%x",
+                              fw_pathname, E1000_SLOT);
+    qtest_start(cmdline);
+    g_free(cmdline);
+    unlink(fw_pathname);
+    g_free(fw_pathname);
+
+    bus = qpci_init_pc(NULL);
+    host = qpci_device_find(bus, QPCI_DEVFN(0, 0));
+    g_assert(host != NULL);
+    dev = qpci_device_find(bus, QPCI_DEVFN(E1000_SLOT, 0));
+    g_assert(dev != NULL);
+
+    /* Subregions: map a BAR, unmap and map it again, move it */
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, E1000_BAR0_A);
+    qpci_device_enable(dev);
+    cmd = qpci_config_readw(dev, PCI_COMMAND);
+    for (i = 0; i < 4; i++) {
+        qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+        qpci_config_writew(dev, PCI_COMMAND, cmd);
+        qpci_config_writel(dev, PCI_BASE_ADDRESS_0,
+                           i & 1 ? E1000_BAR0_A : E1000_BAR0_B);
+    }
+
+    /* Aliases: PAM switches between aliases of RAM and of PCI space,
+     * the one for PAM_RE alone being read-only.  Neighbouring areas are
+     * changed in the same pass so that their windows touch.
+     */
+    for (i = 1; i < 14; i++) {
+        pam_set(host, i, PAM_RE);
+    }
+    write_area(0xe0000, 0xeffff, 0x42);
+    g_assert(verify_area(0xe0000, 0xeffff, 0));
+    for (i = 1; i < 14; i++) {
+        pam_set(host, i, i & 1 ? PAM_RE | PAM_WE : PAM_WE);
+    }
+    for (i = 1; i < 14; i++) {
+        pam_set(host, i, 0);
+    }
+
+    /* Enabled: open SMRAM, which hides the VGA window, and close it */
+    qpci_config_writeb(host, 0x72, 0x4a);
+    qpci_config_writeb(host, 0x72, 0x02);
+
+    /* ROMD: a flash command takes the flash out of ROMD mode and
+     * "read array" brings it back.
+     */
+    g_assert_cmphex(readb(flash + 0x10), ==, 0x10);
+    writeb(flash, 0x70);
+    g_assert_cmphex(readb(flash + 0x10), !=, 0x10);
+    writeb(flash, 0xff);
+    g_assert_cmphex(readb(flash + 0x10), ==, 0x10);
+
+    g_free(dev);
+    g_free(host);
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
 static void add_firmware_test(const char *testpath,
                               void (*setup_fixture)(FirmwareTestFixture *f,
                                                     gconstpointer test_data))
@@ -403,6 +485,7 @@ int main(int argc, char **argv)
     qtest_add_data_func("i440fx/pam", &data, test_i440fx_pam);
     add_firmware_test("i440fx/firmware/bios", request_bios);
     add_firmware_test("i440fx/firmware/pflash", request_pflash);
+    qtest_add_func("i440fx/flatview", test_i440fx_flatview);
 
     return g_test_run();
 }
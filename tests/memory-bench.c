@@ -0,0 +1,149 @@
+/*
+ * Memory API topology update benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * Starts a PC machine under qtest with a number of e1000 NICs, each of
+ * which brings a BAR into the PCI address space and a bus master
+ * AddressSpace of its own.  Every memory transaction commit has to look
+ * at all of them, which is what makes topology updates expensive on big
+ * guests.  The benchmark then reprograms the BARs of one device the way
+ * a guest does while sizing or moving them:
+ *
+ *   - toggling memory decoding in the command register, which unmaps and
+ *     maps all BARs of the device;
+ *   - moving BAR 0 between two addresses.
+ *
+ * Each operation is a config space write that takes one round trip over
+ * the qtest socket.  Writes to a register that does not affect the memory
+ * map are timed too, so that the round trip can be told apart from the
+ * cost of the topology update itself.
+ *
+ * Run it with QTEST_QEMU_BINARY set, e.g.
+ *   QTEST_QEMU_BINARY=x86_64-softmmu/qemu-system-x86_64 tests/memory-bench
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "qemu/timer.h"
+#include "hw/pci/pci_regs.h"
+
+#define FIRST_SLOT      4
+#define BAR0_ADDR_A     0xe0000000
+#define BAR0_ADDR_B     0xe1000000
+
+static unsigned int n_devices = 32;
+static unsigned int n_iters = 10000;
+
+static const char commands[] = "\n"
+    " -d = number of e1000 devices (default 32)\n"
+    " -n = number of iterations (default 10000)\n"
+    " -h = show this help message.\n";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "d:hn:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'd':
+            n_devices = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        default:
+            usage_complete(argc, argv);
+            exit(1);
+        }
+    }
+    if (!n_devices || n_devices > 32 - FIRST_SLOT || !n_iters) {
+        usage_complete(argc, argv);
+        exit(1);
+    }
+}
+
+static void report(const char *what, int64_t ns, unsigned int ops,
+                   int64_t base_ns)
+{
+    double per_op = (double)ns / ops / 1000;
+
+    if (base_ns < 0) {
+        printf("%-24s %10.2f us/op\n", what, per_op);
+    } else {
+        printf("%-24s %10.2f us/op (%.2f us over the round trip)\n",
+               what, per_op, per_op - (double)base_ns / ops / 1000);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    GString *cmdline = g_string_new("-M pc -nodefaults");
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    uint16_t cmd;
+    int64_t start, base, toggle, move;
+    unsigned int i;
+
+    parse_args(argc, argv);
+
+    for (i = 0; i < n_devices; i++) {
+        g_string_append_printf(cmdline, " -device e1000,addr=%x",
+                               FIRST_SLOT + i);
+    }
+    qtest_start(cmdline->str);
+    g_string_free(cmdline, true);
+
+    bus = qpci_init_pc(NULL);
+    dev = qpci_device_find(bus, QPCI_DEVFN(FIRST_SLOT, 0));
+    g_assert(dev != NULL);
+
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, BAR0_ADDR_A);
+    qpci_device_enable(dev);
+    cmd = qpci_config_readw(dev, PCI_COMMAND);
+
+    start = get_clock();
+    for (i = 0; i < n_iters; i++) {
+        qpci_config_writeb(dev, PCI_LATENCY_TIMER, i & 0xf8);
+    }
+    base = get_clock() - start;
+
+    start = get_clock();
+    for (i = 0; i < n_iters; i++) {
+        qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+        qpci_config_writew(dev, PCI_COMMAND, cmd);
+    }
+    toggle = get_clock() - start;
+
+    start = get_clock();
+    for (i = 0; i < n_iters; i++) {
+        qpci_config_writel(dev, PCI_BASE_ADDRESS_0, BAR0_ADDR_B);
+        qpci_config_writel(dev, PCI_BASE_ADDRESS_0, BAR0_ADDR_A);
+    }
+    move = get_clock() - start;
+
+    printf("%u devices, %u iterations\n", n_devices, n_iters);
+    report("config write", base, n_iters, -1);
+    report("memory decode toggle", toggle, n_iters * 2, base * 2);
+    report("BAR move", move, n_iters * 2, base * 2);
+
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_end();
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * QMP round trip benchmark for large replies
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * Starts a PC machine under qtest with many vCPUs and many (null) block
+ * devices, then times QMP commands whose replies grow with the size of
+ * the guest or of the schema:
+ *
+ *   - query-qmp-schema, the largest reply QEMU has;
+ *   - query-cpus, one entry per vCPU;
+ *   - query-block, one entry per drive.
+ *
+ * query-status is timed too; its reply is tiny, so it gives the cost of
+ * a round trip over the QMP socket that the others can be compared
+ * with.  The times include parsing the reply on the client side.
+ *
+ * Run it with QTEST_QEMU_BINARY set, e.g.
+ *   QTEST_QEMU_BINARY=x86_64-softmmu/qemu-system-x86_64 tests/qmp-bench
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu/timer.h"
+#include "qapi/qmp/qjson.h"
+
+static unsigned int n_cpus = 128;
+static unsigned int n_drives = 64;
+static unsigned int n_iters = 100;
+
+static const char commands[] = "\n"
+    " -c = number of vCPUs (default 128)\n"
+    " -d = number of drives (default 64)\n"
+    " -n = number of iterations (default 100)\n"
+    " -h = show this help message.\n";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "c:d:hn:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'c':
+            n_cpus = atoi(optarg);
+            break;
+        case 'd':
+            n_drives = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        default:
+            usage_complete(argc, argv);
+            exit(1);
+        }
+    }
+    if (!n_cpus || n_cpus > 255 || !n_iters) {
+        usage_complete(argc, argv);
+        exit(1);
+    }
+}
+
+static void bench(const char *cmd)
+{
+    QDict *rsp;
+    QString *json;
+    size_t size;
+    int64_t start, ns;
+    unsigned int i;
+
+    rsp = qmp("{ 'execute': %s }", cmd);
+    g_assert(qdict_haskey(rsp, "return"));
+    json = qobject_to_json(QOBJECT(rsp));
+    size = qstring_get_length(json);
+    QDECREF(json);
+    QDECREF(rsp);
+
+    start = get_clock();
+    for (i = 0; i < n_iters; i++) {
+        rsp = qmp("{ 'execute': %s }", cmd);
+        QDECREF(rsp);
+    }
+    ns = get_clock() - start;
+
+    printf("%-20s %10zu bytes %10.2f us/op\n",
+           cmd, size, (double)ns / n_iters / 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    GString *cmdline = g_string_new("-M pc -nodefaults");
+    unsigned int i;
+
+    parse_args(argc, argv);
+
+    g_string_append_printf(cmdline, " -smp %u", n_cpus);
+    for (i = 0; i < n_drives; i++) {
+        g_string_append_printf(cmdline,
+                               " -drive if=none,driver=null-co,id=drive%u", i);
+    }
+    qtest_start(cmdline->str);
+    g_string_free(cmdline, true);
+
+    printf("%u vCPUs, %u drives, %u iterations\n", n_cpus, n_drives, n_iters);
+    bench("query-status");
+    bench("query-qmp-schema");
+    bench("query-cpus");
+    bench("query-block");
+
+    qtest_end();
+    return 0;
+}
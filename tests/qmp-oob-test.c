@@ -0,0 +1,174 @@
+/*
+ * QTest testcase for out-of-band QMP execution
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * A second monitor runs on a socket chardev with io-thread=on.  The
+ * main loop is kept busy by a blockdev-add whose blkdebug config file is
+ * a FIFO: opening it for reading blocks until the test opens the other
+ * end.  While it is blocked:
+ *
+ *   - "exec-oob" commands are still answered, by the monitor I/O thread;
+ *   - once QMP_REQ_QUEUE_LEN_MAX (8) in-band requests are pending, the
+ *     I/O thread stops reading, so not even out-of-band commands are
+ *     answered until the main loop catches up;
+ *   - the in-band replies then come back in the order of the requests.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qstring.h"
+#include "qemu/sockets.h"
+
+#define QMP_REQ_QUEUE_LEN_MAX 8
+
+static char tmpdir[] = "/tmp/qmp-oob-test.XXXXXX";
+static char *fifo_path;
+
+/* Receive a reply and check that it is a success for request @id */
+static void get_return(int fd, const char *id)
+{
+    QDict *rsp = qmp_fd_receive(fd);
+
+    g_assert(qdict_haskey(rsp, "return"));
+    g_assert_cmpstr(qdict_get_try_str(rsp, "id"), ==, id);
+    QDECREF(rsp);
+}
+
+static bool fd_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+/* Let the blocked blockdev-add read an empty config file */
+static void unblock_main_loop(void)
+{
+    int fd = open(fifo_path, O_WRONLY);
+
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+}
+
+static void block_main_loop(int fd, const char *id)
+{
+    qmp_fd_send(fd, "{ 'execute': 'blockdev-add', 'id': %s,"
+                "  'arguments': { 'driver': 'blkdebug', 'node-name': %s,"
+                "                 'config': %s,"
+                "                 'image': { 'driver': 'null-co' } } }",
+                id, id, fifo_path);
+}
+
+static int qmp_oob_connect(const char *path)
+{
+    QDict *rsp, *qmp;
+    QList *caps;
+    int fd;
+
+    fd = unix_connect(path, &error_abort);
+
+    /* The greeting offers the capability only with io-thread=on */
+    rsp = qmp_fd_receive(fd);
+    qmp = qdict_get_qdict(rsp, "QMP");
+    caps = qdict_get_qlist(qmp, "capabilities");
+    g_assert_cmpint(qlist_size(caps), ==, 1);
+    g_assert_cmpstr(qstring_get_str(qobject_to_qstring(qlist_peek(caps))),
+                    ==, "oob");
+    QDECREF(rsp);
+
+    rsp = qmp_fd(fd, "{ 'execute': 'qmp_capabilities',"
+                 "  'arguments': { 'enable': [ 'oob' ] } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+    return fd;
+}
+
+static void test_qmp_oob(void)
+{
+    char *sock_path, *args;
+    char id[16];
+    bool seen_oob = false;
+    QDict *rsp;
+    int fd, i;
+
+    sock_path = g_strdup_printf("%s/qmp.sock", tmpdir);
+    args = g_strdup_printf("-nodefaults "
+                           "-chardev socket,id=mon0,path=%s,server,nowait "
+                           "-mon chardev=mon0,mode=control,io-thread=on",
+                           sock_path);
+    qtest_start(args);
+    fd = qmp_oob_connect(sock_path);
+
+    /* Only commands marked allow-oob may bypass the queue */
+    rsp = qmp_fd(fd, "{ 'exec-oob': 'query-kvm', 'id': 'no-oob' }");
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+
+    /* The I/O thread answers while the main loop is stuck */
+    block_main_loop(fd, "blocked");
+    rsp = qmp_fd(fd, "{ 'exec-oob': 'query-status', 'id': 'oob0' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    g_assert_cmpstr(qdict_get_str(rsp, "id"), ==, "oob0");
+    QDECREF(rsp);
+
+    /* Fill up the queue; the blocked request counts as pending */
+    for (i = 1; i < QMP_REQ_QUEUE_LEN_MAX; i++) {
+        snprintf(id, sizeof(id), "ib%d", i);
+        qmp_fd_send(fd, "{ 'execute': 'query-status', 'id': %s }", id);
+    }
+    qmp_fd_send(fd, "{ 'exec-oob': 'query-status', 'id': 'oob1' }");
+    g_assert(!fd_readable(fd, 200));
+
+    /* In-band replies come back in order, oob1 somewhere after the first */
+    unblock_main_loop();
+    get_return(fd, "blocked");
+    for (i = 1; i < QMP_REQ_QUEUE_LEN_MAX; i++) {
+        snprintf(id, sizeof(id), "ib%d", i);
+        rsp = qmp_fd_receive(fd);
+        if (!seen_oob && !strcmp(qdict_get_str(rsp, "id"), "oob1")) {
+            seen_oob = true;
+            QDECREF(rsp);
+            rsp = qmp_fd_receive(fd);
+        }
+        g_assert(qdict_haskey(rsp, "return"));
+        g_assert_cmpstr(qdict_get_str(rsp, "id"), ==, id);
+        QDECREF(rsp);
+    }
+    if (!seen_oob) {
+        get_return(fd, "oob1");
+    }
+
+    /* The main loop is responsive again */
+    rsp = qmp_fd(fd, "{ 'execute': 'query-status', 'id': 'done' }");
+    g_assert_cmpstr(qdict_get_str(rsp, "id"), ==, "done");
+    QDECREF(rsp);
+
+    close(fd);
+    qtest_end();
+    unlink(sock_path);
+    g_free(sock_path);
+    g_free(args);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_assert(mkdtemp(tmpdir));
+    fifo_path = g_strdup_printf("%s/blkdebug.conf", tmpdir);
+    g_assert_cmpint(mkfifo(fifo_path, 0600), ==, 0);
+
+    qtest_add_func("/qmp/oob", test_qmp_oob);
+    ret = g_test_run();
+
+    unlink(fifo_path);
+    g_free(fifo_path);
+    rmdir(tmpdir);
+    return ret;
+}
@@ -0,0 +1,126 @@
+/*
+ *  TCG micro-benchmarks
+ *
+ *  Small kernels that stress the code generated by TCG rather than the
+ *  helpers: conditional code inside translation blocks, integer arithmetic
+ *  on CPU state, memory traffic and floating point.  Run natively and under
+ *  QEMU (see the 'bench' make target) and compare the times.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define BUF_SIZE 4096
+
+static uint8_t buf[BUF_SIZE];
+static double vec_a[1024], vec_b[1024];
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Data dependent branches that stay within a translation block.  */
+static uint32_t bench_branches(unsigned iters)
+{
+    uint32_t x = 1, acc = 0;
+    unsigned i;
+
+    for (i = 0; i < iters; i++) {
+        x = x * 1103515245 + 12345;
+        if (x & 0x100) {
+            acc += x >> 3;
+        } else {
+            acc ^= x;
+        }
+        if ((int32_t)acc < 0) {
+            acc = -acc;
+        }
+    }
+    return acc;
+}
+
+/* Arithmetic on a few variables: mostly register (global) traffic.  */
+static uint32_t bench_arith(unsigned iters)
+{
+    uint32_t a = 1, b = 2, c = 3, d = 4;
+    unsigned i;
+
+    for (i = 0; i < iters; i++) {
+        a += b ^ (c << 3);
+        b -= c | (d >> 2);
+        c ^= a + d;
+        d += a & b;
+    }
+    return a ^ b ^ c ^ d;
+}
+
+/* Byte-wise loads and stores to guest memory.  */
+static uint32_t bench_memory(unsigned iters)
+{
+    uint32_t sum = 0;
+    unsigned i, j;
+
+    for (i = 0; i < iters; i++) {
+        for (j = 0; j < BUF_SIZE; j++) {
+            buf[j] = buf[j] + j + i;
+            sum += buf[j];
+        }
+    }
+    return sum;
+}
+
+/* Floating point multiply-accumulate.  */
+static double bench_float(unsigned iters)
+{
+    double sum = 0;
+    unsigned i, j;
+
+    for (j = 0; j < 1024; j++) {
+        vec_a[j] = j * 0.5;
+        vec_b[j] = 1.0 / (j + 1);
+    }
+    for (i = 0; i < iters; i++) {
+        for (j = 0; j < 1024; j++) {
+            sum += vec_a[j] * vec_b[j];
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned scale = argc > 1 ? atoi(argv[1]) : 1;
+    double t;
+
+#define RUN(name, expr, fmt)                                   \
+    do {                                                       \
+        t = now();                                             \
+        printf("%-10s " fmt, name, expr);                      \
+        printf(" %8.3f s\n", now() - t);                       \
+    } while (0)
+
+    RUN("branches", bench_branches(scale * 100000000u), "%10u");
+    RUN("arith", bench_arith(scale * 100000000u), "%10u");
+    RUN("memory", bench_memory(scale * 10000u), "%10u");
+    RUN("float", bench_float(scale * 50000u), "%10.4g");
+    return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * QTest testcase for colo-compare
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * The test plays both the primary and the secondary: it writes TCP
+ * segments to the primary_in and secondary_in sockets, reads what
+ * colo-compare releases on outdev, and checks the "stats" property.
+ *
+ * qemu side                  | test side
+ *                            |
+ * +--------------+           |  +---------+
+ * |              <--------------+ pri     |
+ * |              |           |  +---------+
+ * | colo-compare <--------------+ sec     |
+ * |              |           |  +---------+
+ * |              +--------------> out     |
+ * +--------------+           |  +---------+
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "libqtest.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
+#include "qemu/bswap.h"
+#include "qapi/qmp/qdict.h"
+
+#define ETH_HDR_LEN     14
+#define IP_HDR_LEN      20
+#define TCP_HDR_LEN     20
+#define TCP_FLAG_PSH    0x08
+#define TCP_FLAG_ACK    0x10
+
+#define MAX_PACKET      (ETH_HDR_LEN + IP_HDR_LEN + TCP_HDR_LEN + 1024)
+
+typedef struct Packet {
+    uint8_t data[MAX_PACKET];
+    uint32_t len;
+} Packet;
+
+typedef struct CompareTest {
+    char path[3][32];
+    int pri;
+    int sec;
+    int out;
+} CompareTest;
+
+/*
+ * Build a TCP segment from 10.0.0.1:@sport to 10.0.0.2:80 with
+ * @len bytes of @fill as payload.
+ */
+static void build_tcp(Packet *pkt, uint16_t sport, uint32_t seq,
+                      uint8_t fill, int len)
+{
+    uint8_t *ip = pkt->data + ETH_HDR_LEN;
+    uint8_t *tcp = ip + IP_HDR_LEN;
+
+    g_assert_cmpint(len, <=, 1024);
+    memset(pkt->data, 0, sizeof(pkt->data));
+    pkt->len = ETH_HDR_LEN + IP_HDR_LEN + TCP_HDR_LEN + len;
+
+    memcpy(pkt->data, "\x52\x54\x00\x12\x34\x57\x52\x54\x00\x12\x34\x56", 12);
+    stw_be_p(pkt->data + 12, 0x0800);
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, IP_HDR_LEN + TCP_HDR_LEN + len);
+    stw_be_p(ip + 6, 0x4000);               /* DF */
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    stl_be_p(ip + 12, 0x0a000001);
+    stl_be_p(ip + 16, 0x0a000002);
+
+    stw_be_p(tcp, sport);
+    stw_be_p(tcp + 2, 80);
+    stl_be_p(tcp + 4, seq);
+    stl_be_p(tcp + 8, 1);
+    tcp[12] = (TCP_HDR_LEN / 4) << 4;
+    tcp[13] = TCP_FLAG_ACK | (len ? TCP_FLAG_PSH : 0);
+    stw_be_p(tcp + 14, 65535);
+
+    memset(tcp + TCP_HDR_LEN, fill, len);
+}
+
+static void send_packet(int fd, const Packet *pkt)
+{
+    uint32_t size = htonl(pkt->len);
+    struct iovec iov[] = {
+        {
+            .iov_base = &size,
+            .iov_len = sizeof(size),
+        }, {
+            .iov_base = (void *)pkt->data,
+            .iov_len = pkt->len,
+        },
+    };
+    ssize_t ret;
+
+    ret = iov_send(fd, iov, 2, 0, sizeof(size) + pkt->len);
+    g_assert_cmpint(ret, ==, sizeof(size) + pkt->len);
+}
+
+static void recv_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = qemu_recv(fd, (uint8_t *)buf + done, len - done, 0);
+
+        g_assert_cmpint(ret, >, 0);
+        done += ret;
+    }
+}
+
+static void recv_packet(int fd, Packet *pkt)
+{
+    uint32_t len;
+
+    recv_full(fd, &len, sizeof(len));
+    pkt->len = ntohl(len);
+    g_assert_cmpint(pkt->len, <=, sizeof(pkt->data));
+    recv_full(fd, pkt->data, pkt->len);
+}
+
+/* Check that the next packet released on outdev is @expected */
+static void expect_packet(CompareTest *t, const Packet *expected)
+{
+    Packet pkt;
+
+    recv_packet(t->out, &pkt);
+    g_assert_cmpint(pkt.len, ==, expected->len);
+    g_assert(!memcmp(pkt.data, expected->data, pkt.len));
+}
+
+static int64_t get_stat(const char *name)
+{
+    QDict *rsp, *stats;
+    int64_t value;
+
+    rsp = qmp("{ 'execute': 'qom-get', 'arguments': {"
+              " 'path': '/objects/comp0', 'property': 'stats' } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    stats = qdict_get_qdict(rsp, "return");
+    value = qdict_get_int(stats, name);
+    QDECREF(rsp);
+    return value;
+}
+
+/* colo-compare counts packets as it queues them */
+static void wait_stat(const char *name, int64_t value)
+{
+    gint64 end = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+
+    while (get_stat(name) < value) {
+        g_assert(g_get_monotonic_time() < end);
+        g_usleep(1000);
+    }
+    g_assert_cmpint(get_stat(name), ==, value);
+}
+
+static void compare_start(CompareTest *t, int threads)
+{
+    char *cmdline;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        snprintf(t->path[i], sizeof(t->path[i]), "colo-compare%d.XXXXXX", i);
+        g_assert_cmpint(mkstemp(t->path[i]), !=, -1);
+    }
+
+    cmdline = g_strdup_printf("-chardev socket,id=pri0,path=%s,server,nowait "
+                              "-chardev socket,id=sec0,path=%s,server,nowait "
+                              "-chardev socket,id=out0,path=%s,server,nowait "
+                              "-object colo-compare,id=comp0,primary_in=pri0,"
+                              "secondary_in=sec0,outdev=out0,"
+                              "compare_threads=%d",
+                              t->path[0], t->path[1], t->path[2], threads);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    t->pri = unix_connect(t->path[0], NULL);
+    g_assert_cmpint(t->pri, !=, -1);
+    t->sec = unix_connect(t->path[1], NULL);
+    g_assert_cmpint(t->sec, !=, -1);
+    t->out = unix_connect(t->path[2], NULL);
+    g_assert_cmpint(t->out, !=, -1);
+
+    /* send a qmp command to guarantee that 'connected' is setting to true. */
+    qmp_discard_response("{ 'execute' : 'query-status'}");
+}
+
+static void compare_end(CompareTest *t)
+{
+    int i;
+
+    close(t->pri);
+    close(t->sec);
+    close(t->out);
+    qtest_end();
+    for (i = 0; i < 3; i++) {
+        unlink(t->path[i]);
+    }
+}
+
+/*
+ * The secondary sent one 200 byte segment, the primary two 100 byte
+ * segments: both primary segments must be released, in order.
+ */
+static void test_tcp_bulk(void)
+{
+    CompareTest t;
+    Packet s, p1, p2;
+
+    compare_start(&t, 1);
+    build_tcp(&s, 1000, 1000, 'a', 200);
+    build_tcp(&p1, 1000, 1000, 'a', 100);
+    build_tcp(&p2, 1000, 1100, 'a', 100);
+
+    send_packet(t.sec, &s);
+    wait_stat("secondary-packets", 1);
+    send_packet(t.pri, &p1);
+    send_packet(t.pri, &p2);
+
+    expect_packet(&t, &p1);
+    expect_packet(&t, &p2);
+    wait_stat("matched", 2);
+    g_assert_cmpint(get_stat("miscompared"), ==, 0);
+    compare_end(&t);
+}
+
+/*
+ * A pure ACK between two primary segments that the secondary sent as
+ * one must not be overtaken by the second segment.
+ */
+static void test_tcp_ack_order(void)
+{
+    CompareTest t;
+    Packet s, ack, p1, p2;
+
+    compare_start(&t, 1);
+    build_tcp(&s, 1000, 1000, 'a', 200);
+    build_tcp(&ack, 1000, 1100, 0, 0);
+    build_tcp(&p1, 1000, 1000, 'a', 100);
+    build_tcp(&p2, 1000, 1100, 'a', 100);
+
+    send_packet(t.sec, &s);
+    send_packet(t.sec, &ack);
+    wait_stat("secondary-packets", 2);
+    send_packet(t.pri, &p1);
+    send_packet(t.pri, &ack);
+    send_packet(t.pri, &p2);
+
+    expect_packet(&t, &p1);
+    expect_packet(&t, &ack);
+    expect_packet(&t, &p2);
+    wait_stat("matched", 3);
+    compare_end(&t);
+}
+
+/*
+ * Both sides retransmit a segment.  The secondary retransmission is
+ * only indexed once the first copy is released, and must then match
+ * the primary retransmission.
+ */
+static void test_tcp_retransmit(void)
+{
+    CompareTest t;
+    Packet s1, s2, p1, p2;
+
+    compare_start(&t, 1);
+    build_tcp(&s1, 1000, 1000, 'a', 100);
+    build_tcp(&s2, 1000, 1100, 'b', 100);
+    build_tcp(&p1, 1000, 1000, 'a', 100);
+    build_tcp(&p2, 1000, 1100, 'b', 100);
+
+    send_packet(t.sec, &s1);
+    send_packet(t.sec, &s1);
+    send_packet(t.sec, &s2);
+    wait_stat("secondary-packets", 3);
+    send_packet(t.pri, &p1);
+    send_packet(t.pri, &p1);
+    send_packet(t.pri, &p2);
+
+    expect_packet(&t, &p1);
+    expect_packet(&t, &p1);
+    expect_packet(&t, &p2);
+    wait_stat("matched", 3);
+    g_assert_cmpint(get_stat("miscompared"), ==, 0);
+    compare_end(&t);
+}
+
+/* A differing primary segment is counted once, however often it's retried */
+static void test_tcp_miscompare(void)
+{
+    CompareTest t;
+    Packet s, p, ack;
+    int i;
+
+    compare_start(&t, 1);
+    build_tcp(&s, 1000, 1000, 'b', 100);
+    build_tcp(&p, 1000, 1000, 'a', 100);
+
+    send_packet(t.sec, &s);
+    wait_stat("secondary-packets", 1);
+    send_packet(t.pri, &p);
+    wait_stat("primary-packets", 1);
+
+    /* Each secondary packet retries the comparison of the primary head */
+    for (i = 0; i < 3; i++) {
+        build_tcp(&ack, 1000, 2000 + i, 0, 0);
+        send_packet(t.sec, &ack);
+    }
+    wait_stat("secondary-packets", 4);
+
+    g_assert_cmpint(get_stat("miscompared"), ==, 1);
+    g_assert_cmpint(get_stat("matched"), ==, 0);
+    compare_end(&t);
+}
+
+/*
+ * Connections spread over several compare threads.  Each connection's
+ * segments must still be released in order, and the statistics of all
+ * shards must add up.
+ */
+static void test_tcp_shards(void)
+{
+    enum { CONNS = 8 };
+    CompareTest t;
+    Packet s, p;
+    uint32_t next_seq[CONNS];
+    int i;
+
+    compare_start(&t, 4);
+    for (i = 0; i < CONNS; i++) {
+        build_tcp(&s, 2000 + i, 1000, 'a' + i, 200);
+        send_packet(t.sec, &s);
+    }
+    wait_stat("secondary-packets", CONNS);
+    for (i = 0; i < CONNS; i++) {
+        build_tcp(&p, 2000 + i, 1000, 'a' + i, 100);
+        send_packet(t.pri, &p);
+        build_tcp(&p, 2000 + i, 1100, 'a' + i, 100);
+        send_packet(t.pri, &p);
+        next_seq[i] = 1000;
+    }
+
+    for (i = 0; i < 2 * CONNS; i++) {
+        uint8_t *tcp = p.data + ETH_HDR_LEN + IP_HDR_LEN;
+        int conn;
+
+        recv_packet(t.out, &p);
+        g_assert_cmpint(p.len, ==, ETH_HDR_LEN + IP_HDR_LEN +
+                                   TCP_HDR_LEN + 100);
+        conn = lduw_be_p(tcp) - 2000;
+        g_assert_cmpint(conn, >=, 0);
+        g_assert_cmpint(conn, <, CONNS);
+        g_assert_cmpint(ldl_be_p(tcp + 4), ==, next_seq[conn]);
+        g_assert_cmpint(tcp[TCP_HDR_LEN], ==, 'a' + conn);
+        next_seq[conn] += 100;
+    }
+
+    wait_stat("primary-packets", 2 * CONNS);
+    wait_stat("matched", 2 * CONNS);
+    g_assert_cmpint(get_stat("miscompared"), ==, 0);
+    compare_end(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+#ifndef _WIN32
+    /* PF_UNIX sockets which do not exist on windows */
+    qtest_add_func("/colo-compare/tcp/bulk", test_tcp_bulk);
+    qtest_add_func("/colo-compare/tcp/ack-order", test_tcp_ack_order);
+    qtest_add_func("/colo-compare/tcp/retransmit", test_tcp_retransmit);
+    qtest_add_func("/colo-compare/tcp/miscompare", test_tcp_miscompare);
+    qtest_add_func("/colo-compare/tcp/shards", test_tcp_shards);
+#endif
+
+    return g_test_run();
+}
@@ -224,6 +224,40 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check that terminated coroutines are reused
+ */
+
+static void test_pool(void)
+{
+    CoroutinePoolStats before, after;
+    Coroutine *coroutine;
+    bool done;
+    int i;
+
+    qemu_coroutine_get_pool_stats(&before);
+    for (i = 0; i < 1000; i++) {
+        done = false;
+        coroutine = qemu_coroutine_create(set_and_exit, &done);
+        qemu_coroutine_enter(coroutine);
+        g_assert(done);
+    }
+    qemu_coroutine_get_pool_stats(&after);
+
+    /* Once the pool has filled up, nothing is allocated or freed.  */
+    g_assert_cmpint(after.misses - before.misses, <=, before.batch_size + 1);
+    g_assert_cmpint(after.frees, ==, before.frees);
+    g_assert_cmpint(after.hits - before.hits, >, 0);
+    g_assert_cmpint(after.hits - before.hits +
+                    after.misses - before.misses, <=, 1000);
+
+    /* A bigger pool is handed out in bigger batches.  */
+    qemu_coroutine_increase_pool_batch_size(64);
+    qemu_coroutine_get_pool_stats(&after);
+    g_assert_cmpint(after.batch_size, ==, before.batch_size + 64);
+    qemu_coroutine_decrease_pool_batch_size(64);
+}
+
 
 #define RECORD_SIZE 10 /* Leave some room for expansion */
 struct coroutine_position {
@@ -427,6 +461,9 @@ int main(int argc, char **argv)
     }
 
     g_test_add_func("/basic/lifecycle", test_lifecycle);
+    if (CONFIG_COROUTINE_POOL) {
+        g_test_add_func("/basic/pool", test_pool);
+    }
     g_test_add_func("/basic/yield", test_yield);
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
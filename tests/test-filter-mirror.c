@@ -14,6 +14,73 @@
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
+
+#ifndef _WIN32
+/* Send @n NUL-terminated packets, framed as the socket netdev does */
+static void send_packets(int sock, const char **pkts, int n)
+{
+    GString *buf = g_string_new(NULL);
+    struct iovec iov;
+    uint32_t size;
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        size = htonl(strlen(pkts[i]) + 1);
+        g_string_append_len(buf, (char *)&size, sizeof(size));
+        g_string_append_len(buf, pkts[i], strlen(pkts[i]) + 1);
+    }
+
+    /* One write, so that QEMU reads the packets in one go */
+    iov.iov_base = buf->str;
+    iov.iov_len = buf->len;
+    ret = iov_send(sock, &iov, 1, 0, buf->len);
+    g_assert_cmpint(ret, ==, buf->len);
+    g_string_free(buf, TRUE);
+}
+
+static void recv_packet(int sock, const char *expected)
+{
+    uint32_t ret, len = 0;
+    char *recv_buf;
+
+    ret = qemu_recv(sock, &len, sizeof(len), 0);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    len = ntohl(len);
+
+    g_assert_cmpint(len, ==, strlen(expected) + 1);
+    recv_buf = g_malloc(len);
+    ret = qemu_recv(sock, recv_buf, len, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, len);
+    g_assert_cmpstr(recv_buf, ==, expected);
+    g_free(recv_buf);
+}
+
+/* Can this process create the multiqueue tap the test asks QEMU for? */
+static bool have_multiqueue_tap(void)
+{
+#ifdef __linux__
+    struct ifreq ifr = {
+        .ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE,
+    };
+    int fd = open("/dev/net/tun", O_RDWR);
+    bool ok;
+
+    if (fd < 0) {
+        return false;
+    }
+    ok = ioctl(fd, TUNSETIFF, &ifr) == 0;
+    close(fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+#endif
 
 static void test_mirror(void)
 {
@@ -74,7 +141,108 @@ static void test_mirror(void)
     g_free(recv_buf);
     close(recv_sock);
     unlink(sock_path);
+    qtest_end();
+
+#endif
+}
+
+static void test_mirror_batch(void)
+{
+#ifndef _WIN32
+    const char *pkts[] = { "batch 0", "batch 1", "batch 2" };
+    char sock_path[] = "filter-mirror.XXXXXX";
+    int send_sock[2], recv_sock, i, ret;
+    char *cmdline;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, send_sock);
+    g_assert_cmpint(ret, !=, -1);
+    ret = mkstemp(sock_path);
+    g_assert_cmpint(ret, !=, -1);
+
+    /* The socket netdev hands the packets of one read over as a batch */
+    cmdline = g_strdup_printf("-netdev socket,id=qtest-bn0,fd=%d "
+                 "-device e1000,netdev=qtest-bn0,id=qtest-e0 "
+                 "-chardev socket,id=mirror0,path=%s,server,nowait "
+                 "-object filter-mirror,id=qtest-f0,netdev=qtest-bn0,queue=tx,outdev=mirror0 "
+                 , send_sock[1], sock_path);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    recv_sock = unix_connect(sock_path, NULL);
+    g_assert_cmpint(recv_sock, !=, -1);
+    qmp("{ 'execute' : 'query-status'}");
+
+    send_packets(send_sock[0], pkts, ARRAY_SIZE(pkts));
+    for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+        recv_packet(recv_sock, pkts[i]);
+    }
+
+    close(send_sock[0]);
+    close(recv_sock);
+    unlink(sock_path);
+    qtest_end();
+#endif
+}
 
+static void test_mirror_multiqueue(void)
+{
+#ifndef _WIN32
+    const char *pkts[] = { "queue 0", "queue 1" };
+    char in_path[] = "filter-mirror-in.XXXXXX";
+    char out_path[] = "filter-mirror-out.XXXXXX";
+    int in_sock, recv_sock, i, ret;
+    char *cmdline;
+    QDict *rsp;
+
+    if (!have_multiqueue_tap()) {
+        g_test_message("Skipping: cannot create a multiqueue tap");
+        return;
+    }
+
+    ret = mkstemp(in_path);
+    g_assert_cmpint(ret, !=, -1);
+    ret = mkstemp(out_path);
+    g_assert_cmpint(ret, !=, -1);
+
+    /*
+     * Both filters sit on the chain the tap queues share: packets put
+     * in by the redirector must come out of the mirror behind it.
+     */
+    cmdline = g_strdup_printf("-netdev tap,id=qtest-bn0,queues=2,"
+                 "script=no,downscript=no "
+                 "-device virtio-net-pci,netdev=qtest-bn0,mq=on,vectors=6 "
+                 "-chardev socket,id=in0,path=%s,server,nowait "
+                 "-chardev socket,id=mirror0,path=%s,server,nowait "
+                 "-object filter-redirector,id=qtest-f0,netdev=qtest-bn0,"
+                 "queue=tx,indev=in0 "
+                 "-object filter-mirror,id=qtest-f1,netdev=qtest-bn0,"
+                 "queue=tx,outdev=mirror0 "
+                 , in_path, out_path);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    in_sock = unix_connect(in_path, NULL);
+    g_assert_cmpint(in_sock, !=, -1);
+    recv_sock = unix_connect(out_path, NULL);
+    g_assert_cmpint(recv_sock, !=, -1);
+    qmp("{ 'execute' : 'query-status'}");
+
+    send_packets(in_sock, pkts, ARRAY_SIZE(pkts));
+    for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+        recv_packet(recv_sock, pkts[i]);
+    }
+
+    /* Filters on a multiqueue netdev can be removed again */
+    rsp = qmp("{ 'execute' : 'object-del',"
+              " 'arguments' : { 'id' : 'qtest-f1' } }");
+    g_assert(!qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+
+    close(in_sock);
+    close(recv_sock);
+    unlink(in_path);
+    unlink(out_path);
+    qtest_end();
 #endif
 }
 
@@ -85,8 +253,9 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
 
     qtest_add_func("/netfilter/mirror", test_mirror);
+    qtest_add_func("/netfilter/mirror_batch", test_mirror_batch);
+    qtest_add_func("/netfilter/mirror_multiqueue", test_mirror_multiqueue);
     ret = g_test_run();
-    qtest_end();
 
     return ret;
 }
@@ -48,6 +48,13 @@
  * |  rd2    <---------------+sock0  |
  * +---------+            |  +-------+
  *                        +
+ *
+ * --------------------------------------
+ * Case 3, batched tx: the backend sends several packets in one write and
+ * rd0 forwards them in order.
+ *
+ * Case 4, multiqueue: rd0 feeds packets into the filter chain shared by
+ * the queues of a tap with queues=2, and rd1 behind it sends them out.
  */
 
 #include "qemu/osdep.h"
@@ -56,6 +63,73 @@
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
+
+#ifndef _WIN32
+/* Send @n NUL-terminated packets, framed as the socket netdev does */
+static void send_packets(int sock, const char **pkts, int n)
+{
+    GString *buf = g_string_new(NULL);
+    struct iovec iov;
+    uint32_t size;
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        size = htonl(strlen(pkts[i]) + 1);
+        g_string_append_len(buf, (char *)&size, sizeof(size));
+        g_string_append_len(buf, pkts[i], strlen(pkts[i]) + 1);
+    }
+
+    /* One write, so that QEMU reads the packets in one go */
+    iov.iov_base = buf->str;
+    iov.iov_len = buf->len;
+    ret = iov_send(sock, &iov, 1, 0, buf->len);
+    g_assert_cmpint(ret, ==, buf->len);
+    g_string_free(buf, TRUE);
+}
+
+static void recv_packet(int sock, const char *expected)
+{
+    uint32_t ret, len = 0;
+    char *recv_buf;
+
+    ret = qemu_recv(sock, &len, sizeof(len), 0);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    len = ntohl(len);
+
+    g_assert_cmpint(len, ==, strlen(expected) + 1);
+    recv_buf = g_malloc(len);
+    ret = qemu_recv(sock, recv_buf, len, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, len);
+    g_assert_cmpstr(recv_buf, ==, expected);
+    g_free(recv_buf);
+}
+
+/* Can this process create the multiqueue tap the test asks QEMU for? */
+static bool have_multiqueue_tap(void)
+{
+#ifdef __linux__
+    struct ifreq ifr = {
+        .ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE,
+    };
+    int fd = open("/dev/net/tun", O_RDWR);
+    bool ok;
+
+    if (fd < 0) {
+        return false;
+    }
+    ok = ioctl(fd, TUNSETIFF, &ifr) == 0;
+    close(fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+#endif
 
 static void test_redirector_tx(void)
 {
@@ -207,10 +281,102 @@ static void test_redirector_rx(void)
 #endif
 }
 
+static void test_redirector_batch(void)
+{
+#ifndef _WIN32
+    const char *pkts[] = { "batch 0", "batch 1", "batch 2", "batch 3" };
+    char sock_path[] = "filter-redirector0.XXXXXX";
+    int backend_sock[2], recv_sock, i, ret;
+    char *cmdline;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, backend_sock);
+    g_assert_cmpint(ret, !=, -1);
+    ret = mkstemp(sock_path);
+    g_assert_cmpint(ret, !=, -1);
+
+    cmdline = g_strdup_printf("-netdev socket,id=qtest-bn0,fd=%d "
+                "-device rtl8139,netdev=qtest-bn0,id=qtest-e0 "
+                "-chardev socket,id=redirector0,path=%s,server,nowait "
+                "-object filter-redirector,id=qtest-f0,netdev=qtest-bn0,"
+                "queue=tx,outdev=redirector0 "
+                , backend_sock[1], sock_path);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    recv_sock = unix_connect(sock_path, NULL);
+    g_assert_cmpint(recv_sock, !=, -1);
+    qmp("{ 'execute' : 'query-status'}");
+
+    send_packets(backend_sock[0], pkts, ARRAY_SIZE(pkts));
+    for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+        recv_packet(recv_sock, pkts[i]);
+    }
+
+    close(backend_sock[0]);
+    close(recv_sock);
+    unlink(sock_path);
+    qtest_end();
+#endif
+}
+
+static void test_redirector_multiqueue(void)
+{
+#ifndef _WIN32
+    const char *pkts[] = { "queue 0", "queue 1" };
+    char sock_path0[] = "filter-redirector0.XXXXXX";
+    char sock_path1[] = "filter-redirector1.XXXXXX";
+    int send_sock, recv_sock, i, ret;
+    char *cmdline;
+
+    if (!have_multiqueue_tap()) {
+        g_test_message("Skipping: cannot create a multiqueue tap");
+        return;
+    }
+
+    ret = mkstemp(sock_path0);
+    g_assert_cmpint(ret, !=, -1);
+    ret = mkstemp(sock_path1);
+    g_assert_cmpint(ret, !=, -1);
+
+    cmdline = g_strdup_printf("-netdev tap,id=qtest-bn0,queues=2,"
+                "script=no,downscript=no "
+                "-device virtio-net-pci,netdev=qtest-bn0,mq=on,vectors=6 "
+                "-chardev socket,id=redirector0,path=%s,server,nowait "
+                "-chardev socket,id=redirector1,path=%s,server,nowait "
+                "-object filter-redirector,id=qtest-f0,netdev=qtest-bn0,"
+                "queue=tx,indev=redirector0 "
+                "-object filter-redirector,id=qtest-f1,netdev=qtest-bn0,"
+                "queue=tx,outdev=redirector1 "
+                , sock_path0, sock_path1);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    send_sock = unix_connect(sock_path0, NULL);
+    g_assert_cmpint(send_sock, !=, -1);
+    recv_sock = unix_connect(sock_path1, NULL);
+    g_assert_cmpint(recv_sock, !=, -1);
+    qmp("{ 'execute' : 'query-status'}");
+
+    send_packets(send_sock, pkts, ARRAY_SIZE(pkts));
+    for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+        recv_packet(recv_sock, pkts[i]);
+    }
+
+    close(send_sock);
+    close(recv_sock);
+    unlink(sock_path0);
+    unlink(sock_path1);
+    qtest_end();
+#endif
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     qtest_add_func("/netfilter/redirector_tx", test_redirector_tx);
     qtest_add_func("/netfilter/redirector_rx", test_redirector_rx);
+    qtest_add_func("/netfilter/redirector_batch", test_redirector_batch);
+    qtest_add_func("/netfilter/redirector_multiqueue",
+                   test_redirector_multiqueue);
     return g_test_run();
 }
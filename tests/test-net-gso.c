@@ -0,0 +1,262 @@
+/*
+ * Software segmentation and receive coalescing tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gso.h"
+
+#define MSS             1448
+#define PAYLOAD_LEN     (40 * MSS + 100)
+#define TCP_HDR_LEN     32
+
+typedef struct Frames {
+    uint8_t *buf[64];
+    size_t size[64];
+    int count;
+    bool last_seen;
+} Frames;
+
+static ssize_t collect(void *opaque, const struct iovec *iov, int iovcnt,
+                       bool last)
+{
+    Frames *f = opaque;
+    size_t size = iov_size(iov, iovcnt);
+
+    g_assert_cmpint(f->count, <, ARRAY_SIZE(f->buf));
+    g_assert(!f->last_seen);
+    f->buf[f->count] = g_malloc(size);
+    f->size[f->count] = iov_to_buf(iov, iovcnt, 0, f->buf[f->count], size);
+    f->count++;
+    f->last_seen = last;
+    return size;
+}
+
+static void frames_free(Frames *f)
+{
+    int i;
+
+    for (i = 0; i < f->count; i++) {
+        g_free(f->buf[i]);
+    }
+}
+
+/* Build a TCP packet the way a guest hands it over with TSO enabled */
+static size_t build_packet(uint8_t *buf, bool ipv6, size_t payload,
+                           struct virtio_net_hdr *hdr)
+{
+    struct eth_header *eth = (struct eth_header *)buf;
+    size_t l3 = sizeof(*eth);
+    size_t l4 = l3 + (ipv6 ? sizeof(struct ip6_header) :
+                             sizeof(struct ip_header));
+    size_t size = l4 + TCP_HDR_LEN + payload;
+    uint8_t *tcp = buf + l4;
+    uint32_t csum, cso;
+    size_t i;
+
+    memset(buf, 0, l4 + TCP_HDR_LEN);
+    memset(eth->h_dest, 0x52, ETH_ALEN);
+    memset(eth->h_source, 0x54, ETH_ALEN);
+
+    if (ipv6) {
+        struct ip6_header *ip6 = (struct ip6_header *)(buf + l3);
+
+        eth->h_proto = cpu_to_be16(ETH_P_IPV6);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_flow = cpu_to_be32(0x60000000);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_plen = cpu_to_be16(size - l4);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt = IP_PROTO_TCP;
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim = 64;
+        ip6->ip6_src.s6_addr[15] = 1;
+        ip6->ip6_dst.s6_addr[15] = 2;
+        csum = eth_calc_ip6_pseudo_hdr_csum(ip6, size - l4, IP_PROTO_TCP,
+                                            &cso);
+    } else {
+        struct ip_header *ip = (struct ip_header *)(buf + l3);
+
+        eth->h_proto = cpu_to_be16(ETH_P_IP);
+        ip->ip_ver_len = 0x45;
+        ip->ip_len = cpu_to_be16(size - l3);
+        ip->ip_id = cpu_to_be16(0x1234);
+        ip->ip_off = cpu_to_be16(0x4000);
+        ip->ip_ttl = 64;
+        ip->ip_p = IP_PROTO_TCP;
+        ip->ip_src = cpu_to_be32(0x0a000001);
+        ip->ip_dst = cpu_to_be32(0x0a000002);
+        eth_fix_ip4_checksum(ip, sizeof(*ip));
+        csum = eth_calc_ip4_pseudo_hdr_csum(ip, size - l4, &cso);
+    }
+
+    stw_be_p(tcp, 1234);
+    stw_be_p(tcp + 2, 80);
+    stl_be_p(tcp + 4, 0xfffff000);  /* wraps around within the packet */
+    stl_be_p(tcp + 8, 42);
+    tcp[12] = (TCP_HDR_LEN / 4) << 4;
+    tcp[13] = TH_ACK | TH_PUSH;
+    stw_be_p(tcp + 14, 512);
+    /* A timestamp option, the same on every segment */
+    tcp[20] = 1;
+    tcp[21] = 1;
+    tcp[22] = 8;
+    tcp[23] = 10;
+    stl_be_p(tcp + 24, 1000);
+    stl_be_p(tcp + 28, 2000);
+
+    for (i = 0; i < payload; i++) {
+        buf[l4 + TCP_HDR_LEN + i] = i * 7;
+    }
+
+    /* Partial checksum: just the pseudo header, not inverted */
+    stw_be_p(tcp + 16, (uint16_t)~net_checksum_finish(csum));
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->gso_type = ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 :
+                           VIRTIO_NET_HDR_GSO_TCPV4;
+    hdr->hdr_len = l4 + TCP_HDR_LEN;
+    hdr->gso_size = MSS;
+    hdr->csum_start = l4;
+    hdr->csum_offset = 16;
+    return size;
+}
+
+static void check_tcp_csum(uint8_t *buf, size_t size, bool ipv6)
+{
+    size_t l3 = sizeof(struct eth_header);
+    size_t l4 = l3 + (ipv6 ? sizeof(struct ip6_header) :
+                             sizeof(struct ip_header));
+    uint32_t csum, cso;
+
+    if (ipv6) {
+        csum = eth_calc_ip6_pseudo_hdr_csum((struct ip6_header *)(buf + l3),
+                                            size - l4, IP_PROTO_TCP, &cso);
+    } else {
+        g_assert_cmpint(net_raw_checksum(buf + l3, sizeof(struct ip_header)),
+                        ==, 0);
+        csum = eth_calc_ip4_pseudo_hdr_csum((struct ip_header *)(buf + l3),
+                                            size - l4, &cso);
+    }
+    csum += net_checksum_add(size - l4, buf + l4);
+    g_assert_cmpint(net_checksum_finish(csum), ==, 0);
+}
+
+static void test_gso_csum(void)
+{
+    uint8_t *buf = g_malloc(NET_GRO_MAX_SIZE);
+    struct virtio_net_hdr hdr;
+    Frames f = { .count = 0 };
+    size_t size;
+
+    size = build_packet(buf, false, 100, &hdr);
+    hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+
+    g_assert_cmpint(net_gso_segment(&hdr, buf, size, collect, &f), ==, size);
+    g_assert_cmpint(f.count, ==, 1);
+    g_assert(f.last_seen);
+    check_tcp_csum(f.buf[0], f.size[0], false);
+
+    frames_free(&f);
+    f.count = 0;
+    f.last_seen = false;
+
+    /* IPv4 options that run into the TCP header are refused */
+    size = build_packet(buf, false, PAYLOAD_LEN, &hdr);
+    buf[sizeof(struct eth_header)] = 0x4f;
+    g_assert_cmpint(net_gso_segment(&hdr, buf, size, collect, &f), <, 0);
+    g_assert_cmpint(f.count, ==, 0);
+
+    g_free(buf);
+}
+
+static void test_gso_gro(gconstpointer opaque)
+{
+    bool ipv6 = GPOINTER_TO_INT(opaque);
+    size_t l4 = sizeof(struct eth_header) +
+                (ipv6 ? sizeof(struct ip6_header) : sizeof(struct ip_header));
+    uint8_t *buf = g_malloc(NET_GRO_MAX_SIZE);
+    uint8_t *orig = g_malloc(NET_GRO_MAX_SIZE);
+    struct virtio_net_hdr hdr, ghdr;
+    Frames f = { .count = 0 };
+    NetGro *gro = net_gro_new(!ipv6, ipv6);
+    const uint8_t *merged;
+    size_t size, msize;
+    int i;
+
+    size = build_packet(buf, ipv6, PAYLOAD_LEN, &hdr);
+    memcpy(orig, buf, size);
+
+    g_assert_cmpint(net_gso_segment(&hdr, buf, size, collect, &f), >, 0);
+    g_assert_cmpint(f.count, ==, DIV_ROUND_UP(PAYLOAD_LEN, MSS));
+    g_assert(f.last_seen);
+
+    for (i = 0; i < f.count; i++) {
+        uint8_t flags = f.buf[i][l4 + 13];
+
+        check_tcp_csum(f.buf[i], f.size[i], ipv6);
+        g_assert_cmpuint((uint32_t)ldl_be_p(f.buf[i] + l4 + 4), ==,
+                         (uint32_t)(0xfffff000 + i * MSS));
+        g_assert_cmpint(!!(flags & TH_PUSH), ==, i == f.count - 1);
+        g_assert(net_gro_receive(gro, f.buf[i], f.size[i]));
+    }
+
+    /* After the PSH segment nothing more is appended */
+    g_assert(!net_gro_receive(gro, f.buf[0], f.size[0]));
+    g_assert(net_gro_pending(gro));
+
+    merged = net_gro_finish(gro, &ghdr, &msize);
+    g_assert_cmpint(msize, ==, size);
+    g_assert_cmpint(ghdr.gso_type, ==, hdr.gso_type);
+    g_assert_cmpint(ghdr.gso_size, ==, MSS);
+    g_assert_cmpint(ghdr.csum_start, ==, l4);
+    g_assert_cmpint(ghdr.csum_offset, ==, 16);
+    g_assert_cmpint(ghdr.hdr_len, ==, l4 + TCP_HDR_LEN);
+    g_assert(ghdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM);
+
+    /* The merged packet is the one we started with */
+    g_assert(!memcmp(merged, orig, size));
+
+    net_gro_reset(gro);
+    g_assert(!net_gro_pending(gro));
+
+    /* A gap in the sequence space ends the packet */
+    g_assert(net_gro_receive(gro, f.buf[0], f.size[0]));
+    g_assert(!net_gro_receive(gro, f.buf[2], f.size[2]));
+    net_gro_reset(gro);
+
+    /* So does a corrupted segment, which is left to the guest to drop */
+    g_assert(net_gro_receive(gro, f.buf[0], f.size[0]));
+    f.buf[1][f.size[1] - 1] ^= 1;
+    g_assert(!net_gro_receive(gro, f.buf[1], f.size[1]));
+    merged = net_gro_finish(gro, &ghdr, &msize);
+    g_assert_cmpint(msize, ==, f.size[0]);
+    g_assert_cmpint(ghdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    g_assert(ghdr.flags & VIRTIO_NET_HDR_F_DATA_VALID);
+
+    /* A bad IPv4 header checksum is not hidden behind DATA_VALID */
+    if (!ipv6) {
+        net_gro_reset(gro);
+        f.buf[2][sizeof(struct eth_header) + 10] ^= 1;
+        g_assert(!net_gro_receive(gro, f.buf[2], f.size[2]));
+    }
+
+    net_gro_free(gro);
+    frames_free(&f);
+    g_free(orig);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gso/csum", test_gso_csum);
+    g_test_add_data_func("/net/gso/tcp4", GINT_TO_POINTER(false),
+                         test_gso_gro);
+    g_test_add_data_func("/net/gso/tcp6", GINT_TO_POINTER(true),
+                         test_gso_gro);
+    return g_test_run();
+}
@@ -0,0 +1,200 @@
+/*
+ * RSS Toeplitz hash tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The vectors are the verification suite from Microsoft's "Verifying
+ * the RSS Hash Calculation" documentation, run through the same
+ * net_rx_pkt helpers that e1000e, vmxnet3 and virtio-net use.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "net/eth.h"
+#include "hw/net/net_rx_pkt.h"
+
+static uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct RssVector {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t hash_ip;
+    uint32_t hash_l4;
+} RssVector;
+
+static const RssVector vectors4[] = {
+    {
+        { 0x42, 0x09, 0x95, 0xbb }, { 0xa1, 0x8e, 0x64, 0x50 },
+        2794, 1766, 0x323e8fc2, 0x51ccc178,
+    }, {
+        { 0xc7, 0x5c, 0x6f, 0x02 }, { 0x41, 0x45, 0x8c, 0x53 },
+        14230, 4739, 0xd718262a, 0xc626b0ea,
+    }, {
+        { 0x18, 0x13, 0xc6, 0x5f }, { 0x0c, 0x16, 0xcf, 0xb8 },
+        12898, 38024, 0xd2d0a5de, 0x5c2b394a,
+    }, {
+        { 0x26, 0x1b, 0xcd, 0x1e }, { 0xd1, 0x8e, 0xa3, 0x06 },
+        48228, 2217, 0x82989176, 0xafc7327f,
+    }, {
+        { 0x99, 0x27, 0xa3, 0xbf }, { 0xca, 0xbc, 0x7f, 0x02 },
+        44251, 1303, 0x5d1809c5, 0x10e828a2,
+    },
+};
+
+static const RssVector vectors6[] = {
+    {
+        /* 3ffe:2501:200:1fff::7 -> 3ffe:2501:200:3::1 */
+        { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07 },
+        { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
+        2794, 1766, 0x2cc18cd5, 0x40207d3d,
+    }, {
+        /* 3ffe:501:8::260:97ff:fe40:efab -> ff02::1 */
+        { 0x3f, 0xfe, 0x05, 0x01, 0x00, 0x08, 0x00, 0x00,
+          0x02, 0x60, 0x97, 0xff, 0xfe, 0x40, 0xef, 0xab },
+        { 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
+        14230, 4739, 0x0f0c461c, 0xdde51bbf,
+    }, {
+        /* 3ffe:1900:4545:3:200:f8ff:fe21:67cf -> fe80::200:f8ff:fe21:67cf */
+        { 0x3f, 0xfe, 0x19, 0x00, 0x45, 0x45, 0x00, 0x03,
+          0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+        { 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+        44251, 38024, 0x4b61e985, 0x02d1feef,
+    },
+};
+
+/* Build a TCP or UDP packet from the addresses and ports of @v */
+static size_t build_packet(uint8_t *buf, bool ipv6, bool udp,
+                           const RssVector *v)
+{
+    struct eth_header *eth = (struct eth_header *)buf;
+    size_t l3 = sizeof(*eth);
+    size_t l4 = l3 + (ipv6 ? sizeof(struct ip6_header) :
+                             sizeof(struct ip_header));
+    size_t size = l4 + (udp ? sizeof(struct udp_header) :
+                              sizeof(struct tcp_header));
+    uint8_t proto = udp ? IP_PROTO_UDP : IP_PROTO_TCP;
+    uint8_t *l4hdr = buf + l4;
+
+    memset(buf, 0, size);
+    memset(eth->h_dest, 0x52, ETH_ALEN);
+    memset(eth->h_source, 0x54, ETH_ALEN);
+
+    if (ipv6) {
+        struct ip6_header *ip6 = (struct ip6_header *)(buf + l3);
+
+        eth->h_proto = cpu_to_be16(ETH_P_IPV6);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_flow = cpu_to_be32(0x60000000);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_plen = cpu_to_be16(size - l4);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt = proto;
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim = 64;
+        memcpy(&ip6->ip6_src, v->src, 16);
+        memcpy(&ip6->ip6_dst, v->dst, 16);
+    } else {
+        struct ip_header *ip = (struct ip_header *)(buf + l3);
+
+        eth->h_proto = cpu_to_be16(ETH_P_IP);
+        ip->ip_ver_len = 0x45;
+        ip->ip_len = cpu_to_be16(size - l3);
+        ip->ip_ttl = 64;
+        ip->ip_p = proto;
+        memcpy(&ip->ip_src, v->src, 4);
+        memcpy(&ip->ip_dst, v->dst, 4);
+        eth_fix_ip4_checksum(ip, sizeof(*ip));
+    }
+
+    stw_be_p(l4hdr, v->sport);
+    stw_be_p(l4hdr + 2, v->dport);
+    if (udp) {
+        stw_be_p(l4hdr + 4, sizeof(struct udp_header));
+    } else {
+        l4hdr[12] = (sizeof(struct tcp_header) / 4) << 4;
+        l4hdr[13] = TH_ACK;
+    }
+    return size;
+}
+
+static uint32_t rss_hash(struct NetRxPkt *pkt, const uint8_t *buf,
+                         size_t size, NetRxPktRssType type)
+{
+    net_rx_pkt_set_protocols(pkt, buf, size);
+    return net_rx_pkt_calc_rss_hash(pkt, type, rss_key);
+}
+
+static void test_rss_ip4(void)
+{
+    struct NetRxPkt *pkt;
+    uint8_t buf[128];
+    size_t size;
+    int i;
+
+    net_rx_pkt_init(&pkt, false);
+    for (i = 0; i < ARRAY_SIZE(vectors4); i++) {
+        const RssVector *v = &vectors4[i];
+
+        size = build_packet(buf, false, false, v);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV4), ==,
+                        v->hash_ip);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV4Tcp), ==,
+                        v->hash_l4);
+
+        /* UDP hashes the same 4-tuple */
+        size = build_packet(buf, false, true, v);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV4), ==,
+                        v->hash_ip);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV4Udp), ==,
+                        v->hash_l4);
+    }
+    net_rx_pkt_uninit(pkt);
+}
+
+static void test_rss_ip6(void)
+{
+    struct NetRxPkt *pkt;
+    uint8_t buf[128];
+    size_t size;
+    int i;
+
+    net_rx_pkt_init(&pkt, false);
+    for (i = 0; i < ARRAY_SIZE(vectors6); i++) {
+        const RssVector *v = &vectors6[i];
+
+        /* Without extension headers the _EX types hash the same input */
+        size = build_packet(buf, true, false, v);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6), ==,
+                        v->hash_ip);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6Ex), ==,
+                        v->hash_ip);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6Tcp), ==,
+                        v->hash_l4);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6TcpEx), ==,
+                        v->hash_l4);
+
+        size = build_packet(buf, true, true, v);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6Udp), ==,
+                        v->hash_l4);
+        g_assert_cmphex(rss_hash(pkt, buf, size, NetPktRssIpV6UdpEx), ==,
+                        v->hash_l4);
+    }
+    net_rx_pkt_uninit(pkt);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/rss/ip4", test_rss_ip4);
+    g_test_add_func("/net/rss/ip6", test_rss_ip6);
+    return g_test_run();
+}
@@ -3,6 +3,7 @@
 #include "qapi/qmp/types.h"
 #include "test-qmp-commands.h"
 #include "qapi/qmp/dispatch.h"
+#include "qapi/qmp/qjson.h"
 #include "qemu/module.h"
 #include "qapi/qobject-input-visitor.h"
 #include "tests/test-qapi-types.h"
@@ -102,6 +103,20 @@ static void test_dispatch_cmd(void)
     QDECREF(req);
 }
 
+/* test that only commands marked 'allow-oob' may run out-of-band */
+static void test_dispatch_cmd_oob(void)
+{
+    QmpCommand *cmd;
+
+    cmd = qmp_find_command("user_def_cmd");
+    g_assert(cmd != NULL);
+    g_assert(cmd->options & QCO_ALLOW_OOB);
+
+    cmd = qmp_find_command("user_def_cmd1");
+    g_assert(cmd != NULL);
+    g_assert(!(cmd->options & QCO_ALLOW_OOB));
+}
+
 /* test commands that return an error due to invalid parameters */
 static void test_dispatch_cmd_failure(void)
 {
@@ -199,6 +214,67 @@ static void test_dispatch_cmd_io(void)
     QDECREF(req);
 }
 
+/* test commands that format their return value as JSON text */
+static void test_dispatch_cmd_text(void)
+{
+    QDict *req = qdict_new();
+    QDict *args = qdict_new();
+    QDict *ud1a = qdict_new();
+    QDict *ret, *ret_dict;
+    QString *text = qstring_from_str("prefix ");
+    Error *err = NULL;
+
+    qdict_put(ud1a, "integer", qint_from_int(42));
+    qdict_put(ud1a, "string", qstring_from_str("hello"));
+    qdict_put(args, "ud1a", ud1a);
+    qdict_put(req, "arguments", args);
+    qdict_put(req, "execute", qstring_from_str("user_def_cmd2"));
+
+    g_assert(qmp_dispatch_text(QOBJECT(req), text, &err));
+    g_assert(!err);
+    g_assert(g_str_has_prefix(qstring_get_str(text), "prefix {"));
+    ret = qobject_to_qdict(qobject_from_json(qstring_get_str(text) + 7));
+    g_assert(ret);
+    g_assert_cmpstr(qdict_get_str(ret, "string0"), ==, "blah1");
+    ret_dict = qdict_get_qdict(ret, "dict1");
+    g_assert_cmpstr(qdict_get_str(ret_dict, "string1"), ==, "blah2");
+    ret_dict = qdict_get_qdict(qdict_get_qdict(ret_dict, "dict2"), "userdef");
+    g_assert_cmpint(qdict_get_int(ret_dict, "integer"), ==, 42);
+    g_assert_cmpstr(qdict_get_str(ret_dict, "string"), ==, "hello");
+    QDECREF(ret);
+    QDECREF(text);
+
+    /* A failing command leaves the text alone */
+    text = qstring_new();
+    qdict_put(args, "ud1b", qstring_from_str("not a UserDefOne"));
+    g_assert(qmp_dispatch_text(QOBJECT(req), text, &err));
+    error_free_or_abort(&err);
+    g_assert_cmpint(qstring_get_length(text), ==, 0);
+
+    qdict_del(req, "arguments");
+    qdict_put(req, "execute", qstring_from_str("guest-get-time"));
+    args = qdict_new();
+    qdict_put(args, "a", qint_from_int(66));
+    qdict_put(req, "arguments", args);
+    g_assert(qmp_dispatch_text(QOBJECT(req), text, &err));
+    g_assert(!err);
+    g_assert_cmpstr(qstring_get_str(text), ==, "66");
+    QDECREF(text);
+
+    /* Commands without a return value go through qmp_dispatch() */
+    text = qstring_new();
+    qdict_del(req, "arguments");
+    qdict_put(req, "execute", qstring_from_str("user_def_cmd"));
+    g_assert(!qmp_dispatch_text(QOBJECT(req), text, &err));
+    qdict_put(req, "execute", qstring_from_str("no-such-command"));
+    g_assert(!qmp_dispatch_text(QOBJECT(req), text, &err));
+    g_assert(!err);
+    g_assert_cmpint(qstring_get_length(text), ==, 0);
+    QDECREF(text);
+
+    QDECREF(req);
+}
+
 /* test generated dealloc functions for generated types */
 static void test_dealloc_types(void)
 {
@@ -268,8 +344,10 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/0.15/dispatch_cmd", test_dispatch_cmd);
+    g_test_add_func("/0.15/dispatch_cmd_oob", test_dispatch_cmd_oob);
     g_test_add_func("/0.15/dispatch_cmd_failure", test_dispatch_cmd_failure);
     g_test_add_func("/0.15/dispatch_cmd_io", test_dispatch_cmd_io);
+    g_test_add_func("/0.15/dispatch_cmd_text", test_dispatch_cmd_text);
     g_test_add_func("/0.15/dealloc_types", test_dealloc_types);
     g_test_add_func("/0.15/dealloc_partial", test_dealloc_partial);
 
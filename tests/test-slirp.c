@@ -0,0 +1,358 @@
+/*
+ * slirp socket polling tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/main-loop.h"
+#include "qemu/sockets.h"
+#include "migration/vmstate.h"
+#include "monitor/monitor.h"
+#include "sysemu/char.h"
+#include "slirp/slirp.h"
+
+#ifdef CONFIG_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+
+/* slirp calls back into the net, migration and chardev code */
+
+static int output_count;
+
+void slirp_output(void *opaque, const uint8_t *pkt, int pkt_len)
+{
+    output_count++;
+}
+
+int register_savevm(DeviceState *dev, const char *idstr, int instance_id,
+                    int version_id, SaveStateHandler *save_state,
+                    LoadStateHandler *load_state, void *opaque)
+{
+    return 0;
+}
+
+void unregister_savevm(DeviceState *dev, const char *idstr, void *opaque)
+{
+}
+
+void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
+{
+    g_assert_not_reached();
+}
+
+void qemu_put_byte(QEMUFile *f, int v)
+{
+    g_assert_not_reached();
+}
+
+void qemu_put_be16(QEMUFile *f, unsigned int v)
+{
+    g_assert_not_reached();
+}
+
+void qemu_put_be32(QEMUFile *f, unsigned int v)
+{
+    g_assert_not_reached();
+}
+
+size_t qemu_get_buffer(QEMUFile *f, uint8_t *buf, size_t size)
+{
+    g_assert_not_reached();
+}
+
+int qemu_get_byte(QEMUFile *f)
+{
+    g_assert_not_reached();
+}
+
+unsigned int qemu_get_be16(QEMUFile *f)
+{
+    g_assert_not_reached();
+}
+
+unsigned int qemu_get_be32(QEMUFile *f)
+{
+    g_assert_not_reached();
+}
+
+int qemu_chr_fe_write_all(CharBackend *be, const uint8_t *buf, int len)
+{
+    g_assert_not_reached();
+}
+
+int qemu_add_child_watch(pid_t pid)
+{
+    g_assert_not_reached();
+}
+
+void monitor_printf(Monitor *mon, const char *fmt, ...)
+{
+}
+
+static Slirp *test_slirp_new(void)
+{
+    struct in_addr net = { .s_addr = htonl(0x0a000200) };   /* 10.0.2.0 */
+    struct in_addr mask = { .s_addr = htonl(0xffffff00) };
+    struct in_addr host = { .s_addr = htonl(0x0a000202) };
+    struct in_addr dhcp = { .s_addr = htonl(0x0a00020f) };
+    struct in_addr dns = { .s_addr = htonl(0x0a000203) };
+    struct in6_addr prefix6 = { .s6_addr = { 0xfe, 0xc0 } };
+    struct in6_addr host6 = prefix6;
+    struct in6_addr dns6 = prefix6;
+
+    host6.s6_addr[15] = 2;
+    dns6.s6_addr[15] = 3;
+    return slirp_init(0, true, net, mask, host, false, prefix6, 64, host6,
+                      NULL, NULL, NULL, dhcp, dns, dns6, NULL, NULL);
+}
+
+/* Forward a loopback port to the guest and return the listening socket */
+static struct socket *test_slirp_hostfwd(Slirp *slirp)
+{
+    struct in_addr loopback = { .s_addr = htonl(INADDR_LOOPBACK) };
+    struct in_addr guest = { .s_addr = 0 };
+    struct socket *so;
+
+    g_assert_cmpint(slirp_add_hostfwd(slirp, 0, loopback, 0, guest, 22),
+                    ==, 0);
+    so = slirp->tcb.so_next;
+    g_assert(so != &slirp->tcb);
+    g_assert(so->so_state & SS_FACCEPTCONN);
+    return so;
+}
+
+static int test_slirp_connect(struct socket *so)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = so->so_fport,
+    };
+    int fd = qemu_socket(AF_INET, SOCK_STREAM, 0);
+
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(connect(fd, (struct sockaddr *)&addr, sizeof(addr)),
+                    ==, 0);
+    return fd;
+}
+
+static bool test_slirp_pollfds_have(GArray *pollfds, int fd)
+{
+    int i;
+
+    for (i = 0; i < pollfds->len; i++) {
+        if (g_array_index(pollfds, GPollFD, i).fd == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Run main loop iterations until slirp has accepted a connection */
+static void test_slirp_wait_accept(Slirp *slirp, GArray *pollfds)
+{
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        uint32_t timeout = 100;
+        int ret;
+
+        g_array_set_size(pollfds, 0);
+        slirp_pollfds_fill(pollfds, &timeout);
+        ret = g_poll((GPollFD *)pollfds->data, pollfds->len, 100);
+        slirp_pollfds_poll(pollfds, ret < 0);
+
+        if (slirp->tcb.so_next->so_next != &slirp->tcb) {
+            return;
+        }
+    }
+    g_assert_not_reached();
+}
+
+static void test_slirp_poll(void)
+{
+    Slirp *slirp = test_slirp_new();
+    GArray *pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    struct socket *so;
+    uint32_t timeout = 1000;
+    int fd;
+
+#ifdef CONFIG_EPOLL_CREATE1
+    if (slirp->epoll_fd >= 0) {
+        close(slirp->epoll_fd);
+        slirp->epoll_fd = -1;
+    }
+#endif
+
+    so = test_slirp_hostfwd(slirp);
+    slirp_pollfds_fill(pollfds, &timeout);
+    g_assert(test_slirp_pollfds_have(pollfds, so->s));
+    g_assert_cmpint(so->pollfds_idx, !=, -1);
+
+    fd = test_slirp_connect(so);
+    output_count = 0;
+    test_slirp_wait_accept(slirp, pollfds);
+    /* The SYN to the guest waits for the ARP request to be answered */
+    g_assert_cmpint(output_count, >, 0);
+
+    close(fd);
+    slirp_cleanup(slirp);
+    g_array_free(pollfds, TRUE);
+}
+
+#ifdef CONFIG_EPOLL_CREATE1
+/* The events @fd is registered with in @epfd, or -1 if it is not */
+static int test_slirp_epoll_events(int epfd, int fd)
+{
+    char *path = g_strdup_printf("/proc/self/fdinfo/%d", epfd);
+    char *contents, **lines, **line;
+    int events = -1;
+
+    g_assert(g_file_get_contents(path, &contents, NULL, NULL));
+    lines = g_strsplit(contents, "\n", -1);
+    for (line = lines; *line; line++) {
+        int tfd;
+        unsigned int mask;
+
+        if (sscanf(*line, "tfd: %d events: %x", &tfd, &mask) == 2 &&
+            tfd == fd) {
+            /* The kernel always adds EPOLLHUP and EPOLLERR */
+            events = mask & (EPOLLIN | EPOLLPRI | EPOLLOUT);
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    g_free(path);
+    return events;
+}
+
+static void test_slirp_epoll_fill(GArray *pollfds)
+{
+    uint32_t timeout = 1000;
+
+    g_array_set_size(pollfds, 0);
+    slirp_pollfds_fill(pollfds, &timeout);
+}
+
+static void test_slirp_epoll(void)
+{
+    Slirp *slirp = test_slirp_new();
+    GArray *pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    struct socket *so;
+    int state, fd;
+
+    if (slirp->epoll_fd < 0) {
+        g_test_message("epoll not available");
+        goto out;
+    }
+
+    /* A new socket is added to the set and not handed to poll() */
+    so = test_slirp_hostfwd(slirp);
+    g_assert(so->watch_changed);
+    test_slirp_epoll_fill(pollfds);
+    g_assert(!so->watch_changed);
+    g_assert_cmpint(so->poll_events, ==, G_IO_IN | G_IO_HUP | G_IO_ERR);
+    g_assert_cmpint(test_slirp_epoll_events(slirp->epoll_fd, so->s),
+                    ==, EPOLLIN);
+    g_assert(test_slirp_pollfds_have(pollfds, slirp->epoll_fd));
+    g_assert(!test_slirp_pollfds_have(pollfds, so->s));
+
+    /* Unchanged sockets are left alone */
+    test_slirp_epoll_fill(pollfds);
+    g_assert(QTAILQ_EMPTY(&slirp->watch_changed));
+
+    /* Changing what the socket waits for modifies the registration */
+    state = so->so_state;
+    so->so_state = SS_ISFCONNECTING;
+    sowatch(so);
+    test_slirp_epoll_fill(pollfds);
+    g_assert_cmpint(so->poll_events, ==, G_IO_OUT | G_IO_ERR);
+    g_assert_cmpint(test_slirp_epoll_events(slirp->epoll_fd, so->s),
+                    ==, EPOLLOUT);
+
+    /* A socket that waits for nothing is deleted from the set */
+    so->so_state = SS_NOFDREF;
+    sowatch(so);
+    test_slirp_epoll_fill(pollfds);
+    g_assert_cmpint(so->poll_events, ==, 0);
+    g_assert_cmpint(test_slirp_epoll_events(slirp->epoll_fd, so->s), ==, -1);
+
+    so->so_state = state;
+    sowatch(so);
+    test_slirp_epoll_fill(pollfds);
+    g_assert_cmpint(test_slirp_epoll_events(slirp->epoll_fd, so->s),
+                    ==, EPOLLIN);
+
+    /* Only the sockets epoll reports are dispatched */
+    fd = test_slirp_connect(so);
+    test_slirp_wait_accept(slirp, pollfds);
+    g_assert(QTAILQ_EMPTY(&slirp->watch_ready));
+    close(fd);
+
+    /* Sockets are taken out of the set before their fd is closed */
+    sounwatch(so);
+    g_assert_cmpint(test_slirp_epoll_events(slirp->epoll_fd, so->s), ==, -1);
+    g_assert(so->watch_changed);
+
+out:
+    slirp_cleanup(slirp);
+    g_array_free(pollfds, TRUE);
+}
+
+static void test_slirp_epoll_disable(void)
+{
+    Slirp *slirp = test_slirp_new();
+    GArray *pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    struct socket *so;
+    int fd;
+
+    if (slirp->epoll_fd < 0) {
+        g_test_message("epoll not available");
+        goto out;
+    }
+
+    /* Replace the epoll fd by one that epoll_ctl() rejects */
+    fd = open("/dev/null", O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(dup2(fd, slirp->epoll_fd), ==, slirp->epoll_fd);
+    close(fd);
+
+    /* The failed update falls back to poll() for every socket */
+    so = test_slirp_hostfwd(slirp);
+    test_slirp_epoll_fill(pollfds);
+    g_assert_cmpint(slirp->epoll_fd, ==, -1);
+    g_assert_cmpint(slirp->epoll_pollfds_idx, ==, -1);
+    g_assert(QTAILQ_EMPTY(&slirp->watch_changed));
+    g_assert_cmpint(so->poll_events, ==, 0);
+    g_assert(test_slirp_pollfds_have(pollfds, so->s));
+
+    /* Later changes are not tracked any more */
+    sowatch(so);
+    g_assert(!so->watch_changed);
+
+    fd = test_slirp_connect(so);
+    test_slirp_wait_accept(slirp, pollfds);
+    close(fd);
+
+out:
+    slirp_cleanup(slirp);
+    g_array_free(pollfds, TRUE);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    init_clocks();
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/slirp/poll", test_slirp_poll);
+#ifdef CONFIG_EPOLL_CREATE1
+    g_test_add_func("/slirp/epoll", test_slirp_epoll);
+    g_test_add_func("/slirp/epoll/disable", test_slirp_epoll_disable);
+#endif
+
+    return g_test_run();
+}
@@ -134,6 +134,56 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_plugged(void)
+{
+    WorkerTestData data[100];
+    int i;
+
+    thread_pool_plug(pool);
+    for (i = 0; i < 100; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        data[i].aiocb = thread_pool_submit_aio(pool, worker_cb, &data[i],
+                                               done_cb, &data[i]);
+    }
+    active = 100;
+
+    /* Nothing runs until the pool is unplugged...  */
+    g_usleep(10000);
+    for (i = 0; i < 100; i++) {
+        g_assert_cmpint(data[i].n, ==, 0);
+    }
+
+    /* ... and what is canceled before that never runs.  */
+    data[0].n = 3;
+    data[0].ret = -ECANCELED;
+    bdrv_aio_cancel_async(data[0].aiocb);
+
+    thread_pool_unplug(pool);
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data[0].n, ==, 3);
+    for (i = 1; i < 100; i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+}
+
+static void test_resize(void)
+{
+    /* Workers beyond the new maximum only go away once idle, so requests
+     * keep flowing while the pool shrinks.
+     */
+    thread_pool_set_size(pool, 1, 1);
+    test_submit_many();
+
+    thread_pool_set_size(pool, 8, 64);
+    test_submit_many();
+
+    thread_pool_set_size(pool, 0, 64);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +290,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-plugged", test_submit_plugged);
+    g_test_add_func("/thread-pool/resize", test_resize);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
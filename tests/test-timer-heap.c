@@ -0,0 +1,298 @@
+/*
+ * Timer list tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The active timers of a QEMUTimerList are kept in a pairing heap.
+ * These tests arm, re-arm and delete timers in every position of the
+ * heap and check that the deadline and the order in which the timers
+ * fire still match a plain sorted list.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/timer.h"
+
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t my_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return my_clock_value;
+}
+
+#define N_TIMERS    8
+
+static QEMUTimerList *tl;
+static QEMUTimer timers[N_TIMERS];
+static int fired[N_TIMERS * 2];
+static int n_fired;
+
+static void timer_cb(void *opaque)
+{
+    g_assert_cmpint(n_fired, <, ARRAY_SIZE(fired));
+    fired[n_fired++] = (uintptr_t)opaque;
+}
+
+static void timers_setup(void)
+{
+    int i;
+
+    my_clock_value = 0;
+    n_fired = 0;
+    tl = timerlist_new(QEMU_CLOCK_VIRTUAL, NULL, NULL);
+    for (i = 0; i < N_TIMERS; i++) {
+        timer_init_tl(&timers[i], tl, SCALE_NS, timer_cb,
+                      (void *)(uintptr_t)i);
+    }
+}
+
+static void timers_teardown(void)
+{
+    int i;
+
+    for (i = 0; i < N_TIMERS; i++) {
+        timer_del(&timers[i]);
+        timer_deinit(&timers[i]);
+    }
+    timerlist_free(tl);
+}
+
+/* Run every timer up to @now and check they fired in the order given */
+static void run_and_check(int64_t now, const int *order, int n)
+{
+    int i;
+
+    my_clock_value = now;
+    n_fired = 0;
+    timerlist_run_timers(tl);
+    g_assert_cmpint(n_fired, ==, n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpint(fired[i], ==, order[i]);
+    }
+}
+
+static void test_timer_order(void)
+{
+    static const int64_t deadlines[] = { 50, 10, 70, 30, 20, 80, 60, 40 };
+    static const int order[] = { 1, 4, 3, 7, 0, 6, 2, 5 };
+    int i;
+
+    timers_setup();
+    for (i = 0; i < N_TIMERS; i++) {
+        timer_mod_ns(&timers[i], deadlines[i]);
+    }
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 10);
+
+    /* Only the expired timers run */
+    run_and_check(35, order, 3);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 5);
+    run_and_check(100, order + 3, 5);
+    g_assert(!timerlist_has_timers(tl));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, -1);
+    timers_teardown();
+}
+
+static void test_timer_del(void)
+{
+    static const int order[] = { 0, 2, 4, 5 };
+
+    timers_setup();
+
+    /* Each timer armed after the root becomes its first child, so
+     * timers[1] ends up as the last sibling and timers[3] as the
+     * first child.
+     */
+    timer_mod_ns(&timers[0], 10);
+    timer_mod_ns(&timers[1], 20);
+    timer_mod_ns(&timers[2], 30);
+    timer_mod_ns(&timers[3], 40);
+    g_assert(timers[0].child == &timers[3]);
+    g_assert(timers[1].prev == &timers[2] && !timers[1].next);
+
+    /* First child */
+    timer_del(&timers[3]);
+    g_assert(!timer_pending(&timers[3]));
+    g_assert(timers[0].child == &timers[2]);
+    g_assert(timers[2].prev == &timers[0]);
+
+    /* Later sibling */
+    timer_del(&timers[1]);
+    g_assert(!timer_pending(&timers[1]));
+    g_assert(!timers[2].next);
+
+    /* Deleting twice is harmless */
+    timer_del(&timers[1]);
+
+    /* A non-root timer that has children of its own: running the root
+     * pairs its children up, so timers[6] gets timers[5] as a child.
+     */
+    timer_mod_ns(&timers[4], 50);
+    timer_mod_ns(&timers[5], 60);
+    timer_mod_ns(&timers[6], 55);
+    run_and_check(10, order, 1);
+    g_assert(timers[6].prev == &timers[2]);
+    g_assert(timers[6].child == &timers[5]);
+    timer_del(&timers[6]);
+    g_assert(timers[2].child == &timers[5]);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 20);
+
+    /* The root */
+    timer_mod_ns(&timers[7], 25);
+    timer_del(&timers[7]);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 20);
+
+    run_and_check(100, order + 1, 3);
+    g_assert(!timerlist_has_timers(tl));
+    timers_teardown();
+}
+
+static void test_timer_rearm(void)
+{
+    static const int order[] = { 1, 0, 2, 3 };
+
+    timers_setup();
+    timer_mod_ns(&timers[0], 10);
+    timer_mod_ns(&timers[1], 20);
+    timer_mod_ns(&timers[2], 30);
+    timer_mod_ns(&timers[3], 40);
+
+    /* Later: the root moves down the heap */
+    timer_mod_ns(&timers[0], 25);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 20);
+
+    /* Earlier: a child becomes the root */
+    timer_mod_ns(&timers[1], 5);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 5);
+
+    /* Same deadline */
+    timer_mod_ns(&timers[2], 30);
+    g_assert(timer_pending(&timers[2]));
+
+    /* Every timer fires once, at its last deadline */
+    run_and_check(100, order, 4);
+    g_assert(!timerlist_has_timers(tl));
+    timers_teardown();
+}
+
+static void test_timer_fifo(void)
+{
+    static const int order_first[] = { 5 };
+    static const int order[] = { 3, 1, 6, 2, 0, 7 };
+
+    timers_setup();
+    timer_mod_ns(&timers[3], 10);
+    timer_mod_ns(&timers[1], 10);
+    timer_mod_ns(&timers[0], 10);
+    timer_mod_ns(&timers[6], 10);
+    timer_mod_ns(&timers[2], 10);
+    timer_mod_ns(&timers[5], 5);
+    timer_mod_ns(&timers[7], 20);
+
+    /* Re-arming moves a timer behind the others with the same deadline */
+    timer_mod_ns(&timers[0], 10);
+
+    run_and_check(5, order_first, 1);
+    run_and_check(100, order, ARRAY_SIZE(order));
+    timers_teardown();
+}
+
+static void test_timer_anticipate(void)
+{
+    static const int order[] = { 1, 3, 2, 0 };
+
+    timers_setup();
+
+    /* An idle timer is armed */
+    timer_mod_anticipate_ns(&timers[0], 30);
+    g_assert(timer_pending(&timers[0]));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 30);
+
+    /* A later deadline is ignored */
+    timer_mod_ns(&timers[1], 20);
+    timer_mod_anticipate_ns(&timers[1], 40);
+    g_assert_cmpint(timers[1].expire_time, ==, 20);
+
+    /* An earlier one moves the timer */
+    timer_mod_ns(&timers[2], 50);
+    timer_mod_anticipate_ns(&timers[2], 25);
+    g_assert_cmpint(timers[2].expire_time, ==, 25);
+
+    /* An equal one keeps its place among timers with that deadline */
+    timer_mod_ns(&timers[3], 20);
+    timer_mod_anticipate_ns(&timers[1], 20);
+
+    run_and_check(100, order, ARRAY_SIZE(order));
+    timers_teardown();
+}
+
+/* Random arms, re-arms and deletes, checked against a linear scan */
+static void test_timer_random(void)
+{
+    int64_t armed[N_TIMERS];
+    int64_t deadline;
+    int i, j, k;
+
+    timers_setup();
+    g_random_set_seed(42);
+    for (i = 0; i < 10000; i++) {
+        j = g_random_int_range(0, N_TIMERS);
+        switch (g_random_int_range(0, 4)) {
+        case 0:
+            timer_del(&timers[j]);
+            break;
+        case 1:
+            timer_mod_anticipate_ns(&timers[j],
+                                    my_clock_value +
+                                    g_random_int_range(0, 100));
+            break;
+        case 2:
+            my_clock_value += g_random_int_range(0, 20);
+            n_fired = 0;
+            timerlist_run_timers(tl);
+            for (k = 1; k < n_fired; k++) {
+                g_assert_cmpint(armed[fired[k - 1]], <=, armed[fired[k]]);
+            }
+            for (k = 0; k < N_TIMERS; k++) {
+                g_assert(!timer_pending(&timers[k]) ||
+                         !timer_expired(&timers[k], my_clock_value));
+            }
+            break;
+        default:
+            timer_mod_ns(&timers[j],
+                         my_clock_value + g_random_int_range(0, 100));
+            break;
+        }
+        armed[j] = timers[j].expire_time;
+
+        deadline = -1;
+        for (k = 0; k < N_TIMERS; k++) {
+            if (timer_pending(&timers[k]) &&
+                (deadline == -1 || timers[k].expire_time < deadline)) {
+                deadline = timers[k].expire_time;
+            }
+        }
+        if (deadline != -1) {
+            deadline = MAX(deadline - my_clock_value, 0);
+        }
+        g_assert_cmpint(timerlist_deadline_ns(tl), ==, deadline);
+    }
+    timers_teardown();
+}
+
+int main(int argc, char **argv)
+{
+    init_clocks();
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL, true);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/timer/heap/order", test_timer_order);
+    g_test_add_func("/timer/heap/del", test_timer_del);
+    g_test_add_func("/timer/heap/rearm", test_timer_rearm);
+    g_test_add_func("/timer/heap/fifo", test_timer_fifo);
+    g_test_add_func("/timer/heap/anticipate", test_timer_anticipate);
+    g_test_add_func("/timer/heap/random", test_timer_random);
+
+    return g_test_run();
+}
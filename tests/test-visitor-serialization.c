@@ -22,6 +22,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qobject-output-visitor.h"
+#include "qapi/json-output-visitor.h"
 #include "qapi/string-input-visitor.h"
 #include "qapi/string-output-visitor.h"
 #include "qapi-types.h"
@@ -1055,6 +1056,47 @@ static void qmp_cleanup(void *datap)
     g_free(d);
 }
 
+typedef struct JsonSerializeData {
+    QString *json;
+    Visitor *jov;
+    Visitor *qiv;
+} JsonSerializeData;
+
+static void json_serialize(void *native_in, void **datap,
+                           VisitorFunc visit, Error **errp)
+{
+    JsonSerializeData *d = g_malloc0(sizeof(*d));
+
+    d->json = qstring_new();
+    d->jov = json_output_visitor_new(d->json);
+    visit(d->jov, &native_in, errp);
+    *datap = d;
+}
+
+static void json_deserialize(void **native_out, void *datap,
+                             VisitorFunc visit, Error **errp)
+{
+    JsonSerializeData *d = datap;
+    QObject *obj;
+
+    visit_complete(d->jov, d->json);
+    obj = qobject_from_json(qstring_get_str(d->json));
+    g_assert(obj);
+    d->qiv = qobject_input_visitor_new(obj, true);
+    qobject_decref(obj);
+    visit(d->qiv, native_out, errp);
+}
+
+static void json_cleanup(void *datap)
+{
+    JsonSerializeData *d = datap;
+
+    visit_free(d->jov);
+    visit_free(d->qiv);
+    QDECREF(d->json);
+    g_free(d);
+}
+
 typedef struct StringSerializeData {
     char *string;
     Visitor *sov;
@@ -1106,6 +1148,14 @@ static const SerializeOps visitors[] = {
         .caps = VCAP_PRIMITIVES | VCAP_STRUCTURES | VCAP_LISTS |
                 VCAP_PRIMITIVE_LISTS
     },
+    {
+        .type = "JSON",
+        .serialize = json_serialize,
+        .deserialize = json_deserialize,
+        .cleanup = json_cleanup,
+        .caps = VCAP_PRIMITIVES | VCAP_STRUCTURES | VCAP_LISTS |
+                VCAP_PRIMITIVE_LISTS
+    },
     {
         .type = "String",
         .serialize = string_serialize,
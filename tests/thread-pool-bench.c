@@ -0,0 +1,151 @@
+/*
+ * Thread pool throughput benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Submits bursts of requests to the thread pool of an AioContext and waits
+ * for all of them to complete, the way a device does with a queue full of
+ * buffered I/O.  Each request spins for a configurable amount of time.
+ * Bursts can be plugged, so that they are handed to the workers in one go.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#include "qapi/error.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+
+static AioContext *ctx;
+static ThreadPool *pool;
+static unsigned int burst = 64;
+static unsigned int duration = 2;
+static unsigned int work_ns = 1000;
+static unsigned int min_threads;
+static unsigned int max_threads = 64;
+static bool plug;
+static int active;
+
+static const char commands[] = "\n"
+    " -b = requests per burst (default 64)\n"
+    " -d = duration in seconds (default 2)\n"
+    " -w = time spent in each request, in ns (default 1000)\n"
+    " -m = minimum number of worker threads (default 0)\n"
+    " -M = maximum number of worker threads (default 64)\n"
+    " -p = plug each burst\n"
+    " -h = show this help message.\n";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "b:d:hm:M:pw:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'b':
+            burst = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'm':
+            min_threads = atoi(optarg);
+            break;
+        case 'M':
+            max_threads = atoi(optarg);
+            break;
+        case 'p':
+            plug = true;
+            break;
+        case 'w':
+            work_ns = atoi(optarg);
+            break;
+        default:
+            usage_complete(argc, argv);
+            exit(1);
+        }
+    }
+    if (!burst || !duration || !max_threads ||
+        max_threads > THREAD_POOL_MAX_THREADS || min_threads > max_threads) {
+        usage_complete(argc, argv);
+        exit(1);
+    }
+}
+
+static int worker_cb(void *opaque)
+{
+    int64_t end = get_clock() + work_ns;
+
+    while (get_clock() < end) {
+        /* spin */
+    }
+    return 0;
+}
+
+static void done_cb(void *opaque, int ret)
+{
+    active--;
+}
+
+int main(int argc, char *argv[])
+{
+    Error *local_error = NULL;
+    uint64_t bursts = 0;
+    int64_t start, now, end;
+    unsigned int i;
+
+    parse_args(argc, argv);
+    init_clocks();
+
+    ctx = aio_context_new(&local_error);
+    if (!ctx) {
+        error_reportf_err(local_error, "Failed to create AIO Context: ");
+        exit(1);
+    }
+    pool = aio_get_thread_pool(ctx);
+    thread_pool_set_size(pool, min_threads, max_threads);
+
+    start = get_clock();
+    end = start + duration * NANOSECONDS_PER_SECOND;
+    do {
+        if (plug) {
+            thread_pool_plug(pool);
+        }
+        for (i = 0; i < burst; i++) {
+            thread_pool_submit_aio(pool, worker_cb, NULL, done_cb, NULL);
+        }
+        if (plug) {
+            thread_pool_unplug(pool);
+        }
+
+        active = burst;
+        while (active > 0) {
+            aio_poll(ctx, true);
+        }
+        bursts++;
+        now = get_clock();
+    } while (now < end);
+
+    printf("%u requests per burst, %u ns each, %u-%u threads%s\n",
+           burst, work_ns, min_threads, max_threads, plug ? ", plugged" : "");
+    printf("%.0f requests/s, %.2f us per burst\n",
+           (double)bursts * burst * NANOSECONDS_PER_SECOND / (now - start),
+           (double)(now - start) / bursts / 1000);
+
+    aio_context_unref(ctx);
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Timer list benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Arms a large number of timers on a QEMU_CLOCK_VIRTUAL timer list with
+ * random deadlines, then:
+ *
+ *   - re-arms random timers, reading the deadline after each change the
+ *     way aio_poll does;
+ *   - deletes and re-arms random timers;
+ *   - advances the clock past every deadline and runs all the timers,
+ *     checking that they fire in order.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/timer.h"
+
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t my_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return my_clock_value;
+}
+
+#define SPAN_NS     (10 * NANOSECONDS_PER_SECOND)
+
+static unsigned int n_timers = 50000;
+static unsigned int n_ops = 1000000;
+
+static QEMUTimer *timers;
+static int64_t *deadlines;
+static int64_t last_fired;
+static unsigned int fired;
+
+static const char commands[] = "\n"
+    " -n = number of armed timers (default 50000)\n"
+    " -o = number of operations per phase (default 1000000)\n"
+    " -h = show this help message.\n";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:o:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'n':
+            n_timers = atoi(optarg);
+            break;
+        case 'o':
+            n_ops = atoi(optarg);
+            break;
+        default:
+            usage_complete(argc, argv);
+            exit(1);
+        }
+    }
+    if (!n_timers || !n_ops) {
+        usage_complete(argc, argv);
+        exit(1);
+    }
+}
+
+static void timer_cb(void *opaque)
+{
+    unsigned int i = (uintptr_t)opaque;
+
+    if (deadlines[i] < last_fired) {
+        fprintf(stderr, "timer %u fired out of order\n", i);
+        exit(1);
+    }
+    last_fired = deadlines[i];
+    fired++;
+}
+
+static void arm(unsigned int i)
+{
+    deadlines[i] = my_clock_value + g_random_int_range(1, SPAN_NS / 1000) *
+                   (int64_t)1000;
+    timer_mod(&timers[i], deadlines[i]);
+}
+
+static void report(const char *what, int64_t ns, unsigned int ops)
+{
+    printf("%-24s %10.1f ns/op\n", what, (double)ns / ops);
+}
+
+int main(int argc, char *argv[])
+{
+    QEMUTimerList *tl;
+    int64_t start, t_arm, t_rearm, t_del, t_run;
+    int64_t deadline = 0;
+    unsigned int i;
+
+    parse_args(argc, argv);
+    init_clocks();
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL, true);
+    g_random_set_seed(42);
+
+    tl = timerlist_new(QEMU_CLOCK_VIRTUAL, NULL, NULL);
+    timers = g_new0(QEMUTimer, n_timers);
+    deadlines = g_new(int64_t, n_timers);
+    for (i = 0; i < n_timers; i++) {
+        timer_init_tl(&timers[i], tl, SCALE_NS, timer_cb,
+                      (void *)(uintptr_t)i);
+    }
+
+    start = get_clock();
+    for (i = 0; i < n_timers; i++) {
+        arm(i);
+    }
+    t_arm = get_clock() - start;
+
+    start = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        arm(g_random_int_range(0, n_timers));
+        deadline += timerlist_deadline_ns(tl);
+    }
+    t_rearm = get_clock() - start;
+
+    start = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        unsigned int j = g_random_int_range(0, n_timers);
+
+        timer_del(&timers[j]);
+        arm(j);
+    }
+    t_del = get_clock() - start;
+
+    my_clock_value = SPAN_NS;
+    start = get_clock();
+    timerlist_run_timers(tl);
+    t_run = get_clock() - start;
+
+    if (fired != n_timers || timerlist_has_timers(tl)) {
+        fprintf(stderr, "%u timers out of %u fired\n", fired, n_timers);
+        exit(1);
+    }
+
+    printf("%u timers, %u operations (average deadline %" PRId64 " ns)\n",
+           n_timers, n_ops, deadline / n_ops);
+    report("arm", t_arm, n_timers);
+    report("re-arm + deadline", t_rearm, n_ops);
+    report("delete + arm", t_del, n_ops);
+    report("run", t_run, n_timers);
+
+    for (i = 0; i < n_timers; i++) {
+        timer_deinit(&timers[i]);
+    }
+    timerlist_free(tl);
+    g_free(deadlines);
+    g_free(timers);
+    return 0;
+}
@@ -0,0 +1,823 @@
+/*
+ * vhost-user datapath benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * The main thread plays the part of both QEMU and the guest driver: it
+ * creates a shared memory region holding an RX and a TX virtqueue, split
+ * or packed (-p), plus packet buffers, and configures a libvhost-user loopback backend
+ * over a socketpair exactly as QEMU's vhost-user master would.  The
+ * backend runs in its own thread and copies every TX buffer into the
+ * next RX buffer.  The driver polls the used rings, so the numbers
+ * measure the ring handling and kick path of the backend rather than
+ * interrupt delivery.
+ *
+ * Two measurements are taken: packets per second with a configurable
+ * number of packets in flight, and round-trip latency with a single
+ * packet in flight.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "contrib/libvhost-user/libvhost-user.h"
+
+#define VUB_RX_QUEUE    0
+#define VUB_TX_QUEUE    1
+#define VUB_NR_QUEUES   2
+
+#define VUB_BUF_SIZE    2048
+#define VUB_RING_ALIGN  4096
+#define VUB_MAX_WATCHES (VHOST_MAX_NR_VIRTQUEUE + 1)
+
+/* Backend side */
+
+typedef struct VubWatch {
+    int fd;
+    vu_watch_cb cb;
+    void *data;
+} VubWatch;
+
+typedef struct VubBackend {
+    VuDev vudev;
+    QemuThread thread;
+    VubWatch watches[VUB_MAX_WATCHES];
+    bool quit;
+    bool stopping;
+} VubBackend;
+
+/* Driver side */
+
+typedef struct VubQueue {
+    struct vring vring;
+    struct vring_packed_desc *desc_packed;
+    struct vring_packed_desc_event *driver_event;
+    struct vring_packed_desc_event *device_event;
+    bool avail_wrap_counter;
+    bool used_wrap_counter;
+    uint64_t ring_gpa;
+    uint8_t *bufs;
+    uint64_t bufs_gpa;
+    uint16_t avail_idx;
+    uint16_t last_used_idx;
+    int kick_fd;
+    int call_fd;
+} VubQueue;
+
+typedef struct VubDriver {
+    int sock;
+    int mem_fd;
+    uint8_t *mem;
+    size_t mem_size;
+    unsigned int num;
+    bool packed;
+    size_t hdrlen;
+    VubQueue vq[VUB_NR_QUEUES];
+} VubDriver;
+
+static void
+vub_die(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+static void
+vub_loopback(VuDev *dev)
+{
+    VuVirtq *rxq = vu_get_queue(dev, VUB_RX_QUEUE);
+    VuVirtq *txq = vu_get_queue(dev, VUB_TX_QUEUE);
+    unsigned int n = 0;
+
+    for (;;) {
+        VuVirtqElement *tx, *rx;
+        size_t len = 0;
+        unsigned int i;
+
+        tx = vu_queue_pop(dev, txq, sizeof(VuVirtqElement));
+        if (!tx) {
+            break;
+        }
+        rx = vu_queue_pop(dev, rxq, sizeof(VuVirtqElement));
+        if (!rx) {
+            /* Wait for the driver to kick the RX queue. */
+            vu_queue_rewind(dev, txq, 1);
+            free(tx);
+            break;
+        }
+
+        for (i = 0; i < tx->out_num; i++) {
+            len += iov_from_buf(rx->in_sg, rx->in_num, len,
+                                tx->out_sg[i].iov_base,
+                                tx->out_sg[i].iov_len);
+        }
+
+        vu_queue_fill(dev, txq, tx, 0, n);
+        vu_queue_fill(dev, rxq, rx, len, n);
+        n++;
+
+        free(tx);
+        free(rx);
+    }
+
+    if (n) {
+        vu_queue_flush(dev, txq, n);
+        vu_queue_flush(dev, rxq, n);
+        vu_queue_notify(dev, txq);
+        vu_queue_notify(dev, rxq);
+    }
+}
+
+static void
+vub_handle_queue(VuDev *dev, int qidx)
+{
+    vub_loopback(dev);
+}
+
+static void
+vub_queue_set_started(VuDev *dev, int qidx, bool started)
+{
+    vu_set_queue_handler(dev, vu_get_queue(dev, qidx),
+                         started ? vub_handle_queue : NULL);
+}
+
+static void
+vub_panic(VuDev *dev, const char *msg)
+{
+    VubBackend *be = container_of(dev, VubBackend, vudev);
+
+    if (!atomic_read(&be->stopping)) {
+        fprintf(stderr, "backend panic: %s\n", msg);
+        exit(1);
+    }
+    be->quit = true;
+}
+
+static void
+vub_set_watch(VuDev *dev, int fd, int condition,
+              vu_watch_cb cb, void *data)
+{
+    VubBackend *be = container_of(dev, VubBackend, vudev);
+    VubWatch *free_slot = NULL;
+    int i;
+
+    for (i = 0; i < VUB_MAX_WATCHES; i++) {
+        VubWatch *w = &be->watches[i];
+
+        if (w->fd == fd) {
+            free_slot = w;
+            break;
+        }
+        if (w->fd == -1 && !free_slot) {
+            free_slot = w;
+        }
+    }
+
+    assert(free_slot);
+    *free_slot = (VubWatch) { .fd = fd, .cb = cb, .data = data };
+}
+
+static void
+vub_remove_watch(VuDev *dev, int fd)
+{
+    VubBackend *be = container_of(dev, VubBackend, vudev);
+    int i;
+
+    for (i = 0; i < VUB_MAX_WATCHES; i++) {
+        if (be->watches[i].fd == fd) {
+            be->watches[i].fd = -1;
+        }
+    }
+}
+
+static void
+vub_sock_cb(VuDev *dev, int condition, void *data)
+{
+    vu_dispatch(dev);
+}
+
+static uint64_t
+vub_get_features(VuDev *dev)
+{
+    return 1ULL << VIRTIO_F_RING_PACKED;
+}
+
+static const VuDevIface vub_iface = {
+    .get_features = vub_get_features,
+    .queue_set_started = vub_queue_set_started,
+};
+
+static void *
+vub_backend_thread(void *opaque)
+{
+    VubBackend *be = opaque;
+    struct pollfd pfd[VUB_MAX_WATCHES];
+    int i, n;
+
+    while (!be->quit) {
+        n = 0;
+        for (i = 0; i < VUB_MAX_WATCHES; i++) {
+            if (be->watches[i].fd != -1) {
+                pfd[n].fd = be->watches[i].fd;
+                pfd[n].events = POLLIN;
+                pfd[n].revents = 0;
+                n++;
+            }
+        }
+
+        if (poll(pfd, n, 100) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            vub_die("poll()");
+        }
+
+        for (i = 0; i < n && !be->quit; i++) {
+            int j;
+
+            if (!pfd[i].revents) {
+                continue;
+            }
+            /* A callback may have removed or replaced other watches. */
+            for (j = 0; j < VUB_MAX_WATCHES; j++) {
+                VubWatch *w = &be->watches[j];
+
+                if (w->fd == pfd[i].fd) {
+                    w->cb(&be->vudev, VU_WATCH_IN, w->data);
+                    break;
+                }
+            }
+        }
+    }
+
+    vu_deinit(&be->vudev);
+    return NULL;
+}
+
+static void
+vub_backend_start(VubBackend *be, int sock)
+{
+    int i;
+
+    for (i = 0; i < VUB_MAX_WATCHES; i++) {
+        be->watches[i].fd = -1;
+    }
+
+    vu_init(&be->vudev, sock, vub_panic, vub_set_watch, vub_remove_watch,
+            &vub_iface);
+    vub_set_watch(&be->vudev, sock, VU_WATCH_IN, vub_sock_cb, NULL);
+
+    qemu_thread_create(&be->thread, "vhost-user-bench", vub_backend_thread,
+                       be, QEMU_THREAD_JOINABLE);
+}
+
+/* vhost-user master */
+
+static void
+vub_send_msg(VubDriver *drv, VhostUserRequest request, const void *payload,
+             uint32_t size, int *fds, int fd_num)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .size = size,
+    };
+    char control[CMSG_SPACE(VHOST_MEMORY_MAX_NREGIONS * sizeof(int))];
+    struct iovec iov = {
+        .iov_base = &msg,
+        .iov_len = VHOST_USER_HDR_SIZE + size,
+    };
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    ssize_t rc;
+
+    assert(size <= sizeof(msg.payload));
+    if (size) {
+        memcpy(&msg.payload, payload, size);
+    }
+
+    if (fd_num) {
+        struct cmsghdr *cmsg;
+        size_t fd_size = fd_num * sizeof(int);
+
+        assert(fd_num <= VHOST_MEMORY_MAX_NREGIONS);
+        mh.msg_control = control;
+        mh.msg_controllen = CMSG_SPACE(fd_size);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_len = CMSG_LEN(fd_size);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(cmsg), fds, fd_size);
+    }
+
+    do {
+        rc = sendmsg(drv->sock, &mh, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc != iov.iov_len) {
+        vub_die("sendmsg()");
+    }
+}
+
+static uint64_t
+vub_get_u64(VubDriver *drv, VhostUserRequest request)
+{
+    VhostUserMsg msg;
+
+    vub_send_msg(drv, request, NULL, 0, NULL, 0);
+
+    if (read(drv->sock, &msg, VHOST_USER_HDR_SIZE) != VHOST_USER_HDR_SIZE ||
+        msg.request != request || !(msg.flags & VHOST_USER_REPLY_MASK) ||
+        msg.size != sizeof(msg.payload.u64) ||
+        read(drv->sock, &msg.payload.u64, msg.size) != msg.size) {
+        fprintf(stderr, "bad reply to request %d\n", request);
+        exit(1);
+    }
+
+    return msg.payload.u64;
+}
+
+static void
+vub_set_u64(VubDriver *drv, VhostUserRequest request, uint64_t u64, int fd)
+{
+    vub_send_msg(drv, request, &u64, sizeof(u64), &fd, fd == -1 ? 0 : 1);
+}
+
+static void
+vub_set_state(VubDriver *drv, VhostUserRequest request,
+              unsigned int index, unsigned int num)
+{
+    struct vhost_vring_state state = { .index = index, .num = num };
+
+    vub_send_msg(drv, request, &state, sizeof(state), NULL, 0);
+}
+
+static void
+vub_setup_mem(VubDriver *drv, unsigned int num)
+{
+    char template[] = "/tmp/vhost-user-bench-XXXXXX";
+    size_t ring_size = QEMU_ALIGN_UP(vring_size(num, VUB_RING_ALIGN),
+                                     VUB_RING_ALIGN);
+    size_t bufs_size = num * VUB_BUF_SIZE;
+    uint64_t gpa = 0;
+    int i;
+
+    drv->num = num;
+    drv->mem_size = VUB_NR_QUEUES * (ring_size + bufs_size);
+
+    drv->mem_fd = mkstemp(template);
+    if (drv->mem_fd < 0) {
+        vub_die("mkstemp()");
+    }
+    unlink(template);
+    if (ftruncate(drv->mem_fd, drv->mem_size) < 0) {
+        vub_die("ftruncate()");
+    }
+    drv->mem = mmap(NULL, drv->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    drv->mem_fd, 0);
+    if (drv->mem == MAP_FAILED) {
+        vub_die("mmap()");
+    }
+    memset(drv->mem, 0, drv->mem_size);
+
+    /* Guest physical addresses are simply offsets into the region. */
+    for (i = 0; i < VUB_NR_QUEUES; i++) {
+        VubQueue *q = &drv->vq[i];
+
+        q->ring_gpa = gpa;
+        if (drv->packed) {
+            /* Descriptors, then the driver and device event areas */
+            q->desc_packed = (void *)(drv->mem + gpa);
+            q->driver_event = (void *)(q->desc_packed + num);
+            q->device_event = q->driver_event + 1;
+            q->avail_wrap_counter = q->used_wrap_counter = true;
+        } else {
+            vring_init(&q->vring, num, drv->mem + gpa, VUB_RING_ALIGN);
+        }
+        gpa += ring_size;
+
+        q->bufs_gpa = gpa;
+        q->bufs = drv->mem + gpa;
+        gpa += bufs_size;
+
+        /* The driver polls the used rings, no interrupts needed. */
+        if (drv->packed) {
+            q->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+        } else {
+            q->vring.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+        }
+
+        q->kick_fd = eventfd(0, EFD_NONBLOCK);
+        q->call_fd = eventfd(0, EFD_NONBLOCK);
+        if (q->kick_fd < 0 || q->call_fd < 0) {
+            vub_die("eventfd()");
+        }
+    }
+}
+
+static void
+vub_setup_device(VubDriver *drv)
+{
+    VhostUserMemory mem = {
+        .nregions = 1,
+        .regions[0] = {
+            .guest_phys_addr = 0,
+            .memory_size = drv->mem_size,
+            .userspace_addr = (uintptr_t)drv->mem,
+            .mmap_offset = 0,
+        },
+    };
+    uint64_t features;
+    int i;
+
+    vub_send_msg(drv, VHOST_USER_SET_OWNER, NULL, 0, NULL, 0);
+
+    /*
+     * Do not ack VHOST_USER_F_PROTOCOL_FEATURES, so that the rings are
+     * enabled as soon as they are started.  Dirty logging is only
+     * enabled by QEMU during migration.
+     */
+    features = vub_get_u64(drv, VHOST_USER_GET_FEATURES);
+    features &= ~(1ULL << VHOST_USER_F_PROTOCOL_FEATURES |
+                  1ULL << VHOST_F_LOG_ALL);
+    if (!drv->packed) {
+        features &= ~(1ULL << VIRTIO_F_RING_PACKED);
+    } else if (!(features & (1ULL << VIRTIO_F_RING_PACKED))) {
+        fprintf(stderr, "backend does not support packed rings\n");
+        exit(1);
+    }
+    drv->hdrlen = sizeof(struct virtio_net_hdr);
+    if (features & (1ULL << VIRTIO_NET_F_MRG_RXBUF)) {
+        drv->hdrlen = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    }
+    vub_set_u64(drv, VHOST_USER_SET_FEATURES, features, -1);
+
+    vub_send_msg(drv, VHOST_USER_SET_MEM_TABLE, &mem, sizeof(mem),
+                 &drv->mem_fd, 1);
+
+    for (i = 0; i < VUB_NR_QUEUES; i++) {
+        VubQueue *q = &drv->vq[i];
+        struct vhost_vring_addr addr = {
+            .index = i,
+            .desc_user_addr = (uintptr_t)q->vring.desc,
+            .avail_user_addr = (uintptr_t)q->vring.avail,
+            .used_user_addr = (uintptr_t)q->vring.used,
+            .log_guest_addr = q->ring_gpa +
+                ((uint8_t *)q->vring.used - (uint8_t *)q->vring.desc),
+        };
+        unsigned int base = 0;
+
+        if (drv->packed) {
+            addr.desc_user_addr = (uintptr_t)q->desc_packed;
+            addr.avail_user_addr = (uintptr_t)q->driver_event;
+            addr.used_user_addr = (uintptr_t)q->device_event;
+            addr.log_guest_addr = q->ring_gpa +
+                ((uint8_t *)q->device_event - (uint8_t *)q->desc_packed);
+            /* Both wrap counters start at 1, in bit 15 of the base */
+            base = 1 << 15;
+        }
+
+        vub_set_state(drv, VHOST_USER_SET_VRING_NUM, i, drv->num);
+        vub_send_msg(drv, VHOST_USER_SET_VRING_ADDR, &addr, sizeof(addr),
+                     NULL, 0);
+        vub_set_state(drv, VHOST_USER_SET_VRING_BASE, i, base);
+        vub_set_u64(drv, VHOST_USER_SET_VRING_CALL, i, q->call_fd);
+        vub_set_u64(drv, VHOST_USER_SET_VRING_KICK, i, q->kick_fd);
+    }
+}
+
+/* Guest driver */
+
+static void
+vub_kick(VubDriver *drv, VubQueue *q)
+{
+    bool notify;
+
+    if (drv->packed) {
+        notify = atomic_read(&q->device_event->flags) !=
+                 VRING_PACKED_EVENT_FLAG_DISABLE;
+    } else {
+        notify = !(atomic_read(&q->vring.used->flags) &
+                   VRING_USED_F_NO_NOTIFY);
+    }
+    if (notify) {
+        if (eventfd_write(q->kick_fd, 1) < 0) {
+            vub_die("eventfd_write()");
+        }
+    }
+}
+
+static void
+vub_add_buf_packed(VubDriver *drv, VubQueue *q, unsigned int id, uint32_t len,
+                   bool write)
+{
+    struct vring_packed_desc *desc;
+    uint16_t flags = write ? VRING_DESC_F_WRITE : 0;
+
+    /* Buffer ids and ring slots are unrelated in a packed ring */
+    desc = &q->desc_packed[q->avail_idx % drv->num];
+    desc->addr = q->bufs_gpa + id * VUB_BUF_SIZE;
+    desc->len = len;
+    desc->id = id;
+
+    if (q->avail_wrap_counter) {
+        flags |= 1 << VRING_PACKED_DESC_F_AVAIL;
+    } else {
+        flags |= 1 << VRING_PACKED_DESC_F_USED;
+    }
+    /* The descriptor before the flags that make it available. */
+    smp_wmb();
+    atomic_set(&desc->flags, flags);
+
+    if (++q->avail_idx % drv->num == 0) {
+        q->avail_wrap_counter = !q->avail_wrap_counter;
+    }
+}
+
+static void
+vub_add_buf(VubDriver *drv, VubQueue *q, unsigned int id, uint32_t len,
+            bool write)
+{
+    struct vring_desc *desc = &q->vring.desc[id];
+
+    if (drv->packed) {
+        vub_add_buf_packed(drv, q, id, len, write);
+        return;
+    }
+
+    desc->addr = q->bufs_gpa + id * VUB_BUF_SIZE;
+    desc->len = len;
+    desc->flags = write ? VRING_DESC_F_WRITE : 0;
+    desc->next = 0;
+
+    q->vring.avail->ring[q->avail_idx % drv->num] = id;
+    q->avail_idx++;
+}
+
+static void
+vub_publish(VubDriver *drv, VubQueue *q)
+{
+    if (!drv->packed) {
+        /* Descriptors and ring entries before the index. */
+        smp_wmb();
+        atomic_set(&q->vring.avail->idx, q->avail_idx);
+    }
+    smp_mb();
+}
+
+static bool
+vub_get_used_packed(VubDriver *drv, VubQueue *q, struct vring_used_elem *elem)
+{
+    struct vring_packed_desc *desc;
+    uint16_t flags;
+
+    desc = &q->desc_packed[q->last_used_idx % drv->num];
+    flags = atomic_read(&desc->flags);
+    if (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) != q->used_wrap_counter ||
+        !!(flags & (1 << VRING_PACKED_DESC_F_USED)) != q->used_wrap_counter) {
+        return false;
+    }
+    smp_rmb();
+    elem->id = desc->id;
+    elem->len = desc->len;
+
+    /* Every buffer is a single descriptor. */
+    if (++q->last_used_idx % drv->num == 0) {
+        q->used_wrap_counter = !q->used_wrap_counter;
+    }
+    return true;
+}
+
+static bool
+vub_get_used(VubDriver *drv, VubQueue *q, struct vring_used_elem *elem)
+{
+    if (drv->packed) {
+        return vub_get_used_packed(drv, q, elem);
+    }
+    if (q->last_used_idx == atomic_read(&q->vring.used->idx)) {
+        return false;
+    }
+    smp_rmb();
+    *elem = q->vring.used->ring[q->last_used_idx % drv->num];
+    q->last_used_idx++;
+    return true;
+}
+
+static void
+vub_fill_rx(VubDriver *drv)
+{
+    VubQueue *rxq = &drv->vq[VUB_RX_QUEUE];
+    unsigned int i;
+
+    for (i = 0; i < drv->num; i++) {
+        vub_add_buf(drv, rxq, i, VUB_BUF_SIZE, true);
+    }
+    vub_publish(drv, rxq);
+    vub_kick(drv, rxq);
+}
+
+/*
+ * Keep up to @batch packets of @len bytes in flight until @count
+ * packets have been looped back.  If @lat is not NULL, record the
+ * round trip time of each packet; this only makes sense with @batch 1.
+ */
+static void
+vub_run(VubDriver *drv, uint64_t count, unsigned int batch, size_t len,
+        int64_t *lat)
+{
+    VubQueue *rxq = &drv->vq[VUB_RX_QUEUE];
+    VubQueue *txq = &drv->vq[VUB_TX_QUEUE];
+    uint64_t sent = 0, completed = 0, received = 0;
+    size_t pkt_len = drv->hdrlen + len;
+    int64_t t0 = 0;
+
+    while (received < count) {
+        struct vring_used_elem used;
+        unsigned int reposted = 0;
+        unsigned int posted = 0;
+
+        while (sent < count && sent - received < batch &&
+               sent - completed < drv->num) {
+            unsigned int id = txq->avail_idx % drv->num;
+            uint8_t *pkt = txq->bufs + id * VUB_BUF_SIZE;
+
+            memset(pkt, 0, drv->hdrlen);
+            stq_le_p(pkt + drv->hdrlen, sent);
+            vub_add_buf(drv, txq, id, pkt_len, false);
+            sent++;
+            posted++;
+        }
+        if (posted) {
+            if (lat) {
+                t0 = get_clock();
+            }
+            vub_publish(drv, txq);
+            vub_kick(drv, txq);
+        }
+
+        while (vub_get_used(drv, txq, &used)) {
+            completed++;
+        }
+
+        while (vub_get_used(drv, rxq, &used)) {
+            uint8_t *pkt = rxq->bufs + used.id * VUB_BUF_SIZE;
+
+            if (lat) {
+                lat[received] = get_clock() - t0;
+            }
+            if (used.len != pkt_len ||
+                ldq_le_p(pkt + drv->hdrlen) != received) {
+                fprintf(stderr, "bad packet %" PRIu64 "\n", received);
+                exit(1);
+            }
+            received++;
+
+            vub_add_buf(drv, rxq, used.id, VUB_BUF_SIZE, true);
+            reposted++;
+        }
+        if (reposted) {
+            vub_publish(drv, rxq);
+            vub_kick(drv, rxq);
+        }
+    }
+
+    /* Wait for the last TX completions so that the rings are idle. */
+    while (completed < sent) {
+        struct vring_used_elem used;
+
+        if (vub_get_used(drv, txq, &used)) {
+            completed++;
+        }
+    }
+}
+
+static double
+vub_seconds(int64_t ns)
+{
+    return ns / (double)NANOSECONDS_PER_SECOND;
+}
+
+static int
+vub_cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n packets] [-b batch] [-l len] "
+            "[-q queue-size] [-L latency-samples] [-p]\n", prog);
+    fprintf(stderr, "\t-n packets for the throughput test. default: 1000000\n");
+    fprintf(stderr, "\t-b packets in flight. default: 32\n");
+    fprintf(stderr, "\t-l payload length in bytes. default: 64\n");
+    fprintf(stderr, "\t-q virtqueue size. default: 256\n");
+    fprintf(stderr, "\t-L round trips for the latency test. default: 100000\n");
+    fprintf(stderr, "\t-p use packed virtqueues. default: split\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t count = 1000000, samples = 100000, i;
+    unsigned int batch = 32, num = 256;
+    size_t len = 64;
+    VubBackend be = { };
+    VubDriver drv = { };
+    int sv[2], opt;
+    int64_t start, elapsed, sum = 0;
+    int64_t *lat;
+
+    while ((opt = getopt(argc, argv, "n:b:l:q:L:p")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            len = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            num = strtoul(optarg, NULL, 0);
+            break;
+        case 'L':
+            samples = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            drv.packed = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!num || num > VIRTQUEUE_MAX_SIZE || (num & (num - 1)) ||
+        !batch || batch > num || !count || !samples ||
+        len < sizeof(uint64_t) ||
+        len + sizeof(struct virtio_net_hdr_mrg_rxbuf) > VUB_BUF_SIZE) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        vub_die("socketpair()");
+    }
+    drv.sock = sv[0];
+
+    vub_backend_start(&be, sv[1]);
+    vub_setup_mem(&drv, num);
+    vub_setup_device(&drv);
+    vub_fill_rx(&drv);
+
+    printf("%s queue size %u, payload %zu bytes, header %zu bytes\n",
+           drv.packed ? "packed" : "split", num, len, drv.hdrlen);
+
+    start = get_clock();
+    vub_run(&drv, count, batch, len, NULL);
+    elapsed = get_clock() - start;
+    printf("throughput: %" PRIu64 " packets, batch %u: %.3f s, %.0f pps\n",
+           count, batch, vub_seconds(elapsed), count / vub_seconds(elapsed));
+
+    lat = g_new(int64_t, samples);
+    vub_run(&drv, samples, 1, len, lat);
+    for (i = 0; i < samples; i++) {
+        sum += lat[i];
+    }
+    qsort(lat, samples, sizeof(*lat), vub_cmp_int64);
+    printf("latency: %" PRIu64 " round trips: min %" PRId64 " ns, "
+           "avg %" PRId64 " ns, p99 %" PRId64 " ns, max %" PRId64 " ns\n",
+           samples, lat[0], sum / (int64_t)samples,
+           lat[samples * 99 / 100], lat[samples - 1]);
+    g_free(lat);
+
+    /* Closing the master socket makes the backend thread exit. */
+    atomic_set(&be.stopping, true);
+    close(drv.sock);
+    qemu_thread_join(&be.thread);
+
+    munmap(drv.mem, drv.mem_size);
+    close(drv.mem_fd);
+    for (i = 0; i < VUB_NR_QUEUES; i++) {
+        close(drv.vq[i].kick_fd);
+        close(drv.vq[i].call_fd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,473 @@
+/*
+ * QTest testcase for the VirtIO packed virtqueue layout
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Drives the request queue of a virtio-rng-pci device through the modern
+ * (VIRTIO 1.0) PCI interface, with a ring small enough that descriptor
+ * chains cross its end and both wrap counters flip several times.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "standard-headers/linux/virtio_pci.h"
+
+#include "hw/pci/pci.h"
+#include "hw/pci/pci_regs.h"
+
+#define QUEUE_SIZE      8
+#define BUF_LEN         16
+
+#define PACKED_DESC_SIZE        16
+#define PACKED_DESC_ADDR        0
+#define PACKED_DESC_LEN         8
+#define PACKED_DESC_ID          12
+#define PACKED_DESC_FLAGS       14
+
+#define DESC_F_AVAIL    (1 << VRING_PACKED_DESC_F_AVAIL)
+#define DESC_F_USED     (1 << VRING_PACKED_DESC_F_USED)
+
+typedef struct QVirtioPackedDevice {
+    QPCIDevice *pdev;
+    QPCIBar bars[6];
+    bool mapped[6];
+
+    QPCIBar common_bar;
+    uint64_t common_off;
+    QPCIBar notify_bar;
+    uint64_t notify_off;
+    uint32_t notify_mult;
+
+    /* The request queue */
+    uint64_t desc;
+    uint64_t driver;
+    uint64_t device;
+    uint16_t avail_idx;
+    bool avail_wrap;
+    uint16_t used_idx;
+    bool used_wrap;
+    /* Number of ring slots taken by each buffer id */
+    uint16_t ndescs[QUEUE_SIZE];
+} QVirtioPackedDevice;
+
+static QGuestAllocator *test_alloc;
+static QPCIBus *test_bus;
+
+static void packed_pci_foreach_callback(QPCIDevice *dev, int devfn,
+                                        void *data)
+{
+    *(QPCIDevice **)data = dev;
+}
+
+static QPCIBar packed_bar(QVirtioPackedDevice *d, int bar)
+{
+    g_assert_cmpint(bar, <, ARRAY_SIZE(d->bars));
+    if (!d->mapped[bar]) {
+        d->bars[bar] = qpci_iomap(d->pdev, bar, NULL);
+        d->mapped[bar] = true;
+    }
+    return d->bars[bar];
+}
+
+/* Find the modern interface through the vendor capabilities */
+static void packed_find_caps(QVirtioPackedDevice *d)
+{
+    bool common = false, notify = false;
+    uint8_t cap;
+
+    g_assert(qpci_config_readw(d->pdev, PCI_STATUS) & PCI_STATUS_CAP_LIST);
+    cap = qpci_config_readb(d->pdev, PCI_CAPABILITY_LIST);
+    while (cap) {
+        uint8_t type, bar;
+        uint32_t offset;
+
+        if (qpci_config_readb(d->pdev, cap + PCI_CAP_LIST_ID) !=
+            PCI_CAP_ID_VNDR) {
+            cap = qpci_config_readb(d->pdev, cap + PCI_CAP_LIST_NEXT);
+            continue;
+        }
+
+        type = qpci_config_readb(d->pdev, cap + VIRTIO_PCI_CAP_CFG_TYPE);
+        bar = qpci_config_readb(d->pdev, cap + VIRTIO_PCI_CAP_BAR);
+        offset = qpci_config_readl(d->pdev, cap + VIRTIO_PCI_CAP_OFFSET);
+        switch (type) {
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            d->common_bar = packed_bar(d, bar);
+            d->common_off = offset;
+            common = true;
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            d->notify_bar = packed_bar(d, bar);
+            d->notify_off = offset;
+            d->notify_mult = qpci_config_readl(d->pdev, cap +
+                                               VIRTIO_PCI_NOTIFY_CAP_MULT);
+            notify = true;
+            break;
+        }
+        cap = qpci_config_readb(d->pdev, cap + PCI_CAP_LIST_NEXT);
+    }
+
+    g_assert(common && notify);
+}
+
+static uint8_t common_readb(QVirtioPackedDevice *d, uint64_t off)
+{
+    return qpci_io_readb(d->pdev, d->common_bar, d->common_off + off);
+}
+
+static uint16_t common_readw(QVirtioPackedDevice *d, uint64_t off)
+{
+    return qpci_io_readw(d->pdev, d->common_bar, d->common_off + off);
+}
+
+static uint32_t common_readl(QVirtioPackedDevice *d, uint64_t off)
+{
+    return qpci_io_readl(d->pdev, d->common_bar, d->common_off + off);
+}
+
+static void common_writeb(QVirtioPackedDevice *d, uint64_t off, uint8_t val)
+{
+    qpci_io_writeb(d->pdev, d->common_bar, d->common_off + off, val);
+}
+
+static void common_writew(QVirtioPackedDevice *d, uint64_t off, uint16_t val)
+{
+    qpci_io_writew(d->pdev, d->common_bar, d->common_off + off, val);
+}
+
+static void common_writel(QVirtioPackedDevice *d, uint64_t off, uint32_t val)
+{
+    qpci_io_writel(d->pdev, d->common_bar, d->common_off + off, val);
+}
+
+static void common_set_status(QVirtioPackedDevice *d, uint8_t status)
+{
+    common_writeb(d, VIRTIO_PCI_COMMON_STATUS, status);
+    g_assert_cmphex(common_readb(d, VIRTIO_PCI_COMMON_STATUS), ==, status);
+}
+
+static void packed_device_init(QVirtioPackedDevice *d, bool indirect)
+{
+    uint64_t features, wanted;
+    uint8_t status;
+
+    memset(d, 0, sizeof(*d));
+    qpci_device_foreach(test_bus, PCI_VENDOR_ID_REDHAT_QUMRANET,
+                        PCI_DEVICE_ID_VIRTIO_RNG,
+                        packed_pci_foreach_callback, &d->pdev);
+    g_assert(d->pdev);
+    qpci_device_enable(d->pdev);
+    packed_find_caps(d);
+
+    common_set_status(d, 0);
+    status = VIRTIO_CONFIG_S_ACKNOWLEDGE;
+    common_set_status(d, status);
+    status |= VIRTIO_CONFIG_S_DRIVER;
+    common_set_status(d, status);
+
+    common_writel(d, VIRTIO_PCI_COMMON_DFSELECT, 0);
+    features = common_readl(d, VIRTIO_PCI_COMMON_DF);
+    common_writel(d, VIRTIO_PCI_COMMON_DFSELECT, 1);
+    features |= (uint64_t)common_readl(d, VIRTIO_PCI_COMMON_DF) << 32;
+
+    wanted = 1ull << VIRTIO_F_VERSION_1 | 1ull << VIRTIO_F_RING_PACKED;
+    if (indirect) {
+        wanted |= 1ull << VIRTIO_RING_F_INDIRECT_DESC;
+    }
+    g_assert_cmphex(features & wanted, ==, wanted);
+
+    common_writel(d, VIRTIO_PCI_COMMON_GFSELECT, 0);
+    common_writel(d, VIRTIO_PCI_COMMON_GF, wanted);
+    common_writel(d, VIRTIO_PCI_COMMON_GFSELECT, 1);
+    common_writel(d, VIRTIO_PCI_COMMON_GF, wanted >> 32);
+    status |= VIRTIO_CONFIG_S_FEATURES_OK;
+    common_set_status(d, status);
+
+    /* Shrink the ring so that the tests go round it quickly */
+    common_writew(d, VIRTIO_PCI_COMMON_Q_SELECT, 0);
+    common_writew(d, VIRTIO_PCI_COMMON_Q_SIZE, QUEUE_SIZE);
+
+    d->desc = guest_alloc(test_alloc, QUEUE_SIZE * PACKED_DESC_SIZE);
+    d->driver = guest_alloc(test_alloc, 4);
+    d->device = guest_alloc(test_alloc, 4);
+    qmemset(d->desc, 0, QUEUE_SIZE * PACKED_DESC_SIZE);
+    qmemset(d->driver, 0, 4);
+    qmemset(d->device, 0, 4);
+    d->avail_wrap = d->used_wrap = true;
+
+    common_writel(d, VIRTIO_PCI_COMMON_Q_DESCLO, d->desc);
+    common_writel(d, VIRTIO_PCI_COMMON_Q_DESCHI, d->desc >> 32);
+    common_writel(d, VIRTIO_PCI_COMMON_Q_AVAILLO, d->driver);
+    common_writel(d, VIRTIO_PCI_COMMON_Q_AVAILHI, d->driver >> 32);
+    common_writel(d, VIRTIO_PCI_COMMON_Q_USEDLO, d->device);
+    common_writel(d, VIRTIO_PCI_COMMON_Q_USEDHI, d->device >> 32);
+    common_writew(d, VIRTIO_PCI_COMMON_Q_ENABLE, 1);
+
+    status |= VIRTIO_CONFIG_S_DRIVER_OK;
+    common_set_status(d, status);
+}
+
+static void packed_device_clear(QVirtioPackedDevice *d)
+{
+    common_set_status(d, 0);
+    guest_free(test_alloc, d->desc);
+    guest_free(test_alloc, d->driver);
+    guest_free(test_alloc, d->device);
+    g_free(d->pdev);
+}
+
+static uint16_t packed_avail_flags(bool wrap)
+{
+    return wrap ? DESC_F_AVAIL : DESC_F_USED;
+}
+
+static void packed_desc_write(uint64_t desc, uint64_t addr, uint32_t len,
+                              uint16_t id)
+{
+    writeq(desc + PACKED_DESC_ADDR, addr);
+    writel(desc + PACKED_DESC_LEN, len);
+    writew(desc + PACKED_DESC_ID, id);
+}
+
+/*
+ * Make @n write-only buffers available as buffer @id, either as a chain of
+ * ring descriptors or through an indirect table.  The flags of the first
+ * descriptor are written last, as they hand the whole chain over.
+ */
+static void packed_add(QVirtioPackedDevice *d, uint16_t id,
+                       const uint64_t *bufs, int n, uint64_t indirect)
+{
+    uint16_t head = d->avail_idx;
+    uint16_t head_flags = 0;
+    int i;
+
+    if (indirect) {
+        for (i = 0; i < n; i++) {
+            uint64_t desc = indirect + i * PACKED_DESC_SIZE;
+
+            packed_desc_write(desc, bufs[i], BUF_LEN, 0);
+            writew(desc + PACKED_DESC_FLAGS, VRING_DESC_F_WRITE);
+        }
+        packed_desc_write(d->desc + head * PACKED_DESC_SIZE, indirect,
+                          n * PACKED_DESC_SIZE, id);
+        head_flags = VRING_DESC_F_INDIRECT |
+                     packed_avail_flags(d->avail_wrap);
+        n = 1;
+    } else {
+        for (i = 0; i < n; i++) {
+            uint64_t desc = d->desc + d->avail_idx * PACKED_DESC_SIZE;
+            uint16_t flags = VRING_DESC_F_WRITE |
+                             packed_avail_flags(d->avail_wrap);
+
+            if (i < n - 1) {
+                flags |= VRING_DESC_F_NEXT;
+            }
+            packed_desc_write(desc, bufs[i], BUF_LEN, id);
+            if (i) {
+                writew(desc + PACKED_DESC_FLAGS, flags);
+            } else {
+                head_flags = flags;
+            }
+            if (++d->avail_idx == QUEUE_SIZE) {
+                d->avail_idx = 0;
+                d->avail_wrap = !d->avail_wrap;
+            }
+        }
+    }
+    if (indirect && ++d->avail_idx == QUEUE_SIZE) {
+        d->avail_idx = 0;
+        d->avail_wrap = !d->avail_wrap;
+    }
+
+    d->ndescs[id] = n;
+    writew(d->desc + head * PACKED_DESC_SIZE + PACKED_DESC_FLAGS, head_flags);
+}
+
+static void packed_kick(QVirtioPackedDevice *d)
+{
+    uint16_t noff;
+
+    common_writew(d, VIRTIO_PCI_COMMON_Q_SELECT, 0);
+    noff = common_readw(d, VIRTIO_PCI_COMMON_Q_NOFF);
+    qpci_io_writew(d->pdev, d->notify_bar,
+                   d->notify_off + noff * d->notify_mult, 0);
+}
+
+/* Wait for the next used buffer and return its id */
+static uint16_t packed_wait_used(QVirtioPackedDevice *d, uint32_t *len)
+{
+    uint64_t desc = d->desc + d->used_idx * PACKED_DESC_SIZE;
+    gint64 start_time = g_get_monotonic_time();
+    uint16_t flags, id;
+
+    for (;;) {
+        flags = readw(desc + PACKED_DESC_FLAGS);
+        if (!!(flags & DESC_F_AVAIL) == d->used_wrap &&
+            !!(flags & DESC_F_USED) == d->used_wrap) {
+            break;
+        }
+        clock_step(100);
+        g_assert(g_get_monotonic_time() - start_time <=
+                 5 * G_TIME_SPAN_SECOND);
+    }
+
+    id = readw(desc + PACKED_DESC_ID);
+    *len = readl(desc + PACKED_DESC_LEN);
+    g_assert_cmpint(id, <, QUEUE_SIZE);
+    g_assert_cmpint(d->ndescs[id], >, 0);
+
+    d->used_idx += d->ndescs[id];
+    if (d->used_idx >= QUEUE_SIZE) {
+        d->used_idx -= QUEUE_SIZE;
+        d->used_wrap = !d->used_wrap;
+    }
+    d->ndescs[id] = 0;
+    return id;
+}
+
+static void packed_test_start(QVirtioPackedDevice *d, bool indirect)
+{
+    qtest_start("-object rng-random,id=rng0,filename=/dev/urandom "
+                "-device virtio-rng-pci,rng=rng0,packed=on");
+    test_bus = qpci_init_pc(NULL);
+    test_alloc = pc_alloc_init();
+    packed_device_init(d, indirect);
+}
+
+static void packed_test_end(QVirtioPackedDevice *d)
+{
+    packed_device_clear(d);
+    pc_alloc_uninit(test_alloc);
+    qpci_free_pc(test_bus);
+    qtest_end();
+}
+
+/*
+ * Chains of three descriptors on a ring of eight: every third chain runs
+ * over the end of the ring, and the avail and used wrap counters flip
+ * every few requests.
+ */
+static void test_chain_wrap(void)
+{
+    QVirtioPackedDevice d;
+    uint64_t bufs[3];
+    uint32_t len;
+    int i, j;
+
+    packed_test_start(&d, false);
+    for (j = 0; j < ARRAY_SIZE(bufs); j++) {
+        bufs[j] = guest_alloc(test_alloc, BUF_LEN);
+    }
+
+    for (i = 0; i < 4 * QUEUE_SIZE; i++) {
+        uint16_t id = i % QUEUE_SIZE;
+
+        packed_add(&d, id, bufs, ARRAY_SIZE(bufs), 0);
+        packed_kick(&d);
+        /* The device must skip the whole chain, wrapping with it */
+        g_assert_cmpint(packed_wait_used(&d, &len), ==, id);
+        g_assert_cmpint(len, ==, ARRAY_SIZE(bufs) * BUF_LEN);
+        g_assert_cmpint(d.used_idx, ==, d.avail_idx);
+        g_assert_cmpint(d.used_wrap, ==, d.avail_wrap);
+    }
+
+    for (j = 0; j < ARRAY_SIZE(bufs); j++) {
+        guest_free(test_alloc, bufs[j]);
+    }
+    packed_test_end(&d);
+}
+
+/*
+ * Fill the whole ring before kicking, so that the device has to find the
+ * end of what is available by the flags alone, then do it again on the
+ * other side of the wrap.
+ */
+static void test_full_ring(void)
+{
+    QVirtioPackedDevice d;
+    uint64_t bufs[QUEUE_SIZE];
+    uint32_t len;
+    int i, round;
+
+    packed_test_start(&d, false);
+    for (i = 0; i < QUEUE_SIZE; i++) {
+        bufs[i] = guest_alloc(test_alloc, BUF_LEN);
+    }
+
+    for (round = 0; round < 3; round++) {
+        bool wrap = d.avail_wrap;
+
+        for (i = 0; i < QUEUE_SIZE; i++) {
+            packed_add(&d, i, &bufs[i], 1, 0);
+        }
+        g_assert_cmpint(d.avail_idx, ==, 0);
+        g_assert_cmpint(d.avail_wrap, !=, wrap);
+        packed_kick(&d);
+
+        for (i = 0; i < QUEUE_SIZE; i++) {
+            g_assert_cmpint(packed_wait_used(&d, &len), ==, i);
+            g_assert_cmpint(len, ==, BUF_LEN);
+        }
+        g_assert_cmpint(d.used_idx, ==, 0);
+        g_assert_cmpint(d.used_wrap, ==, d.avail_wrap);
+    }
+
+    for (i = 0; i < QUEUE_SIZE; i++) {
+        guest_free(test_alloc, bufs[i]);
+    }
+    packed_test_end(&d);
+}
+
+/*
+ * Indirect tables take a single ring slot each, whatever their size, and
+ * are used whole.
+ */
+static void test_indirect(void)
+{
+    QVirtioPackedDevice d;
+    uint64_t bufs[4], table;
+    uint32_t len;
+    int i, j;
+
+    packed_test_start(&d, true);
+    for (j = 0; j < ARRAY_SIZE(bufs); j++) {
+        bufs[j] = guest_alloc(test_alloc, BUF_LEN);
+    }
+    table = guest_alloc(test_alloc, ARRAY_SIZE(bufs) * PACKED_DESC_SIZE);
+
+    for (i = 0; i < 3 * QUEUE_SIZE; i++) {
+        uint16_t used_idx = d.used_idx;
+        uint16_t id = (i * 3) % QUEUE_SIZE;
+        int n = 1 + i % ARRAY_SIZE(bufs);
+
+        packed_add(&d, id, bufs, n, table);
+        packed_kick(&d);
+        g_assert_cmpint(packed_wait_used(&d, &len), ==, id);
+        g_assert_cmpint(len, ==, n * BUF_LEN);
+        g_assert_cmpint(d.used_idx, ==, (used_idx + 1) % QUEUE_SIZE);
+        g_assert_cmpint(d.used_idx, ==, d.avail_idx);
+        g_assert_cmpint(d.used_wrap, ==, d.avail_wrap);
+    }
+
+    guest_free(test_alloc, table);
+    for (j = 0; j < ARRAY_SIZE(bufs); j++) {
+        guest_free(test_alloc, bufs[j]);
+    }
+    packed_test_end(&d);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/virtio/packed/rng/chain-wrap", test_chain_wrap);
+    qtest_add_func("/virtio/packed/rng/full-ring", test_full_ring);
+    qtest_add_func("/virtio/packed/rng/indirect", test_indirect);
+
+    return g_test_run();
+}
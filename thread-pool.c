@@ -23,9 +23,14 @@
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
+#include "qemu/bitmap.h"
+
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef QTAILQ_HEAD(ThreadPoolElementHead, ThreadPoolElement)
+    ThreadPoolElementHead;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -33,74 +38,229 @@ enum ThreadState {
     THREAD_DONE,
 };
 
+/* Requests are flushed to the workers once this many are plugged.  */
+#define THREAD_POOL_MAX_PLUGGED 128
+
 struct ThreadPoolElement {
     BlockAIOCB common;
     ThreadPool *pool;
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by the lock of
+     * worker.  After that, only the worker thread that runs the request
+     * can write to it.  Reads and writes of state and ret are ordered with
+     * memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* The worker whose queue holds the request, NULL while it is plugged.
+     * Only written by the AioContext thread.
+     */
+    ThreadPoolWorker *worker;
+
+    /* Access to this list is protected by the lock of worker, or only
+     * done from the AioContext thread while the request is plugged.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+/* Each worker thread owns a queue of requests.  The AioContext pushes
+ * requests at the tail, the owner takes them from the head, and a worker
+ * that runs out of work steals from the tail of someone else's queue.
+ * Workers only ever take their own lock or the lock of one victim, so
+ * submission and completion do not contend on a pool-wide lock.
+ *
+ * Worker structs are allocated when their slot is first used and stay
+ * around until the pool is freed, so that a thief may look at any slot
+ * below cur_threads without further synchronization.
+ */
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    QemuThread thread;
+    int index;
+    unsigned affinity_gen;      /* only accessed by the worker thread */
+
+    /* Posted when a request is queued while the worker is idle.  */
+    QemuSemaphore sem;
+
+    QemuMutex lock;
+
+    /* The following variables are protected by lock.  queued and idle are
+     * also read without it by submitters and thieves, as hints.
+     */
+    ThreadPoolElementHead request_list;
+    int queued;
+    bool running;               /* requests may be queued here */
+    bool idle;                  /* waiting on sem */
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    ThreadPoolElementHead plugged_list;
+    int plugged;
+    int nr_plugged;
+    int next_worker;
+
+    /* Slots 0 to cur_threads - 1 have a worker, either running or about
+     * to be created.  Only the topmost worker may go away, so the slots in
+     * use stay contiguous.  cur_threads is protected by lock, but it is
+     * also read without it.
+     */
+    ThreadPoolWorker *workers[THREAD_POOL_MAX_THREADS];
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int min_threads;
+    int max_threads;
+    unsigned long *affinity;
+    long affinity_nbits;
+    unsigned affinity_gen;
     bool stopping;
 };
 
+static ThreadPoolElement *worker_take_request(ThreadPoolWorker *worker,
+                                              bool steal)
+{
+    ThreadPoolElement *req;
+
+    qemu_mutex_lock(&worker->lock);
+    if (steal) {
+        req = QTAILQ_LAST(&worker->request_list, ThreadPoolElementHead);
+    } else {
+        req = QTAILQ_FIRST(&worker->request_list);
+    }
+    if (req) {
+        QTAILQ_REMOVE(&worker->request_list, req, reqs);
+        atomic_set(&worker->queued, worker->queued - 1);
+        req->state = THREAD_ACTIVE;
+    }
+    qemu_mutex_unlock(&worker->lock);
+    return req;
+}
+
+static ThreadPoolElement *worker_get_request(ThreadPoolWorker *worker)
+{
+    ThreadPool *pool = worker->pool;
+    ThreadPoolElement *req;
+    int i, n;
+
+    req = worker_take_request(worker, false);
+    if (req) {
+        return req;
+    }
+
+    n = atomic_mb_read(&pool->cur_threads);
+    for (i = 1; i < n; i++) {
+        ThreadPoolWorker *victim = atomic_read(
+            &pool->workers[(worker->index + i) % n]);
+
+        if (atomic_read(&victim->queued)) {
+            req = worker_take_request(victim, true);
+            if (req) {
+                trace_thread_pool_steal(pool, req, worker->index,
+                                        victim->index);
+                return req;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Wait for work.  Returns false if the worker has gone idle for long
+ * enough that it should exit.
+ */
+static bool worker_wait(ThreadPoolWorker *worker)
+{
+    ThreadPool *pool = worker->pool;
+    bool stop = false;
+
+    qemu_mutex_lock(&worker->lock);
+    if (!QTAILQ_EMPTY(&worker->request_list)) {
+        qemu_mutex_unlock(&worker->lock);
+        return true;
+    }
+    atomic_mb_set(&worker->idle, true);
+    qemu_mutex_unlock(&worker->lock);
+
+    if (qemu_sem_timedwait(&worker->sem, 10000) == 0) {
+        return true;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&worker->lock);
+    if (worker->idle && QTAILQ_EMPTY(&worker->request_list) &&
+        worker->index == pool->cur_threads - 1 &&
+        pool->cur_threads > pool->min_threads && !pool->stopping) {
+        worker->running = false;
+        atomic_set(&pool->cur_threads, pool->cur_threads - 1);
+        stop = true;
+    }
+    atomic_set(&worker->idle, false);
+    qemu_mutex_unlock(&worker->lock);
+    qemu_mutex_unlock(&pool->lock);
+    return !stop;
+}
+
+static void worker_apply_affinity(ThreadPoolWorker *worker)
+{
+    ThreadPool *pool = worker->pool;
+    int ret = 0;
+
+    qemu_mutex_lock(&pool->lock);
+    worker->affinity_gen = pool->affinity_gen;
+    if (pool->affinity) {
+        ret = qemu_thread_set_affinity(&worker->thread, pool->affinity,
+                                       pool->affinity_nbits);
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    if (ret < 0) {
+        trace_thread_pool_affinity_failed(pool, worker->index, ret);
+    }
+}
+
 static void *worker_thread(void *opaque)
 {
-    ThreadPool *pool = opaque;
+    ThreadPoolWorker *worker = opaque;
+    ThreadPool *pool = worker->pool;
+
+    qemu_thread_get_self(&worker->thread);
+    worker->affinity_gen = 0;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    while (!atomic_read(&pool->stopping)) {
         ThreadPoolElement *req;
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
+        if (worker->affinity_gen != atomic_read(&pool->affinity_gen)) {
+            worker_apply_affinity(worker);
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        req = worker_get_request(worker);
+        if (!req) {
+            if (!worker_wait(worker)) {
+                return NULL;
+            }
+            continue;
+        }
 
         ret = req->func(req->arg);
 
@@ -109,11 +269,10 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
         qemu_bh_schedule(pool->completion_bh);
     }
 
+    qemu_mutex_lock(&pool->lock);
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
@@ -122,6 +281,7 @@ static void *worker_thread(void *opaque)
 
 static void do_spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *worker;
     QemuThread t;
 
     /* Runs with lock taken.  */
@@ -129,10 +289,13 @@ static void do_spawn_thread(ThreadPool *pool)
         return;
     }
 
+    /* The slots still waiting for a thread are the topmost ones.  */
+    worker = pool->workers[pool->cur_threads - pool->new_threads];
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    qemu_thread_create(&t, "worker", worker_thread, worker,
+                       QEMU_THREAD_DETACHED);
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -144,9 +307,34 @@ static void spawn_thread_bh_fn(void *opaque)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+/* Claim the next free slot and arrange for a thread to serve it.  Requests
+ * can be queued to the returned worker right away.
+ */
+static ThreadPoolWorker *spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    ThreadPoolWorker *worker;
+    int index = pool->cur_threads;
+
+    /* Runs with lock taken.  */
+    assert(index < THREAD_POOL_MAX_THREADS);
+    worker = pool->workers[index];
+    if (!worker) {
+        worker = g_new0(ThreadPoolWorker, 1);
+        worker->pool = pool;
+        worker->index = index;
+        qemu_sem_init(&worker->sem, 0);
+        qemu_mutex_init(&worker->lock);
+        QTAILQ_INIT(&worker->request_list);
+        atomic_set(&pool->workers[index], worker);
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    worker->running = true;
+    worker->idle = false;
+    qemu_mutex_unlock(&worker->lock);
+
+    /* Publish the worker before the slot count.  */
+    atomic_mb_set(&pool->cur_threads, index + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -158,6 +346,94 @@ static void spawn_thread(ThreadPool *pool)
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
+    return worker;
+}
+
+/* Choose the worker that gets the next request: an idle one if there is
+ * one, else a new one if the pool may still grow, else the less loaded of
+ * two busy ones.  Whoever ends up with too much work will have it stolen.
+ */
+static ThreadPoolWorker *thread_pool_pick_worker(ThreadPool *pool)
+{
+    ThreadPoolWorker *a, *b;
+    int i, n;
+
+    n = atomic_mb_read(&pool->cur_threads);
+    for (i = 0; i < n; i++) {
+        int index = (pool->next_worker + i) % n;
+
+        a = atomic_read(&pool->workers[index]);
+        if (atomic_read(&a->idle)) {
+            pool->next_worker = index + 1;
+            return a;
+        }
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    if (pool->cur_threads < pool->max_threads || !pool->cur_threads) {
+        a = spawn_thread(pool);
+        qemu_mutex_unlock(&pool->lock);
+        return a;
+    }
+    n = pool->cur_threads;
+    qemu_mutex_unlock(&pool->lock);
+
+    a = atomic_read(&pool->workers[pool->next_worker % n]);
+    b = atomic_read(&pool->workers[(pool->next_worker + 1) % n]);
+    pool->next_worker = (pool->next_worker + 1) % n;
+    return atomic_read(&a->queued) <= atomic_read(&b->queued) ? a : b;
+}
+
+/* Move up to @count requests from the head of @reqs to the queue of one
+ * worker, taking its lock and waking it up only once.
+ */
+static void thread_pool_queue(ThreadPool *pool, ThreadPoolElementHead *reqs,
+                              int count)
+{
+    ThreadPoolWorker *worker;
+    ThreadPoolElement *req;
+    bool wake;
+
+    for (;;) {
+        worker = thread_pool_pick_worker(pool);
+        qemu_mutex_lock(&worker->lock);
+        if (worker->running) {
+            break;
+        }
+        /* It went away after being picked, try another one.  */
+        qemu_mutex_unlock(&worker->lock);
+    }
+
+    while (count-- > 0 && (req = QTAILQ_FIRST(reqs)) != NULL) {
+        QTAILQ_REMOVE(reqs, req, reqs);
+        req->worker = worker;
+        QTAILQ_INSERT_TAIL(&worker->request_list, req, reqs);
+        atomic_set(&worker->queued, worker->queued + 1);
+    }
+    wake = worker->idle;
+    atomic_set(&worker->idle, false);
+    qemu_mutex_unlock(&worker->lock);
+
+    if (wake) {
+        qemu_sem_post(&worker->sem);
+    }
+}
+
+static void thread_pool_flush(ThreadPool *pool)
+{
+    int share;
+
+    if (!pool->nr_plugged) {
+        return;
+    }
+
+    /* Spread the batch over as many workers as the pool may have.  */
+    share = DIV_ROUND_UP(pool->nr_plugged,
+                         MIN(pool->nr_plugged, atomic_read(&pool->max_threads)));
+    while (!QTAILQ_EMPTY(&pool->plugged_list)) {
+        thread_pool_queue(pool, &pool->plugged_list, share);
+    }
+    pool->nr_plugged = 0;
 }
 
 static void thread_pool_completion_bh(void *opaque)
@@ -197,25 +473,35 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolWorker *worker = elem->worker;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    qemu_mutex_lock(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
+    if (!worker) {
+        /* Still plugged, no worker has seen it.  */
+        QTAILQ_REMOVE(&pool->plugged_list, elem, reqs);
+        pool->nr_plugged--;
+        qemu_bh_schedule(pool->completion_bh);
+
+        elem->state = THREAD_DONE;
+        elem->ret = -ECANCELED;
+        return;
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    if (elem->state == THREAD_QUEUED) {
+        /* No thread has yet started working on elem, and none can while
+         * we hold the lock of the queue it is on.
          */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&worker->request_list, elem, reqs);
+        atomic_set(&worker->queued, worker->queued - 1);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
     }
 
-    qemu_mutex_unlock(&pool->lock);
+    qemu_mutex_unlock(&worker->lock);
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -243,20 +529,39 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     req->state = THREAD_QUEUED;
     req->pool = pool;
 
+    req->worker = NULL;
+
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    if (pool->plugged) {
+        QTAILQ_INSERT_TAIL(&pool->plugged_list, req, reqs);
+        if (++pool->nr_plugged >= THREAD_POOL_MAX_PLUGGED) {
+            thread_pool_flush(pool);
+        }
+    } else {
+        ThreadPoolElementHead list = QTAILQ_HEAD_INITIALIZER(list);
+
+        QTAILQ_INSERT_TAIL(&list, req, reqs);
+        thread_pool_queue(pool, &list, 1);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
+void thread_pool_plug(ThreadPool *pool)
+{
+    pool->plugged++;
+}
+
+void thread_pool_unplug(ThreadPool *pool)
+{
+    assert(pool->plugged);
+    if (--pool->plugged == 0) {
+        thread_pool_flush(pool);
+    }
+}
+
 typedef struct ThreadPoolCo {
     Coroutine *co;
     int ret;
@@ -296,12 +601,12 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
+    pool->min_threads = 0;
+    pool->max_threads = THREAD_POOL_DEFAULT_MAX_THREADS;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->plugged_list);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -311,13 +616,50 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_set_size(ThreadPool *pool, int min_threads, int max_threads)
+{
+    assert(0 <= min_threads && min_threads <= max_threads);
+    assert(max_threads > 0 && max_threads <= THREAD_POOL_MAX_THREADS);
+
+    qemu_mutex_lock(&pool->lock);
+    pool->min_threads = min_threads;
+    atomic_set(&pool->max_threads, max_threads);
+    while (pool->cur_threads < min_threads) {
+        spawn_thread(pool);
+    }
+    /* Workers above max_threads exit once they have been idle for a
+     * while, like those above min_threads.
+     */
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_set_affinity(ThreadPool *pool, const unsigned long *host_cpus,
+                              long nbits)
+{
+    qemu_mutex_lock(&pool->lock);
+    g_free(pool->affinity);
+    pool->affinity = NULL;
+    pool->affinity_nbits = 0;
+    if (host_cpus && !bitmap_empty(host_cpus, nbits)) {
+        pool->affinity = bitmap_new(nbits);
+        bitmap_copy(pool->affinity, host_cpus, nbits);
+        pool->affinity_nbits = nbits;
+    }
+    /* Each worker picks up the new mask before its next request.  */
+    atomic_set(&pool->affinity_gen, pool->affinity_gen + 1);
+    qemu_mutex_unlock(&pool->lock);
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
+    int i;
+
     if (!pool) {
         return;
     }
 
     assert(QLIST_EMPTY(&pool->head));
+    assert(!pool->plugged);
 
     qemu_mutex_lock(&pool->lock);
 
@@ -327,17 +669,25 @@ void thread_pool_free(ThreadPool *pool)
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->stopping = true;
+    atomic_set(&pool->stopping, true);
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        for (i = 0; i < THREAD_POOL_MAX_THREADS && pool->workers[i]; i++) {
+            qemu_sem_post(&pool->workers[i]->sem);
+        }
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
+    for (i = 0; i < THREAD_POOL_MAX_THREADS && pool->workers[i]; i++) {
+        qemu_sem_destroy(&pool->workers[i]->sem);
+        qemu_mutex_destroy(&pool->workers[i]->lock);
+        g_free(pool->workers[i]);
+    }
+
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
+    g_free(pool->affinity);
     g_free(pool);
 }
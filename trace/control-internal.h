@@ -54,7 +54,7 @@ static inline bool trace_event_get_state_static(TraceEvent *ev)
 
 /* it's on fast path, avoid consistency checks (asserts) */
 #define trace_event_get_state_dynamic_by_id(id) \
-    (unlikely(trace_events_enabled_count) && _ ## id ## _DSTATE)
+    (unlikely(trace_events_enabled_count) && unlikely(_ ## id ## _DSTATE))
 
 static inline bool trace_event_get_state_dynamic(TraceEvent *ev)
 {
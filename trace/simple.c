@@ -13,6 +13,7 @@
 #include <pthread.h>
 #endif
 #include "qemu/timer.h"
+#include "qemu/thread.h"
 #include "trace.h"
 #include "trace/control.h"
 #include "trace/simple.h"
@@ -29,12 +30,12 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * Each thread that traces gets a ring buffer of its own, so recording an
+ * event takes neither a lock nor an atomic operation on shared counters.
+ * The owning thread is the only producer; a dedicated writeout thread is
+ * the only consumer.  It waits for records to become available, writes
+ * them out merged by timestamp, and then waits again.
  */
 static CompatGMutex trace_lock;
 static CompatGCond trace_available_cond;
@@ -44,14 +45,33 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+enum {
+    TRACE_BUF_LIVE,     /* owned by a running thread */
+    TRACE_BUF_DEAD,     /* owner has exited, records may be left */
+    TRACE_BUF_FREE,     /* drained, can be claimed by a new thread */
+};
+
+typedef struct TraceThreadBuf {
+    uint8_t buf[TRACE_BUF_LEN];
+    unsigned int head;      /* written by the owner only */
+    unsigned int tail;      /* written by the writeout thread only */
+    unsigned int rec_head;  /* end of the record being written */
+    bool in_record;
+    int dropped;
+    int state;
+    Notifier exit_notifier;
+    struct TraceThreadBuf *next;
+} TraceThreadBuf;
+
+/* Buffers are only ever pushed to this list, and never freed */
+static TraceThreadBuf *trace_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
+static __thread bool trace_thread_exited;
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -75,53 +95,25 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
-
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(dataptr, tb->buf + off, first);
+    memcpy((uint8_t *)dataptr + first, tb->buf, size - first);
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
-{
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
-    }
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    const void *dataptr, size_t size)
+{
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(size, TRACE_BUF_LEN - off);
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    memcpy(tb->buf + off, dataptr, first);
+    memcpy(tb->buf, (const uint8_t *)dataptr + first, size - first);
+    return idx + size; /* most callers wants to know where to write next */
 }
 
 /**
@@ -153,14 +145,118 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/* Where the writeout thread is in one buffer during a pass */
+typedef struct {
+    TraceThreadBuf *tb;
+    unsigned int head;      /* records up to here were complete */
+    uint64_t timestamp_ns;  /* of the record at tb->tail */
+} TraceMergeEntry;
+
+static void merge_entry_load(TraceMergeEntry *e)
+{
+    TraceRecord record;
+
+    read_from_buffer(e->tb, e->tb->tail, &record, sizeof(record));
+    e->timestamp_ns = record.timestamp_ns;
+}
+
+/* Restore the min-heap property of @heap below index @i */
+static void merge_heap_down(TraceMergeEntry *heap, int n, int i)
+{
+    TraceMergeEntry tmp;
+    int child;
+
+    for (; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            heap[child + 1].timestamp_ns < heap[child].timestamp_ns) {
+            child++;
+        }
+        if (heap[i].timestamp_ns <= heap[child].timestamp_ns) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+}
+
+/*
+ * Write out the records that are complete in all buffers, oldest first.
+ * Records that are completed while this runs are left for the next pass.
+ */
+static void write_out_records(void)
+{
+    TraceThreadBuf *first = atomic_rcu_read(&trace_bufs);
+    TraceMergeEntry *heap;
+    TraceThreadBuf *tb;
+    TraceRecord record;
+    unsigned int off;
+    size_t len;
+    int n = 0, max = 0, i;
+    size_t unused __attribute__ ((unused));
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+
+    for (tb = first; tb; tb = tb->next) {
+        max++;
+    }
+    /* don't use g_malloc, can deadlock when traced */
+    heap = malloc(max * sizeof(*heap));
+    if (!heap) {
+        return;
+    }
+
+    for (tb = first; tb; tb = tb->next) {
+        int state = atomic_load_acquire(&tb->state);
+        TraceMergeEntry *e = &heap[n];
+
+        e->tb = tb;
+        e->head = atomic_load_acquire(&tb->head);
+        if (e->head != tb->tail) {
+            merge_entry_load(e);
+            n++;
+        } else if (state == TRACE_BUF_DEAD) {
+            /* Nothing can be added any more, let a new thread have it */
+            atomic_set(&tb->state, TRACE_BUF_FREE);
+        }
+    }
+
+    for (i = n / 2 - 1; i >= 0; i--) {
+        merge_heap_down(heap, n, i);
+    }
+
+    while (n) {
+        tb = heap[0].tb;
+        read_from_buffer(tb, tb->tail, &record, sizeof(record));
+
+        /* The record may wrap around the end of the buffer */
+        off = tb->tail % TRACE_BUF_LEN;
+        len = MIN(record.length, TRACE_BUF_LEN - off);
+        unused = fwrite(&type, sizeof(type), 1, trace_fp);
+        unused = fwrite(tb->buf + off, len, 1, trace_fp);
+        if (len < record.length) {
+            unused = fwrite(tb->buf, record.length - len, 1, trace_fp);
+        }
+        /* let the owner reuse the space */
+        atomic_store_release(&tb->tail, tb->tail + record.length);
+
+        if (tb->tail == heap[0].head) {
+            heap[0] = heap[--n];
+        } else {
+            merge_entry_load(&heap[0]);
+        }
+        merge_heap_down(heap, n, 0);
+    }
+
+    free(heap);
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceThreadBuf *tb;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -168,113 +264,138 @@ static gpointer writeout_thread(gpointer opaque)
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = 0;
+        for (tb = atomic_rcu_read(&trace_bufs); tb; tb = tb->next) {
+            if (atomic_read(&tb->dropped)) {
+                dropped_count += atomic_xchg(&tb->dropped, 0);
+            }
+        }
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID,
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t),
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
-        }
+        write_out_records();
 
         fflush(trace_fp);
     }
     return NULL;
 }
 
-void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
+static void trace_thread_buf_exit(Notifier *n, void *unused)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
-}
+    TraceThreadBuf *tb = container_of(n, TraceThreadBuf, exit_notifier);
 
-void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
-{
-    /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
-    /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    /* Anything traced from now on, e.g. by other destructors, is dropped */
+    trace_thread_exited = true;
+    trace_thread_buf = NULL;
+    atomic_store_release(&tb->state, TRACE_BUF_DEAD);
 }
 
-int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
+/* Set up the ring buffer of the current thread */
+static TraceThreadBuf *trace_thread_buf_get(void)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
-    uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
+    TraceThreadBuf *tb, *old;
+
+    if (trace_thread_exited) {
+        return NULL;
+    }
+
+    /* Take over the buffer of a thread that is gone, if there is one */
+    for (tb = atomic_rcu_read(&trace_bufs); tb; tb = tb->next) {
+        if (atomic_read(&tb->state) == TRACE_BUF_FREE &&
+            atomic_cmpxchg(&tb->state, TRACE_BUF_FREE, TRACE_BUF_LIVE) ==
+            TRACE_BUF_FREE) {
+            break;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    if (!tb) {
+        /* don't use g_malloc, can deadlock when traced */
+        tb = calloc(1, sizeof(*tb));
+        if (!tb) {
+            return NULL;
+        }
+        tb->state = TRACE_BUF_LIVE;
+        old = atomic_read(&trace_bufs);
+        do {
+            tb->next = old;
+        } while ((old = atomic_cmpxchg(&trace_bufs, old, tb)) != tb->next);
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    tb->exit_notifier.notify = trace_thread_buf_exit;
+    qemu_thread_atexit_add(&tb->exit_notifier);
+    trace_thread_buf = tb;
+    return tb;
+}
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
-    return 0;
+void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
+{
+    rec->rec_off = write_to_buffer(trace_thread_buf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    /* Write string length first */
+    rec->rec_off = write_to_buffer(trace_thread_buf, rec->rec_off,
+                                   &slen, sizeof(slen));
+    /* Write actual string now */
+    rec->rec_off = write_to_buffer(trace_thread_buf, rec->rec_off, s, slen);
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
+    TraceThreadBuf *tb = trace_thread_buf;
+    TraceRecord record = {
+        .event = event,
+        .timestamp_ns = get_clock(),
+        .length = sizeof(TraceRecord) + datasize,
+        .pid = trace_pid,
+    };
+
+    if (!tb) {
+        tb = trace_thread_buf_get();
+        if (!tb) {
+            return -ENOSPC;
         }
-        trace_buf[idx++] = data_ptr[x++];
     }
-    return idx; /* most callers wants to know where to write next */
+
+    /*
+     * A signal handler that traces while this thread is in the middle of
+     * a record would scribble over it; drop the nested record instead.
+     */
+    if (tb->in_record ||
+        tb->head + record.length - atomic_load_acquire(&tb->tail) >
+        TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        atomic_inc(&tb->dropped);
+        return -ENOSPC;
+    }
+    tb->in_record = true;
+
+    rec->tbuf_idx = tb->head;
+    rec->rec_off = write_to_buffer(tb, tb->head, &record, sizeof(record));
+    tb->rec_head = tb->head + record.length;
+    return 0;
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuf *tb = trace_thread_buf;
+
+    assert(rec->rec_off == tb->rec_head);
+    /* Publish the record to the writeout thread */
+    atomic_store_release(&tb->head, tb->rec_head);
+    tb->in_record = false;
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (tb->head - atomic_read(&tb->tail) > TRACE_BUF_FLUSH_THRESHOLD &&
+        !atomic_read(&trace_available)) {
         flush_trace_file(false);
     }
 }
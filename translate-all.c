@@ -48,6 +48,8 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -148,6 +150,7 @@ static void *l1_map[V_L1_MAX_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 bool parallel_cpus;
+bool tb_hot_enabled;
 
 /* translation block context */
 __thread int have_tb_lock;
@@ -849,6 +852,7 @@ static TranslationBlock *tb_alloc(target_ulong pc)
     tb->pc = pc;
     tb->cflags = 0;
     tb->invalid = false;
+    tb->exec_count = 0;
     return tb;
 }
 
@@ -1276,6 +1280,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
         cflags |= CF_USE_ICOUNT;
     }
+    if (tb_hot_enabled) {
+        cflags |= CF_COUNT_EXEC;
+    }
 
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
@@ -1337,6 +1344,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (unlikely(search_size < 0)) {
         goto buffer_overflow;
     }
+    tb->tc_size = gen_code_size;
 
 #ifdef CONFIG_PROFILER
     tcg_ctx.code_time += profile_getclock();
@@ -1947,6 +1955,70 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+static int tb_hot_cmp(const void *a, const void *b)
+{
+    const TranslationBlock *ta = *(const TranslationBlock **)a;
+    const TranslationBlock *tb = *(const TranslationBlock **)b;
+
+    if (ta->exec_count != tb->exec_count) {
+        return ta->exec_count < tb->exec_count ? 1 : -1;
+    }
+    return ta < tb ? -1 : ta > tb;
+}
+
+TbHotInfoList *qmp_x_query_tb_hot(bool has_count, int64_t count,
+                                  Error **errp)
+{
+    TbHotInfoList *head = NULL, **tail = &head;
+    TranslationBlock **tbs;
+    int i, nb_hot;
+
+    if (!tcg_enabled() || !tb_hot_enabled) {
+        error_setg(errp, "TB execution counters are not enabled; "
+                   "use -accel tcg,tb-hot=on");
+        return NULL;
+    }
+    if (!has_count) {
+        count = 20;
+    } else if (count < 0) {
+        error_setg(errp, "Parameter 'count' expects a non-negative value");
+        return NULL;
+    }
+
+    tb_lock();
+
+    tbs = g_new(TranslationBlock *, tcg_ctx.tb_ctx.nb_tbs);
+    nb_hot = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
+        TranslationBlock *tb = &tcg_ctx.tb_ctx.tbs[i];
+
+        if (!tb->invalid && tb->exec_count) {
+            tbs[nb_hot++] = tb;
+        }
+    }
+    qsort(tbs, nb_hot, sizeof(*tbs), tb_hot_cmp);
+
+    for (i = 0; i < nb_hot && i < count; i++) {
+        TranslationBlock *tb = tbs[i];
+        TbHotInfoList *entry = g_new0(TbHotInfoList, 1);
+
+        entry->value = g_new0(TbHotInfo, 1);
+        entry->value->pc = tb->pc;
+        entry->value->cs_base = tb->cs_base;
+        entry->value->flags = tb->flags;
+        entry->value->guest_size = tb->size;
+        entry->value->host_size = tb->tc_size;
+        entry->value->exec_count = tb->exec_count;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    tb_unlock();
+    g_free(tbs);
+
+    return head;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
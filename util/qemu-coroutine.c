@@ -21,21 +21,34 @@
 #include "qemu/coroutine_int.h"
 
 enum {
-    POOL_BATCH_SIZE = 64,
+    POOL_DEFAULT_BATCH_SIZE = 64,
 };
 
 /** Free list to speed up creation */
 static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
+static unsigned int pool_batch_size = POOL_DEFAULT_BATCH_SIZE;
 static unsigned int release_pool_size;
 static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(pool);
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
+/* Pool statistics.  Hits are counted per thread and folded into pool_hits
+ * whenever the thread runs out of pooled coroutines, so that the fast path
+ * does not touch shared cache lines.
+ */
+static __thread unsigned long alloc_pool_hits;
+static unsigned long pool_hits;
+static unsigned long pool_misses;
+static unsigned long pool_frees;
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
     Coroutine *tmp;
 
+    atomic_add(&pool_hits, alloc_pool_hits);
+    alloc_pool_hits = 0;
+
     QSLIST_FOREACH_SAFE(co, &alloc_pool, pool_next, tmp) {
         QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
         qemu_coroutine_delete(co);
@@ -49,7 +62,10 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     if (CONFIG_COROUTINE_POOL) {
         co = QSLIST_FIRST(&alloc_pool);
         if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
+            atomic_add(&pool_hits, alloc_pool_hits);
+            alloc_pool_hits = 0;
+
+            if (release_pool_size > atomic_read(&pool_batch_size)) {
                 /* Slow path; a good place to register the destructor, too.  */
                 if (!coroutine_pool_cleanup_notifier.notify) {
                     coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
@@ -68,10 +84,12 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         if (co) {
             QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
             alloc_pool_size--;
+            alloc_pool_hits++;
         }
     }
 
     if (!co) {
+        atomic_inc(&pool_misses);
         co = qemu_coroutine_new();
     }
 
@@ -86,21 +104,43 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
+        unsigned int batch_size = atomic_read(&pool_batch_size);
+
+        if (release_pool_size < batch_size * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             atomic_inc(&release_pool_size);
             return;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        if (alloc_pool_size < batch_size) {
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
             return;
         }
     }
 
+    atomic_inc(&pool_frees);
     qemu_coroutine_delete(co);
 }
 
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size)
+{
+    atomic_add(&pool_batch_size, additional_pool_size);
+}
+
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size)
+{
+    atomic_sub(&pool_batch_size, removing_pool_size);
+}
+
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats)
+{
+    stats->batch_size = atomic_read(&pool_batch_size);
+    stats->release_pool_size = atomic_read(&release_pool_size);
+    stats->hits = atomic_read(&pool_hits);
+    stats->misses = atomic_read(&pool_misses);
+    stats->frees = atomic_read(&pool_frees);
+}
+
 void qemu_coroutine_enter(Coroutine *co)
 {
     Coroutine *self = qemu_coroutine_self();
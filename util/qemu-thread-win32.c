@@ -14,6 +14,7 @@
 #include "qemu-common.h"
 #include "qemu/thread.h"
 #include "qemu/notify.h"
+#include "qemu/bitops.h"
 #include <process.h>
 
 static bool name_threads;
@@ -510,3 +511,36 @@ bool qemu_thread_is_self(QemuThread *thread)
 {
     return GetCurrentThreadId() == thread->tid;
 }
+
+int qemu_thread_set_affinity(QemuThread *thread, const unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+    DWORD_PTR mask = 0;
+    HANDLE handle;
+    unsigned long cpu;
+    int ret = 0;
+
+    /* A thread affinity mask only covers the first processor group.  */
+    for (cpu = 0; cpu < nbits && cpu < sizeof(mask) * 8; cpu++) {
+        if (test_bit(cpu, host_cpus)) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    if (!mask) {
+        return -EINVAL;
+    }
+
+    if (qemu_thread_is_self(thread)) {
+        return SetThreadAffinityMask(GetCurrentThread(), mask) ? 0 : -EINVAL;
+    }
+
+    handle = qemu_thread_get_handle(thread);
+    if (!handle) {
+        return -ESRCH;
+    }
+    if (!SetThreadAffinityMask(handle, mask)) {
+        ret = -EINVAL;
+    }
+    CloseHandle(handle);
+    return ret;
+}
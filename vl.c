@@ -312,6 +312,11 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "tb-hot",
+            .type = QEMU_OPT_BOOL,
+            .help = "Count translation block executions",
+        },
         { /* end of list */ }
     },
 };
@@ -2452,6 +2457,20 @@ static int mon_init_func(void *opaque, QemuOpts *opts, Error **errp)
         exit(1);
     }
 
+    if (qemu_opt_get_bool(opts, "io-thread", false)) {
+        if (!(flags & MONITOR_USE_CONTROL)) {
+            error_report("option 'io-thread' requires mode=control");
+            exit(1);
+        }
+        if (chr->is_mux ||
+            !qemu_chr_has_feature(chr, QEMU_CHAR_FEATURE_GCONTEXT)) {
+            error_report("chardev \"%s\" can't be used by a monitor I/O "
+                         "thread", chardev);
+            exit(1);
+        }
+        flags |= MONITOR_USE_IO_THREAD;
+    }
+
     monitor_init(chr, flags);
     return 0;
 }